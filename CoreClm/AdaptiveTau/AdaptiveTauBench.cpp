@@ -0,0 +1,1663 @@
+/*  AdaptiveTauBench.cpp
+    --------------------------------------------------------------------------
+    Benchmark suite for the stochastic solver core (stochasticeqns.h).
+
+    Runs canonical reaction networks at several scales through the exact
+    (direct method, rejection-based SSA "exact-rssa" & partial-propensity
+    direct method "exact-pdm"), explicit (ATL) and implicit (ATL with
+    mass-action or finite-difference Jacobian) paths, implicit ATL with
+    chemical Langevin steps ("atl-cle"), R-leaping ("rleap"), and
+    the smaller ones also through the lockstep multi-trajectory mode
+    (batcheqns.h), and reports, per case, events/sec, leaps/sec, wall time to tF, setup time
+    (constructing CStochasticEqns), heap allocations, peak heap & peak RSS.
+    Each network is compiled (compiledmodel.h) once and shared by all of
+    its cases & repeats, as a parameter sweep would; the compile time is
+    printed once per network, so setup time is only the per-run state.
+    Results are written as CSV with one row per case; all runs use a fixed
+    seed, so step & firing counts are identical between builds unless the
+    algorithm changed, and two result files can be compared directly
+    (--baseline).
+
+    Networks:
+        lotka-volterra   Gillespie/LotkaVolterra.fs (rates as in
+                         GillespieTauLeapingExample)
+        dimerization     decaying dimerization (Gillespie 2001)
+        stiff-pair       fast reversible S1 <-> S2, slow S2 -> S3
+        clm-1k .. -100k  synthetic CLM-like catalytic networks (food,
+                         spontaneous & catalytic synthesis / destruction,
+                         ligation) with 1K, 10K & 100K species
+        frank            Frank-type symmetry breaking (L & D made from
+                         food, autocatalytically, & destroying each
+                         other); used by --splitting & --mlmc only
+
+    Build (Linux & macOS; see CMakeLists.txt, which also runs the checks):
+        cmake -S . -B build && cmake --build build -j
+        ctest --test-dir build --output-on-failure
+    or AdaptiveTauBench.vcxproj on Windows.
+
+    Usage:
+        adaptivetau-bench [--filter <substring>] [--out <results.csv>]
+                          [--baseline <old.csv>] [--workdir <dir>]
+                          [--seed <n>] [--repeat <n>] [--quick]
+                          [--profile <n>] [--trace <n>] [--threads <n>]
+                          [--lanes <n>] [--check-allocs]
+                          [--splitting <target |ee|>] [--mlmc <std err>]
+                          [--compartments <n>] [--autotune <error budget>]
+                          [--validate <runs>] [--moments <runs>]
+                          [--sensitivity <runs>] [--check-deterministic]
+                          [--check-kernels <c++ compiler>]
+    --profile prints the n transitions with the largest integrated
+    propensity after each case (profiling slows the run somewhat).
+    --trace writes a Chrome trace of every n-th step of each case to
+    <workdir>/trace-<case>.json.
+    --threads runs each trajectory on a pool of n threads (models below
+    CStochasticEqns::kDefaultParallelThreshold transitions stay serial).
+    --check-allocs runs, instead of the benchmark, a check that the cases
+    without a step limit make no heap allocations per step after warm-up
+    (exit status 1 if any does).
+    --check-kernels runs, instead of the benchmark, a check of generated
+    kernels (modelkernels.h): for lotka-volterra, dimerization, stiff-pair,
+    clm-1k & frank it writes kernels-<network>.cpp to the workdir, builds
+    it into a shared object with the given compiler (gcc or clang style
+    options), loads it and compares its rates, transitions & firings with
+    the generic ones at random states, and runs ATL both ways; kernels
+    of another model must be refused (exit status 1 on any failure).
+    --check-deterministic runs, instead of the benchmark, a check that
+    deterministic transitions keep being advanced once no stochastic
+    transition can fire, in every method (exit status 1 if one is not).
+    --lanes sets the number of replicates the atl-batch cases advance in
+    lockstep (default 64); their events/s count all lanes, their sim_time
+    is the mean over lanes & --profile/--trace/--threads do not apply.
+    --splitting runs, instead of the benchmark, a rare-event estimate
+    (splitting.h) of the probability that |ee| = |L - D| / (L + D) of the
+    frank network reaches the target by t = 5, and the same number of
+    events spent on plain replicates, and compares their errors.
+    --mlmc runs, instead of the benchmark, a multilevel Monte Carlo
+    estimate (mlmc.h) of the mean of L at t = 5 in the frank network to
+    the given standard error, and plain exact runs with the same number
+    of rate evaluations, and compares their errors.
+    --compartments runs, instead of the benchmark, lotka-volterra in a
+    chain of n compartments (hares & foxes diffusing between neighbours,
+    all foxes starting in the first) to t = 1, exactly by the Next
+    Subvolume Method & by split leaping (compartments.h), and reports
+    events/s & the totals at t = 1 of both.
+    --autotune tunes, instead of the benchmark, the tau leaping parameters
+    of lotka-volterra & dimerization (autotune.h) to the given error
+    budget, stores them with <workdir>/tuned-<network>.clmmodel, and
+    reports the throughput (simulated time per second) & error of the
+    exact runs, the default & the tuned parameters.
+    --validate checks, instead of the benchmark, the accuracy of every
+    fast mode (validation.h): ensembles of the given number of runs of
+    lotka-volterra & dimerization, in each mode & exactly, are compared
+    at three times by KS, Anderson-Darling & mean tests, and the speedup
+    & verdict reported per mode, with the failed comparisons.  "exact"
+    (against differently seeded exact runs) shows the rate of false
+    alarms, "atl eps=0.01" what a smaller epsilon buys.
+    --moments compares, instead of the benchmark, the means & standard
+    deviations of lotka-volterra & dimerization from the linear noise
+    approximation & the second-order moment closure (moments.h) with an
+    ensemble of the given number of exact runs, at the --validate times,
+    and reports the wall time of each.
+    --sensitivity estimates, instead of the benchmark, the derivatives of
+    the mean hares of lotka-volterra at t = 1 & of the mean S2 of
+    dimerization at t = 0.01 with respect to the log of every rate
+    constant, from the given number of coupled runs (sensitivity.h), both
+    exactly & by leaping, and reports per rate constant the standard error
+    of the coupled & of independent runs, and the variance reduction.
+    --------------------------------------------------------------------------
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "autotune.h"
+#include "batcheqns.h"
+#include "compartments.h"
+#include "mlmc.h"
+#include "modelkernels.h"
+#include "moments.h"
+#include "sensitivity.h"
+#include "splitting.h"
+#include "stochasticeqns.h"
+#include "validation.h"
+
+using namespace std;
+
+/*---------------------------------------------------------------------------*/
+// host hooks (see stochasticeqns.h)
+
+static unsigned int g_NumWarnings = 0;
+
+bool AdaptiveTauCheckUserInterrupt(void) { return false; }
+void AdaptiveTauWarning(const char *msg) {
+    if (g_NumWarnings++ < 10) {
+        cerr << "warning: " << msg << endl;
+    }
+}
+void AdaptiveTauTrace(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+/*---------------------------------------------------------------------------*/
+// Counting allocator: every operator new / delete in the process goes
+// through here, so that allocations & live heap can be attributed to a
+// benchmark case.  Each block carries a 16-byte header holding its size.
+
+namespace {
+    struct SHeapCounters {
+        uint64_t m_Allocs;
+        uint64_t m_Bytes;
+        uint64_t m_Live;
+        uint64_t m_PeakLive;
+    };
+    SHeapCounters g_Heap = { 0, 0, 0, 0 };
+    const size_t kHeapHeader = 16;
+
+    void* CountedAlloc(size_t size) {
+        unsigned char *p = static_cast<unsigned char*>
+            (malloc(size + kHeapHeader));
+        if (!p) {
+            return NULL;
+        }
+        *reinterpret_cast<size_t*>(p) = size;
+        ++g_Heap.m_Allocs;
+        g_Heap.m_Bytes += size;
+        g_Heap.m_Live += size;
+        if (g_Heap.m_Live > g_Heap.m_PeakLive) {
+            g_Heap.m_PeakLive = g_Heap.m_Live;
+        }
+        return p + kHeapHeader;
+    }
+    void CountedFree(void *ptr) {
+        if (!ptr) {
+            return;
+        }
+        unsigned char *p = static_cast<unsigned char*>(ptr) - kHeapHeader;
+        g_Heap.m_Live -= *reinterpret_cast<size_t*>(p);
+        free(p);
+    }
+}
+
+void* operator new(size_t size) {
+    void *p = CountedAlloc(size);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    return CountedAlloc(size);
+}
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return CountedAlloc(size);
+}
+void operator delete(void *p) noexcept { CountedFree(p); }
+void operator delete[](void *p) noexcept { CountedFree(p); }
+void operator delete(void *p, const nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void *p, const nothrow_t&) noexcept { CountedFree(p); }
+void operator delete(void *p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void *p, size_t) noexcept { CountedFree(p); }
+
+static double PeakRssMB(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return pmc.PeakWorkingSetSize / (1024. * 1024.);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.; //kilobytes on Linux
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+// Reference networks
+
+namespace {
+    SReactant R(int state, int order) {
+        SReactant r;
+        r.m_State = state;  r.m_Order = order;
+        return r;
+    }
+    SChange C(int state, int mag) {
+        SChange c;
+        c.m_State = state;  c.m_Mag = mag;
+        return c;
+    }
+    vector<SReactant> Rs(void) { return vector<SReactant>(); }
+    vector<SReactant> Rs(SReactant a) { return vector<SReactant>(1, a); }
+    vector<SReactant> Rs(SReactant a, SReactant b) {
+        vector<SReactant> v(1, a);
+        v.push_back(b);
+        return v;
+    }
+    vector<SChange> Cs(SChange a) { return vector<SChange>(1, a); }
+    vector<SChange> Cs(SChange a, SChange b) {
+        vector<SChange> v(1, a);
+        v.push_back(b);
+        return v;
+    }
+    vector<SChange> Cs(SChange a, SChange b, SChange c) {
+        vector<SChange> v = Cs(a, b);
+        v.push_back(c);
+        return v;
+    }
+
+    void BuildLotkaVolterra(CModelFileWriter &w, unsigned int) {
+        const unsigned int cat = w.AddCategory("lotka-volterra");
+        const int hare = w.AddSpecies("hare", cat, 1000);
+        const int fox = w.AddSpecies("fox", cat, 10);
+        w.AddTransition(Rs(R(hare, 1)), Cs(C(hare, 1)), 1.0, cat);
+        w.AddTransition(Rs(R(hare, 1), R(fox, 1)), Cs(C(hare, -1)), 0.03, cat);
+        w.AddTransition(Rs(), Cs(C(hare, 1)), 0.1, cat);
+        w.AddTransition(Rs(R(hare, 2)), Cs(C(hare, -1)), 0.0001, cat);
+        w.AddTransition(Rs(R(fox, 1)), Cs(C(fox, 1)), 0.01, cat);
+        w.AddTransition(Rs(R(fox, 1)), Cs(C(fox, -1)), 1.0, cat);
+        w.AddTransition(Rs(), Cs(C(fox, 1)), 0.1, cat);
+    }
+
+    // Gillespie (2001) with c2 = 0.002 for x(x-1)/2 -> 0.001 for x(x-1)
+    void BuildDimerization(CModelFileWriter &w, unsigned int) {
+        const unsigned int cat = w.AddCategory("dimerization");
+        const int s1 = w.AddSpecies("S1", cat, 100000);
+        const int s2 = w.AddSpecies("S2", cat, 0);
+        const int s3 = w.AddSpecies("S3", cat, 0);
+        w.AddTransition(Rs(R(s1, 1)), Cs(C(s1, -1)), 1, cat);
+        w.AddTransition(Rs(R(s1, 2)), Cs(C(s1, -2), C(s2, 1)), 0.001, cat);
+        w.AddTransition(Rs(R(s2, 1)), Cs(C(s1, 2), C(s2, -1)), 0.5, cat);
+        w.AddTransition(Rs(R(s2, 1)), Cs(C(s2, -1), C(s3, 1)), 0.04, cat);
+    }
+
+    void BuildStiffPair(CModelFileWriter &w, unsigned int) {
+        const unsigned int cat = w.AddCategory("stiff-pair");
+        const int s1 = w.AddSpecies("S1", cat, 10000);
+        const int s2 = w.AddSpecies("S2", cat, 10000);
+        const int s3 = w.AddSpecies("S3", cat, 0);
+        w.AddTransition(Rs(R(s1, 1)), Cs(C(s1, -1), C(s2, 1)), 100000, cat);
+        w.AddTransition(Rs(R(s2, 1)), Cs(C(s1, 1), C(s2, -1)), 100000, cat);
+        w.AddTransition(Rs(R(s2, 1)), Cs(C(s2, -1), C(s3, 1)), 1, cat);
+    }
+
+    // Food Y plus n-1 substances A_i.  Rates are chosen so that every
+    // transition fires about once per unit time at the initial state.
+    void BuildClm(CModelFileWriter &w, unsigned int n) {
+        const unsigned int catFood = w.AddCategory("food");
+        const unsigned int catSubst = w.AddCategory("substance");
+        const unsigned int catSyn = w.AddCategory("synthesis");
+        const unsigned int catDes = w.AddCategory("destruction");
+        const unsigned int catCatSyn = w.AddCategory("catalytic synthesis");
+        const unsigned int catCatDes = w.AddCategory("catalytic destruction");
+        const unsigned int catLig = w.AddCategory("ligation");
+        const double food = 1000. * n, subst = 10;
+        const int y = w.AddSpecies("Y", catFood, food);
+        for (unsigned int i = 1;  i < n;  ++i) {
+            ostringstream name;
+            name << "A" << i;
+            w.AddSpecies(name.str(), catSubst, subst);
+        }
+
+        CRandom rnd(12345);
+        const unsigned int m = n - 1;
+        for (int i = 1;  i < (int) n;  ++i) {
+            w.AddTransition(Rs(R(y, 1)), Cs(C(y, -1), C(i, 1)),
+                            1. / food, catSyn);
+            w.AddTransition(Rs(R(i, 1)), Cs(C(i, -1), C(y, 1)),
+                            1. / subst, catDes);
+            for (unsigned int k = 0;  k < 2;  ++k) {
+                int c = 1 + (int) (rnd.Unif() * m);
+                if (c == i) {
+                    continue;
+                }
+                w.AddTransition(Rs(R(y, 1), R(c, 1)), Cs(C(y, -1), C(i, 1)),
+                                1. / (food * subst), catCatSyn);
+            }
+            int c = 1 + (int) (rnd.Unif() * m);
+            if (c != i) {
+                w.AddTransition(Rs(R(i, 1), R(c, 1)), Cs(C(i, -1), C(y, 1)),
+                                1. / (subst * subst), catCatDes);
+            }
+            int a = 1 + (int) (rnd.Unif() * m);
+            int p = 1 + (int) (rnd.Unif() * m);
+            if (a != i  &&  p != i  &&  p != a) {
+                w.AddTransition(Rs(R(i, 1), R(a, 1)),
+                                Cs(C(i, -1), C(a, -1), C(p, 1)),
+                                1. / (subst * subst), catLig);
+                w.AddTransition(Rs(R(p, 1)), Cs(C(i, 1), C(a, 1), C(p, -1)),
+                                1. / subst, catLig);
+            }
+        }
+    }
+
+    // racemic start; autocatalysis amplifies & mutual destruction locks in
+    // any excess of L or D
+    void BuildFrank(CModelFileWriter &w, unsigned int) {
+        const unsigned int cat = w.AddCategory("frank");
+        const int a = w.AddSpecies("A", cat, 0);
+        const int l = w.AddSpecies("L", cat, 100);
+        const int d = w.AddSpecies("D", cat, 100);
+        w.AddTransition(Rs(), Cs(C(a, 1)), 200, cat);
+        w.AddTransition(Rs(R(a, 1)), Cs(C(a, -1)), 1, cat);
+        for (int x = l;  x <= d;  ++x) {
+            w.AddTransition(Rs(R(a, 1)), Cs(C(a, -1), C(x, 1)), 0.001, cat);
+            w.AddTransition(Rs(R(a, 1), R(x, 1)), Cs(C(a, -1), C(x, 1)),
+                            0.01, cat);
+            w.AddTransition(Rs(R(x, 1)), Cs(C(x, -1)), 1, cat);
+        }
+        w.AddTransition(Rs(R(l, 1), R(d, 1)), Cs(C(l, -1), C(d, -1)), 0.001,
+                        cat);
+    }
+
+    typedef void (*TBuildNetwork)(CModelFileWriter &w, unsigned int size);
+
+    struct SNetwork {
+        const char *m_Name;
+        TBuildNetwork m_Build;
+        unsigned int m_Size;
+    };
+
+    const SNetwork kNetworks[] = {
+        { "lotka-volterra", BuildLotkaVolterra, 0 },
+        { "dimerization",   BuildDimerization,  0 },
+        { "stiff-pair",     BuildStiffPair,     0 },
+        { "clm-1k",         BuildClm,           1000 },
+        { "clm-10k",        BuildClm,           10000 },
+        { "clm-100k",       BuildClm,           100000 },
+        { "frank",          BuildFrank,         0 }
+    };
+
+    enum EMethod {
+        eMethodExact = 0,
+        eMethodExplicit,
+        eMethodImplicit,
+        eMethodBatch,     // CBatchStochasticEqns, --lanes replicates
+        eMethodImplicitFD,// finite-difference Jacobian
+        eMethodRejection, // exact by the rejection-based SSA
+        eMethodPartialPropensity, // exact by partial propensities
+        eMethodLangevin,  // atl-implicit with chemical Langevin steps
+        eMethodRLeap      // R-leaping
+    };
+    const char* const kMethodNames[] = { "exact", "atl", "atl-implicit",
+                                         "atl-batch", "atl-implicit-fd",
+                                         "exact-rssa", "exact-pdm",
+                                         "atl-cle", "rleap" };
+    bool IsExact(EMethod method) {
+        return method == eMethodExact  ||  method == eMethodRejection  ||
+            method == eMethodPartialPropensity;
+    }
+    EExactMethod ExactMethod(EMethod method) {
+        return method == eMethodRejection ? eExactRejection :
+            method == eMethodPartialPropensity ? eExactPartialPropensity :
+            eExactDirect;
+    }
+    bool UsesJacobian(EMethod method) {
+        return method == eMethodImplicit  ||  method == eMethodLangevin;
+    }
+    // expected firings per transition for a Langevin step (0 == never)
+    double LangevinThreshold(EMethod method) {
+        return method == eMethodLangevin ? 100 : 0;
+    }
+    ELeapMethod LeapMethod(EMethod method) {
+        return method == eMethodRLeap ? eLeapR : eLeapTau;
+    }
+
+    struct SBenchCase {
+        const char *m_Network;
+        EMethod m_Method;
+        double m_TF;
+        unsigned int m_MaxSteps; // 0 == no limit
+    };
+
+    const SBenchCase kCases[] = {
+        { "lotka-volterra", eMethodExact,             100,  0 },
+        { "lotka-volterra", eMethodRejection,         100,  0 },
+        { "lotka-volterra", eMethodPartialPropensity, 100,  0 },
+        { "lotka-volterra", eMethodExplicit,          100,  0 },
+        { "lotka-volterra", eMethodRLeap,             100,  0 },
+        { "lotka-volterra", eMethodBatch,             100,  0 },
+        { "dimerization",   eMethodExact,             30,   2000000 },
+        { "dimerization",   eMethodRejection,         30,   2000000 },
+        { "dimerization",   eMethodPartialPropensity, 30,   2000000 },
+        { "dimerization",   eMethodExplicit,          30,   0 },
+        { "dimerization",   eMethodImplicit,          30,   0 },
+        { "dimerization",   eMethodImplicitFD,        30,   0 },
+        { "dimerization",   eMethodLangevin,          30,   0 },
+        { "dimerization",   eMethodRLeap,             30,   0 },
+        { "dimerization",   eMethodBatch,             30,   0 },
+        { "stiff-pair",     eMethodExact,             10,   2000000 },
+        { "stiff-pair",     eMethodRejection,         10,   2000000 },
+        { "stiff-pair",     eMethodPartialPropensity, 10,   2000000 },
+        { "stiff-pair",     eMethodExplicit,          10,   0 },
+        { "stiff-pair",     eMethodImplicit,          10,   0 },
+        { "stiff-pair",     eMethodImplicitFD,        10,   0 },
+        { "stiff-pair",     eMethodLangevin,          10,   0 },
+        { "stiff-pair",     eMethodRLeap,             10,   2000000 },
+        { "clm-1k",         eMethodExact,             10,   200000 },
+        { "clm-1k",         eMethodRejection,         10,   200000 },
+        { "clm-1k",         eMethodPartialPropensity, 10,   200000 },
+        { "clm-1k",         eMethodExplicit,          10,   20000 },
+        { "clm-1k",         eMethodRLeap,             10,   20000 },
+        { "clm-1k",         eMethodBatch,             10,   200 },
+        { "clm-10k",        eMethodExact,             10,   20000 },
+        { "clm-10k",        eMethodRejection,         10,   20000 },
+        { "clm-10k",        eMethodPartialPropensity, 10,   20000 },
+        { "clm-10k",        eMethodExplicit,          10,   2000 },
+        { "clm-10k",        eMethodRLeap,             10,   2000 },
+        { "clm-100k",       eMethodExact,             10,   2000 },
+        { "clm-100k",       eMethodRejection,         10,   2000 },
+        { "clm-100k",       eMethodPartialPropensity, 10,   2000 },
+        { "clm-100k",       eMethodExplicit,          10,   200 }
+    };
+
+    struct SResult {
+        string m_Case;
+        unsigned int m_NumSpecies;
+        unsigned int m_NumTransitions;
+        double m_SimTime;
+        double m_SetupSeconds;
+        double m_WallSeconds;
+        SRunStatistics m_Stats;
+        uint64_t m_Allocs;
+        uint64_t m_AllocBytes;
+        uint64_t m_PeakHeap;
+        double m_PeakRssMB;
+        string m_ProfileReport;
+    };
+
+    const char kCsvHeader[] = "case,species,transitions,sim_time,wall_s,setup_s,"
+        "exact_steps,explicit_steps,implicit_steps,firings,events_per_s,"
+        "leaps_per_s,allocs,alloc_mb,peak_heap_mb,peak_rss_mb,tau_halvings,"
+        "newton_iterations,rate_evals,jacobian_evals,avg_tau,rates_s,"
+        "jacobian_s,linear_solve_s,tau_selection_s,rejections,"
+        "langevin_steps";
+
+    void WriteCsvRow(ostream &out, const SResult &r) {
+        const uint64_t leaps = r.m_Stats.m_Steps[eExplicit] +
+            r.m_Stats.m_Steps[eImplicit];
+        out << r.m_Case << "," << r.m_NumSpecies << "," <<
+            r.m_NumTransitions << "," << r.m_SimTime << "," <<
+            r.m_WallSeconds << "," << r.m_SetupSeconds << "," <<
+            r.m_Stats.m_Steps[eExact] << "," <<
+            r.m_Stats.m_Steps[eExplicit] << "," <<
+            r.m_Stats.m_Steps[eImplicit] << "," << r.m_Stats.m_Firings << "," <<
+            r.m_Stats.m_Firings / r.m_WallSeconds << "," <<
+            leaps / r.m_WallSeconds << "," << r.m_Allocs << "," <<
+            r.m_AllocBytes / (1024. * 1024.) << "," <<
+            r.m_PeakHeap / (1024. * 1024.) << "," << r.m_PeakRssMB << "," <<
+            r.m_Stats.m_TauHalvings << "," << r.m_Stats.m_NewtonIterations <<
+            "," << r.m_Stats.m_RateEvaluations << "," <<
+            r.m_Stats.m_JacobianEvaluations << "," << r.m_Stats.AverageTau() <<
+            "," << r.m_Stats.m_Seconds[ePhaseRates] << "," <<
+            r.m_Stats.m_Seconds[ePhaseJacobian] << "," <<
+            r.m_Stats.m_Seconds[ePhaseLinearSolve] << "," <<
+            r.m_Stats.m_Seconds[ePhaseTauSelection] << "," <<
+            r.m_Stats.m_Rejections << "," << r.m_Stats.m_LangevinSteps << "\n";
+    }
+
+    // case name -> wall seconds, from a previous results file
+    map<string, double> ReadBaseline(const string &path) {
+        ifstream in(path.c_str());
+        if (!in) {
+            throwError("unable to read baseline '" << path << "'");
+        }
+        map<string, double> res;
+        string line;
+        getline(in, line); //header
+        while (getline(in, line)) {
+            istringstream iss(line);
+            string field;
+            vector<string> fields;
+            while (getline(iss, field, ',')) {
+                fields.push_back(field);
+            }
+            if (fields.size() > 4) {
+                res[fields[0]] = atof(fields[4].c_str());
+            }
+        }
+        return res;
+    }
+
+    // PRE : r.m_Case set; start of the setup phase
+    // POST: numLanes replicates run in lockstep; r's times & stats set
+    void RunBatch(const SBenchCase &bc, const CModelFile &model,
+                  uint64_t seed, unsigned int maxSteps,
+                  unsigned int numLanes, SResult &r,
+                  chrono::steady_clock::time_point &start) {
+        CBatchStochasticEqns eqns(model, numLanes);
+        r.m_SetupSeconds = chrono::duration<double>
+            (chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        eqns.Seed(seed);
+        eqns.SetMaxSteps(maxSteps);
+        try {
+            eqns.EvaluateUntil(bc.m_TF);
+        } catch (CEarlyExit &e) {
+            cerr << r.m_Case << ": " << e.what() << endl;
+        }
+        r.m_SimTime = 0;
+        for (unsigned int l = 0;  l < numLanes;  ++l) {
+            r.m_SimTime += eqns.GetTime(l) / numLanes;
+        }
+        r.m_Stats = eqns.GetStatistics();
+    }
+
+    SResult RunCase(const SBenchCase &bc, const SNetwork &net,
+                    const CModelFile &model,
+                    const TCompiledModelPtr &compiled, uint64_t seed,
+                    unsigned int maxSteps, unsigned int profileRows,
+                    unsigned int traceEvery, const string &workDir,
+                    CThreadPool *pool, unsigned int numLanes) {
+        SResult r;
+        r.m_Case = string(net.m_Name) + "/" + kMethodNames[bc.m_Method];
+        r.m_NumSpecies = model.NumSpecies();
+        r.m_NumTransitions = model.NumTransitions();
+
+        const SHeapCounters heapBefore = g_Heap;
+        g_Heap.m_PeakLive = g_Heap.m_Live;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (bc.m_Method == eMethodBatch) {
+            RunBatch(bc, model, seed, maxSteps, numLanes, r, start);
+        } else {
+            CStochasticEqns eqns(compiled);
+            eqns.SetThreadPool(pool);
+            r.m_SetupSeconds = chrono::duration<double>
+                (chrono::steady_clock::now() - start).count();
+            start = chrono::steady_clock::now();
+            eqns.Seed(seed);
+            eqns.SetMaxSteps(maxSteps);
+            if (UsesJacobian(bc.m_Method)) {
+                eqns.SetUseJacobian(true);
+            } else if (bc.m_Method == eMethodImplicitFD) {
+                eqns.SetFiniteDifferenceJacobian(true);
+            } else if (IsExact(bc.m_Method)) {
+                eqns.SetExactMethod(ExactMethod(bc.m_Method));
+            }
+            eqns.SetLangevinThreshold(LangevinThreshold(bc.m_Method));
+            eqns.SetLeapMethod(LeapMethod(bc.m_Method));
+            if (profileRows > 0) {
+                eqns.SetProfiling(true);
+            }
+            unique_ptr<CTraceBuffer> trace;
+            if (traceEvery > 0) {
+                trace.reset(new CTraceBuffer(1 << 20, r.m_Case));
+                trace->SetSampling(traceEvery);
+                eqns.SetTraceBuffer(trace.get());
+            }
+            try {
+                if (IsExact(bc.m_Method)) {
+                    eqns.EvaluateExactUntil(bc.m_TF);
+                } else {
+                    eqns.EvaluateATLUntil(bc.m_TF);
+                }
+            } catch (CEarlyExit &e) {
+                cerr << r.m_Case << ": " << e.what() << endl;
+            }
+            r.m_SimTime = eqns.GetTime();
+            if (trace) {
+                string name = r.m_Case;
+                replace(name.begin(), name.end(), '/', '-');
+                WriteChromeTrace(workDir + "/trace-" + name + ".json",
+                                 vector<const CTraceBuffer*>(1, trace.get()));
+            }
+            r.m_Stats = eqns.GetStatistics();
+            if (profileRows > 0) {
+                ostringstream oss;
+                eqns.WriteProfileReport(oss, profileRows);
+                r.m_ProfileReport = oss.str();
+            }
+        }
+        r.m_WallSeconds = chrono::duration<double>
+            (chrono::steady_clock::now() - start).count();
+        r.m_Allocs = g_Heap.m_Allocs - heapBefore.m_Allocs;
+        r.m_AllocBytes = g_Heap.m_Bytes - heapBefore.m_Bytes;
+        r.m_PeakHeap = g_Heap.m_PeakLive - heapBefore.m_Live;
+        r.m_PeakRssMB = PeakRssMB();
+        return r;
+    }
+
+    uint64_t TotalSteps(const SRunStatistics &stats) {
+        return stats.m_Steps[eExact] + stats.m_Steps[eExplicit] +
+            stats.m_Steps[eImplicit];
+    }
+
+    // PRE : case without a step limit
+    // POST: heap allocations made by the steps of the case after warm-up
+    // (the first tenth of its simulated time); steps taken meanwhile in
+    // steps.  The time series is reserved up front from a first run, so
+    // any allocation counted is one made by the step loop itself.
+    uint64_t SteadyStateAllocs(const SBenchCase &bc, const CModelFile &model,
+                               const TCompiledModelPtr &compiled,
+                               uint64_t seed, unsigned int numLanes,
+                               uint64_t &steps) {
+        const double warmUp = bc.m_TF / 10;
+        if (bc.m_Method == eMethodBatch) {
+            CBatchStochasticEqns eqns(model, numLanes);
+            eqns.Seed(seed);
+            eqns.EvaluateUntil(warmUp);
+            const uint64_t before = TotalSteps(eqns.GetStatistics());
+            const uint64_t allocs = g_Heap.m_Allocs;
+            eqns.EvaluateUntil(bc.m_TF);
+            steps = TotalSteps(eqns.GetStatistics()) - before;
+            return g_Heap.m_Allocs - allocs;
+        }
+
+        unsigned int points;
+        {
+            CStochasticEqns eqns(compiled);
+            eqns.Seed(seed);
+            eqns.SetUseJacobian(UsesJacobian(bc.m_Method));
+            eqns.SetFiniteDifferenceJacobian(bc.m_Method == eMethodImplicitFD);
+            eqns.SetExactMethod(ExactMethod(bc.m_Method));
+            eqns.SetLangevinThreshold(LangevinThreshold(bc.m_Method));
+            eqns.SetLeapMethod(LeapMethod(bc.m_Method));
+            if (IsExact(bc.m_Method)) {
+                eqns.EvaluateExactUntil(bc.m_TF);
+            } else {
+                eqns.EvaluateATLUntil(bc.m_TF);
+            }
+            points = eqns.GetTimeSeries().size();
+        }
+        CStochasticEqns eqns(compiled);
+        eqns.Seed(seed);
+        eqns.SetUseJacobian(UsesJacobian(bc.m_Method));
+        eqns.SetFiniteDifferenceJacobian(bc.m_Method == eMethodImplicitFD);
+        eqns.SetExactMethod(ExactMethod(bc.m_Method));
+        eqns.SetLangevinThreshold(LangevinThreshold(bc.m_Method));
+        eqns.SetLeapMethod(LeapMethod(bc.m_Method));
+        eqns.ReserveTimeSeries(2 * points + 2); //split run differs a little
+        if (IsExact(bc.m_Method)) {
+            eqns.EvaluateExactUntil(warmUp);
+        } else {
+            eqns.EvaluateATLUntil(warmUp);
+        }
+        const uint64_t before = TotalSteps(eqns.GetStatistics());
+        const uint64_t allocs = g_Heap.m_Allocs;
+        if (IsExact(bc.m_Method)) {
+            eqns.EvaluateExactUntil(bc.m_TF);
+        } else {
+            eqns.EvaluateATLUntil(bc.m_TF);
+        }
+        steps = TotalSteps(eqns.GetStatistics()) - before;
+        return g_Heap.m_Allocs - allocs;
+    }
+
+    // POST: splitting estimate vs plain replicates with the same number of
+    // events, for P(|ee| >= target by t = 5) in the frank network
+    void RunSplitting(double target, const string &workDir, uint64_t seed,
+                      CThreadPool *pool) {
+        const double tF = 5;
+        const string modelPath = workDir + "/bench-frank.clmmodel";
+        {
+            CModelFileWriter writer;
+            BuildFrank(writer, 0);
+            writer.Write(modelPath);
+        }
+        CModelFile model(modelPath);
+        const TCompiledModelPtr compiled =
+            make_shared<const CCompiledModel>(model);
+        CStopCriteria::TWeights num, den;
+        num.push_back(make_pair(1u, 1.));
+        num.push_back(make_pair(2u, -1.));
+        den.push_back(make_pair(1u, 1.));
+        den.push_back(make_pair(2u, 1.));
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        CSplittingEstimator est(compiled);
+        est.SetCoordinate(num, den);
+        est.SetEvenLevels(target, 8);
+        est.SetTrajectoriesPerLevel(500);
+        est.SetReplicates(10);
+        est.Seed(seed);
+        est.SetThreadPool(pool);
+        const SSplittingResult res = est.Estimate(tF);
+        const double splitWall = chrono::duration<double>
+            (chrono::steady_clock::now() - start).count();
+
+        //plain replicates until the same number of events is spent
+        start = chrono::steady_clock::now();
+        CStochasticEqns eqns(compiled);
+        CStopCriteria hit;
+        hit.AddThreshold("target", num, den, target);
+        eqns.SetStopCriteria(hit);
+        eqns.Seed(seed);
+        uint64_t runs = 0, hits = 0;
+        while (eqns.GetStatistics().m_Firings < res.m_Firings) {
+            eqns.SetState(0, model.InitialState());
+            eqns.EvaluateExactUntil(tF);
+            ++runs;
+            hits += eqns.GetStopReason() == eStopCriterion;
+        }
+        const double plainWall = chrono::duration<double>
+            (chrono::steady_clock::now() - start).count();
+        const double p = double(hits) / runs;
+
+        cout << "P(|ee| >= " << target << " by t = " << tF << ")" << endl;
+        cout << left << setw(12) << "method" << right << setw(14) <<
+            "estimate" << setw(12) << "std_err" << setw(14) << "events" <<
+            setw(10) << "wall_s" << endl;
+        cout << left << setw(12) << "splitting" << right << setprecision(4) <<
+            setw(14) << res.m_Probability << setw(12) << res.m_StdError <<
+            setw(14) << res.m_Firings << fixed << setprecision(2) <<
+            setw(10) << splitWall << endl;
+        cout.unsetf(ios::floatfield);
+        cout << left << setw(12) << "plain" << right << setprecision(4) <<
+            setw(14) << p << setw(12) << sqrt(p * (1 - p) / runs) <<
+            setw(14) << eqns.GetStatistics().m_Firings << fixed <<
+            setprecision(2) << setw(10) << plainWall << endl;
+        cout.unsetf(ios::floatfield);
+        cout << "95% CI [" << res.m_Lower << ", " << res.m_Upper << "]; plain "
+            "replicates would need ~" << setprecision(3) <<
+            res.m_EquivalentFirings << " events for the same std_err" << endl;
+    }
+
+    // POST: multilevel estimate of E[L(t = 5)] in the frank network vs
+    // plain exact runs with the same number of rate evaluations
+    void RunMultilevel(double stdError, const string &workDir,
+                       uint64_t seed) {
+        const double tF = 5;
+        const string modelPath = workDir + "/bench-frank.clmmodel";
+        {
+            CModelFileWriter writer;
+            BuildFrank(writer, 0);
+            writer.Write(modelPath);
+        }
+        CModelFile model(modelPath);
+        const TCompiledModelPtr compiled =
+            make_shared<const CCompiledModel>(model);
+        CStopCriteria::TWeights num(1, make_pair(1u, 1.)), den;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        CMultilevelEstimator est(compiled);
+        est.SetObservable(num, den);
+        est.SetLevels(0.5, 4, 3);
+        est.Seed(seed);
+        const SMultilevelResult res = est.Estimate(tF, stdError * stdError);
+        const double mlmcWall = chrono::duration<double>
+            (chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        CStochasticEqns eqns(compiled);
+        eqns.Seed(seed);
+        uint64_t runs = 0;
+        double sum = 0, sumSq = 0;
+        while (eqns.GetStatistics().m_RateEvaluations < res.m_Cost) {
+            eqns.SetState(0, model.InitialState());
+            eqns.EvaluateExactUntil(tF);
+            ++runs;
+            sum += eqns.GetState()[1];
+            sumSq += eqns.GetState()[1] * eqns.GetState()[1];
+        }
+        const double plainWall = chrono::duration<double>
+            (chrono::steady_clock::now() - start).count();
+        const double mean = sum / runs;
+
+        cout << "E[L(t = " << tF << ")]" << endl;
+        cout << left << setw(10) << "level" << right << setw(12) << "tau" <<
+            setw(12) << "samples" << setw(12) << "mean" << setw(12) <<
+            "variance" << setw(12) << "cost" << endl;
+        for (unsigned int l = 0;  l < res.m_Levels.size();  ++l) {
+            const SMultilevelLevel &level = res.m_Levels[l];
+            cout << left << setw(10) << l << right << setprecision(4) <<
+                setw(12) << level.m_Tau << setw(12) << level.m_Samples <<
+                setw(12) << level.m_Mean << setw(12) << level.m_Variance <<
+                setw(12) << level.m_Cost << endl;
+        }
+        cout << left << setw(10) << "method" << right << setw(12) <<
+            "estimate" << setw(12) << "std_err" << setw(14) << "rate_evals" <<
+            setw(10) << "wall_s" << endl;
+        cout << left << setw(10) << "mlmc" << right << setprecision(5) <<
+            setw(12) << res.m_Mean << setw(12) << res.m_StdError <<
+            setw(14) << res.m_Cost << fixed << setprecision(2) <<
+            setw(10) << mlmcWall << endl;
+        cout.unsetf(ios::floatfield);
+        cout << left << setw(10) << "plain" << right << setprecision(5) <<
+            setw(12) << mean << setw(12) <<
+            sqrt(max(0., sumSq / runs - mean * mean) / runs) << setw(14) <<
+            eqns.GetStatistics().m_RateEvaluations << fixed <<
+            setprecision(2) << setw(10) << plainWall << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(4) << "95% CI [" << res.m_Lower << ", " <<
+            res.m_Upper << "]; plain exact runs would need ~" <<
+            setprecision(3) <<
+            res.m_SingleLevelCost << " rate evaluations for the same std_err"
+            << endl;
+    }
+
+    // POST: lotka-volterra in a chain of numCompartments run by NSM & by
+    // split leaping
+    void RunCompartments(unsigned int numCompartments, const string &workDir,
+                         uint64_t seed) {
+        const double tF = 1, dt = 0.01;
+        const string modelPath = workDir + "/bench-lotka-volterra.clmmodel";
+        {
+            CModelFileWriter writer;
+            BuildLotkaVolterra(writer, 0);
+            writer.Write(modelPath);
+        }
+        CModelFile model(modelPath);
+        const TCompiledModelPtr compiled =
+            make_shared<const CCompiledModel>(model);
+        vector<double> noFoxes(model.InitialState(),
+                               model.InitialState() + model.NumSpecies());
+        noFoxes[1] = 0;
+
+        cout << numCompartments << " compartments" << endl;
+        cout << left << setw(10) << "method" << right << setw(10) <<
+            "wall_s" << setw(14) << "events" << setw(14) << "events/s" <<
+            setw(12) << "hares" << setw(12) << "foxes" << endl;
+        for (unsigned int split = 0;  split < 2;  ++split) {
+            CCompartmentEqns eqns(compiled, numCompartments, &noFoxes[0]);
+            eqns.SetInitialState(0, model.InitialState());
+            for (unsigned int c = 0;  c + 1 < numCompartments;  ++c) {
+                eqns.AddDiffusion(0, c, c + 1, 1);
+                eqns.AddDiffusion(1, c, c + 1, 1);
+            }
+            eqns.Seed(seed);
+            const chrono::steady_clock::time_point start =
+                chrono::steady_clock::now();
+            if (split) {
+                eqns.EvaluateSplitUntil(tF, dt);
+            } else {
+                eqns.EvaluateExactUntil(tF);
+            }
+            const double wall = chrono::duration<double>
+                (chrono::steady_clock::now() - start).count();
+            const uint64_t events = eqns.GetStatistics().m_Firings;
+            cout << left << setw(10) << (split ? "split" : "nsm") << right <<
+                fixed << setprecision(3) << setw(10) << wall <<
+                setw(14) << events << setprecision(0) << setw(14) <<
+                events / wall << setw(12) << eqns.GetTotal(0) << setw(12) <<
+                eqns.GetTotal(1) << endl;
+            cout.unsetf(ios::floatfield);
+        }
+    }
+
+    // POST: tau leaping parameters of the small networks tuned to the
+    // error budget, stored with their model files & read back
+    void RunAutotune(double budget, const string &workDir, uint64_t seed) {
+        struct STuneCase {
+            const char *m_Network;
+            TBuildNetwork m_Build;
+            double m_PilotTime;
+        };
+        const STuneCase cases[] = {
+            { "lotka-volterra", BuildLotkaVolterra, 2 },
+            { "dimerization",   BuildDimerization,  0.2 }
+        };
+        cout << left << setw(16) << "network" << right << setw(12) <<
+            "exact t/s" << setw(12) << "start t/s" << setw(10) <<
+            "start err" << setw(12) << "tuned t/s" << setw(10) <<
+            "tuned err" << setw(9) << "epsilon" << setw(8) << "ncrit" <<
+            setw(8) << "thresh" << setw(8) << "trials" << endl;
+        for (unsigned int k = 0;  k < sizeof(cases)/sizeof(cases[0]);  ++k) {
+            const string modelPath = workDir + "/tuned-" +
+                cases[k].m_Network + ".clmmodel";
+            {
+                CModelFileWriter writer;
+                cases[k].m_Build(writer, 0);
+                writer.Write(modelPath);
+            }
+            STuningResult res;
+            {
+                CModelFile model(modelPath);
+                CTauLeapingTuner tuner(make_shared<const CCompiledModel>(model));
+                tuner.SetPilotTime(cases[k].m_PilotTime);
+                tuner.SetErrorBudget(budget);
+                tuner.Seed(seed);
+                res = tuner.Tune();
+            }
+            SaveTauLeapingParams(modelPath, res.m_Params);
+            CModelFile stored(modelPath);
+            CStochasticEqns eqns(make_shared<const CCompiledModel>(stored));
+            const STauLeapingParams readBack = eqns.GetTauLeapingParams();
+            if (memcmp(&readBack, &res.m_Params, sizeof(readBack)) != 0) {
+                throwError("tuned parameters of " << cases[k].m_Network <<
+                           " were not read back from the model file");
+            }
+            cout << left << setw(16) << cases[k].m_Network << right <<
+                fixed << setprecision(0) << setw(12) <<
+                res.m_ExactThroughput << setw(12) << res.m_StartThroughput <<
+                setprecision(3) << setw(10) << res.m_StartError <<
+                setprecision(0) << setw(12) << res.m_Throughput <<
+                setprecision(3) << setw(10) << res.m_Error <<
+                setw(9) << res.m_Params.m_Epsilon << setprecision(0) <<
+                setw(8) << res.m_Params.m_Ncritical << setw(8) <<
+                res.m_Params.m_ExactThreshold << setw(8) <<
+                res.m_Trials.size() <<
+                (res.m_WithinBudget ? "" : "   (none within budget)") << endl;
+            cout.unsetf(ios::floatfield);
+        }
+    }
+
+    // userData of SampleBatch
+    struct SBatchSampler {
+        const CModelFile *m_Model;
+        unsigned int m_Lanes;
+        double m_Epsilon;  // 0 == default
+    };
+
+    // TEnsembleSampler of the lockstep mode: runs in batches of m_Lanes
+    void SampleBatch(const double *x0, const vector<double> &times,
+                     unsigned int runs, uint64_t seed, double *states,
+                     void *userData) {
+        const SBatchSampler &sampler = *static_cast<SBatchSampler*>(userData);
+        for (unsigned int first = 0;  first < runs;  first += sampler.m_Lanes) {
+            const unsigned int lanes = min(sampler.m_Lanes, runs - first);
+            CBatchStochasticEqns eqns(*sampler.m_Model, lanes, x0);
+            if (sampler.m_Epsilon > 0) {
+                eqns.SetEpsilon(sampler.m_Epsilon);
+            }
+            eqns.Seed(seed + first);
+            eqns.SetOutputTimes(times);
+            eqns.EvaluateUntil(times.back());
+            const unsigned int n = eqns.GetNumStates();
+            for (unsigned int l = 0;  l < lanes;  ++l) {
+                double *row = states + (size_t) (first + l) * times.size() * n;
+                for (unsigned int p = 0;  p < times.size();  ++p) {
+                    for (unsigned int i = 0;  i < n;  ++i) {
+                        const double x = eqns.GetOutput(p, l, i);
+                        row[p * n + i] = std::isnan(x) ? eqns.GetState(l, i) : x;
+                    }
+                }
+            }
+        }
+    }
+
+    // POST: the fast modes of the small networks compared with exact SSA
+    // ensembles of the given size
+    void RunValidation(unsigned int runs, const string &workDir,
+                       uint64_t seed, unsigned int numLanes) {
+        struct SValidationCase {
+            const char *m_Network;
+            TBuildNetwork m_Build;
+            double m_Times[3];
+        };
+        const SValidationCase cases[] = {
+            { "lotka-volterra", BuildLotkaVolterra, { 0.5, 1, 2 } },
+            { "dimerization",   BuildDimerization,  { 0.05, 0.1, 0.2 } }
+        };
+        // mode under test; epsilon 0 == default
+        struct SMode {
+            const char *m_Name;
+            EMethod m_Method;
+            double m_Epsilon;
+        };
+        const SMode modes[] = {
+            { "exact",           eMethodExact,             0 },
+            { "exact-rssa",      eMethodRejection,         0 },
+            { "exact-pdm",       eMethodPartialPropensity, 0 },
+            { "atl",             eMethodExplicit,          0 },
+            { "atl eps=0.01",    eMethodExplicit,          0.01 },
+            { "atl-implicit",    eMethodImplicit,          0 },
+            { "atl-implicit-fd", eMethodImplicitFD,        0 },
+            { "atl-cle",         eMethodLangevin,          0 },
+            { "rleap",           eMethodRLeap,             0 },
+            { "atl-batch",       eMethodBatch,             0 }
+        };
+        cout << left << setw(16) << "network" << setw(17) << "mode" <<
+            right << setw(10) << "exact_s" << setw(10) << "fast_s" <<
+            setw(10) << "speedup" << setw(11) << "min_p" << setw(9) <<
+            "failed" << "   verdict" << endl;
+        for (unsigned int k = 0;  k < sizeof(cases)/sizeof(cases[0]);  ++k) {
+            const string modelPath = workDir + "/bench-" +
+                cases[k].m_Network + ".clmmodel";
+            {
+                CModelFileWriter writer;
+                cases[k].m_Build(writer, 0);
+                writer.Write(modelPath);
+            }
+            CModelFile model(modelPath);
+            const TCompiledModelPtr compiled =
+                make_shared<const CCompiledModel>(model);
+            CAccuracyValidator validator(compiled);
+            validator.SetTimes(vector<double>(cases[k].m_Times,
+                                              cases[k].m_Times + 3));
+            validator.SetRuns(runs);
+            validator.Seed(seed);
+            for (unsigned int m = 0;  m < sizeof(modes)/sizeof(modes[0]);  ++m) {
+                SValidationReport res;
+                if (modes[m].m_Method == eMethodBatch) {
+                    SBatchSampler sampler = { &model, numLanes, modes[m].m_Epsilon };
+                    res = validator.Validate(SampleBatch, &sampler);
+                } else {
+                    CStochasticEqns eqns(compiled);
+                    if (modes[m].m_Epsilon > 0) {
+                        eqns.SetEpsilon(modes[m].m_Epsilon);
+                    }
+                    if (UsesJacobian(modes[m].m_Method)) {
+                        eqns.SetUseJacobian(true);
+                    } else if (modes[m].m_Method == eMethodImplicitFD) {
+                        eqns.SetFiniteDifferenceJacobian(true);
+                    } else if (IsExact(modes[m].m_Method)) {
+                        eqns.SetExactMethod(ExactMethod(modes[m].m_Method));
+                    }
+                    eqns.SetLangevinThreshold(LangevinThreshold(modes[m].m_Method));
+                    eqns.SetLeapMethod(LeapMethod(modes[m].m_Method));
+                    res = validator.Validate(IsExact(modes[m].m_Method) ?
+                                             CAccuracyValidator::SampleExact :
+                                             CAccuracyValidator::SampleATL,
+                                             &eqns);
+                }
+                cout << left << setw(16) << cases[k].m_Network << setw(17) <<
+                    modes[m].m_Name << right << fixed << setprecision(3) <<
+                    setw(10) << res.m_ExactSeconds << setw(10) <<
+                    res.m_FastSeconds << setprecision(1) << setw(10) <<
+                    res.m_Speedup << scientific << setprecision(2) <<
+                    setw(11) << res.m_MinPValue << setw(6) <<
+                    res.m_Failures << "/" << left << setw(2) <<
+                    res.m_Tests.size() << right << "   " <<
+                    (res.m_Passed ? "PASS" : "FAIL") << endl;
+                cout.unsetf(ios::floatfield);
+                for (unsigned int t = 0;  t < res.m_Tests.size();  ++t) {
+                    const SMarginalTest &test = res.m_Tests[t];
+                    if (!test.m_Passed) {
+                        cout << setprecision(4) << "    " <<
+                            model.SpeciesName(test.m_Species) << " at t=" <<
+                            test.m_Time << ": mean " << test.m_MeanFast <<
+                            " vs " << test.m_MeanExact << ", sd " <<
+                            test.m_SdFast << " vs " << test.m_SdExact <<
+                            "; p KS " << test.m_KSPValue << ", AD " <<
+                            (test.m_ADBound < 0 ? "< " :
+                             test.m_ADBound > 0 ? "> " : "") <<
+                            test.m_ADPValue << ", mean " <<
+                            test.m_MeanPValue << endl;
+                    }
+                }
+            }
+        }
+    }
+
+    // POST: moment equations of the small networks compared with exact
+    // SSA ensembles of the given size
+    void RunMoments(unsigned int runs, const string &workDir, uint64_t seed) {
+        struct SMomentCase {
+            const char *m_Network;
+            TBuildNetwork m_Build;
+            double m_Times[3];
+        };
+        const SMomentCase cases[] = {
+            { "lotka-volterra", BuildLotkaVolterra, { 0.5, 1, 2 } },
+            { "dimerization",   BuildDimerization,  { 0.05, 0.1, 0.2 } }
+        };
+        for (unsigned int k = 0;  k < sizeof(cases)/sizeof(cases[0]);  ++k) {
+            const string modelPath = workDir + "/bench-" +
+                cases[k].m_Network + ".clmmodel";
+            {
+                CModelFileWriter writer;
+                cases[k].m_Build(writer, 0);
+                writer.Write(modelPath);
+            }
+            CModelFile model(modelPath);
+            const TCompiledModelPtr compiled =
+                make_shared<const CCompiledModel>(model);
+            const unsigned int n = compiled->NumStates();
+            const vector<double> times(cases[k].m_Times, cases[k].m_Times + 3);
+
+            vector<double> states((size_t) runs * times.size() * n);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            {
+                CStochasticEqns eqns(compiled);
+                CAccuracyValidator::SampleExact(model.InitialState(), times,
+                                                runs, seed, &states[0], &eqns);
+            }
+            const double ssaWall = chrono::duration<double>
+                (chrono::steady_clock::now() - start).count();
+
+            SMomentTrajectory lna, closure;
+            {
+                CMomentEquations moments(compiled);
+                moments.SetTimes(times);
+                lna = moments.Integrate();
+                moments.SetClosure(eNormalClosure);
+                closure = moments.Integrate();
+            }
+            cout << cases[k].m_Network << ": " << runs << " exact runs " <<
+                fixed << setprecision(3) << ssaWall << " s, LNA " <<
+                setprecision(5) << lna.m_Seconds << " s (" << lna.m_Steps <<
+                " steps), closure " << closure.m_Seconds << " s (" <<
+                closure.m_Steps << " steps)" << endl;
+            cout.unsetf(ios::floatfield);
+            cout << left << setw(10) << "species" << right << setw(8) <<
+                "t" << setw(12) << "ssa_mean" << setw(10) << "ssa_sd" <<
+                setw(12) << "lna_mean" << setw(10) << "lna_sd" <<
+                setw(12) << "mc2_mean" << setw(10) << "mc2_sd" << endl;
+            for (unsigned int i = 0;  i < n;  ++i) {
+                for (unsigned int p = 0;  p < times.size();  ++p) {
+                    double sum = 0, sumSq = 0;
+                    for (unsigned int r = 0;  r < runs;  ++r) {
+                        const double v =
+                            states[((size_t) r * times.size() + p) * n + i];
+                        sum += v;
+                        sumSq += v * v;
+                    }
+                    const double mean = sum / runs;
+                    const double sd = runs > 1 ?
+                        sqrt(max(0., (sumSq - sum * mean) / (runs - 1))) : 0;
+                    const size_t at = (size_t) p * n + i;
+                    cout << setprecision(5) << left << setw(10) <<
+                        model.SpeciesName(i) << right << setw(8) << times[p] <<
+                        setw(12) << mean << setw(10) << sd << setw(12) <<
+                        lna.m_Means[at] << setw(10) <<
+                        sqrt(max(0., lna.m_Covariances[at * n + i])) <<
+                        setw(12) << closure.m_Means[at] << setw(10) <<
+                        sqrt(max(0., closure.m_Covariances[at * n + i])) << endl;
+                }
+            }
+        }
+    }
+
+    // POST: sensitivities of the small networks to every rate constant,
+    // from coupled runs, vs the std errors of independent runs
+    void RunSensitivity(unsigned int runs, const string &workDir,
+                        uint64_t seed) {
+        struct SSensitivityCase {
+            const char *m_Network;
+            TBuildNetwork m_Build;
+            unsigned int m_Species;   // observable
+            double m_TF;
+            double m_LeapStep;
+        };
+        const SSensitivityCase cases[] = {
+            { "lotka-volterra", BuildLotkaVolterra, 0, 1,    0.01 },
+            { "dimerization",   BuildDimerization,  1, 0.01, 0.0001 }
+        };
+        const double relStep = 0.05;
+        for (unsigned int k = 0;  k < sizeof(cases)/sizeof(cases[0]);  ++k) {
+            const string modelPath = workDir + "/bench-" +
+                cases[k].m_Network + ".clmmodel";
+            {
+                CModelFileWriter writer;
+                cases[k].m_Build(writer, 0);
+                writer.Write(modelPath);
+            }
+            CModelFile model(modelPath);
+            const TCompiledModelPtr compiled =
+                make_shared<const CCompiledModel>(model);
+            CStopCriteria::TWeights num(1,
+                make_pair(cases[k].m_Species, 1.)), den;
+
+            CSensitivityEstimator est(compiled);
+            est.SetObservable(num, den);
+            for (unsigned int j = 0;  j < compiled->NumTransitions();  ++j) {
+                ostringstream name;
+                name << "k" << j + 1;
+                est.AddParameter(name.str(), vector<unsigned int>(1, j),
+                                 relStep);
+            }
+            est.SetLeapStep(cases[k].m_LeapStep);
+            est.SetRuns(runs);
+            est.Seed(seed);
+            for (int method = eSensitivityExact;  method <= eSensitivityLeap;
+                 ++method) {
+                est.SetMethod((ESensitivityMethod) method);
+                const SSensitivityResult res = est.Estimate(cases[k].m_TF);
+                cout << cases[k].m_Network << " " <<
+                    (method == eSensitivityExact ? "exact" : "leap") <<
+                    ": d E[" << model.SpeciesName(cases[k].m_Species) <<
+                    "(t = " << cases[k].m_TF << ")] / d log k, " << runs <<
+                    " coupled runs, mean " << setprecision(5) <<
+                    res.m_Nominal << ", " << res.m_Cost << " rate evals, " <<
+                    fixed << setprecision(3) << res.m_Seconds << " s" << endl;
+                cout.unsetf(ios::floatfield);
+                cout << left << setw(8) << "param" << right << setw(12) <<
+                    "estimate" << setw(12) << "std_err" << setw(14) <<
+                    "indep_err" << setw(12) << "var_ratio" << endl;
+                for (unsigned int p = 0;  p < res.m_Estimates.size();  ++p) {
+                    const SSensitivityEstimate &e = res.m_Estimates[p];
+                    cout << left << setw(8) << e.m_Parameter << right <<
+                        setprecision(5) << setw(12) << e.m_Derivative <<
+                        setw(12) << e.m_DerivativeStdError << setw(14) <<
+                        sqrt(e.m_IndependentVariance / runs) /
+                        log1p(e.m_RelStep) << setprecision(4) << setw(12) <<
+                        e.m_VarianceReduction << endl;
+                }
+            }
+        }
+    }
+
+    // POST: number of methods that do not advance a deterministic decay
+    // A -> 0 (rate 1) to tF once the only stochastic transition, B -> 0,
+    // cannot fire (B = 0); each must end as the exact path does
+    unsigned int CheckDeterministic(const string &workDir) {
+        const string modelPath = workDir + "/bench-deterministic.clmmodel";
+        {
+            CModelFileWriter w;
+            const unsigned int cat = w.AddCategory("all");
+            const int a = w.AddSpecies("A", cat, 1000);
+            const int b = w.AddSpecies("B", cat, 0);
+            w.AddTransition(Rs(R(a, 1)), Cs(C(a, -1)), 1, cat,
+                            eTransDeterministic);
+            w.AddTransition(Rs(R(b, 1)), Cs(C(b, -1)), 1, cat);
+            w.Write(modelPath);
+        }
+        CModelFile model(modelPath);
+        const TCompiledModelPtr compiled =
+            make_shared<const CCompiledModel>(model);
+        const double tF = 0.5;
+        double expected = 0;
+        unsigned int numFailed = 0;
+        cout << left << setw(28) << "method" << right << setw(12) << "A(tF)" <<
+            endl;
+        for (unsigned int k = 0;  k < 2;  ++k) {
+            CStochasticEqns eqns(compiled);
+            eqns.SetState(0, model.InitialState());
+            if (k == 0) {
+                eqns.EvaluateExactUntil(tF);
+                expected = eqns.GetState()[0];
+            } else {
+                eqns.SetLeapMethod(eLeapR);
+                eqns.EvaluateATLUntil(tF);
+            }
+            const double x = eqns.GetState()[0];
+            const bool failed = !(fabs(x - expected) <= 1e-9 * expected)  ||
+                !(x < model.InitialState()[0]);
+            cout << left << setw(28) << (k == 0 ? "exact" : "rleap") <<
+                right << setw(12) << x << (failed ? "   FAILED" : "") << endl;
+            numFailed += failed;
+        }
+        return numFailed;
+    }
+
+    // POST: number of networks whose generated kernels do not load or do
+    // not match CCompiledModel's generic rates & updates
+    unsigned int CheckKernels(const string &compiler, const string &workDir,
+                              uint64_t seed) {
+        const char *networks[] = {
+            "lotka-volterra", "dimerization", "stiff-pair", "clm-1k", "frank"
+        };
+        const unsigned int numNetworks = sizeof(networks)/sizeof(networks[0]);
+        vector<string> libPaths;
+        unsigned int numFailed = 0;
+        cout << left << setw(16) << "network" << right << setw(12) <<
+            "rate_err" << setw(12) << "nu_err" << setw(12) << "fire_err" <<
+            setw(10) << "atl" << setw(10) << "foreign" << endl;
+        for (unsigned int k = 0;  k < numNetworks;  ++k) {
+            const SNetwork *net = NULL;
+            for (unsigned int n = 0;
+                 n < sizeof(kNetworks)/sizeof(kNetworks[0]);  ++n) {
+                if (networks[k] == string(kNetworks[n].m_Name)) {
+                    net = &kNetworks[n];
+                }
+            }
+            const string base = workDir + "/kernels-" + net->m_Name;
+            const string modelPath = workDir + "/bench-" + net->m_Name +
+                ".clmmodel";
+            {
+                CModelFileWriter writer;
+                net->m_Build(writer, net->m_Size);
+                writer.Write(modelPath);
+            }
+            CModelFile model(modelPath);
+            {
+                ofstream src((base + ".cpp").c_str());
+                WriteModelKernels(model, src);
+                src.close();
+                if (!src) {
+                    throwError("unable to write '" << base << ".cpp'");
+                }
+            }
+            const string command = compiler + " -O2 -shared -fPIC -o \"" +
+                base + ".so\" \"" + base + ".cpp\"";
+            if (system(command.c_str()) != 0) {
+                cout << left << setw(16) << net->m_Name <<
+                    "FAILED: '" << command << "' failed" << endl;
+                ++numFailed;
+                libPaths.push_back("");
+                continue;
+            }
+            libPaths.push_back(base + ".so");
+            CModelKernels kernels(libPaths.back(), model);
+            const TCompiledModelPtr generic =
+                make_shared<const CCompiledModel>(model);
+            const TCompiledModelPtr special =
+                make_shared<const CCompiledModel>(model, &kernels);
+
+            //rates, single transitions & firings at random states
+            const unsigned int n = model.NumSpecies();
+            const unsigned int m = model.NumTransitions();
+            CRandom rnd(seed);
+            vector<double> x(n), x1(n), x2(n), r1(m), r2(m), firings(m);
+            double rateErr = 0, nuErr = 0, fireErr = 0;
+            for (unsigned int p = 0;  p < 20;  ++p) {
+                for (unsigned int i = 0;  i < n;  ++i) {
+                    x[i] = p == 0 ? model.InitialState()[i] :
+                        floor(rnd.Unif(0, 2 * model.InitialState()[i] + 10));
+                }
+                generic->CalcRates(&x[0], &r1[0]);
+                special->CalcRates(&x[0], &r2[0]);
+                for (unsigned int j = 0;  j < m;  ++j) {
+                    rateErr = max(rateErr, fabs(r1[j] - r2[j]) /
+                                  max(fabs(r1[j]), 1e-300));
+                    firings[j] = rnd.Pois(3);
+                }
+                for (unsigned int j = 0;  j < m;  ++j) {
+                    x1 = x;
+                    x2 = x;
+                    generic->ApplyTransition(j, firings[j], &x1[0]);
+                    special->ApplyTransition(j, firings[j], &x2[0]);
+                    for (unsigned int i = 0;  i < n;  ++i) {
+                        nuErr = max(nuErr, fabs(x1[i] - x2[i]));
+                    }
+                }
+                x1 = x;
+                x2 = x;
+                for (unsigned int j = 0;  j < m;  ++j) {
+                    generic->ApplyTransition(j, firings[j], &x1[0]);
+                }
+                kernels.ApplyFirings(&firings[0], &x2[0]);
+                for (unsigned int i = 0;  i < n;  ++i) {
+                    fireErr = max(fireErr, fabs(x1[i] - x2[i]));
+                }
+            }
+
+            //the engine on both: same seed, so the same path unless round-off
+            //differences flip a draw
+            SRunStatistics stats[2];
+            for (unsigned int s = 0;  s < 2;  ++s) {
+                CStochasticEqns eqns(s == 0 ? generic : special);
+                eqns.Seed(seed);
+                eqns.SetState(0, model.InitialState());
+                eqns.SetMaxSteps(200);
+                try {
+                    eqns.EvaluateATLUntil(1);
+                } catch (CEarlyExit &) {
+                }
+                stats[s] = eqns.GetStatistics();
+            }
+            const bool atlOk = fabs((double) stats[0].m_Firings -
+                                    (double) stats[1].m_Firings) <=
+                0.01 * stats[0].m_Firings;
+
+            //kernels of the previous network must be refused
+            bool foreignRefused = true;
+            if (k > 0  &&  !libPaths[k - 1].empty()) {
+                try {
+                    CModelKernels foreign(libPaths[k - 1], model);
+                    foreignRefused = false;
+                } catch (runtime_error &) {
+                }
+            }
+
+            const bool failed = !(rateErr <= 1e-12)  ||  nuErr != 0  ||
+                fireErr != 0  ||  !atlOk  ||  !foreignRefused;
+            cout << left << setw(16) << net->m_Name << right <<
+                setprecision(3) << setw(12) << rateErr << setw(12) << nuErr <<
+                setw(12) << fireErr << setw(10) << (atlOk ? "match" : "differ") <<
+                setw(10) << (foreignRefused ? "refused" : "loaded") <<
+                (failed ? "   FAILED" : "") << endl;
+            numFailed += failed;
+        }
+        return numFailed;
+    }
+
+    void Usage(void) {
+        cerr << "usage: adaptivetau-bench [--filter <substring>] "
+            "[--out <results.csv>] [--baseline <old.csv>] [--workdir <dir>] "
+            "[--seed <n>] [--repeat <n>] [--quick] [--profile <n>] "
+            "[--trace <n>] [--threads <n>] [--lanes <n>] [--check-allocs] "
+            "[--splitting <target |ee|>] [--mlmc <std err>] "
+            "[--compartments <n>] [--autotune <error budget>] "
+            "[--validate <runs>] [--moments <runs>] "
+            "[--sensitivity <runs>] [--check-deterministic] "
+            "[--check-kernels <c++ compiler>]" << endl;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char **argv) {
+    string filter, outPath = "adaptivetau-bench.csv", baselinePath;
+    string workDir = ".", kernelCompiler;
+    uint64_t seed = 1;
+    unsigned int repeat = 1;
+    bool quick = false;
+    unsigned int profileRows = 0, traceEvery = 0, numThreads = 0;
+    unsigned int numLanes = 64, numCompartments = 0, validationRuns = 0;
+    unsigned int momentRuns = 0, sensitivityRuns = 0;
+    bool checkAllocs = false, checkDeterministic = false;
+    double splittingTarget = 0, mlmcStdError = 0, tuningBudget = 0;
+    for (int i = 1;  i < argc;  ++i) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--filter"  &&  hasValue) {
+            filter = argv[++i];
+        } else if (arg == "--out"  &&  hasValue) {
+            outPath = argv[++i];
+        } else if (arg == "--baseline"  &&  hasValue) {
+            baselinePath = argv[++i];
+        } else if (arg == "--workdir"  &&  hasValue) {
+            workDir = argv[++i];
+        } else if (arg == "--seed"  &&  hasValue) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "--repeat"  &&  hasValue) {
+            repeat = max(1, atoi(argv[++i]));
+        } else if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--profile"  &&  hasValue) {
+            profileRows = max(0, atoi(argv[++i]));
+        } else if (arg == "--threads"  &&  hasValue) {
+            numThreads = max(0, atoi(argv[++i]));
+        } else if (arg == "--check-allocs") {
+            checkAllocs = true;
+        } else if (arg == "--check-deterministic") {
+            checkDeterministic = true;
+        } else if (arg == "--check-kernels"  &&  hasValue) {
+            kernelCompiler = argv[++i];
+        } else if (arg == "--lanes"  &&  hasValue) {
+            numLanes = max(1, atoi(argv[++i]));
+        } else if (arg == "--splitting"  &&  hasValue) {
+            splittingTarget = atof(argv[++i]);
+        } else if (arg == "--mlmc"  &&  hasValue) {
+            mlmcStdError = atof(argv[++i]);
+        } else if (arg == "--autotune"  &&  hasValue) {
+            tuningBudget = atof(argv[++i]);
+        } else if (arg == "--validate"  &&  hasValue) {
+            validationRuns = max(0, atoi(argv[++i]));
+        } else if (arg == "--moments"  &&  hasValue) {
+            momentRuns = max(0, atoi(argv[++i]));
+        } else if (arg == "--sensitivity"  &&  hasValue) {
+            sensitivityRuns = max(0, atoi(argv[++i]));
+        } else if (arg == "--compartments"  &&  hasValue) {
+            numCompartments = max(0, atoi(argv[++i]));
+        } else if (arg == "--trace"  &&  hasValue) {
+            traceEvery = max(0, atoi(argv[++i]));
+        } else {
+            Usage();
+            return 2;
+        }
+    }
+
+    try {
+        unique_ptr<CThreadPool> pool;
+        if (numThreads > 0) {
+            pool.reset(new CThreadPool(numThreads));
+        }
+        if (splittingTarget > 0) {
+            RunSplitting(splittingTarget, workDir, seed, pool.get());
+            return 0;
+        }
+        if (mlmcStdError > 0) {
+            RunMultilevel(mlmcStdError, workDir, seed);
+            return 0;
+        }
+        if (numCompartments > 0) {
+            RunCompartments(numCompartments, workDir, seed);
+            return 0;
+        }
+        if (tuningBudget > 0) {
+            RunAutotune(tuningBudget, workDir, seed);
+            return 0;
+        }
+        if (validationRuns > 0) {
+            RunValidation(validationRuns, workDir, seed, numLanes);
+            return 0;
+        }
+        if (momentRuns > 0) {
+            RunMoments(momentRuns, workDir, seed);
+            return 0;
+        }
+        if (sensitivityRuns > 0) {
+            RunSensitivity(sensitivityRuns, workDir, seed);
+            return 0;
+        }
+        if (checkDeterministic) {
+            return CheckDeterministic(workDir) > 0 ? 1 : 0;
+        }
+        if (!kernelCompiler.empty()) {
+            return CheckKernels(kernelCompiler, workDir, seed) > 0 ? 1 : 0;
+        }
+        map<string, double> baseline;
+        if (!baselinePath.empty()) {
+            baseline = ReadBaseline(baselinePath);
+        }
+        ofstream out;
+        unsigned int numFailed = 0;
+        if (checkAllocs) {
+            cout << left << setw(28) << "case" << right << setw(12) <<
+                "steps" << setw(12) << "allocs" << endl;
+        } else {
+            out.open(outPath.c_str());
+            if (!out) {
+                throwError("unable to create '" << outPath << "'");
+            }
+            out << setprecision(6) << kCsvHeader << "\n";
+            cout << left << setw(28) << "case" << right << setw(10) <<
+                "wall_s" << setw(10) << "setup_s" <<
+                setw(14) << "events/s" << setw(12) << "leaps/s" <<
+                setw(12) << "allocs" << setw(11) << "heap_mb" <<
+                (baseline.empty() ? "" : "   vs baseline") << endl;
+        }
+
+        const unsigned int numNetworks = sizeof(kNetworks)/sizeof(kNetworks[0]);
+        const unsigned int numCases = sizeof(kCases)/sizeof(kCases[0]);
+        for (unsigned int n = 0;  n < numNetworks;  ++n) {
+            const SNetwork &net = kNetworks[n];
+            bool wanted = false;
+            for (unsigned int c = 0;  c < numCases;  ++c) {
+                wanted = wanted  ||  (kCases[c].m_Network == string(net.m_Name) &&
+                    (string(net.m_Name) + "/" +
+                     kMethodNames[kCases[c].m_Method]).find(filter) !=
+                    string::npos);
+            }
+            if (!wanted) {
+                continue;
+            }
+
+            const string modelPath = workDir + "/bench-" + net.m_Name +
+                ".clmmodel";
+            {
+                CModelFileWriter writer;
+                net.m_Build(writer, net.m_Size);
+                writer.Write(modelPath);
+            }
+            CModelFile model(modelPath);
+            const chrono::steady_clock::time_point compileStart =
+                chrono::steady_clock::now();
+            const TCompiledModelPtr compiled =
+                make_shared<const CCompiledModel>(model);
+            if (!checkAllocs) {
+                cout << net.m_Name << ": compiled in " << fixed <<
+                    setprecision(3) << chrono::duration<double>
+                    (chrono::steady_clock::now() - compileStart).count() <<
+                    " s" << endl;
+            }
+
+            for (unsigned int c = 0;  c < numCases;  ++c) {
+                const SBenchCase &bc = kCases[c];
+                const string name = string(net.m_Name) + "/" +
+                    kMethodNames[bc.m_Method];
+                if (bc.m_Network != string(net.m_Name)  ||
+                    name.find(filter) == string::npos) {
+                    continue;
+                }
+                if (checkAllocs) {
+                    if (bc.m_MaxSteps != 0) {
+                        continue; //would end in CEarlyExit, which allocates
+                    }
+                    uint64_t steps = 0;
+                    const uint64_t allocs =
+                        SteadyStateAllocs(bc, model, compiled, seed, numLanes,
+                                          steps);
+                    cout << left << setw(28) << name << right << setw(12) <<
+                        steps << setw(12) << allocs <<
+                        (allocs > 0 ? "   FAILED" : "") << endl;
+                    numFailed += allocs > 0;
+                    continue;
+                }
+                unsigned int maxSteps = bc.m_MaxSteps;
+                if (quick) {
+                    maxSteps = maxSteps == 0 ? 1000 : max(1u, maxSteps / 10);
+                }
+                SResult best;
+                for (unsigned int k = 0;  k < repeat;  ++k) {
+                    SResult r = RunCase(bc, net, model, compiled, seed,
+                                        maxSteps, profileRows, traceEvery,
+                                        workDir, pool.get(), numLanes);
+                    if (k == 0  ||  r.m_WallSeconds < best.m_WallSeconds) {
+                        best = r;
+                    }
+                }
+                WriteCsvRow(out, best);
+                out.flush();
+
+                const uint64_t leaps = best.m_Stats.m_Steps[eExplicit] +
+                    best.m_Stats.m_Steps[eImplicit];
+                cout << left << setw(28) << name << right << fixed <<
+                    setprecision(3) << setw(10) << best.m_WallSeconds <<
+                    setw(10) << best.m_SetupSeconds <<
+                    setprecision(0) << setw(14) <<
+                    best.m_Stats.m_Firings / best.m_WallSeconds <<
+                    setw(12) << leaps / best.m_WallSeconds <<
+                    setw(12) << best.m_Allocs << setprecision(1) <<
+                    setw(11) << best.m_PeakHeap / (1024. * 1024.);
+                map<string, double>::const_iterator b = baseline.find(name);
+                if (b != baseline.end()  &&  b->second > 0) {
+                    cout << setprecision(2) << setw(10) <<
+                        best.m_WallSeconds / b->second << "x";
+                }
+                cout << endl;
+                if (!best.m_ProfileReport.empty()) {
+                    cout.unsetf(ios::floatfield);
+                    cout << best.m_ProfileReport << endl;
+                }
+            }
+        }
+        if (numFailed > 0) {
+            cerr << numFailed << " case(s) allocate on the heap after "
+                "warm-up" << endl;
+            return 1;
+        }
+    } catch (exception &e) {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
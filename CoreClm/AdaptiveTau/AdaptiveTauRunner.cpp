@@ -0,0 +1,588 @@
+/*  AdaptiveTauRunner.cpp
+    --------------------------------------------------------------------------
+    Command-line runner for the stochastic solver core (stochasticeqns.h),
+    for worker nodes that run simulations without the .NET host.
+
+    Loads a binary model file (modelformat.h), optionally with compiled
+    rate kernels (modelkernels.h), runs one exact or adaptive tau leaping
+    trajectory from the model's initial state (or one given on the command
+    line) and writes the result to a binary output file.  The output is
+    written to <out>.part & renamed when complete, so a file that exists
+    under its final name is never partial.
+
+    Build (Linux & macOS; see CMakeLists.txt):
+        cmake -S . -B build && cmake --build build -j --target adaptivetau-run
+    or AdaptiveTauRunner.vcxproj on Windows.
+
+    Usage:
+        adaptivetau-run --model <file.clmmodel> --out <result.bin>
+                        [--tend <t>] [--seed <n>]
+                        [--method exact|atl|atl-implicit|atl-implicit-fd|rleap]
+                        [--exact-steps direct|rssa|pdm]
+                        [--epsilon <e>] [--delta <d>] [--max-tau <t>]
+                        [--langevin <firings>]
+                        [--max-steps <n>] [--max-wall <seconds>]
+                        [--y0 <v1,v2,...|@file>] [--set <species>=<value>]
+                        [--output trajectory|final] [--every <dt>]
+                        [--kernels <library>] [--threads <n>]
+                        [--progress <seconds>]
+    --tend defaults to 1 & --seed to 1; --method defaults to atl; rleap
+    leaps a fixed number of firings (see CStochasticEqns::SetLeapMethod).
+    --exact-steps rssa|pdm takes the exact steps (of --method exact, and
+    those ATL falls back to) by the rejection-based SSA or the
+    partial-propensity direct method rather than the direct method (see
+    CStochasticEqns::SetExactMethod).
+    --langevin takes leaps in which every transition is expected to fire at
+    least that many times as chemical Langevin steps (see
+    CStochasticEqns::SetLangevinThreshold).
+    Tau leaping parameters stored with the model (autotune.h) are used
+    unless given here.
+    --y0 replaces the initial state: one value per species, separated by
+    commas or white space, given inline or read from a text file (@file).
+    --set changes one species (by name, or 1-based index) after --y0 &
+    may be repeated.
+    --output trajectory (default) records every step, or, with --every,
+    the state at 0, dt, 2 dt, ... & tend; --output final records only
+    the state at the end of the run.  Runs that stop before tend also
+    record the state they stopped in.
+    --max-steps & --max-wall bound the whole run (0 == unlimited).
+    --progress prints simulated time & steps to stderr this often.
+    SIGINT & SIGTERM end the run early; what was simulated is written.
+
+    Output file (host byte order; SRunnerHeader below, 104 bytes):
+        char[8]   magic "ATRUN01\0"
+        uint32    number of species (n)
+        uint32    stop reason (EStopReason in stochasticeqns.h)
+        int32     0-based halting transition, -1 if none
+        uint32    flags: 1 == trajectory (else final state only),
+                  2 == points on the --every grid
+        uint64    seed
+        uint64    number of points (p)
+        double    tend requested, time reached
+        uint64    exact, explicit & implicit steps, firings,
+                  rate evaluations
+        double    wall seconds
+    followed by p points of (double t, double x[n]).
+
+    Exit status:
+        0   reached tend
+        1   error (nothing written)
+        2   bad command line
+        3   a halting transition fired
+        4   --max-steps used up
+        5   ended early (--max-wall, SIGINT, SIGTERM)
+    --------------------------------------------------------------------------
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include "modelkernels.h"
+#include "stochasticeqns.h"
+#include "threadpool.h"
+
+using namespace std;
+
+/*---------------------------------------------------------------------------*/
+// host hooks (see stochasticeqns.h)
+
+static volatile sig_atomic_t g_Interrupted = 0;
+static unsigned int g_NumWarnings = 0;
+
+bool AdaptiveTauCheckUserInterrupt(void) { return g_Interrupted != 0; }
+void AdaptiveTauWarning(const char *msg) {
+    if (g_NumWarnings++ < 10) {
+        cerr << "warning: " << msg << endl;
+    }
+}
+void AdaptiveTauTrace(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+extern "C" void OnSignal(int) { g_Interrupted = 1; }
+
+/*---------------------------------------------------------------------------*/
+namespace {
+    enum EExitStatus {
+        eExitFinalTime = 0,
+        eExitError = 1,
+        eExitUsage = 2,
+        eExitHalting = 3,
+        eExitMaxSteps = 4,
+        eExitEarly = 5
+    };
+
+    enum EMethod {
+        eMethodExact = 0,
+        eMethodATL,
+        eMethodImplicit,
+        eMethodImplicitFD,
+        eMethodRLeap
+    };
+
+    enum EOutputFlags {
+        eOutputTrajectory = 1,
+        eOutputGrid = 2
+    };
+
+    struct SRunnerHeader {
+        char m_Magic[8];
+        uint32_t m_NumStates;
+        uint32_t m_StopReason;
+        int32_t m_HaltingTransition;
+        uint32_t m_Flags;
+        uint64_t m_Seed;
+        uint64_t m_NumPoints;
+        double m_FinalTime;
+        double m_Time;
+        uint64_t m_Steps[3];
+        uint64_t m_Firings;
+        uint64_t m_RateEvaluations;
+        double m_WallSeconds;
+    };
+    static_assert(sizeof(SRunnerHeader) == 104, "output header layout");
+    const char kMagic[8] = { 'A', 'T', 'R', 'U', 'N', '0', '1', '\0' };
+
+    struct SOptions {
+        SOptions(void) : m_FinalTime(1), m_Seed(1), m_Method(eMethodATL),
+                         m_ExactMethod(eExactDirect), m_Epsilon(0), m_Delta(0), m_MaxTau(0),
+                         m_LangevinThreshold(0), m_MaxSteps(0), m_MaxWall(0), m_Trajectory(true),
+                         m_Every(0), m_NumThreads(0), m_Progress(0) {}
+        string m_ModelPath;
+        string m_OutPath;
+        string m_KernelsPath;
+        double m_FinalTime;
+        uint64_t m_Seed;
+        EMethod m_Method;
+        EExactMethod m_ExactMethod;
+        double m_Epsilon;       // 0 == solver default
+        double m_Delta;
+        double m_MaxTau;
+        double m_LangevinThreshold; // 0 == no Langevin steps
+        uint64_t m_MaxSteps;    // 0 == unlimited
+        double m_MaxWall;
+        string m_Y0;
+        vector<string> m_Sets;  // "species=value"
+        bool m_Trajectory;
+        double m_Every;
+        unsigned int m_NumThreads;
+        double m_Progress;
+    };
+
+    // POST: point (t, x[0..n-1]) appended to data
+    void AppendPoint(vector<double> &data, double t, const double *x,
+                     unsigned int n) {
+        data.push_back(t);
+        data.insert(data.end(), x, x + n);
+    }
+
+    uint64_t TotalSteps(const SRunStatistics &stats) {
+        return stats.m_Steps[eExact] + stats.m_Steps[eExplicit] +
+            stats.m_Steps[eImplicit];
+    }
+
+    // PRE : y0 as given to --y0
+    // POST: initial state replaced by its values
+    void ParseInitialState(const string &y0, vector<double> &x) {
+        string text = y0;
+        if (!text.empty()  &&  text[0] == '@') {
+            ifstream in(text.c_str() + 1);
+            if (!in) {
+                throwError("unable to read initial state '" << text.substr(1)
+                           << "'");
+            }
+            ostringstream oss;
+            oss << in.rdbuf();
+            text = oss.str();
+        }
+        replace(text.begin(), text.end(), ',', ' ');
+        istringstream iss(text);
+        vector<double> values;
+        string field;
+        while (iss >> field) {
+            char *end;
+            const double v = strtod(field.c_str(), &end);
+            if (*end != '\0') {
+                throwError("invalid initial value '" << field << "'");
+            }
+            values.push_back(v);
+        }
+        if (values.size() != x.size()) {
+            throwError("initial state has " << values.size() << " values; "
+                       "the model has " << x.size() << " species");
+        }
+        x = values;
+    }
+
+    // PRE : set as given to --set
+    // POST: that species' initial value replaced
+    void ParseSetting(const string &set, const CModelFile &model,
+                      vector<double> &x) {
+        const size_t eq = set.find('=');
+        if (eq == string::npos  ||  eq == 0) {
+            throwError("--set expects <species>=<value>, not '" << set << "'");
+        }
+        const string name = set.substr(0, eq);
+        char *end;
+        const double v = strtod(set.c_str() + eq + 1, &end);
+        if (*end != '\0'  ||  eq + 1 == set.size()) {
+            throwError("invalid value in --set '" << set << "'");
+        }
+        for (unsigned int i = 0;  i < model.NumSpecies();  ++i) {
+            if (model.HasSpeciesNames()  &&  model.SpeciesName(i) == name) {
+                x[i] = v;
+                return;
+            }
+        }
+        const unsigned long i = strtoul(name.c_str(), &end, 10);
+        if (*end != '\0'  ||  i < 1  ||  i > model.NumSpecies()) {
+            throwError("no species '" << name << "' in the model");
+        }
+        x[i - 1] = v;
+    }
+
+    bool PrintProgress(const SProgress &progress, void *) {
+        cerr << "t = " << progress.m_Time << " / " << progress.m_FinalTime <<
+            ", " << progress.m_Steps << " steps, " <<
+            progress.m_WallSeconds << " s" << endl;
+        return true;
+    }
+
+    // POST: eqns advanced to tF, within what is left of the step & wall
+    // budgets; false if the run ended before tF (see GetStopReason)
+    bool Advance(CStochasticEqns &eqns, const SOptions &opt, double tF,
+                 chrono::steady_clock::time_point start) {
+        if (opt.m_MaxSteps > 0) {
+            const uint64_t done = TotalSteps(eqns.GetStatistics());
+            if (done >= opt.m_MaxSteps) {
+                return false;
+            }
+            eqns.SetMaxSteps((unsigned int) min<uint64_t>(opt.m_MaxSteps - done,
+                                                          ~0u));
+        }
+        if (opt.m_MaxWall > 0) {
+            const double left = opt.m_MaxWall - chrono::duration<double>
+                (chrono::steady_clock::now() - start).count();
+            if (left <= 0) {
+                return false;
+            }
+            eqns.GetRunControl().SetWallClockBudget(left);
+        }
+        try {
+            if (opt.m_Method == eMethodExact) {
+                eqns.EvaluateExactUntil(tF);
+            } else {
+                eqns.EvaluateATLUntil(tF);
+            }
+        } catch (CEarlyExit &e) {
+            cerr << e.what() << endl;
+        }
+        return eqns.GetStopReason() == eStopFinalTime;
+    }
+
+    // POST: header & points written to path (by way of path.part)
+    void WriteOutput(const string &path, const SRunnerHeader &header,
+                     const vector<double> &data) {
+        const string part = path + ".part";
+        {
+            ofstream out(part.c_str(), ios::binary | ios::trunc);
+            if (!out) {
+                throwError("unable to create '" << part << "'");
+            }
+            out.write((const char *) &header, sizeof(header));
+            if (!data.empty()) {
+                out.write((const char *) &data[0], data.size() * sizeof(double));
+            }
+            out.close();
+            if (!out) {
+                throwError("unable to write '" << part << "'");
+            }
+        }
+        //replace path atomically; on failure it stays as it was
+#ifdef _WIN32
+        const bool replaced = MoveFileExA(part.c_str(), path.c_str(),
+                                          MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        const bool replaced = rename(part.c_str(), path.c_str()) == 0;
+#endif
+        if (!replaced) {
+            throwError("unable to rename '" << part << "' to '" << path <<
+                       "'");
+        }
+    }
+
+    // POST: one trajectory simulated & written; returns the exit status
+    int Run(const SOptions &opt) {
+        const chrono::steady_clock::time_point start =
+            chrono::steady_clock::now();
+        CModelFile model(opt.m_ModelPath);
+        unique_ptr<CModelKernels> kernels;
+        if (!opt.m_KernelsPath.empty()) {
+            kernels.reset(new CModelKernels(opt.m_KernelsPath, model));
+        }
+        const unsigned int n = model.NumSpecies();
+        vector<double> x0(model.InitialState(), model.InitialState() + n);
+        if (!opt.m_Y0.empty()) {
+            ParseInitialState(opt.m_Y0, x0);
+        }
+        for (unsigned int k = 0;  k < opt.m_Sets.size();  ++k) {
+            ParseSetting(opt.m_Sets[k], model, x0);
+        }
+
+        CStochasticEqns eqns(make_shared<const CCompiledModel>(model,
+                                                               kernels.get()),
+                             &x0[0]);
+        unique_ptr<CThreadPool> pool;
+        if (opt.m_NumThreads > 0) {
+            pool.reset(new CThreadPool(opt.m_NumThreads));
+            eqns.SetThreadPool(pool.get());
+        }
+        eqns.Seed(opt.m_Seed);
+        if (opt.m_Epsilon > 0) {
+            eqns.SetEpsilon(opt.m_Epsilon);
+        }
+        if (opt.m_Delta > 0) {
+            eqns.SetDelta(opt.m_Delta);
+        }
+        if (opt.m_MaxTau > 0) {
+            eqns.SetMaxTau(opt.m_MaxTau);
+        }
+        if (opt.m_Method == eMethodImplicit) {
+            eqns.SetUseJacobian(true);
+        } else if (opt.m_Method == eMethodImplicitFD) {
+            eqns.SetFiniteDifferenceJacobian(true);
+        } else if (opt.m_Method == eMethodRLeap) {
+            eqns.SetLeapMethod(eLeapR);
+        }
+        if (opt.m_ExactMethod != eExactDirect) {
+            eqns.SetExactMethod(opt.m_ExactMethod);
+        }
+        if (opt.m_LangevinThreshold > 0) {
+            eqns.SetLangevinThreshold(opt.m_LangevinThreshold);
+        }
+        if (opt.m_Progress > 0) {
+            eqns.GetRunControl().SetProgressCallback(PrintProgress, NULL, 0,
+                                                     opt.m_Progress);
+        }
+        const bool everyStep = opt.m_Trajectory  &&  opt.m_Every <= 0;
+        eqns.SetRecordTimeSeries(everyStep);
+
+        vector<double> data; //recorded points, back to back
+        bool reached = true;
+        if (opt.m_Trajectory  &&  opt.m_Every > 0) {
+            AppendPoint(data, eqns.GetTime(), eqns.GetState(), n);
+            for (uint64_t k = 1;  reached;  ++k) {
+                const double t = min(opt.m_FinalTime, k * opt.m_Every);
+                reached = Advance(eqns, opt, t, start);
+                if (reached) {
+                    AppendPoint(data, t, eqns.GetState(), n);
+                }
+                if (t >= opt.m_FinalTime) {
+                    break;
+                }
+            }
+            if (!reached) {
+                AppendPoint(data, eqns.GetTime(), eqns.GetState(), n);
+            }
+        } else {
+            reached = Advance(eqns, opt, opt.m_FinalTime, start);
+            if (everyStep) {
+                const CStochasticEqns::CTimeSeries &ts = eqns.GetTimeSeries();
+                data.reserve((size_t) ts.size() * (n + 1));
+                for (unsigned int p = 0;  p < ts.size();  ++p) {
+                    AppendPoint(data, ts[p].m_T, ts[p].m_X, n);
+                }
+            } else {
+                AppendPoint(data, eqns.GetTime(), eqns.GetState(), n);
+            }
+        }
+        EStopReason reason = eqns.GetStopReason();
+        if (!reached  &&  reason == eStopFinalTime) {
+            //a budget ran out between two grid points
+            reason = opt.m_MaxSteps > 0  &&
+                TotalSteps(eqns.GetStatistics()) >= opt.m_MaxSteps ?
+                eStopMaxSteps : eStopEarlyExit;
+        }
+
+        SRunnerHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.m_Magic, kMagic, sizeof(kMagic));
+        header.m_NumStates = n;
+        header.m_StopReason = reason;
+        header.m_HaltingTransition = eqns.GetHaltingTransition();
+        header.m_Flags = (opt.m_Trajectory ? eOutputTrajectory : 0) |
+            (opt.m_Trajectory  &&  opt.m_Every > 0 ? eOutputGrid : 0);
+        header.m_Seed = opt.m_Seed;
+        header.m_NumPoints = data.size() / (n + 1);
+        header.m_FinalTime = opt.m_FinalTime;
+        header.m_Time = eqns.GetTime();
+        const SRunStatistics &stats = eqns.GetStatistics();
+        for (unsigned int k = 0;  k < 3;  ++k) {
+            header.m_Steps[k] = stats.m_Steps[k];
+        }
+        header.m_Firings = stats.m_Firings;
+        header.m_RateEvaluations = stats.m_RateEvaluations;
+        header.m_WallSeconds = chrono::duration<double>
+            (chrono::steady_clock::now() - start).count();
+        WriteOutput(opt.m_OutPath, header, data);
+
+        switch (reason) {
+        case eStopFinalTime:
+        case eStopCriterion:
+            return eExitFinalTime;
+        case eStopHalting:
+            return eExitHalting;
+        case eStopMaxSteps:
+            return eExitMaxSteps;
+        default:
+            return eExitEarly;
+        }
+    }
+
+    void Usage(void) {
+        cerr << "usage: adaptivetau-run --model <file.clmmodel> "
+            "--out <result.bin> [--tend <t>] [--seed <n>] "
+            "[--method exact|atl|atl-implicit|atl-implicit-fd|rleap] "
+            "[--exact-steps direct|rssa|pdm] "
+            "[--epsilon <e>] [--delta <d>] [--max-tau <t>] "
+            "[--langevin <firings>] "
+            "[--max-steps <n>] [--max-wall <seconds>] "
+            "[--y0 <v1,v2,...|@file>] [--set <species>=<value>] "
+            "[--output trajectory|final] [--every <dt>] "
+            "[--kernels <library>] [--threads <n>] [--progress <seconds>]"
+            << endl;
+    }
+
+    // POST: value of a numeric option; false if it is not a number
+    bool ParseNumber(const char *arg, double &value) {
+        char *end;
+        value = strtod(arg, &end);
+        return *arg != '\0'  &&  *end == '\0';
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char **argv) {
+    SOptions opt;
+    bool ok = true;
+    for (int i = 1;  i < argc  &&  ok;  ++i) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        double v = 0;
+        if (!hasValue) {
+            ok = false;
+        } else if (arg == "--model") {
+            opt.m_ModelPath = argv[++i];
+        } else if (arg == "--out") {
+            opt.m_OutPath = argv[++i];
+        } else if (arg == "--kernels") {
+            opt.m_KernelsPath = argv[++i];
+        } else if (arg == "--y0") {
+            opt.m_Y0 = argv[++i];
+        } else if (arg == "--set") {
+            opt.m_Sets.push_back(argv[++i]);
+        } else if (arg == "--method") {
+            const string m = argv[++i];
+            if (m == "exact") {
+                opt.m_Method = eMethodExact;
+            } else if (m == "atl") {
+                opt.m_Method = eMethodATL;
+            } else if (m == "atl-implicit") {
+                opt.m_Method = eMethodImplicit;
+            } else if (m == "atl-implicit-fd") {
+                opt.m_Method = eMethodImplicitFD;
+            } else if (m == "rleap") {
+                opt.m_Method = eMethodRLeap;
+            } else {
+                ok = false;
+            }
+        } else if (arg == "--exact-steps") {
+            const string m = argv[++i];
+            if (m == "direct") {
+                opt.m_ExactMethod = eExactDirect;
+            } else if (m == "rssa") {
+                opt.m_ExactMethod = eExactRejection;
+            } else if (m == "pdm") {
+                opt.m_ExactMethod = eExactPartialPropensity;
+            } else {
+                ok = false;
+            }
+        } else if (arg == "--output") {
+            const string m = argv[++i];
+            opt.m_Trajectory = m == "trajectory";
+            ok = opt.m_Trajectory  ||  m == "final";
+        } else if (arg == "--seed") {
+            char *end;
+            opt.m_Seed = strtoull(argv[++i], &end, 10);
+            ok = *end == '\0';
+        } else if (!ParseNumber(argv[i+1], v)  ||  v < 0) {
+            ok = false;
+        } else if (arg == "--tend") {
+            opt.m_FinalTime = v;
+            ++i;
+        } else if (arg == "--epsilon") {
+            opt.m_Epsilon = v;
+            ++i;
+        } else if (arg == "--delta") {
+            opt.m_Delta = v;
+            ++i;
+        } else if (arg == "--max-tau") {
+            opt.m_MaxTau = v;
+            ++i;
+        } else if (arg == "--langevin") {
+            opt.m_LangevinThreshold = v;
+            ++i;
+        } else if (arg == "--max-steps") {
+            opt.m_MaxSteps = (uint64_t) v;
+            ++i;
+        } else if (arg == "--max-wall") {
+            opt.m_MaxWall = v;
+            ++i;
+        } else if (arg == "--every") {
+            opt.m_Every = v;
+            ++i;
+        } else if (arg == "--threads") {
+            opt.m_NumThreads = (unsigned int) v;
+            ++i;
+        } else if (arg == "--progress") {
+            opt.m_Progress = v;
+            ++i;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok  ||  opt.m_ModelPath.empty()  ||  opt.m_OutPath.empty()) {
+        Usage();
+        return eExitUsage;
+    }
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    try {
+        return Run(opt);
+    } catch (exception &e) {
+        cerr << "error: " << e.what() << endl;
+        return eExitError;
+    }
+}
@@ -21,12 +21,27 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
+    The algorithm itself lives in stochasticeqns.cpp (no R dependencies);
+    this file holds the R flavour of CStochasticEqns & the R entry points.
+
+    Random numbers: every simulation draws from its own xoshiro256**
+    generator (random.h), seeded by two unif_rand() draws from R's RNG
+    when it is set up.  set.seed() therefore still makes runs
+    reproducible, but a given seed yields different trajectories than
+    versions that drew from unif_rand/rpois directly (see NEWS).
+
     If building library outside of R package (i.e. for debugging):
-        R CMD SHLIB adaptivetau.cpp
+        R CMD SHLIB adaptivetau.cpp stochasticeqns.cpp compiledmodel.cpp \
+            modelformat.cpp modelkernels.cpp stopcriteria.cpp tracing.cpp \
+            threadpool.cpp
     --------------------------------------------------------------------------
 */
 
+
+#include <cstdarg>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <limits>
 #include <sstream>
@@ -35,36 +50,13 @@
 #include <R.h>
 #include <Rinternals.h>
 #include <R_ext/Rdynload.h>
-#include <R_ext/Lapack.h>
 #include <Rmath.h>
 
 #include "Rwrappers.h"
+#include "stochasticeqns.h"
 
 using namespace std;
 
-enum EStepType {
-    eExact = 0,
-    eExplicit,
-    eImplicit
-};
-
-const bool debug = false;
-
-class CEarlyExit : public runtime_error {
-public:
-    CEarlyExit(const string &w) : runtime_error(w) {}
-};
-
-//use below rather than R's "error" directly (which will not free memory, etc.)
-#ifdef throwError
-#undef throwError
-#endif
-#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
-#ifdef throwEarlyExit
-#undef throwEarlyExit
-#endif
-#define throwEarlyExit(e) { ostringstream s; s << e << "; results returned only up until this point"; throw CEarlyExit(s.str());}
-
 // Functions below are a hack suggested by Simon Urbanek (although
 // he "would not recommend for general use") to check if the user has
 // asked to interrupt execution.  The problem with calling
@@ -76,48 +68,78 @@ extern "C" void chkIntFn(void*) { R_CheckUserInterrupt(); }
 bool AdaptiveTauCheckUserInterrupt(void) {
     return (R_ToplevelExec(chkIntFn, NULL) == FALSE);
 }
+void AdaptiveTauWarning(const char *msg) { warning(msg); }
+void AdaptiveTauTrace(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    REvprintf(format, args);
+    va_end(args);
+}
+
+// PRE : name of an exact method: "direct", "rssa" or "pdm"
+// POST: method set; false if there is no such method
+static bool ExactMethodByName(const char *name, EExactMethod &method) {
+    if (strcmp(name, "direct") == 0) {
+        method = eExactDirect;
+    } else if (strcmp(name, "rssa") == 0) {
+        method = eExactRejection;
+    } else if (strcmp(name, "pdm") == 0) {
+        method = eExactPartialPropensity;
+    } else {
+        return false;
+    }
+    return true;
+}
 
-class CStochasticEqns {
+class CRStochasticEqns : public CStochasticEqns {
 public:
-    CStochasticEqns(SEXP initVal, SEXP nu,
-                    SEXP rateFunc, SEXP rateJacobianFunc,
-                    SEXP params, double* changeBound, SEXP maxTauFunc,
-                    SEXP detTrans, SEXP haltTrans) {
+    CRStochasticEqns(SEXP initVal, SEXP nu,
+                     SEXP rateFunc, SEXP rateJacobianFunc,
+                     SEXP params, double* changeBound, SEXP maxTauFunc,
+                     SEXP detTrans, SEXP haltTrans) {
+        m_NumProtected = 0;
+        m_RatesProtected = false;
+
         // copy initial values into new vector (keeping in SEXP vector
         // allows easy calling of R function to calculate rates)
         m_NumStates = length(initVal);
+        vector<string> varNames;
         SEXP x;
-        x = PROTECT(allocVector(REALSXP, m_NumStates));//protected until ~CStochasticEqns
+        x = x_Protect(allocVector(REALSXP, m_NumStates));
         copyVector(x, coerceVector(initVal,REALSXP));
         if (isNull(getAttrib(initVal, R_NamesSymbol))) {
-            m_VarNames = NULL;
+            m_RVarNames = NULL;
         } else {
             SEXP namesO = PROTECT(getAttrib(initVal, R_NamesSymbol));
-            m_VarNames = PROTECT(allocVector(STRSXP, length(namesO)));
-            copyVector(m_VarNames, namesO);
-            setAttrib(x, R_NamesSymbol, m_VarNames);
+            m_RVarNames = PROTECT(allocVector(STRSXP, length(namesO)));
+            copyVector(m_RVarNames, namesO);
+            setAttrib(x, R_NamesSymbol, m_RVarNames);
             UNPROTECT(2);
-            PROTECT(m_VarNames);
+            x_Protect(m_RVarNames);
+            for (int i = 0;  i < length(m_RVarNames);  ++i) {
+                varNames.push_back(CHAR(STRING_PTR(m_RVarNames)[i]));
+            }
         }
         m_X = REAL(x);
 
         // copy Nu matrix into my own sparse matrix data structure
+        vector< vector<SChange> > nuRows;
         if (isMatrix(nu)) { //old matrix data structure
             CRMatrix<int> mat(PROTECT(coerceVector(nu,INTSXP)));
-            m_Nu.resize(mat.ncol());
+            nuRows.resize(mat.ncol());
             for (int i = 0;  i < mat.nrow();  ++i) {
                 for (int j = 0;  j < mat.ncol();  ++j) {
                     if (mat(i,j) != 0) {
                         SChange s;
                         s.m_State = i; s.m_Mag = mat(i,j);
-                        m_Nu[j].push_back(s);
+                        nuRows[j].push_back(s);
                     }
                 }
             }
             UNPROTECT(1);
         } else { //list (newer, sparse data structure)
             CRList list(nu);
-            m_Nu.resize(list.size());
+            nuRows.resize(list.size());
             for (unsigned int j = 0;  j < list.size();  ++j) {
                 if (!isInteger(list[j])  &&  !isReal(list[j])) {
                     throwError("the sparse transition matrix representation "
@@ -126,133 +148,97 @@ public:
                 }
                 const CRVector<int> trans(PROTECT(coerceVector(list[j],INTSXP)));
                 UNPROTECT(1);
-                m_Nu[j].resize(trans.size());
-                for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
-                    short int state = -1;
+                nuRows[j].resize(trans.size());
+                for (unsigned int i = 0;  i < nuRows[j].size();  ++i) {
                     const char *stateStr = trans.GetName(i);
                     if (strcmp(stateStr, "") == 0) {
                         throwError("transition matrix contains values without "
                                    "a corresponding state variable.");
                     }
-                    if (m_VarNames != NULL) {
-                        for (state = 0;  state < length(m_VarNames)  &&
-                                 strcmp(CHAR(STRING_PTR(m_VarNames)[state]),
-                                        stateStr) != 0;
-                             ++state);
-                    }
-                    if (state < 0  ||  state >= (int) m_NumStates) {
-                        istringstream iss(stateStr);
-                        iss >> state;
-                        if (!iss  ||  !iss.eof()) {
-                            state = -1;
-                        } else {
-                            --state; //switch from 1-based to 0-based
-                        }
-                    }
-                    if (state < 0  ||  state >= (int) m_NumStates) {
+                    const int state = x_StateIndex(stateStr);
+                    if (state < 0) {
                         throwError("transition matrix references non-existent "
                                    "state variable '" << stateStr << "'");
                     }
-                    m_Nu[j][i].m_State = state;
-                    m_Nu[j][i].m_Mag = trans[i];
+                    nuRows[j][i].m_State = state;
+                    nuRows[j][i].m_Mag = trans[i];
                 }
             }
         }
-        m_TransCats.resize(m_Nu.size(), eNormal);
-
-        // potentially flag some transitions as "deterministic"
-        x_SetCat(detTrans, eDeterministic);
-        if (m_TransByCat[eDeterministic].size() == m_TransCats.size()) {
-            throwError("At least one transition must be stochastic (all "
-                       "transitions are currently flagged as "
-                       "deterministic).");
-        }
-
-        // potentially flag some transitions as "halting" (which are
-        // always critical)
-        x_SetCat(haltTrans, eHalting);
-        m_TransByCat[eCritical] = m_TransByCat[eHalting];
 
-        // needed for ITL
-        x_IdentifyBalancedPairs();
-        x_IdentifyRealValuedVariables();
+        // potentially flag some transitions as "deterministic" or
+        // "halting" (which are always critical)
+        x_AttachModel(make_shared<const CCompiledModel>
+                      (m_NumStates, nuRows, x_TransList(detTrans, nuRows.size()),
+                       x_TransList(haltTrans, nuRows.size()), varNames));
 
         // prepare R function for evaluation by setting up arguments
         // (current X values, parameters, current time)
         SEXP s_time;
-        s_time = PROTECT(allocVector(REALSXP, 1));//protected until ~CStochasticEqns
+        s_time = x_Protect(allocVector(REALSXP, 1));
         m_T = REAL(s_time);
-        m_RateFunc = PROTECT(lang4(rateFunc, x, params, s_time));//protected until ~CStochasticEqns
+        m_RateFunc = x_Protect(lang4(rateFunc, x, params, s_time));
         if (!rateJacobianFunc  ||  isNull(rateJacobianFunc)) {
             m_RateJacobianFunc = NULL;
         } else {
-            PROTECT(m_RateJacobianFunc = lang4(rateJacobianFunc, x,
-                                               params, s_time)); //protected until ~CStochasticEqns
+            m_RateJacobianFunc = x_Protect(lang4(rateJacobianFunc, x,
+                                                 params, s_time));
         }
         m_Rates = NULL;
 
-        //default parameters to adaptive tau leaping algorithm
-        m_Epsilon = 0.05;
-        m_Ncritical = 10;
-        m_Nstiff = 100;
-        m_ExactThreshold = 10;
-        m_Delta = 0.05;
-        m_NumExactSteps[eExact] = 100;
-        m_NumExactSteps[eExplicit] = 100;
-        m_NumExactSteps[eImplicit] = 10;
-        m_ITLConvergenceTol = 0.01;
-        m_MaxTau = numeric_limits<double>::infinity();
-        m_MaxSteps = 0; // special case 0 == no limit
-
-        //useful additional parameters
-        m_ExtraChecks = true;
-        m_VerboseTracing = 0;
-        m_RateChangeBound = changeBound;
+        x_InitDefaultParams(changeBound);
         if (!maxTauFunc  ||  isNull(maxTauFunc)) {
             m_MaxTauFunc = NULL;
         } else {
-            PROTECT(m_MaxTauFunc = lang4(maxTauFunc, x, params, s_time));//protected until ~CStochasticEqns
+            m_MaxTauFunc = x_Protect(lang4(maxTauFunc, x, params, s_time));
         }
 
-        //check initial conditions to make sure legit
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            if (m_X[i] < 0) {
-                throwError("initial value for variable " << i+1 <<
-                           " must be positive (currently " << m_X[i] << ")");
-            }
-            if (!m_RealValuedVariables[i]  &&
-                (m_X[i] - Rf_ftrunc(m_X[i]) > 1e-5)) {
-                if (m_VarNames != NULL) {
-                    throwError("initial value for variable " << i+1 <<
-                               " ('"<<CHAR(STRING_PTR(m_VarNames)[i])<<"') " <<
-                               "must be an integer (currently " << m_X[i] << ")");
-                } else {
-                    throwError("initial value for variable " << i+1 <<
-                               " must be an integer (currently " << m_X[i] << ")");
-                }
-            }
-        }
-        
+        x_CheckInitialValues();
         *m_T = 0;
         m_LastTransition = -1;
         m_PrevStepType = eExact;
-        GetRNGstate();
+        x_ReserveWorkspace();
+        x_SeedFromR();
     }
-    ~CStochasticEqns(void) {
-        int cnt = 4;
-        if (m_RateJacobianFunc != NULL) {
-            ++cnt;
-        }
-        if (m_Rates != NULL) {
-            ++cnt;
-        }
-        if (m_MaxTauFunc != NULL) {
-            ++cnt;
+    // Binary model (see CStochasticEqns); initVal may be NULL (use initial
+    // state stored in model) & changeBound may be NULL (use 1 for all).
+    CRStochasticEqns(const CModelFile &model, SEXP initVal,
+                     const double* changeBound,
+                     const CModelKernels *kernels = NULL)
+        : CStochasticEqns(model, initVal  &&  !isNull(initVal) ?
+                          REAL(coerceVector(initVal, REALSXP)) : NULL,
+                          changeBound, kernels) {
+        m_NumProtected = 0;
+        m_RatesProtected = false;
+        m_RVarNames = NULL;
+        if (!GetVarNames().empty()) {
+            m_RVarNames = x_Protect(allocVector(STRSXP, m_NumStates));
+            for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+                SET_STRING_ELT(m_RVarNames, i,
+                               mkChar(GetVarNames()[i].c_str()));
+            }
         }
-        UNPROTECT(cnt);
+        m_RateFunc = NULL;
+        m_RateJacobianFunc = NULL;
+        m_MaxTauFunc = NULL;
+        x_SeedFromR();
+    }
+    ~CRStochasticEqns(void) {
+        UNPROTECT(m_NumProtected + (m_RatesProtected ? 1 : 0));
     }
     void SetTLParams(SEXP list) {
         SEXP names = PROTECT(getAttrib(list, R_NamesSymbol));
+        unsigned int traceEvery = 1, traceCapacity = 1 << 20;
+        unsigned int threads = 0;
+        unsigned int parallelThreshold = kDefaultParallelThreshold;
+        CStopCriteria stopCriteria;
+        double stopInterval = 0;
+        bool fdJacobian = false;
+        EExactMethod exactMethod = eExactDirect;
+        double rssaFluctuation = kDefaultRSSAFluctuation;
+        double langevinThreshold = 0;
+        ELeapMethod leapMethod = eLeapTau;
+        SEXP rateDeps = R_NilValue;
         try {
             for (int i = 0;  i < length(names);  ++i) {
                 if (strcmp("epsilon", CHAR(STRING_PTR(names)[i])) == 0) {
@@ -261,21 +247,21 @@ public:
                         throwError("invalid value for parameter '" <<
                                    CHAR(STRING_PTR(names)[i]) << "'");
                     }
-                    m_Epsilon = REAL(VECTOR_ELT(list, i))[0];
+                    SetEpsilon(REAL(VECTOR_ELT(list, i))[0]);
                 } else if (strcmp("delta", CHAR(STRING_PTR(names)[i])) == 0) {
                     if (!isReal(VECTOR_ELT(list, i))  ||
                         length(VECTOR_ELT(list, i)) != 1) {
                         throwError("invalid value for parameter '" <<
                                    CHAR(STRING_PTR(names)[i]) << "'");
                     }
-                    m_Delta = REAL(VECTOR_ELT(list, i))[0];
+                    SetDelta(REAL(VECTOR_ELT(list, i))[0]);
                 } else if (strcmp("maxtau", CHAR(STRING_PTR(names)[i])) == 0) {
                     if (!isReal(VECTOR_ELT(list, i))  ||
                         length(VECTOR_ELT(list, i)) != 1) {
                         throwError("invalid value for parameter '" <<
                                    CHAR(STRING_PTR(names)[i]) << "'");
                     }
-                    m_MaxTau = REAL(VECTOR_ELT(list, i))[0];
+                    SetMaxTau(REAL(VECTOR_ELT(list, i))[0]);
                 } else if (strcmp("extraChecks",
                                   CHAR(STRING_PTR(names)[i])) == 0) {
                     if (!isLogical(VECTOR_ELT(list, i))  ||
@@ -283,7 +269,7 @@ public:
                         throwError("invalid value for parameter '" <<
                                    CHAR(STRING_PTR(names)[i]) << "'");
                     }
-                    m_ExtraChecks = LOGICAL(VECTOR_ELT(list, i))[0];
+                    SetExtraChecks(LOGICAL(VECTOR_ELT(list, i))[0]);
                 } else if (strcmp("verbose",
                                   CHAR(STRING_PTR(names)[i])) == 0) {
                     if (!isInteger(VECTOR_ELT(list, i))  ||
@@ -291,7 +277,157 @@ public:
                         throwError("invalid value for parameter '" <<
                                    CHAR(STRING_PTR(names)[i]) << "'");
                     }
-                    m_VerboseTracing = INTEGER(VECTOR_ELT(list, i))[0];
+                    SetVerboseTracing(INTEGER(VECTOR_ELT(list, i))[0]);
+                } else if (strcmp("profile",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isLogical(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    SetProfiling(LOGICAL(VECTOR_ELT(list, i))[0]);
+                } else if (strcmp("maxWallTime",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isReal(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    GetRunControl().SetWallClockBudget(
+                        REAL(VECTOR_ELT(list, i))[0]);
+                } else if (strcmp("threads",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isInteger(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1  ||
+                        INTEGER(VECTOR_ELT(list, i))[0] < 0) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    threads = INTEGER(VECTOR_ELT(list, i))[0];
+                } else if (strcmp("parallelThreshold",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isInteger(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1  ||
+                        INTEGER(VECTOR_ELT(list, i))[0] < 0) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    parallelThreshold = INTEGER(VECTOR_ELT(list, i))[0];
+                } else if (strcmp("traceFile",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isString(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    m_TraceFile = CHAR(STRING_ELT(VECTOR_ELT(list, i), 0));
+                } else if (strcmp("traceEvery",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isInteger(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1  ||
+                        INTEGER(VECTOR_ELT(list, i))[0] < 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    traceEvery = INTEGER(VECTOR_ELT(list, i))[0];
+                } else if (strcmp("traceCapacity",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isInteger(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1  ||
+                        INTEGER(VECTOR_ELT(list, i))[0] < 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    traceCapacity = INTEGER(VECTOR_ELT(list, i))[0];
+                } else if (strcmp("stop", CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isVectorList(VECTOR_ELT(list, i))) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    x_ParseStopCriteria(VECTOR_ELT(list, i), stopCriteria);
+                } else if (strcmp("stopInterval",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isReal(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1  ||
+                        REAL(VECTOR_ELT(list, i))[0] < 0) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    stopInterval = REAL(VECTOR_ELT(list, i))[0];
+                } else if (strcmp("fdJacobian",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isLogical(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    fdJacobian = LOGICAL(VECTOR_ELT(list, i))[0];
+                } else if (strcmp("rssa", CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isLogical(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    exactMethod = LOGICAL(VECTOR_ELT(list, i))[0] ?
+                        eExactRejection : eExactDirect;
+                } else if (strcmp("exactMethod",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isString(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    const char *m = CHAR(STRING_ELT(VECTOR_ELT(list, i), 0));
+                    if (!ExactMethodByName(m, exactMethod)) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) <<
+                                   "' (must be \"direct\", \"rssa\" or "
+                                   "\"pdm\")");
+                    }
+                } else if (strcmp("rssaFluctuation",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isReal(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    rssaFluctuation = REAL(VECTOR_ELT(list, i))[0];
+                } else if (strcmp("langevinThreshold",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isReal(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    langevinThreshold = REAL(VECTOR_ELT(list, i))[0];
+                } else if (strcmp("leapMethod",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isString(VECTOR_ELT(list, i))  ||
+                        length(VECTOR_ELT(list, i)) != 1) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "'");
+                    }
+                    const char *m = CHAR(STRING_ELT(VECTOR_ELT(list, i), 0));
+                    if (strcmp(m, "tau") == 0) {
+                        leapMethod = eLeapTau;
+                    } else if (strcmp(m, "r") == 0) {
+                        leapMethod = eLeapR;
+                    } else {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) <<
+                                   "' (must be \"tau\" or \"r\")");
+                    }
+                } else if (strcmp("rateDependencies",
+                                  CHAR(STRING_PTR(names)[i])) == 0) {
+                    if (!isVectorList(VECTOR_ELT(list, i))  ||
+                        (unsigned int) length(VECTOR_ELT(list, i)) !=
+                        m_Nu.size()) {
+                        throwError("invalid value for parameter '" <<
+                                   CHAR(STRING_PTR(names)[i]) << "' (must "
+                                   "be a list with one element per "
+                                   "transition)");
+                    }
+                    rateDeps = VECTOR_ELT(list, i);
                 } else {
                     warning("ignoring unknown parameter '%s'",
                             CHAR(STRING_PTR(names)[i]));
@@ -302,67 +438,155 @@ public:
             throw;
         }
         UNPROTECT(1);
-    }
-
-    void EvaluateATLUntil(double tF) {
-        unsigned int c = 0;
-        //add initial conditions to time series
-        m_TimeSeries.push_back(STimePoint(0, m_X, m_NumStates));
-        //main loop
-        while (*m_T < tF  &&  (m_MaxSteps == 0 || c < m_MaxSteps)  &&
-               (m_LastTransition < 0  ||
-                m_TransCats[m_LastTransition] != eHalting)) {
-            x_UpdateRates();
-            x_SingleStepATL(tF);
-            if (++c % 10 == 0  &&  AdaptiveTauCheckUserInterrupt()) {
-                throwEarlyExit("simulation interrupted by user at time " << *m_T
-                               << " after " << c << " time steps.");
-            }
+        if (threads > 0) {
+            m_ThreadPool.reset(new CThreadPool(threads));
+            SetThreadPool(m_ThreadPool.get(), parallelThreshold);
+        }
+        if (!isNull(rateDeps)) {
+            SetRateDependencies(x_ParseRateDependencies(rateDeps));
+        }
+        if (fdJacobian) {
+            SetFiniteDifferenceJacobian(true);
+        }
+        if (exactMethod != eExactDirect) {
+            SetRSSAFluctuation(rssaFluctuation);
+            SetExactMethod(exactMethod);
+        }
+        if (langevinThreshold != 0) {
+            SetLangevinThreshold(langevinThreshold);
+        }
+        SetLeapMethod(leapMethod);
+        if (!stopCriteria.empty()) {
+            stopCriteria.SetSampleInterval(stopInterval);
+            SetStopCriteria(stopCriteria);
+        }
+        if (!m_TraceFile.empty()) {
+            m_TraceBuffer.reset(new CTraceBuffer(traceCapacity));
+            m_TraceBuffer->SetSampling(traceEvery);
+            SetTraceBuffer(m_TraceBuffer.get());
         }
-        //save RNG state back to R (could also do in destructor, but
-        //no harm in extra calls to PutRNGstate and avoids potential
-        //problems with PROTECTing return value from GetTimeSeriesSEXP
-        PutRNGstate();
     }
-    void EvaluateExactUntil(double tF) {
-        unsigned int c = 0;
-        //add initial conditions to time series
-        m_TimeSeries.push_back(STimePoint(0, m_X, m_NumStates));
-        m_LastTransition = -1;
-        //main loop
-        while (*m_T < tF  &&  (m_MaxSteps == 0 || c < m_MaxSteps)  &&
-               (m_LastTransition < 0  ||
-                m_TransCats[m_LastTransition] != eHalting)) {
-            x_UpdateRates();
-            x_SingleStepExact(tF);
-            if (++c % 10 == 0  &&  AdaptiveTauCheckUserInterrupt()) {
-                throwEarlyExit("simulation interrupted by user at time " << *m_T
-                               << " after " << c << " time steps.");
-            }
+
+    // POST: trace written to the file given as tl.params$traceFile (if any)
+    void WriteTrace(void) const {
+        if (m_TraceBuffer) {
+            vector<const CTraceBuffer*> buffers(1, m_TraceBuffer.get());
+            WriteChromeTrace(m_TraceFile, buffers);
         }
-        //save RNG state back to R (could also do in destructor, but
-        //no harm in extra calls to PutRNGstate and avoids potential
-        //problems with PROTECTing return value from GetTimeSeriesSEXP
-        PutRNGstate();
     }
 
+    // solver statistics are attached to the dynamics matrix as the
+    // "statistics" attribute (and also returned as a list element when
+    // the result is a list)
     SEXP GetResult(void) const {
+        SEXP dynamics = PROTECT(GetTimeSeriesSEXP());
+        SEXP stats = PROTECT(GetStatisticsSEXP());
+        setAttrib(dynamics, install("statistics"), stats);
+        if (IsProfiling()) {
+            SEXP profile = PROTECT(GetProfileSEXP());
+            setAttrib(dynamics, install("profile"), profile);
+            UNPROTECT(1);
+        }
+        setAttrib(dynamics, install("stopReason"),
+                  mkString(StopReasonName(GetStopReason())));
+        if (GetStopCriterion() >= 0) {
+            setAttrib(dynamics, install("stopCriterion"),
+                      mkString(GetStopCriteria().GetName(GetStopCriterion())
+                               .c_str()));
+        }
         if (m_TransByCat[eHalting].size() == 0) {
-            return GetTimeSeriesSEXP();
+            UNPROTECT(2);
+            return dynamics;
         } else {
-            CRList res(2);
+            CRList res(3);
             PROTECT(res);
-            res.SetSEXP(0, PROTECT(GetTimeSeriesSEXP()), "dynamics");
+            res.SetSEXP(0, dynamics, "dynamics");
             CRVector<int> lastTrans(1);
-            lastTrans[0] = (m_LastTransition < 0  ||
-                            m_TransCats[m_LastTransition] != eHalting) ?
-                NA_INTEGER : m_LastTransition+1;
+            lastTrans[0] = GetHaltingTransition() < 0 ?
+                NA_INTEGER : GetHaltingTransition()+1;
             res.SetSEXP(1, lastTrans, "haltingTransition");
-            UNPROTECT(2);
+            res.SetSEXP(2, stats, "statistics");
+            UNPROTECT(3);
             return res;
         }
     }
 
+    // named list of the counters in SRunStatistics (counts as doubles, as
+    // they may exceed R's integer range)
+    SEXP GetStatisticsSEXP(void) const {
+        const SRunStatistics &st = GetStatistics();
+        const char *names[] = {"exactSteps", "explicitSteps", "implicitSteps",
+                               "firings", "tauHalvings", "newtonIterations",
+                               "itlNotConverged", "lapackFailures",
+                               "rateEvaluations", "jacobianEvaluations",
+                               "rejections", "langevinSteps", "averageTau",
+                               "seconds"};
+        const unsigned int n = sizeof(names)/sizeof(names[0]);
+        const double values[] = {
+            (double)st.m_Steps[eExact], (double)st.m_Steps[eExplicit],
+            (double)st.m_Steps[eImplicit], (double)st.m_Firings,
+            (double)st.m_TauHalvings, (double)st.m_NewtonIterations,
+            (double)st.m_ITLNotConverged, (double)st.m_LapackFailures,
+            (double)st.m_RateEvaluations, (double)st.m_JacobianEvaluations,
+            (double)st.m_Rejections, (double)st.m_LangevinSteps,
+            st.AverageTau()};
+
+        SEXP res, resNames, seconds, secondsNames;
+        PROTECT(res = allocVector(VECSXP, n));
+        PROTECT(resNames = allocVector(STRSXP, n));
+        for (unsigned int i = 0;  i < n;  ++i) {
+            SET_STRING_ELT(resNames, i, mkChar(names[i]));
+            if (i < n-1) {
+                SET_VECTOR_ELT(res, i, ScalarReal(values[i]));
+            }
+        }
+        PROTECT(seconds = allocVector(REALSXP, eNumPhases));
+        PROTECT(secondsNames = allocVector(STRSXP, eNumPhases));
+        for (unsigned int p = 0;  p < eNumPhases;  ++p) {
+            REAL(seconds)[p] = st.m_Seconds[p];
+            SET_STRING_ELT(secondsNames, p,
+                           mkChar(SRunStatistics::PhaseName(EPhase(p))));
+        }
+        setAttrib(seconds, R_NamesSymbol, secondsNames);
+        SET_VECTOR_ELT(res, n-1, seconds);
+        setAttrib(res, R_NamesSymbol, resNames);
+        UNPROTECT(4);
+        return res;
+    }
+
+    // ranked per-transition profile: list of equal-length vectors
+    // (transition, reaction, firings, critical, propensity)
+    SEXP GetProfileSEXP(void) const {
+        const vector<unsigned int> order = GetProfileRanking();
+        const STransitionProfile &prof = GetProfile();
+        SEXP res, names, trans, reaction, firings, critical, propensity;
+        PROTECT(res = allocVector(VECSXP, 5));
+        PROTECT(names = allocVector(STRSXP, 5));
+        PROTECT(trans = allocVector(INTSXP, order.size()));
+        PROTECT(reaction = allocVector(STRSXP, order.size()));
+        PROTECT(firings = allocVector(REALSXP, order.size()));
+        PROTECT(critical = allocVector(REALSXP, order.size()));
+        PROTECT(propensity = allocVector(REALSXP, order.size()));
+        for (unsigned int r = 0;  r < order.size();  ++r) {
+            const unsigned int j = order[r];
+            INTEGER(trans)[r] = j+1;
+            SET_STRING_ELT(reaction, r, mkChar(DescribeTransition(j).c_str()));
+            REAL(firings)[r] = prof.m_Firings[j];
+            REAL(critical)[r] = prof.m_Critical[j];
+            REAL(propensity)[r] = prof.m_Propensity[j];
+        }
+        const char *n[] = {"transition", "reaction", "firings", "critical",
+                           "propensity"};
+        SEXP cols[] = {trans, reaction, firings, critical, propensity};
+        for (unsigned int i = 0;  i < 5;  ++i) {
+            SET_STRING_ELT(names, i, mkChar(n[i]));
+            SET_VECTOR_ELT(res, i, cols[i]);
+        }
+        setAttrib(res, R_NamesSymbol, names);
+        UNPROTECT(7);
+        return res;
+    }
+
     SEXP GetTimeSeriesSEXP(void) const {
         SEXP res;
         PROTECT(res = allocMatrix(REALSXP, m_TimeSeries.size(), m_NumStates+1));
@@ -380,9 +604,9 @@ public:
         SET_VECTOR_ELT(dimnames, 1, colnames);
         SET_VECTOR_ELT(colnames, 0, mkChar("time"));
         for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            if (m_VarNames  &&  (unsigned int)length(m_VarNames) > i) {
+            if (m_RVarNames  &&  (unsigned int)length(m_RVarNames) > i) {
                 SET_VECTOR_ELT(colnames, i+1,
-                               STRING_PTR(m_VarNames)[i]);
+                               STRING_PTR(m_RVarNames)[i]);
             } else {
                 ostringstream oss;
                 oss << "x" << i+1;
@@ -396,80 +620,49 @@ public:
     }
 
 protected:
-    enum ETransCat {
-        eNormal = 0,
-        eCritical,
-        eDeterministic,
-        eHalting
-    };
-    typedef vector<ETransCat> TTransCats;
-    typedef vector<int> TTransList;
-    typedef vector<pair<unsigned int, unsigned int> > TBalancedPairs;
-    typedef vector<bool> TBools;
-    typedef double* TStates;
-    typedef double* TRates;
-    struct SChange {
-        short int m_State;
-        short int m_Mag;
-    };
-    typedef vector< vector<SChange> > TTransitions;
-    struct STimePoint {
-        STimePoint(double t, double *x, int n) {
-            m_T = t;
-            m_X = new double[n];
-            memcpy(m_X, x, n*sizeof(double));
-        }
-        double m_T;
-        double *m_X;
-    };
-    class CTimeSeries : public vector<STimePoint> {
-    public:
-        ~CTimeSeries(void) {
-            for (iterator i = begin();  i != end();  ++i) {
-                delete[] i->m_X; i->m_X = NULL;
-            }
-        }
-    };
-
-protected:
-    void x_IdentifyBalancedPairs(void);
-    void x_IdentifyRealValuedVariables(void);
-    void x_SetCat(SEXP trans, ETransCat cat);
-
-    void x_AdvanceDeterministic(double deltaT, bool clamp = false);
-    void x_SingleStepExact(double tf);
-    void x_SingleStepETL(double tau);
-    void x_SingleStepITL(double tau);
-    void x_SingleStepATL(double tf);
-
-    void x_UpdateRates(void) {
-        if (m_ExtraChecks) {
-            for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-                if (m_X[i] < 0) {
-                    throwError("negative variable: " << i+1 << " is " <<
-                               m_X[i] << " (check rate function "
-                               "and/or transition matrix)");
-                } else if (ISNAN(m_X[i])) {
-                    throwError("NaN variable: " << i+1 << " is " <<
-                               m_X[i] << " (check rate function "
-                               "and/or transition matrix)");
-                }
-            }
+    SEXP x_Protect(SEXP s) { //protected until ~CRStochasticEqns
+        PROTECT(s);
+        ++m_NumProtected;
+        return s;
+    }
+    // POST: own generator seeded from R's RNG, which advances by 2 draws
+    void x_SeedFromR(void) {
+        GetRNGstate();
+        uint64_t seed = (uint64_t) (unif_rand() * 4294967296.);
+        seed = (seed << 32) | (uint64_t) (unif_rand() * 4294967296.);
+        PutRNGstate();
+        Seed(seed);
+    }
+    static TTransList x_TransList(SEXP trans, unsigned int numTrans);
+    // PRE : variable name, or its 1-based number
+    // POST: 0-based index of the variable; -1 if there is none
+    int x_StateIndex(const char *name) const;
+    // PRE : list of stop criteria (see tl.params$stop)
+    // POST: criteria added to res
+    void x_ParseStopCriteria(SEXP list, CStopCriteria &res) const;
+    CStopCriteria::TWeights x_ParseWeights(SEXP weights,
+                                           const string &criterion) const;
+    // PRE : list (one element per transition) of the variables each rate
+    // depends on, by name or 1-based number
+    vector< vector<unsigned int> > x_ParseRateDependencies(SEXP list) const;
+
+    bool x_HasJacobian(void) const {
+        return m_RateJacobianFunc != NULL  ||  CStochasticEqns::x_HasJacobian();
+    }
+    bool x_HasUserMaxTau(void) const { return m_MaxTauFunc != NULL; }
+    void x_CalcRates(void) {
+        if (!m_RateFunc) {
+            CStochasticEqns::x_CalcRates();
+            return;
         }
-
-        //sigh.  Cover ourselves in case rateFunc code messes with
-        //RNGs (which really should NOT be the case -- we rely on the
-        //rate functions being deterministic!), but ran into this
-        //problem when using a Rcpp rate function (which adds
-        //arbitrary calls to Get/Put RNG).
-        PutRNGstate(); 
-
         // make sure our rates are protected!
-        if (m_Rates != NULL) { 
+        if (m_RatesProtected) {
             UNPROTECT(1);
+            m_RatesProtected = false;
             m_Rates = NULL;
         }
         SEXP res = PROTECT(eval(m_RateFunc, R_EmptyEnv));
+        m_RatesProtected = true;
         m_Rates = REAL(res);
 
         if ((unsigned int) length(res) != m_Nu.size()) {
@@ -477,21 +670,11 @@ protected:
                        << length(res) << ") is not the same as specified by "
                        "the transition matrix (" << m_Nu.size() << ")!");
         }
-        if (m_ExtraChecks) {
-            for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
-                if (ISNAN(m_Rates[j])) {
-                    throwError("invalid rate function -- rate for transition "
-                               << j+1 << " is not a number (NA/NaN)! (check "
-                               "for divison by zero or similar)");
-                }
-                if (m_Rates[j] < 0) {
-                    throwError("invalid rate function -- rate for transition "
-                               << j+1 << " is negative!");
-                }
-            }
-        }
     }
     double* x_CalcJacobian(void) {
+        if (!m_RateJacobianFunc) {
+            return CStochasticEqns::x_CalcJacobian();
+        }
         SEXP res = eval(m_RateJacobianFunc, R_EmptyEnv);
         if (!isMatrix(res)) {
             throwError("invalid Jacobian function -- should return a " <<
@@ -517,763 +700,208 @@ protected:
         return REAL(res)[0];
     }
 
-    unsigned int x_PickCritical(double prCrit) const;
-
-    double x_TauEx(void) const {
-        double tau = numeric_limits<double>::infinity();
-        vector <double> mu(m_NumStates, 0);
-        vector <double> sigma(m_NumStates, 0);
-
-        for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
-             j != m_TransByCat[eNormal].end();  ++j) {
-            for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
-                const SChange &c = m_Nu[*j][i];
-                mu[c.m_State] += c.m_Mag * m_Rates[*j];
-                sigma[c.m_State] += c.m_Mag * c.m_Mag * m_Rates[*j];
-            }
-        }
-        //cerr << "-=| mu:";
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            //cerr << "\t" << mu[i];
-            double val = max(m_Epsilon * m_X[i] / m_RateChangeBound[i],
-                             1.)/fabs(mu[i]);
-            //cerr << "/" << val;
-            if (val < tau) {
-                tau = val;
-                if (tau < 0) {
-                    throwError("tried to select tau < 0; most likely means "
-                               "your rate function generated a negative rate");
-                }
-            }
-            val = pow(max(m_Epsilon * m_X[i] / m_RateChangeBound[i],
-                          1.),2) / sigma[i];
-            if (val < tau) {
-                tau = val;
-                if (tau < 0) {
-                    throwError("tried to select tau < 0; most likely means "
-                               "your rate function generated a negative rate");
-                }
-            }
-        }
-        //cerr << endl;
-
-        return tau;
-    }
-
-    double x_TauIm(void) const {
-        if (!m_RateJacobianFunc) {
-            return 0;
-        }
-        vector<bool> equil(m_TransCats.size(), false);
-        for (TBalancedPairs::const_iterator i = m_BalancedPairs.begin();
-             i != m_BalancedPairs.end();  ++i) {
-            if (fabs(m_Rates[i->first] - m_Rates[i->second]) <=
-                m_Delta * min(m_Rates[i->first], m_Rates[i->second])) {
-                equil[i->first] = true;
-                equil[i->second] = true;
-            }
-        }
-
-        vector<double> mu(m_NumStates, 0);
-        vector<double> sigma(m_NumStates, 0);
-        for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
-             j != m_TransByCat[eNormal].end();  ++j) {
-            if (!equil[*j]) {
-                for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
-                    const SChange &c = m_Nu[*j][i];
-                    mu[c.m_State] += c.m_Mag * m_Rates[*j];
-                    sigma[c.m_State] += c.m_Mag * c.m_Mag * m_Rates[*j];
-                }
-            }
-        }
-
-        double tau = numeric_limits<double>::infinity();
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            double val = max(m_Epsilon * m_X[i] / m_RateChangeBound[i],
-                             1.)/fabs(mu[i]);
-            if (val < tau) {
-                tau = val;
-            }
-            val = pow(max(m_Epsilon * m_X[i] / m_RateChangeBound[i],
-                          1.),2) / sigma[i];
-            if (val < tau) {
-                tau = val;
-            }
-        }
-        
-        return tau;
-    }
-
 private:
-    bool m_ExtraChecks; //turns on extra checks on rates returned by
-                        //user-supplied rate function. Slower, but if
-                        //the rate function does have a bug, this will
-                        //give a more meaningful error message.
-    int m_VerboseTracing; //trace algorithm verbosely
-
-    // parameters to tau leaping algorithm
-    unsigned int m_Ncritical;
-    double m_Nstiff;
-    double m_Epsilon;
-    double m_ExactThreshold;
-    double m_Delta;
-    unsigned int m_NumExactSteps[3];
-    double m_ITLConvergenceTol;
-    double m_MaxTau;
-    unsigned int m_MaxSteps;
-
-    // time-dependent variables
-    double *m_T;    // *current* time
-    TStates m_X;    // *current* state variables
-    TRates m_Rates; // *current* rates (must be updated if m_X changes!)
-    EStepType m_PrevStepType; // type of last step
-    int m_LastTransition; // id of transition taken if critical/exact; -1 o.w.
-
-    // constant variables
-    unsigned int m_NumStates; //total number of states
-    SEXP m_VarNames;          //variable names (if any)
-    TTransitions m_Nu;        //state changes caused by transitions
-    TTransCats  m_TransCats;  //i.e. normal, deterministic, halting
-    TTransList  m_TransByCat[4];//i.e. critical, normal, deterministic, halting
-    TBalancedPairs m_BalancedPairs;
-    TBools m_RealValuedVariables;
+    SEXP m_RVarNames;        //variable names (if any)
     SEXP m_RateFunc;         //R function to calculate rates as f(m_X)
     SEXP m_RateJacobianFunc; //R function to calculate Jacobian of rates as f(m_X) [optional!]
-    double *m_RateChangeBound; //see Cao (2006) for details
     SEXP m_MaxTauFunc; //R function to calculate maximum leap given curr. state
-
-    CTimeSeries m_TimeSeries;
+    int m_NumProtected; //SEXPs protected until ~CRStochasticEqns
+    bool m_RatesProtected; //m_Rates points into a protected R vector
+    std::string m_TraceFile; //Chrome trace output (if any)
+    unique_ptr<CTraceBuffer> m_TraceBuffer;
+    unique_ptr<CThreadPool> m_ThreadPool; //tl.params$threads (if any)
 };
 
 
 /*---------------------------------------------------------------------------*/
-// PRE : m_Nu initialized
-// POST: all balanced pairs of transitions identified & saved
-void CStochasticEqns::x_IdentifyBalancedPairs(void) {
-    for (unsigned int j1 = 0;  j1 < m_Nu.size();  ++j1) {
-        for (unsigned int j2 = j1 + 1;  j2 < m_Nu.size();  ++j2) {
-            if (m_Nu[j1].size() != m_Nu[j2].size()) {
-                continue;
-            }
-            unsigned int i;
-            for (i = 0;  i < m_Nu[j1].size()  &&
-                     m_Nu[j1][i].m_State == m_Nu[j2][i].m_State  &&
-                     m_Nu[j1][i].m_Mag == -m_Nu[j2][i].m_Mag;  ++i);
-            if (i == m_Nu[j1].size()) {
-                m_BalancedPairs.push_back(TBalancedPairs::value_type(j1, j2));
-                if (debug) {
-                    cerr << "balanced pair " << j1 << " and " << j2 << endl;
-                }
-            }
-        }
-    }
-}
-
-/*---------------------------------------------------------------------------*/
-// PRE : boolean vector flagging transitions as category "cat"
-// POST: appropriate transCats set
-void CStochasticEqns::x_SetCat(SEXP trans, ETransCat cat) {
-    if (!trans  || isNull(trans)) { return; } //NULL may be passed as a flag
-    if (isLogical(trans)) {
-        CRVector<bool> logic(trans);
-        if (logic.size() > m_TransCats.size()) {
-            throwError("length of logical vector specifying deterministic or "
-                       "halting transitions is greater than the total number "
-                       "of transitions!");
-        }
-        for (unsigned int i = 0;  i < logic.size();  ++i) {
-            if (logic[i]) {
-                m_TransCats[i] = cat;
-                m_TransByCat[cat].push_back(i);
-            }
-        }
-    } else {
-        CRVector<int> w(PROTECT(coerceVector(trans, INTSXP)));
-        UNPROTECT(1);
-        for (unsigned int i = 0;  i < w.size();  ++i) {
-            if (w[i] > (int) m_TransCats.size()) {
-                throwError("one of your list(s) of transitions references a "
-                           "transition that doesn't exist (" << w[i] << ") "
-                           "when last transition is " << m_TransCats.size() <<
-                           ")")
-            }
-            m_TransCats[w[i]-1] = cat;
-            m_TransByCat[cat].push_back(w[i]-1);
-        }
-    }
-}
-
-/*---------------------------------------------------------------------------*/
-// PRE : m_Nu initialized, deterministic transition set (if any)
-// POST: all variables identified will take real values
-// (i.e. either non-integer nu or modified by a deterministic transition)
-void CStochasticEqns::x_IdentifyRealValuedVariables(void) {
-    m_RealValuedVariables.clear();
-    m_RealValuedVariables.resize(m_NumStates, false);
-
-    for (TTransList::const_iterator j = m_TransByCat[eDeterministic].begin();
-         j != m_TransByCat[eDeterministic].end();  ++j) {
-        for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
-            m_RealValuedVariables[m_Nu[*j][i].m_State] = true;
-        }
-    }
-                    
-}
-
-/*---------------------------------------------------------------------------*/
-// PRE : list of critical transitions & their total rate
-// POST: one picked according to probability
-unsigned int CStochasticEqns::x_PickCritical(double critRate) const {
-    double r = runif(0,1);
-    double d = 0;
-    TTransList::const_iterator j = m_TransByCat[eCritical].begin();
-    while (j != m_TransByCat[eCritical].end()) {
-        d += m_Rates[*j]/critRate;
-        if (d > r) {
-            break;
-        }
-        ++j;
+int CRStochasticEqns::x_StateIndex(const char *name) const {
+    int state = -1;
+    if (m_RVarNames != NULL) {
+        for (state = 0;  state < length(m_RVarNames)  &&
+                 strcmp(CHAR(STRING_PTR(m_RVarNames)[state]), name) != 0;
+             ++state);
     }
-    if (!(d >= r)) { throwError("logic error at line " << __LINE__) }
-    return *j;
-}
-
-/*---------------------------------------------------------------------------*/
-// PRE : time period to step; whether to clamp variables at 0
-// POST: all determinisitic transitions updated by the expected amount
-// (i.e. Euler method); if clamping, then negative variables set to 0.
-void CStochasticEqns::x_AdvanceDeterministic(double deltaT, bool clamp) {
-    for (TTransList::const_iterator j = m_TransByCat[eDeterministic].begin();
-         j != m_TransByCat[eDeterministic].end();  ++j) {
-        for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
-            m_X[m_Nu[*j][i].m_State] += m_Nu[*j][i].m_Mag * m_Rates[*j] *
-                deltaT;
-            //clamp at zero if specified
-            if (clamp  &&  m_X[m_Nu[*j][i].m_State] < 0) {
-                m_X[m_Nu[*j][i].m_State] = 0;
-            }
-        }
-    }
-}
-
-/*---------------------------------------------------------------------------*/
-// PRE : simulation end time; **transition rates already updated**
-// POST: id of transition taken (if none, then -1) & time series updated.
-void CStochasticEqns::x_SingleStepExact(double tf) {
-    m_LastTransition = -1;
-    double stochRate = 0;
-    double detRate = 0;
-    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
-        if (m_TransCats[j] != eDeterministic) {
-            stochRate += m_Rates[j];
+    if (state < 0  ||  state >= (int) m_NumStates) {
+        istringstream iss(name);
+        iss >> state;
+        if (!iss  ||  !iss.eof()) {
+            state = -1;
         } else {
-            detRate += m_Rates[j];
+            --state; //switch from 1-based to 0-based
         }
     }
-
-    double tau = stochRate > 0 ? rexp(1./stochRate) :
-        detRate > 0 ? 1./detRate : tf - *m_T;
-    if (stochRate == 0  ||  tau > tf - *m_T) {
-        tau = tf - *m_T; // step is off end so just advance time
-    } else {
-        double r = runif(0,1);
-        double d = 0;
-        unsigned int j = 0;
-        for (;  j < m_Nu.size()  &&  d < r;  ++j) {
-            if (m_TransCats[j] != eDeterministic) {
-                d += m_Rates[j]/stochRate;
-            }
-        }
-        if (!(d >= r)) { throwError("logic error at line " << __LINE__) }
-        --j;
-
-        //take transition "j"
-        if (m_VerboseTracing >= 1) {
-            REprintf("%f: taking transition #%i\n", *m_T, j+1);
-        }
-        for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
-            m_X[m_Nu[j][i].m_State] += m_Nu[j][i].m_Mag;
-        }
-        m_LastTransition = j;
-    }
-
-    //clamp deterministic at 0, assuming that it is unreasonable to
-    //take a smaller step then exact.
-    x_AdvanceDeterministic(tau, true);
-    *m_T += tau;
-    m_TimeSeries.push_back(STimePoint(*m_T, m_X, m_NumStates));
+    return (state < 0  ||  state >= (int) m_NumStates) ? -1 : state;
 }
 
 /*---------------------------------------------------------------------------*/
-// PRE : tau value to use for step, list of "critical" transitions
-// POST: IMPLICIT tau step taken (m_X updated if so) (or overflow
-// error thrown if tau was too big)
-// NOTE: See equation (7) in Cao et al. (2007)
-void CStochasticEqns::x_SingleStepITL(double tau) {
-    if (m_VerboseTracing >= 1) {
-        REprintf("%f: taking implicit step of tau = %f\n", *m_T, tau);
-    }
-    if (!m_RateJacobianFunc) { throwError("logic error at line " << __LINE__) }
-    double *origX = new double[m_NumStates];
-    double *origRates = new double[m_NumStates];
-    memcpy(origX, m_X, sizeof(double)*m_NumStates);
-    memcpy(origRates, m_Rates, sizeof(double)*m_NumStates);
-
-    if (debug) {
-        cerr << " origX: ";
-        for (unsigned int i =0; i < m_NumStates;  ++i) {
-            cerr << origX[i] << "\t";
-        }
-        cerr << endl;
-    }
-
-    // draw (stochastic) number of times each transition will occur
-    vector<int> numTransitions(m_Nu.size(), 0);
-    
-    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
-         j != m_TransByCat[eNormal].end();  ++j) {
-        if (m_Rates[*j]*tau > 1e8) {
-            //for high rate, use normal to approx poisson.
-            //should basically never yield negative, but just to
-            //be sure, cap at 0
-            numTransitions[*j] = max(0.,floor(rnorm(m_Rates[*j]*tau,
-                                                    sqrt(m_Rates[*j]*tau))));
+// Each stop criterion is a list with elements
+//   type         "steady" or "threshold"
+//   numerator    weights by variable (named numeric vector)
+//   denominator  as numerator (optional; 1 if absent)
+//   window, tol, absTol (optional)        for "steady"
+//   level, hold (optional)                for "threshold"
+//   name         reported as attr(, "stopCriterion") (optional)
+// e.g. list(type="threshold", numerator=c(L=1, D=-1),
+//           denominator=c(L=1, D=1), level=0.9, hold=10) stops once
+// |ee| >= 0.9 for 10 time units.
+void CRStochasticEqns::x_ParseStopCriteria(SEXP list,
+                                           CStopCriteria &res) const {
+    SEXP listNames = getAttrib(list, R_NamesSymbol);
+    for (int c = 0;  c < length(list);  ++c) {
+        SEXP crit = VECTOR_ELT(list, c);
+        if (!isVectorList(crit)) {
+            throwError("each stop criterion must be a list");
+        }
+        ostringstream defaultName;
+        if (!isNull(listNames)  &&
+            strcmp(CHAR(STRING_ELT(listNames, c)), "") != 0) {
+            defaultName << CHAR(STRING_ELT(listNames, c));
         } else {
-            numTransitions[*j] = rpois(m_Rates[*j]*tau);
-            //cerr << "nt[" << *j << "] " << numTransitions[*j] << endl;
-        }
-    }
-
-    // Calculate equation (7) terms not involving x[t+tau] and call this alpha:
-    //   alpha = x + nu.(P - tau/2 R(x))
-    // Also initialize iterative search for x[t+tau] at expectation (reset m_X)
-    double* alpha = new double[m_NumStates];
-    memcpy(alpha, m_X, sizeof(double)*m_NumStates);
-    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
-         j != m_TransByCat[eNormal].end();  ++j) {
-        for (unsigned int k = 0;  k < m_Nu[*j].size();  ++k) {
-            alpha[m_Nu[*j][k].m_State] += m_Nu[*j][k].m_Mag * 
-                (numTransitions[*j] - (tau/2)*m_Rates[*j]);
-            //reset m_X to expectation as our initial guess
-            m_X[m_Nu[*j][k].m_State] += m_Nu[*j][k].m_Mag *
-                (tau/2)*m_Rates[*j];
-        }
-    }
-    //expectations may send states negative; clamp!
-    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-        if (m_X[i] < 0) {
-            m_X[i] = 0;
-        }
-    }
-
-    if (debug) {
-        cerr << " alpha:";
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            cerr << " " << alpha[i];
-        }
-        cerr << endl;
-        cerr << "it " << 0 << " newX: ";
-        for (unsigned int i =0; i < m_NumStates;  ++i) {
-            cerr << m_X[i] << "\t";
-        }
-        cerr << endl;
-    }
-
-    //a few variables needed by LAPACK
-    int N = m_NumStates;
-    int nrhs = 1;
-    int *ipiv = new int[m_NumStates];
-    int info;
-    double *matrixA = new double[m_NumStates*m_NumStates];
-    double *matrixB = new double[m_NumStates];
-
-    
-    //Use Newton's method to solve implicit equation:
-    //  Let Y = x[t+tau]
-    //  F(Y) = Y - alpha - nu.((tau/2)*R(Y))
-    //Solve Jacobian(F(Y0)) Y1 = -F(Y0) for Y1 to iteratively approach solution
-    //This eqn expands to (I - nu.((tau/2)Jacobian(R(Y0)))) Y1 = -F(Y0) where
-    //the Jacobian of rates is supplied by the user.  The term to the
-    //left of Y1 is called matrix A by LAPACK and the term on right is
-    //matrix B.
-    //
-    //Perhaps should adjust max # of iterations..
-    bool converged = false;
-    unsigned int c = 0;
-    while (++c <= 20  &&  !converged) {
-        // Check to make sure we haven't taken too big a step --
-        // i.e. no state variables should go negative
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            if (m_X[i] < 0) {
-                delete[] origRates;
-                delete[] alpha;
-                delete[] ipiv;
-                delete[] matrixA;
-                delete[] matrixB;
-                memcpy(m_X, origX, sizeof(double)*m_NumStates);
-                delete[] origX;
-                throw overflow_error("tau too big");
-            }
-        }
-
-        // define matrix A
-        double* rateJacobian = x_CalcJacobian();
-        memset(matrixA, 0, m_NumStates*m_NumStates*sizeof(double));
-        for (TTransList::const_iterator j =
-                 m_TransByCat[eNormal].begin();
-             j != m_TransByCat[eNormal].end();  ++j) {
-            for (unsigned int k = 0;  k < m_Nu[*j].size();  ++k) {
-                for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-                    //R stores matrices column-wise
-                    //LAPACK stores matrices row-wise
-                    matrixA[i*m_NumStates + m_Nu[*j][k].m_State] +=
-                        m_Nu[*j][k].m_Mag * rateJacobian[(*j)*m_NumStates + i];
+            defaultName << "stop" << c+1;
+        }
+        string name = defaultName.str(), type;
+        SEXP numerator = R_NilValue, denominator = R_NilValue;
+        double window = 0, tol = -1, absTol = 0, level = -1, hold = 0;
+        SEXP names = getAttrib(crit, R_NamesSymbol);
+        for (int i = 0;  i < length(names);  ++i) {
+            const char *field = CHAR(STRING_ELT(names, i));
+            SEXP value = VECTOR_ELT(crit, i);
+            if (strcmp(field, "type") == 0  ||  strcmp(field, "name") == 0) {
+                if (!isString(value)  ||  length(value) != 1) {
+                    throwError("invalid '" << field << "' of stop criterion");
+                }
+                (strcmp(field, "type") == 0 ? type : name) =
+                    CHAR(STRING_ELT(value, 0));
+            } else if (strcmp(field, "numerator") == 0) {
+                numerator = value;
+            } else if (strcmp(field, "denominator") == 0) {
+                denominator = value;
+            } else {
+                double *target =
+                    strcmp(field, "window") == 0 ? &window :
+                    strcmp(field, "tol") == 0 ? &tol :
+                    strcmp(field, "absTol") == 0 ? &absTol :
+                    strcmp(field, "level") == 0 ? &level :
+                    strcmp(field, "hold") == 0 ? &hold : NULL;
+                if (!target) {
+                    throwError("unknown field '" << field << "' in stop "
+                               "criterion '" << name << "'");
+                }
+                if (!(isReal(value)  ||  isInteger(value))  ||
+                    length(value) != 1) {
+                    throwError("invalid '" << field << "' of stop criterion '"
+                               << name << "'");
                 }
+                *target = asReal(value);
             }
         }
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            for (unsigned int i2 = 0;  i2 < m_NumStates;  ++i2) {
-                matrixA[i*m_NumStates + i2] *= -tau/2;
-            }
-            matrixA[i*m_NumStates + i] += 1;
+        if (isNull(numerator)) {
+            throwError("stop criterion '" << name << "' has no numerator");
         }
-
-        // define matrix B
-        // m_X is now our proposed x[t+tau].  Note that m_X has changed
-        // even in our first iteration (initialized to expected value).
-        x_UpdateRates();
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            matrixB[i] = alpha[i] - m_X[i];
-        }
-        for (TTransList::const_iterator j =
-                 m_TransByCat[eNormal].begin();
-             j != m_TransByCat[eNormal].end();  ++j) {
-            for (unsigned int k = 0;  k < m_Nu[*j].size();  ++k) {
-                matrixB[m_Nu[*j][k].m_State] += 
-                    m_Nu[*j][k].m_Mag * (tau/2) * m_Rates[*j];
+        const CStopCriteria::TWeights num = x_ParseWeights(numerator, name);
+        const CStopCriteria::TWeights den = isNull(denominator) ?
+            CStopCriteria::TWeights() : x_ParseWeights(denominator, name);
+        if (type == "steady") {
+            if (tol < 0) {
+                throwError("steady stop criterion '" << name << "' needs a "
+                           "non-negative 'tol'");
             }
-        }
-
-
-    if (debug) {
-        cerr << "A:" << endl;
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            for (unsigned int i2 = 0;  i2 < m_NumStates;  ++i2) {
-                cerr << matrixA[i2*m_NumStates + i] << "\t";
+            res.AddSteadyState(name, num, den, window, tol, absTol);
+        } else if (type == "threshold") {
+            if (level < 0) {
+                throwError("threshold stop criterion '" << name << "' needs "
+                           "a non-negative 'level'");
             }
-            cerr << endl;
-        }
-
-        cerr << "B:" << endl;
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            cerr << matrixB[i] << "\t";
-        }
-        cerr << endl;
-
-        cerr << "a:" << endl;
-        for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
-            cerr << m_Rates[j] << "\t";
+            res.AddThreshold(name, num, den, level, hold);
+        } else {
+            throwError("stop criterion '" << name << "' must be of type "
+                       "\"steady\" or \"threshold\"");
         }
-        cerr << endl;
     }
+}
 
-        //solve linear eqn
-        F77_NAME(dgesv)(&N, &nrhs, matrixA, &N, ipiv, matrixB, &N, &info); 
-        if (info != 0) {
-            warning("warning: lapack ran into trouble solving implicit equation");
-            break;
-        }
-        //matrixB now contains solution (change in X)
-        double normDelta = 0, normX = 0;
-        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-            m_X[i] += matrixB[i];
-            normDelta += matrixB[i]*matrixB[i];
-            normX += m_X[i] * m_X[i];
-        }
-        //cerr << "\tNorms: " << normDelta << "\t" << normX << endl;
-        converged = (normDelta < normX * m_ITLConvergenceTol);
-        if (debug) {
-            /*
-            cerr << "Delta: ";
-            for (unsigned int i =0; i < m_NumStates;  ++i) {
-                cerr << matrixB[i] << "\t";
-            }
-            cerr << endl;
-            */
-            cerr << "it " << c << " newX: ";
-            for (unsigned int i =0; i < m_NumStates;  ++i) {
-                cerr << m_X[i] << "\t";
-            }
-            cerr << endl;
-            /*
-            x_UpdateRates();
-            double t[m_NumStates];
-            memcpy(t, alpha, sizeof(double)*m_NumStates);
-            for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
-                if (m_TransCats[j] == eNoncritical) {
-                    for (unsigned int k = 0;  k < m_Nu[j].size();  ++k) {
-                        t[m_Nu[j][k].m_State] +=
-                            m_Nu[j][k].m_Mag * (tau/2) * m_Rates[j];
-                    }
-                }
-            }
-            cerr << "     newX: ";
-            for (unsigned int i =0; i < m_NumStates;  ++i) {
-                cerr << t[i] << "\t";
-            }
-            cerr << endl;
-            */
-        }
-
-    } // end of iterating for Newton's method
-    if (!converged) {
-        warning("ITL solution did not converge!");
+CStopCriteria::TWeights
+CRStochasticEqns::x_ParseWeights(SEXP weights, const string &criterion) const {
+    SEXP names = getAttrib(weights, R_NamesSymbol);
+    if (!(isReal(weights)  ||  isInteger(weights))  ||  isNull(names)) {
+        throwError("weights of stop criterion '" << criterion << "' must be "
+                   "a numeric vector named by variable");
     }
-
-    //restore original rates to execute deterministic transitions
-    memcpy(m_Rates, origRates, sizeof(double)*m_NumStates);
-    x_AdvanceDeterministic(tau);
-
-    delete[] origRates;
-    delete[] alpha;
-    delete[] ipiv;
-    delete[] matrixA;
-    delete[] matrixB;
-
-    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-        if (m_X[i] < 0) {
-            memcpy(m_X, origX, sizeof(double)*m_NumStates);
-            delete[] origX;
-            throw overflow_error("tau too big");
-        }
-        if (!m_RealValuedVariables[i]) {
-            m_X[i] = floor(m_X[i] + 0.5); //i.e., round
-        }
+    CStopCriteria::TWeights res;
+    for (int i = 0;  i < length(weights);  ++i) {
+        const int state = x_StateIndex(CHAR(STRING_ELT(names, i)));
+        if (state < 0) {
+            throwError("stop criterion '" << criterion << "' references "
+                       "non-existent state variable '" <<
+                       CHAR(STRING_ELT(names, i)) << "'");
+        }
+        res.push_back(make_pair((unsigned int) state,
+                                isReal(weights) ? REAL(weights)[i] :
+                                (double) INTEGER(weights)[i]));
     }
-    delete[] origX;
-    *m_T += tau;
+    return res;
 }
 
 /*---------------------------------------------------------------------------*/
-// PRE : tau value to use for step, list of "critical" transitions
-// POST: EXPLICIT tau step taken (m_X updated if so) (or overflow
-// error thrown if tau was too big)
-void CStochasticEqns::x_SingleStepETL(double tau) {
-    if (m_VerboseTracing >= 1) {
-        REprintf("%f: taking explicit step of tau = %f\n", *m_T, tau);
-    }
-    if (m_VerboseTracing >= 2) {
-        REprintf("%f:    ", *m_T);
-    }
-    double *origX = new double[m_NumStates];
-    memcpy(origX, m_X, sizeof(double)*m_NumStates);
-    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
-         j != m_TransByCat[eNormal].end();  ++j) {
-        double k;
-        if (m_Rates[*j]*tau > 1e8) {
-            //for high rate, use normal to approx poisson.
-            //should basically never yield negative, but just to
-            //be sure, bound at 0
-            k = max(0.,floor(rnorm(m_Rates[*j]*tau, sqrt(m_Rates[*j]*tau))));
-        } else {
-            k = rpois(m_Rates[*j]*tau);
-        }
-        if (k > 0) {
-            if (m_VerboseTracing >= 2) {
-                REprintf("%fx#%i ", k, *j);
+vector< vector<unsigned int> >
+CRStochasticEqns::x_ParseRateDependencies(SEXP list) const {
+    vector< vector<unsigned int> > res(length(list));
+    for (unsigned int j = 0;  j < res.size();  ++j) {
+        SEXP deps = VECTOR_ELT(list, j);
+        for (int k = 0;  k < length(deps);  ++k) {
+            int state = -1;
+            if (isString(deps)) {
+                state = x_StateIndex(CHAR(STRING_ELT(deps, k)));
+            } else if (isInteger(deps)  ||  isReal(deps)) {
+                state = isInteger(deps) ? INTEGER(deps)[k] - 1 :
+                    (int) REAL(deps)[k] - 1;
+                if (state >= (int) m_NumStates) {
+                    state = -1;
+                }
             }
-            for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
-                m_X[m_Nu[*j][i].m_State] +=  k * m_Nu[*j][i].m_Mag;
+            if (state < 0) {
+                throwError("rateDependencies of transition " << j+1 <<
+                           " reference a non-existent state variable");
             }
+            res[j].push_back(state);
         }
     }
-    if (m_VerboseTracing >= 2) {
-        REprintf("\n");
-    }
-    x_AdvanceDeterministic(tau);
-
-    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-        if (m_X[i] < 0) {
-            memcpy(m_X, origX, sizeof(double)*m_NumStates);
-            delete[] origX;
-            throw overflow_error("tau too big");
-        }
-    }
-
-    *m_T += tau;
-    delete[] origX;
+    return res;
 }
 
 /*---------------------------------------------------------------------------*/
-// PRE : time at which to end simulation; **transition rates already updated**
-// POST: single adaptive tau leaping step taken & time series updated.
-// Implemented from Cao Y, Gillespie DT, Petzold LR. The Journal of Chemical
-// Physics (2007).
-void CStochasticEqns::x_SingleStepATL(double tf) {
-    m_LastTransition = -1;
-    EStepType stepType;
-
-    //identify "critical" transitions
-    double criticalRate = 0;
-    double noncritRate = 0;
-    {
-        for (TTransList::const_iterator j =
-                 m_TransByCat[eDeterministic].begin();
-             j != m_TransByCat[eDeterministic].end();  ++j) {
-            noncritRate += m_Rates[*j];
-        }
-        for (TTransList::const_iterator j =
-                 m_TransByCat[eHalting].begin();
-             j != m_TransByCat[eHalting].end();  ++j) {
-            criticalRate += m_Rates[*j];
+// PRE : logical vector flagging transitions, or 1-based indices of them
+// (NULL for none); number of transitions
+// POST: 0-based list of the flagged transitions
+CRStochasticEqns::TTransList CRStochasticEqns::x_TransList(SEXP trans,
+                                                           unsigned int numTrans) {
+    TTransList res;
+    if (!trans  || isNull(trans)) { return res; } //NULL may be passed as a flag
+    if (isLogical(trans)) {
+        CRVector<bool> logic(trans);
+        if (logic.size() > numTrans) {
+            throwError("length of logical vector specifying deterministic or "
+                       "halting transitions is greater than the total number "
+                       "of transitions!");
         }
-
-        //reset (lop off) all non-halting criticals
-        m_TransByCat[eCritical].resize(m_TransByCat[eHalting].size());
-        m_TransByCat[eNormal].clear();
-        for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
-            if (m_TransCats[j] != eNormal) {
-                continue;
-            }
-            unsigned int minTimes = numeric_limits<unsigned int>::max();
-            for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
-                if (m_Nu[j][i].m_Mag < 0  &&
-                    m_X[m_Nu[j][i].m_State]/abs(m_Nu[j][i].m_Mag) < minTimes) {
-                    minTimes = m_X[m_Nu[j][i].m_State]/abs(m_Nu[j][i].m_Mag);
-                }
-            }
-            if (minTimes < m_Ncritical) {
-                criticalRate += m_Rates[j];
-                m_TransByCat[eCritical].push_back(j);
-            } else {
-                noncritRate += m_Rates[j];
-                m_TransByCat[eNormal].push_back(j);
+        for (unsigned int i = 0;  i < logic.size();  ++i) {
+            if (logic[i]) {
+                res.push_back(i);
             }
         }
-    }
-
-    if (debug) {
-        cerr << "critical rate: " << criticalRate << "\t" << "noncrit rate: " << noncritRate << endl;
-    }
-    if (criticalRate + noncritRate == 0) {
-        *m_T = tf;//numeric_limits<double>::infinity();
-        m_TimeSeries.push_back(STimePoint(*m_T, m_X, m_NumStates));
-        return;
-    }
-    if (!R_finite(criticalRate + noncritRate)) {
-        throwEarlyExit("Infinite transition rate at time " << *m_T);
-    }
-
-    // calc explicit & implicit taus
-    double tau1, tau2;
-    double tauEx = x_TauEx();
-    double tauIm = x_TauIm();
-    if (debug) {
-        cerr << "tauEx: " << tauEx << "  tauIm:" << tauIm << endl;
-    }
-    if (tauEx*m_Nstiff < tauIm) {
-        stepType = eImplicit;
-        tau1 = tauIm;
     } else {
-        stepType = eExplicit;
-        tau1 = tauEx;
-    }
-    if (tau1 > tf - *m_T) { //cap at the final simulation time
-        tau1 = tf - *m_T;
-    }
-    if (tau1 > m_MaxTau) {
-        tau1 = m_MaxTauFunc ? min(tau1, x_CalcUserMaxTau()) : m_MaxTau;
-        if (debug) {
-            cerr << "maxtau: " << tau1 << " (" <<
-                (m_MaxTauFunc ? x_CalcUserMaxTau() : m_MaxTau) << ")" << endl;
-        }
-    }
-
-    bool tauTooBig;
-    do {
-        tauTooBig = false;
-        if (!(tau1 > 0)) { throwError("logic error at line " << __LINE__) }
-        if (tau1 < m_ExactThreshold / (criticalRate + noncritRate)) {
-            if (debug) {
-                cerr << "Taking exact steps.. (tau1 = " << tau1 << ")" << endl;
-            }
-            stepType = eExact;
-            for (unsigned int i = 0;
-                 i < m_NumExactSteps[m_PrevStepType]  &&  *m_T < tf;  ++i) {
-                if (i > 0) {
-                    x_UpdateRates();
-                }
-                x_SingleStepExact(tf);
-                if (m_VerboseTracing >= 2) {
-                    REprintf("%f -- ", *m_T);
-                    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-                        REprintf("%f ", m_X[i]);
-                    }
-                    REprintf("\n");
-                }
-                if (m_LastTransition >= 0  &&
-                    m_TransCats[m_LastTransition] == eHalting) {
-                    return;
-                }
-            }
-        } else {
-            try { //catch exception if tauTooBig
-                tau2 = (criticalRate == 0) ? numeric_limits<double>::infinity():
-                    rexp(1./criticalRate);
-                if (stepType == eExplicit  ||
-                    (tau1 > tau2  &&  stepType == eImplicit && tau2 <= tauEx)) {
-                    if (debug) {
-                        cerr << "going explicit w/ tau = " << min(tau1, tau2)
-                             << endl;
-                    }
-                    x_SingleStepETL(min(tau1, tau2));
-                } else {
-                    if (debug) {
-                        cerr << "going implicit w/ tau = " << tau1 << endl;
-                    }
-                    x_SingleStepITL(tau1);
-                }
-                if (tau1 > tau2) { //pick one critical transition
-                    unsigned int j = x_PickCritical(criticalRate);
-                    m_LastTransition = j;
-                    if (debug) {
-                        cerr << "hittin' the critical (" << j << ")" << endl;
-                    }
-                    if (m_VerboseTracing >= 1) {
-                        REprintf("%f:    executing critical transition #%i\n",
-                                 *m_T, j+1);
-                    }
-                    for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
-                        m_X[m_Nu[j][i].m_State] +=  m_Nu[j][i].m_Mag;
-                        if (m_X[m_Nu[j][i].m_State] < 0) {
-                            throwError("variable " << m_Nu[j][i].m_State+1 <<
-                                       " went negative after executing "
-                                       "transition " << j+1 << ".  Most likely "
-                                       "either your rate calculation or "
-                                       "transition matrix is flawed.");
-                        }
-                    }
-                }
-
-                m_TimeSeries.push_back(STimePoint(*m_T, m_X, m_NumStates));
-                if (m_VerboseTracing >= 2) {
-                    REprintf("%f -- ", *m_T);
-                    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
-                        REprintf("%f ", m_X[i]);
-                    }
-                    REprintf("\n");
-                }
-            } catch (overflow_error&) { //i.e. tauTooBig exception
-                tauTooBig = true;
-                if (m_VerboseTracing >= 1) {
-                    REprintf("%f:    tau too big; cutting in half\n", *m_T);
-                }
-                tau1 /= 2;
+        CRVector<int> w(PROTECT(coerceVector(trans, INTSXP)));
+        UNPROTECT(1);
+        for (unsigned int i = 0;  i < w.size();  ++i) {
+            if (w[i] > (int) numTrans) {
+                throwError("one of your list(s) of transitions references a "
+                           "transition that doesn't exist (" << w[i] << ") "
+                           "when last transition is " << numTrans << ")")
             }
+            res.push_back(w[i]-1);
         }
-    } while (tauTooBig);
-
-    m_PrevStepType = stepType;
+    }
+    return res;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1314,9 +942,9 @@ extern "C" {
             error("invalid maxTau function");
         }
 
-        CStochasticEqns eqns(s_x0, s_nu,
-                             s_f, s_fJacob, s_params, REAL(s_changebound),
-                             s_fMaxtau, s_deterministic, s_halting);
+        CRStochasticEqns eqns(s_x0, s_nu,
+                              s_f, s_fJacob, s_params, REAL(s_changebound),
+                              s_fMaxtau, s_deterministic, s_halting);
         if (!isNull(s_tlparams)) {
             eqns.SetTLParams(s_tlparams);
         }
@@ -1325,6 +953,7 @@ extern "C" {
         } catch (CEarlyExit &e) {
             warning(e.what());
         }
+        eqns.WriteTrace();
         return eqns.GetResult();
         } catch (exception &e) {
             error(e.what());
@@ -1351,9 +980,130 @@ extern "C" {
             error("invalid final time");
         }
 
-        CStochasticEqns eqns(s_x0, s_nu,
-                             s_f, NULL, s_params, NULL, NULL,
-                             R_NilValue, R_NilValue);
+        CRStochasticEqns eqns(s_x0, s_nu,
+                              s_f, NULL, s_params, NULL, NULL,
+                              R_NilValue, R_NilValue);
+        try {
+            eqns.EvaluateExactUntil(REAL(coerceVector(s_tf, REALSXP))[0]);
+        } catch (CEarlyExit &e) {
+            warning(e.what());
+        }
+        return eqns.GetResult();
+        } catch (exception &e) {
+            error(e.what());
+            return R_NilValue;
+        }
+    }
+
+    //-----------------------------------------------------------------------
+    // As above, but the model (transitions, mass-action rates, initial
+    // state) is read from a binary model file written by ClmGenerator.
+    // s_x0 & s_changebound may be NULL to use the defaults.  s_kernels may
+    // name a shared object compiled from generateModelKernels output.
+
+    SEXP simAdaptiveTauModel(SEXP s_model, SEXP s_x0, SEXP s_tf,
+                             SEXP s_changebound, SEXP s_tlparams,
+                             SEXP s_kernels) {
+        try {
+        if (!isString(s_model)  ||  length(s_model) != 1) {
+            error("invalid model file name");
+        }
+        if (!isNull(s_x0)  &&
+            (!isVector(s_x0)  ||  !(isReal(s_x0)  ||  isInteger(s_x0)))) {
+            error("invalid vector of initial values");
+        }
+        if (!(isReal(s_tf)  ||  isInteger(s_tf))  ||  length(s_tf) != 1) {
+            error("invalid final time");
+        }
+        if (!isNull(s_changebound)  &&
+            (!isVector(s_changebound)  ||  !isReal(s_changebound))) {
+            error("invalid relratechange");
+        }
+        if (!isNull(s_tlparams)  &&  !isVector(s_tlparams)) {
+            error("tl.params must be a list");
+        }
+        if (!isNull(s_kernels)  &&
+            (!isString(s_kernels)  ||  length(s_kernels) != 1)) {
+            error("invalid kernels file name");
+        }
+
+        CModelFile model(CHAR(STRING_ELT(s_model, 0)));
+        if (!isNull(s_x0)  &&
+            (unsigned int) length(s_x0) != model.NumSpecies()) {
+            throwError("model has " << model.NumSpecies() << " variables but " <<
+                       length(s_x0) << " initial values were given");
+        }
+        if (!isNull(s_changebound)  &&
+            (unsigned int) length(s_changebound) != model.NumSpecies()) {
+            throwError("invalid relratechange (model has " <<
+                       model.NumSpecies() << " variables)");
+        }
+        unique_ptr<CModelKernels> kernels;
+        if (!isNull(s_kernels)) {
+            kernels.reset(new CModelKernels(CHAR(STRING_ELT(s_kernels, 0)),
+                                            model));
+        }
+        CRStochasticEqns eqns(model, s_x0, isNull(s_changebound) ? NULL :
+                              REAL(s_changebound), kernels.get());
+        if (!isNull(s_tlparams)) {
+            eqns.SetTLParams(s_tlparams);
+        }
+        try {
+            eqns.EvaluateATLUntil(REAL(coerceVector(s_tf, REALSXP))[0]);
+        } catch (CEarlyExit &e) {
+            warning(e.what());
+        }
+        eqns.WriteTrace();
+        return eqns.GetResult();
+        } catch (exception &e) {
+            error(e.what());
+            return R_NilValue;
+        }
+    }
+
+    //-----------------------------------------------------------------------
+    // Exact SSA of a binary model; method NULL == "direct", or "rssa" /
+    // "pdm" (see CStochasticEqns::SetExactMethod).
+
+    SEXP simExactModel(SEXP s_model, SEXP s_x0, SEXP s_tf, SEXP s_kernels,
+                       SEXP s_method) {
+        try {
+        if (!isString(s_model)  ||  length(s_model) != 1) {
+            error("invalid model file name");
+        }
+        if (!isNull(s_x0)  &&
+            (!isVector(s_x0)  ||  !(isReal(s_x0)  ||  isInteger(s_x0)))) {
+            error("invalid vector of initial values");
+        }
+        if (!(isReal(s_tf)  ||  isInteger(s_tf))  ||  length(s_tf) != 1) {
+            error("invalid final time");
+        }
+        if (!isNull(s_kernels)  &&
+            (!isString(s_kernels)  ||  length(s_kernels) != 1)) {
+            error("invalid kernels file name");
+        }
+        EExactMethod method = eExactDirect;
+        if (!isNull(s_method)  &&
+            (!isString(s_method)  ||  length(s_method) != 1  ||
+             !ExactMethodByName(CHAR(STRING_ELT(s_method, 0)), method))) {
+            error("invalid method (must be \"direct\", \"rssa\" or \"pdm\")");
+        }
+
+        CModelFile model(CHAR(STRING_ELT(s_model, 0)));
+        if (!isNull(s_x0)  &&
+            (unsigned int) length(s_x0) != model.NumSpecies()) {
+            throwError("model has " << model.NumSpecies() << " variables but " <<
+                       length(s_x0) << " initial values were given");
+        }
+        unique_ptr<CModelKernels> kernels;
+        if (!isNull(s_kernels)) {
+            kernels.reset(new CModelKernels(CHAR(STRING_ELT(s_kernels, 0)),
+                                            model));
+        }
+        CRStochasticEqns eqns(model, s_x0, NULL, kernels.get());
+        if (method != eExactDirect) {
+            eqns.SetExactMethod(method);
+        }
         try {
             eqns.EvaluateExactUntil(REAL(coerceVector(s_tf, REALSXP))[0]);
         } catch (CEarlyExit &e) {
@@ -1366,9 +1116,40 @@ extern "C" {
         }
     }
 
+    //-----------------------------------------------------------------------
+    // Writes C++ source for kernels specialized to the given binary model
+    // (see modelkernels.h); compile it into a shared object and pass that
+    // to simAdaptiveTauModel / simExactModel.
+
+    SEXP generateModelKernels(SEXP s_model, SEXP s_file) {
+        try {
+        if (!isString(s_model)  ||  length(s_model) != 1) {
+            error("invalid model file name");
+        }
+        if (!isString(s_file)  ||  length(s_file) != 1) {
+            error("invalid output file name");
+        }
+
+        CModelFile model(CHAR(STRING_ELT(s_model, 0)));
+        ofstream out(CHAR(STRING_ELT(s_file, 0)));
+        if (!out) {
+            throwError("unable to create '" << CHAR(STRING_ELT(s_file, 0)) <<
+                       "'");
+        }
+        WriteModelKernels(model, out);
+        return R_NilValue;
+        } catch (exception &e) {
+            error(e.what());
+            return R_NilValue;
+        }
+    }
+
     const R_CallMethodDef callMethods[] = {
 	{"simAdaptiveTau", (DL_FUNC)&simAdaptiveTau, 11},
 	{"simExact", (DL_FUNC)&simExact, 5},
+	{"simAdaptiveTauModel", (DL_FUNC)&simAdaptiveTauModel, 6},
+	{"simExactModel", (DL_FUNC)&simExactModel, 5},
+	{"generateModelKernels", (DL_FUNC)&generateModelKernels, 2},
 	{NULL, NULL, 0}
     };
     void R_init_adaptivetau(DllInfo *dll) {
@@ -1376,4 +1157,4 @@ extern "C" {
 	R_useDynamicSymbols(dll, FALSE);
     }
 
-}
+}
\ No newline at end of file
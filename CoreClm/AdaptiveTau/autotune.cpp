@@ -0,0 +1,287 @@
+/*  autotune.cpp
+    --------------------------------------------------------------------------
+    Automatic choice of tau leaping parameters (see autotune.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "autotune.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+const double CTauLeapingTuner::kMinGain = 1.05;
+
+namespace {
+    double& Epsilon(STauLeapingParams &p) { return p.m_Epsilon; }
+    double& Ncritical(STauLeapingParams &p) { return p.m_Ncritical; }
+    double& ExactThreshold(STauLeapingParams &p) { return p.m_ExactThreshold; }
+    double& ExactAfterExact(STauLeapingParams &p) {
+        return p.m_NumExactSteps[eExact];
+    }
+    double& ExactAfterExplicit(STauLeapingParams &p) {
+        return p.m_NumExactSteps[eExplicit];
+    }
+    double& ExactAfterImplicit(STauLeapingParams &p) {
+        return p.m_NumExactSteps[eImplicit];
+    }
+    double& Nstiff(STauLeapingParams &p) { return p.m_Nstiff; }
+    double& ITLConvergenceTol(STauLeapingParams &p) {
+        return p.m_ITLConvergenceTol;
+    }
+
+    bool SameParams(const STauLeapingParams &a, const STauLeapingParams &b) {
+        return memcmp(&a, &b, sizeof(a)) == 0;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+CTauLeapingTuner::CTauLeapingTuner(const TCompiledModelPtr &compiled,
+                                   const double *initVal)
+    : m_Compiled(compiled), m_PilotTime(0), m_PilotRuns(200), m_Budget(0.1),
+      m_UseJacobian(false), m_FDJacobian(false), m_MaxPasses(3), m_Seed(1),
+      m_Control(NULL) {
+    if (!compiled->Model()) {
+        throwError("tuning needs a compiled binary model");
+    }
+    const double *x0 = initVal ? initVal : compiled->Model()->InitialState();
+    m_InitVal.assign(x0, x0 + compiled->NumStates());
+}
+
+vector<CTauLeapingTuner::SDimension> CTauLeapingTuner::x_Dimensions(void) const {
+    static const double epsilons[] =
+        { 0.01, 0.02, 0.03, 0.05, 0.08, 0.12, 0.2, 0.3 };
+    static const double thresholds[] = { 2, 5, 10, 20, 50 };
+    static const double exactSteps[] = { 10, 30, 100, 300 };
+    static const double implicitSteps[] = { 3, 10, 30 };
+    static const double stiffness[] = { 10, 30, 100, 300, 1000 };
+    static const double tolerances[] = { 0.001, 0.01, 0.1 };
+
+    vector<SDimension> res;
+    SDimension d;
+    d.m_Ref = Epsilon;
+    d.m_Values.assign(epsilons, epsilons + sizeof(epsilons)/sizeof(double));
+    res.push_back(d);
+    d.m_Values.assign(thresholds, thresholds + sizeof(thresholds)/sizeof(double));
+    d.m_Ref = Ncritical;
+    res.push_back(d);
+    d.m_Ref = ExactThreshold;
+    res.push_back(d);
+    d.m_Values.assign(exactSteps, exactSteps + sizeof(exactSteps)/sizeof(double));
+    d.m_Ref = ExactAfterExact;
+    res.push_back(d);
+    d.m_Ref = ExactAfterExplicit;
+    res.push_back(d);
+    if (m_UseJacobian  ||  m_FDJacobian) {
+        d.m_Values.assign(stiffness, stiffness + sizeof(stiffness)/sizeof(double));
+        d.m_Ref = Nstiff;
+        res.push_back(d);
+        d.m_Values.assign(implicitSteps, implicitSteps +
+                          sizeof(implicitSteps)/sizeof(double));
+        d.m_Ref = ExactAfterImplicit;
+        res.push_back(d);
+        d.m_Values.assign(tolerances, tolerances + sizeof(tolerances)/sizeof(double));
+        d.m_Ref = ITLConvergenceTol;
+        res.push_back(d);
+    }
+    return res;
+}
+
+/*---------------------------------------------------------------------------*/
+void CTauLeapingTuner::x_Configure(CStochasticEqns &eqns) const {
+    eqns.SetRecordTimeSeries(false);
+    if (m_Control) {
+        eqns.SetRunControl(m_Control);
+    }
+    if (m_UseJacobian) {
+        eqns.SetUseJacobian(true);
+    } else if (m_FDJacobian) {
+        eqns.SetFiniteDifferenceJacobian(true);
+    }
+}
+
+double CTauLeapingTuner::x_Pilots(CStochasticEqns &eqns, bool exact,
+                                  uint64_t seed, vector<double> &finals) const {
+    const unsigned int n = m_Compiled->NumStates();
+    finals.resize((size_t) m_PilotRuns * n);
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (unsigned int r = 0;  r < m_PilotRuns;  ++r) {
+        eqns.SetState(0, &m_InitVal[0]);
+        eqns.Seed(seed + r);
+        if (exact) {
+            eqns.EvaluateExactUntil(m_PilotTime);
+        } else {
+            eqns.EvaluateATLUntil(m_PilotTime);
+        }
+        copy(eqns.GetState(), eqns.GetState() + n, &finals[(size_t) r * n]);
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void CTauLeapingTuner::x_Reference(STuningResult &res) {
+    const unsigned int n = m_Compiled->NumStates();
+    CStochasticEqns eqns(m_Compiled, &m_InitVal[0]);
+    x_Configure(eqns);
+    vector<double> finals;
+    //seeds of the reference differ from those of the candidates
+    const double wall = x_Pilots(eqns, true, m_Seed + m_PilotRuns, finals);
+    res.m_ExactThroughput = m_PilotTime * m_PilotRuns / max(wall, 1e-9);
+
+    m_RefMean.assign(m_Measured.size(), 0);
+    m_RefSd.assign(m_Measured.size(), 0);
+    m_RefKurtosis.assign(m_Measured.size(), 3);
+    for (unsigned int k = 0;  k < m_Measured.size();  ++k) {
+        double sum = 0;
+        for (unsigned int r = 0;  r < m_PilotRuns;  ++r) {
+            sum += finals[(size_t) r * n + m_Measured[k]];
+        }
+        const double mean = sum / m_PilotRuns;
+        double m2 = 0, m4 = 0;
+        for (unsigned int r = 0;  r < m_PilotRuns;  ++r) {
+            const double d = finals[(size_t) r * n + m_Measured[k]] - mean;
+            m2 += d * d;
+            m4 += d * d * d * d;
+        }
+        m_RefMean[k] = mean;
+        m_RefSd[k] = sqrt(m2 / (m_PilotRuns - 1));
+        if (m2 > 0) {
+            m_RefKurtosis[k] = m4 * m_PilotRuns / (m2 * m2);
+        }
+    }
+}
+
+const STuningTrial& CTauLeapingTuner::x_Try(const STauLeapingParams &params,
+                                            STuningResult &res) {
+    for (unsigned int k = 0;  k < res.m_Trials.size();  ++k) {
+        if (SameParams(res.m_Trials[k].m_Params, params)) {
+            return res.m_Trials[k];
+        }
+    }
+    const unsigned int n = m_Compiled->NumStates();
+    CStochasticEqns eqns(m_Compiled, &m_InitVal[0]);
+    x_Configure(eqns);
+    eqns.SetTauLeapingParams(params);
+    vector<double> finals;
+    const double wall = x_Pilots(eqns, false, m_Seed, finals);
+
+    //mean square standardized error, less its expectation from sampling
+    //noise alone: var of a mean is sd^2 / N, of an sd about
+    //(kurtosis - 1) sd^2 / 4N (the exact runs' kurtosis for both, as the
+    //distributions are the same if the candidate is faithful)
+    const double runs = m_PilotRuns;
+    double sumSq = 0, nullVar = 0;
+    for (unsigned int k = 0;  k < m_Measured.size();  ++k) {
+        double sum = 0, sumSqV = 0;
+        for (unsigned int r = 0;  r < m_PilotRuns;  ++r) {
+            const double v = finals[(size_t) r * n + m_Measured[k]];
+            sum += v;
+            sumSqV += v * v;
+        }
+        const double mean = sum / runs;
+        const double sd = sqrt(max(0., (sumSqV - sum * mean) / (runs - 1)));
+        if (m_RefSd[k] > 0) {
+            const double ratio = sd / m_RefSd[k];
+            const double bias = (mean - m_RefMean[k]) / m_RefSd[k];
+            const double spread = ratio - 1;
+            const double noiseBias = (1 + ratio * ratio) / runs;
+            const double noiseSpread = (m_RefKurtosis[k] - 1) *
+                (1 + ratio * ratio) / (4 * runs);
+            sumSq += bias * bias + spread * spread - noiseBias - noiseSpread;
+            //each square is about noise * chi^2(1), of variance 2 noise^2
+            nullVar += 2 * (noiseBias * noiseBias + noiseSpread * noiseSpread);
+        } else {
+            const double bias = (mean - m_RefMean[k]) /
+                max(1., fabs(m_RefMean[k]));
+            sumSq += bias * bias;
+        }
+    }
+
+    STuningTrial t;
+    t.m_Params = params;
+    t.m_Throughput = m_PilotTime * m_PilotRuns / max(wall, 1e-9);
+    t.m_Error = sqrt(max(0., sumSq / m_Measured.size()));
+    t.m_Resolution = sqrt(2 * sqrt(nullVar) / m_Measured.size());
+    t.m_WithinBudget = t.m_Error <= max(m_Budget, t.m_Resolution);
+    res.m_Trials.push_back(t);
+    return res.m_Trials.back();
+}
+
+bool CTauLeapingTuner::x_Better(const STuningTrial &a,
+                                const STuningTrial &b) const {
+    if (a.m_WithinBudget != b.m_WithinBudget) {
+        return a.m_WithinBudget;
+    }
+    return a.m_WithinBudget ? a.m_Throughput > b.m_Throughput * kMinGain :
+        a.m_Error < b.m_Error;
+}
+
+/*---------------------------------------------------------------------------*/
+STuningResult CTauLeapingTuner::Tune(void) {
+    if (!(m_PilotTime > 0)) {
+        throwError("tuning needs a positive pilot time (see SetPilotTime)");
+    }
+    if (m_PilotRuns < 2) {
+        throwError("tuning needs at least 2 pilot runs");
+    }
+    const unsigned int n = m_Compiled->NumStates();
+    m_Measured = m_Species;
+    if (m_Measured.empty()) {
+        for (unsigned int i = 0;  i < n;  ++i) {
+            m_Measured.push_back(i);
+        }
+    }
+    for (unsigned int k = 0;  k < m_Measured.size();  ++k) {
+        if (m_Measured[k] >= n) {
+            throwError("species " << m_Measured[k]+1 << " does not exist");
+        }
+    }
+
+    STuningResult res;
+    x_Reference(res);
+    STauLeapingParams current;
+    {
+        CStochasticEqns eqns(m_Compiled, &m_InitVal[0]);
+        current = eqns.GetTauLeapingParams();
+    }
+    STuningTrial best = x_Try(current, res);
+    res.m_StartThroughput = best.m_Throughput;
+    res.m_StartError = best.m_Error;
+
+    const vector<SDimension> dims = x_Dimensions();
+    for (unsigned int pass = 0;  pass < m_MaxPasses;  ++pass) {
+        bool changed = false;
+        for (unsigned int d = 0;  d < dims.size();  ++d) {
+            for (unsigned int v = 0;  v < dims[d].m_Values.size();  ++v) {
+                STauLeapingParams cand = current;
+                dims[d].m_Ref(cand) = dims[d].m_Values[v];
+                const STuningTrial &t = x_Try(cand, res);
+                if (x_Better(t, best)) {
+                    best = t;
+                }
+            }
+            if (!SameParams(best.m_Params, current)) {
+                current = best.m_Params;
+                changed = true;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+    }
+
+    res.m_Params = best.m_Params;
+    res.m_Throughput = best.m_Throughput;
+    res.m_Error = best.m_Error;
+    res.m_WithinBudget = best.m_WithinBudget;
+    return res;
+}
@@ -0,0 +1,143 @@
+/*  autotune.h
+    --------------------------------------------------------------------------
+    Automatic choice of tau leaping parameters for one model.
+
+    CTauLeapingTuner runs short pilot simulations of a binary model to a
+    pilot time tP: a set of exact runs once, as the reference, and for
+    each candidate parameter set the same number of ATL runs, with the
+    same seeds for every candidate (common random numbers, so candidates
+    differ by their parameters rather than their luck).  Per candidate it
+    measures
+        throughput  simulated time per wall second of the ATL runs;
+        error       the accuracy proxy: root mean square, over species,
+                    of the bias of the mean & of the standard deviation
+                    of the state at tP, both in units of the exact
+                    standard deviation, less the part expected from
+                    sampling noise alone (so that a faithful candidate
+                    scores about 0 whatever the number of runs).
+    Species that do not vary in the exact runs are scaled by
+    max(1, |exact mean|) instead, without a noise correction.  With N
+    pilot runs the proxy cannot tell errors below about (8 / N)^(1/2) /
+    species^(1/4) from noise (the trial's resolution); a candidate is
+    within budget if its error is below the budget or the resolution, so
+    budgets below the resolution need more pilot runs, not more passes.
+
+    The search is coordinate-wise: epsilon first (it matters most), then
+    each other parameter in turn over a small grid, keeping the best
+    candidate -- the fastest within the error budget, or, while none is,
+    the most accurate -- and repeating until a pass changes nothing.  A
+    faster candidate must beat the current one by kMinGain to replace
+    it, so that wall-clock noise does not decide.  Implicit-step
+    parameters are only tuned if SetUseJacobian or
+    SetFiniteDifferenceJacobian is on, as in the runs to be tuned for.
+
+    The result is applied with CStochasticEqns::SetTauLeapingParams, or
+    stored with the model file by SaveTauLeapingParams (modelformat.h),
+    after which every CStochasticEqns made from that file starts with it.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_AUTOTUNE_H
+#define ADAPTIVETAU_AUTOTUNE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "compiledmodel.h"
+#include "stochasticeqns.h"
+
+// one candidate evaluated by CTauLeapingTuner
+struct STuningTrial {
+    STauLeapingParams m_Params;
+    double m_Throughput;   // simulated time per wall second
+    double m_Error;        // accuracy proxy (see above)
+    double m_Resolution;   // error that noise alone reaches (2 sd)
+    bool m_WithinBudget;   // error below budget or resolution
+};
+
+// result of CTauLeapingTuner::Tune
+struct STuningResult {
+    STauLeapingParams m_Params;  // chosen
+    double m_Throughput;
+    double m_Error;
+    bool m_WithinBudget;         // false if no candidate was
+    double m_StartThroughput;    // of the parameters the search began with
+    double m_StartError;
+    double m_ExactThroughput;    // of the exact reference runs
+    std::vector<STuningTrial> m_Trials;
+};
+
+class CTauLeapingTuner {
+public:
+    // a faster candidate must be this much faster to be preferred
+    static const double kMinGain;
+
+    // PRE : compiled binary model; initVal NULL == model's initial state.
+    // The search begins at the parameters a CStochasticEqns starts with
+    // (the defaults, or those stored with the model).
+    CTauLeapingTuner(const TCompiledModelPtr &compiled,
+                     const double *initVal = NULL);
+
+    // simulated time of each pilot run (required)
+    void SetPilotTime(double t) { m_PilotTime = t; }
+    // pilot runs per candidate & of the exact reference (default 200)
+    void SetPilotRuns(unsigned int n) { m_PilotRuns = n; }
+    // largest accepted error (default 0.1)
+    void SetErrorBudget(double budget) { m_Budget = budget; }
+    // species the error is measured on (0-based; empty == all)
+    void SetSpecies(const std::vector<unsigned int> &species) {
+        m_Species = species;
+    }
+    // as CStochasticEqns; also tunes the implicit-step parameters
+    void SetUseJacobian(bool useJacobian) { m_UseJacobian = useJacobian; }
+    void SetFiniteDifferenceJacobian(bool fdJacobian) { m_FDJacobian = fdJacobian; }
+    void SetMaxPasses(unsigned int n) { m_MaxPasses = n; }
+    void Seed(uint64_t seed) { m_Seed = seed; }
+    // cancellation only; NULL for none.  Must outlive Tune.
+    void SetRunControl(CRunControl *control) { m_Control = control; }
+
+    // POST: parameters searched as described above; CEarlyExit if
+    // cancelled
+    STuningResult Tune(void);
+
+private:
+    // a tuned parameter: accessor & the values tried
+    typedef double& (*TParamRef)(STauLeapingParams &params);
+    struct SDimension {
+        TParamRef m_Ref;
+        std::vector<double> m_Values;
+    };
+
+    // POST: eqns set up for a pilot (implicit steps as configured)
+    void x_Configure(CStochasticEqns &eqns) const;
+    // POST: final states of the pilot runs (seeds seed, seed + 1, ...)
+    // into finals (run by species); returns wall seconds
+    double x_Pilots(CStochasticEqns &eqns, bool exact, uint64_t seed,
+                    std::vector<double> &finals) const;
+    // POST: exact reference mean & sd per species, exact throughput
+    void x_Reference(STuningResult &res);
+    // POST: candidate evaluated (or found among the trials so far)
+    const STuningTrial& x_Try(const STauLeapingParams &params,
+                              STuningResult &res);
+    bool x_Better(const STuningTrial &a, const STuningTrial &b) const;
+    std::vector<SDimension> x_Dimensions(void) const;
+
+    TCompiledModelPtr m_Compiled;
+    std::vector<double> m_InitVal;
+    double m_PilotTime;
+    unsigned int m_PilotRuns;
+    double m_Budget;
+    std::vector<unsigned int> m_Species;
+    bool m_UseJacobian;
+    bool m_FDJacobian;
+    unsigned int m_MaxPasses;
+    uint64_t m_Seed;
+    CRunControl *m_Control;
+
+    std::vector<unsigned int> m_Measured; // species of this Tune
+    std::vector<double> m_RefMean;  // by measured species
+    std::vector<double> m_RefSd;
+    std::vector<double> m_RefKurtosis;
+};
+
+#endif //ADAPTIVETAU_AUTOTUNE_H
@@ -0,0 +1,468 @@
+/*  batcheqns.cpp
+    --------------------------------------------------------------------------
+    Lockstep multi-trajectory mode (see batcheqns.h).
+
+    The loops over lanes are kept free of branches & calls (selects instead
+    of ifs, raw pointers into distinct vectors, the lane count as the trip
+    count) so that they auto-vectorize at -O3 (/O2 on MSVC); there are no
+    intrinsics, so the code builds everywhere the rest of the core does.
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "batcheqns.h"
+
+using namespace std;
+
+/*---------------------------------------------------------------------------*/
+CBatchStochasticEqns::CBatchStochasticEqns(const CModelFile &model,
+                                           unsigned int numLanes,
+                                           const double *initVal,
+                                           const double *changeBound) {
+    if (numLanes == 0) {
+        throwError("need at least one lane");
+    }
+    m_Model = &model;
+    m_NumStates = model.NumSpecies();
+    m_NumTrans = model.NumTransitions();
+    m_NumLanes = numLanes;
+    m_Nu = model.Changes(); //view into mapping, nothing copied
+    m_IsHalting.resize(m_NumTrans, 0);
+    for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+        if (model.TransitionFlags(j) & eTransDeterministic) {
+            throwError("transition " << j+1 << " is deterministic, which "
+                       "the batch (lockstep) mode does not support");
+        }
+        m_IsHalting[j] = (model.TransitionFlags(j) & eTransHalting) != 0;
+    }
+    m_RateChangeBound.assign(m_NumStates, 1);
+    if (changeBound) {
+        m_RateChangeBound.assign(changeBound, changeBound + m_NumStates);
+    }
+
+    //defaults as in CStochasticEqns::x_InitDefaultParams
+    m_Epsilon = 0.05;
+    m_Ncritical = 10;
+    m_ExactThreshold = 10;
+    m_NumExactSteps = 100;
+    m_MaxTau = numeric_limits<double>::infinity();
+    m_MaxSteps = 0;
+    m_Control = NULL;
+
+    const unsigned int K = m_NumLanes;
+    const double *x0 = initVal ? initVal : model.InitialState();
+    m_X.resize(m_NumStates * K);
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        if (x0[i] < 0) {
+            throwError("initial value for variable " << i+1 <<
+                       " must be non-negative");
+        }
+        fill(m_X.begin() + i*K, m_X.begin() + (i+1)*K, x0[i]);
+    }
+    m_PrevX.resize(m_X.size());
+    m_Mu.resize(m_X.size());
+    m_Sigma.resize(m_X.size());
+    m_Rates.resize(m_NumTrans * K);
+    m_Critical.resize(m_Rates.size());
+    m_Firings.resize(m_Rates.size());
+    m_T.assign(K, 0);
+    m_Tau.assign(K, 0);
+    m_TauCap.assign(K, numeric_limits<double>::infinity());
+    m_CritRate.assign(K, 0);
+    m_NoncritRate.assign(K, 0);
+    m_Bound.assign(K, 0);
+    m_Negative.assign(K, 0);
+    m_NumFired.assign(K, 0);
+    m_Mode.assign(K, eLaneLeap);
+    m_PickCritical.assign(K, 0);
+    m_Halted.assign(K, -1);
+    m_NextOutput.assign(K, 0);
+    m_Random.resize(K);
+    Seed(0);
+}
+
+void CBatchStochasticEqns::Seed(uint64_t seed) {
+    for (unsigned int l = 0;  l < m_NumLanes;  ++l) {
+        m_Random[l].Seed(seed + l);
+    }
+}
+
+void CBatchStochasticEqns::SetOutputTimes(const vector<double> &times) {
+    for (unsigned int p = 1;  p < times.size();  ++p) {
+        if (!(times[p] > times[p-1])) {
+            throwError("output times must be increasing");
+        }
+    }
+    m_OutputTimes = times;
+    m_Output.assign(times.size() * m_NumStates * m_NumLanes,
+                    numeric_limits<double>::quiet_NaN());
+    m_NextOutput.assign(m_NumLanes, 0);
+}
+
+/*---------------------------------------------------------------------------*/
+void CBatchStochasticEqns::x_CalcRates(void) {
+    const unsigned int K = m_NumLanes;
+    const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+    const double *rateConstants = m_Model->RateConstants();
+    for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+        double *r = &m_Rates[j*K];
+        const double c = rateConstants[j];
+        for (unsigned int l = 0;  l < K;  ++l) {
+            r[l] = c;
+        }
+        const CRow<SReactant> re = reactants[j];
+        for (unsigned int k = 0;  k < re.size();  ++k) {
+            const double *x = &m_X[re[k].m_State * K];
+            for (int n = 0;  n < re[k].m_Order;  ++n) {
+                for (unsigned int l = 0;  l < K;  ++l) {
+                    r[l] *= max(x[l] - n, 0.);
+                }
+            }
+        }
+    }
+}
+
+void CBatchStochasticEqns::x_CalcLaneRates(unsigned int lane) {
+    const unsigned int K = m_NumLanes;
+    const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+    const double *rateConstants = m_Model->RateConstants();
+    for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+        double rate = rateConstants[j];
+        const CRow<SReactant> re = reactants[j];
+        for (unsigned int k = 0;  k < re.size()  &&  rate > 0;  ++k) {
+            const double x = m_X[re[k].m_State * K + lane];
+            for (int n = 0;  n < re[k].m_Order;  ++n) {
+                rate *= max(x - n, 0.);
+            }
+        }
+        m_Rates[j*K + lane] = rate;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// critical: may fire fewer than m_Ncritical times before exhausting one of
+// its reactants (as CStochasticEqns::x_IsCritical); halting: always
+void CBatchStochasticEqns::x_Classify(void) {
+    const unsigned int K = m_NumLanes;
+    fill(m_CritRate.begin(), m_CritRate.end(), 0.);
+    fill(m_NoncritRate.begin(), m_NoncritRate.end(), 0.);
+    double *critRate = &m_CritRate[0];
+    double *noncritRate = &m_NoncritRate[0];
+    for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+        double *c = &m_Critical[j*K];
+        const double init = m_IsHalting[j] ? 1. : 0.;
+        for (unsigned int l = 0;  l < K;  ++l) {
+            c[l] = init;
+        }
+        const CRow<SChange> nu = m_Nu[j];
+        for (unsigned int k = 0;  k < nu.size()  &&  !m_IsHalting[j];  ++k) {
+            if (nu[k].m_Mag >= 0) {
+                continue;
+            }
+            const double limit = m_Ncritical * -nu[k].m_Mag;
+            const double *x = &m_X[nu[k].m_State * K];
+            for (unsigned int l = 0;  l < K;  ++l) {
+                c[l] = x[l] < limit ? 1. : c[l];
+            }
+        }
+        const double *r = &m_Rates[j*K];
+        for (unsigned int l = 0;  l < K;  ++l) {
+            critRate[l] += c[l] * r[l];
+            noncritRate[l] += (1 - c[l]) * r[l];
+        }
+    }
+}
+
+// Cao, Gillespie & Petzold (2006) bound over the non-critical transitions,
+// as CStochasticEqns::x_TauEx
+void CBatchStochasticEqns::x_TauEx(void) {
+    const unsigned int K = m_NumLanes;
+    fill(m_Mu.begin(), m_Mu.end(), 0.);
+    fill(m_Sigma.begin(), m_Sigma.end(), 0.);
+    for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+        const double *r = &m_Rates[j*K];
+        const double *c = &m_Critical[j*K];
+        const CRow<SChange> nu = m_Nu[j];
+        for (unsigned int k = 0;  k < nu.size();  ++k) {
+            const double mag = nu[k].m_Mag;
+            double *mu = &m_Mu[nu[k].m_State * K];
+            double *sigma = &m_Sigma[nu[k].m_State * K];
+            for (unsigned int l = 0;  l < K;  ++l) {
+                const double w = (1 - c[l]) * r[l];
+                mu[l] += mag * w;
+                sigma[l] += mag * mag * w;
+            }
+        }
+    }
+
+    double *tau = &m_Tau[0];
+    double *bound = &m_Bound[0];
+    fill(m_Tau.begin(), m_Tau.end(), numeric_limits<double>::infinity());
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        const double *x = &m_X[i*K];
+        const double *mu = &m_Mu[i*K];
+        const double *sigma = &m_Sigma[i*K];
+        const double scale = m_Epsilon / m_RateChangeBound[i];
+        //two passes: GCC won't if-convert the max when it feeds the
+        //divisions directly
+        for (unsigned int l = 0;  l < K;  ++l) {
+            const double scaled = scale * x[l];
+            bound[l] = scaled > 1 ? scaled : 1;
+        }
+        for (unsigned int l = 0;  l < K;  ++l) {
+            const double byMean = bound[l] / fabs(mu[l]);
+            const double byVar = bound[l] * bound[l] / sigma[l];
+            const double t = byMean < byVar ? byMean : byVar;
+            tau[l] = t < tau[l] ? t : tau[l];
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+void CBatchStochasticEqns::x_Record(unsigned int lane, double until,
+                                    const double *src, bool inclusive) {
+    const unsigned int K = m_NumLanes;
+    unsigned int &p = m_NextOutput[lane];
+    while (p < m_OutputTimes.size()  &&
+           (m_OutputTimes[p] < until  ||
+            (inclusive  &&  m_OutputTimes[p] == until))) {
+        double *out = &m_Output[p * m_NumStates * K + lane];
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            out[i*K] = src[i*K + lane];
+        }
+        ++p;
+    }
+}
+
+void CBatchStochasticEqns::x_FinishLane(unsigned int lane, double tF) {
+    x_Record(lane, tF, &m_X[0], true);
+    m_T[lane] = tF;
+    m_Mode[lane] = eLaneDone;
+}
+
+/*---------------------------------------------------------------------------*/
+void CBatchStochasticEqns::x_ExactSteps(unsigned int lane, double tF) {
+    const unsigned int K = m_NumLanes;
+    CRandom &rng = m_Random[lane];
+    for (unsigned int n = 0;  n < m_NumExactSteps;  ++n) {
+        if (n > 0) {
+            CPhaseTimer timer(m_Stats.m_Seconds[ePhaseRates]);
+            x_CalcLaneRates(lane);
+            ++m_Stats.m_RateEvaluations;
+        }
+        double a0 = 0;
+        int last = -1;
+        for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+            if (m_Rates[j*K + lane] > 0) {
+                a0 += m_Rates[j*K + lane];
+                last = j;
+            }
+        }
+        if (a0 == 0) {
+            x_FinishLane(lane, tF);
+            return;
+        }
+        const double dt = rng.Exp(1./a0);
+        if (m_T[lane] + dt >= tF) {
+            x_FinishLane(lane, tF);
+            return;
+        }
+        x_Record(lane, m_T[lane] + dt, &m_X[0], false);
+
+        double u = rng.Unif() * a0;
+        int fired = last; //in case rounding runs past the end
+        for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+            u -= m_Rates[j*K + lane];
+            if (u <= 0  &&  m_Rates[j*K + lane] > 0) {
+                fired = j;
+                break;
+            }
+        }
+        const CRow<SChange> nu = m_Nu[fired];
+        for (unsigned int k = 0;  k < nu.size();  ++k) {
+            m_X[nu[k].m_State * K + lane] += nu[k].m_Mag;
+        }
+        m_T[lane] += dt;
+        ++m_Stats.m_Steps[eExact];
+        ++m_Stats.m_Firings;
+        if (m_IsHalting[fired]) {
+            m_Halted[lane] = fired;
+            m_Mode[lane] = eLaneDone;
+            return;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+void CBatchStochasticEqns::x_Leap(double tF) {
+    const unsigned int K = m_NumLanes;
+    const double *tau = &m_Tau[0];
+
+    //non-critical firings; lanes not leaping have tau == 0 & draw nothing
+    fill(m_NumFired.begin(), m_NumFired.end(), 0.);
+    for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+        double *f = &m_Firings[j*K];
+        const double *r = &m_Rates[j*K];
+        const double *c = &m_Critical[j*K];
+        for (unsigned int l = 0;  l < K;  ++l) {
+            f[l] = (c[l] == 0  &&  tau[l] > 0) ?
+                m_Random[l].Pois(r[l] * tau[l]) : 0;
+            m_NumFired[l] += f[l];
+        }
+    }
+    //plus one critical firing where the leap was cut short by one
+    for (unsigned int l = 0;  l < K;  ++l) {
+        if (m_Mode[l] != eLaneLeap  ||  !m_PickCritical[l]) {
+            continue;
+        }
+        double u = m_Random[l].Unif() * m_CritRate[l];
+        int fired = -1;
+        for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+            if (m_Critical[j*K + l] != 0  &&  m_Rates[j*K + l] > 0) {
+                fired = j;
+                u -= m_Rates[j*K + l];
+                if (u <= 0) {
+                    break;
+                }
+            }
+        }
+        if (fired >= 0) {
+            m_Firings[fired*K + l] += 1;
+            m_NumFired[l] += 1;
+            if (m_IsHalting[fired]) {
+                m_Halted[l] = fired; //undone below if the leap is rejected
+            }
+        }
+    }
+
+    //x += nu . firings, for all lanes at once
+    m_PrevX = m_X;
+    for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+        const double *f = &m_Firings[j*K];
+        const CRow<SChange> nu = m_Nu[j];
+        for (unsigned int k = 0;  k < nu.size();  ++k) {
+            const double mag = nu[k].m_Mag;
+            double *x = &m_X[nu[k].m_State * K];
+            for (unsigned int l = 0;  l < K;  ++l) {
+                x[l] += mag * f[l];
+            }
+        }
+    }
+    double *negative = &m_Negative[0];
+    fill(m_Negative.begin(), m_Negative.end(), 0.);
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        const double *x = &m_X[i*K];
+        for (unsigned int l = 0;  l < K;  ++l) {
+            negative[l] = x[l] < 0 ? 1. : negative[l];
+        }
+    }
+
+    for (unsigned int l = 0;  l < K;  ++l) {
+        if (m_Mode[l] != eLaneLeap) {
+            continue;
+        }
+        if (negative[l] != 0) { //tau too big: undo & retry with half
+            for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+                m_X[i*K + l] = m_PrevX[i*K + l];
+            }
+            m_Halted[l] = -1;
+            m_TauCap[l] = tau[l] / 2;
+            ++m_Stats.m_TauHalvings;
+            continue;
+        }
+        x_Record(l, m_T[l] + tau[l], &m_PrevX[0], false);
+        m_T[l] = (tau[l] >= tF - m_T[l]) ? tF : m_T[l] + tau[l];
+        m_TauCap[l] = numeric_limits<double>::infinity();
+        ++m_Stats.m_Steps[eExplicit];
+        m_Stats.m_TauSum += tau[l];
+        m_Stats.m_Firings += (uint64_t) m_NumFired[l];
+        if (m_Halted[l] >= 0) {
+            m_Mode[l] = eLaneDone;
+        } else if (m_T[l] >= tF) {
+            x_FinishLane(l, tF);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+void CBatchStochasticEqns::EvaluateUntil(double tF) {
+    const unsigned int K = m_NumLanes;
+    CPhaseTimer totalTimer(m_Stats.m_Seconds[ePhaseTotal]);
+    for (unsigned int l = 0;  l < K;  ++l) {
+        m_Mode[l] = m_Halted[l] >= 0 ? eLaneDone : eLaneLeap;
+        if (m_Mode[l] != eLaneDone  &&  m_T[l] >= tF) {
+            x_FinishLane(l, tF);
+        }
+    }
+
+    uint64_t c = 0;
+    for (;;) {
+        unsigned int numActive = 0;
+        for (unsigned int l = 0;  l < K;  ++l) {
+            numActive += m_Mode[l] != eLaneDone;
+        }
+        if (numActive == 0) {
+            break;
+        }
+        if (m_Control  &&  m_Control->IsCancelled()) {
+            throwEarlyExit("simulation cancelled after " << c << " rounds");
+        }
+        if (m_MaxSteps > 0  &&  c >= m_MaxSteps) {
+            throwEarlyExit("simulation reached maximum number of rounds (" <<
+                           m_MaxSteps << ") with " << numActive <<
+                           " lanes before time " << tF);
+        }
+        ++c;
+
+        {
+            CPhaseTimer timer(m_Stats.m_Seconds[ePhaseRates]);
+            x_CalcRates();
+            m_Stats.m_RateEvaluations += numActive;
+        }
+        {
+            CPhaseTimer timer(m_Stats.m_Seconds[ePhaseTauSelection]);
+            x_Classify();
+            x_TauEx();
+        }
+
+        //pick each lane's step; only leaping lanes keep tau > 0
+        bool anyLeap = false;
+        for (unsigned int l = 0;  l < K;  ++l) {
+            if (m_Mode[l] == eLaneDone) {
+                m_Tau[l] = 0;
+                continue;
+            }
+            m_Mode[l] = eLaneLeap;
+            const double a0 = m_CritRate[l] + m_NoncritRate[l];
+            if (a0 == 0) {
+                x_FinishLane(l, tF);
+                m_Tau[l] = 0;
+                continue;
+            }
+            if (!std::isfinite(a0)) {
+                throwEarlyExit("Infinite transition rate in lane " << l <<
+                               " at time " << m_T[l]);
+            }
+            const double tau1 = min(min(m_Tau[l], tF - m_T[l]),
+                                    min(m_MaxTau, m_TauCap[l]));
+            if (tau1 < m_ExactThreshold / a0) {
+                m_Mode[l] = eLaneExact;
+                m_Tau[l] = 0;
+                x_ExactSteps(l, tF);
+                continue;
+            }
+            const double tau2 = m_CritRate[l] == 0 ?
+                numeric_limits<double>::infinity() :
+                m_Random[l].Exp(1./m_CritRate[l]);
+            m_PickCritical[l] = tau2 < tau1;
+            m_Tau[l] = min(tau1, tau2);
+            anyLeap = true;
+        }
+        if (anyLeap) {
+            x_Leap(tF);
+        }
+    }
+}
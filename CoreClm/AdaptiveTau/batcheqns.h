@@ -0,0 +1,155 @@
+/*  batcheqns.h
+    --------------------------------------------------------------------------
+    Lockstep multi-trajectory mode for small & medium binary models.
+
+    CBatchStochasticEqns advances K replicates ("lanes") of one model
+    together.  State, rates & per-step scratch are stored species-by-lane
+    (x[i*K + lane]), so that mass-action propensities, the critical
+    classification, the explicit tau bounds (Cao et al. 2006) and the
+    update of the state by the sampled firings are plain loops over
+    contiguous lanes which the compiler vectorizes.  Poisson & exponential
+    draws stay scalar, one RNG stream per lane.
+
+    Each round, every lane either takes an explicit tau leap (the vector
+    path), or -- if its tau is too small compared to its total rate --
+    a batch of exact (SSA) steps on its own, or sits out because it has
+    reached tF or fired a halting transition; lanes on exact steps or
+    finished contribute tau = 0 to the vector path and thus draw nothing.
+    A lane's trajectory depends only on its own seed (seed + lane), not on
+    K or the other lanes.
+
+    Deterministic transitions & implicit leaps are not supported; use
+    CStochasticEqns for those.  States are sampled on a fixed output grid
+    (SetOutputTimes) rather than recorded at every step.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_BATCHEQNS_H
+#define ADAPTIVETAU_BATCHEQNS_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "modelformat.h"
+#include "random.h"
+#include "stochasticeqns.h"
+
+class CBatchStochasticEqns {
+public:
+    // PRE : model (must outlive this object); number of lanes; initVal (per
+    // species, NULL == model's initial state) & changeBound (NULL == 1)
+    // as for CStochasticEqns.  Throws runtime_error if the model has
+    // deterministic transitions.
+    CBatchStochasticEqns(const CModelFile &model, unsigned int numLanes,
+                         const double *initVal = NULL,
+                         const double *changeBound = NULL);
+
+    // parameters to the tau leaping algorithm (see CStochasticEqns)
+    void SetEpsilon(double epsilon) { m_Epsilon = epsilon; }
+    void SetMaxTau(double maxTau) { m_MaxTau = maxTau; }
+    // maximum number of rounds (0 == no limit)
+    void SetMaxSteps(unsigned int maxSteps) { m_MaxSteps = maxSteps; }
+    // lane l is seeded with seed + l
+    void Seed(uint64_t seed);
+    // PRE : increasing simulated times
+    // POST: state of every lane sampled at these times during the run
+    void SetOutputTimes(const std::vector<double> &times);
+    // cancellation only; NULL for none.  Must outlive the simulation.
+    void SetRunControl(CRunControl *control) { m_Control = control; }
+
+    // POST: all lanes at tF or halted; CEarlyExit if cancelled or out of
+    // steps (lanes keep their state)
+    void EvaluateUntil(double tF);
+
+    unsigned int GetNumStates(void) const { return m_NumStates; }
+    unsigned int GetNumTransitions(void) const { return m_NumTrans; }
+    unsigned int GetNumLanes(void) const { return m_NumLanes; }
+    double GetTime(unsigned int lane) const { return m_T[lane]; }
+    double GetState(unsigned int lane, unsigned int i) const {
+        return m_X[i*m_NumLanes + lane];
+    }
+    // 0-based id of the halting transition that ended lane; -1 if none
+    int GetHaltingTransition(unsigned int lane) const { return m_Halted[lane]; }
+    const std::vector<double>& GetOutputTimes(void) const { return m_OutputTimes; }
+    // state of lane at output time p; NaN if the lane halted before it
+    double GetOutput(unsigned int p, unsigned int lane, unsigned int i) const {
+        return m_Output[(p*m_NumStates + i)*m_NumLanes + lane];
+    }
+    // summed over all lanes (steps are lane-steps)
+    const SRunStatistics& GetStatistics(void) const { return m_Stats; }
+
+private:
+    CBatchStochasticEqns(const CBatchStochasticEqns&);
+    CBatchStochasticEqns& operator=(const CBatchStochasticEqns&);
+
+    enum ELaneMode {
+        eLaneLeap = 0,
+        eLaneExact,
+        eLaneDone
+    };
+
+    // POST: m_Rates of all lanes from m_X
+    void x_CalcRates(void);
+    // POST: m_Rates of one lane from m_X
+    void x_CalcLaneRates(unsigned int lane);
+    // POST: m_Critical, m_CritRate & m_NoncritRate of all lanes
+    void x_Classify(void);
+    // POST: m_Tau = explicit tau bound of all lanes
+    void x_TauEx(void);
+    // POST: up to m_NumExactSteps SSA steps taken by lane
+    void x_ExactSteps(unsigned int lane, double tF);
+    // POST: leap of m_Tau taken by all lanes in eLaneLeap; rejected lanes
+    // restored with their tau cap halved
+    void x_Leap(double tF);
+    // POST: output points before until (or at, if inclusive) filled from
+    // state src of lane
+    void x_Record(unsigned int lane, double until, const double *src,
+                  bool inclusive);
+    // POST: lane marked done at tF with the remaining output filled
+    void x_FinishLane(unsigned int lane, double tF);
+
+    const CModelFile *m_Model;
+    unsigned int m_NumStates;
+    unsigned int m_NumTrans;
+    unsigned int m_NumLanes;
+    CSparseRows<SChange> m_Nu;
+    std::vector<char> m_IsHalting;
+    std::vector<double> m_RateChangeBound;
+
+    double m_Epsilon;
+    double m_Ncritical;
+    double m_ExactThreshold;
+    unsigned int m_NumExactSteps;
+    double m_MaxTau;
+    unsigned int m_MaxSteps;
+    CRunControl *m_Control;
+
+    // species (or transition) by lane
+    std::vector<double> m_X;
+    std::vector<double> m_PrevX;
+    std::vector<double> m_Rates;
+    std::vector<double> m_Critical;  // 1 if critical, else 0
+    std::vector<double> m_Firings;
+    std::vector<double> m_Mu;
+    std::vector<double> m_Sigma;
+    // by lane
+    std::vector<double> m_T;
+    std::vector<double> m_Tau;
+    std::vector<double> m_TauCap;    // after a rejected leap
+    std::vector<double> m_CritRate;
+    std::vector<double> m_NoncritRate;
+    std::vector<double> m_Bound;     // scratch of x_TauEx
+    std::vector<double> m_Negative;  // 1 if leap went negative
+    std::vector<double> m_NumFired;  // firings sampled this leap
+    std::vector<char> m_Mode;        // ELaneMode
+    std::vector<char> m_PickCritical;// leap ends with one critical firing
+    std::vector<int> m_Halted;
+    std::vector<unsigned int> m_NextOutput;
+    std::vector<CRandom> m_Random;
+
+    std::vector<double> m_OutputTimes;
+    std::vector<double> m_Output;    // point by species by lane
+    SRunStatistics m_Stats;
+};
+
+#endif //ADAPTIVETAU_BATCHEQNS_H
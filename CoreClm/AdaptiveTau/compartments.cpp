@@ -0,0 +1,297 @@
+/*  compartments.cpp
+    --------------------------------------------------------------------------
+    Multi-compartment simulation: Next Subvolume Method & split leaping
+    (see compartments.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "compartments.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+/*---------------------------------------------------------------------------*/
+CCompartmentEqns::CCompartmentEqns(const TCompiledModelPtr &compiled,
+                                   unsigned int numCompartments,
+                                   const double *initVal)
+    : m_Compiled(compiled), m_NumStates(compiled->NumStates()),
+      m_NumTrans(compiled->NumTransitions()),
+      m_NumCompartments(numCompartments), m_Transfers(numCompartments),
+      m_Seed(0), m_Random(0), m_Epsilon(0.05), m_Control(NULL), m_T(0),
+      m_Halted(-1), m_HaltedIn(-1), m_NextOutput(0) {
+    if (!compiled->Model()) {
+        throwError("compartments need a compiled binary model");
+    }
+    if (numCompartments == 0) {
+        throwError("at least one compartment is needed");
+    }
+    if (!compiled->TransByCat(eDeterministic).empty()) {
+        throwError("deterministic transitions are not supported in "
+                   "compartments");
+    }
+    const double *x0 = initVal ? initVal : compiled->Model()->InitialState();
+    m_X.resize((size_t) numCompartments * m_NumStates);
+    for (unsigned int c = 0;  c < numCompartments;  ++c) {
+        copy(x0, x0 + m_NumStates, &m_X[(size_t) c * m_NumStates]);
+    }
+    m_Rates.resize((size_t) numCompartments * m_NumTrans);
+    m_ReactionSum.resize(numCompartments);
+    m_TransferSum.resize(numCompartments);
+}
+
+void CCompartmentEqns::SetInitialState(unsigned int c, const double *x) {
+    if (c >= m_NumCompartments) {
+        throwError("compartment " << c+1 << " does not exist");
+    }
+    copy(x, x + m_NumStates, &m_X[(size_t) c * m_NumStates]);
+}
+
+void CCompartmentEqns::AddTransfer(unsigned int species, unsigned int from,
+                                   unsigned int to, double rate) {
+    if (species >= m_NumStates  ||  from >= m_NumCompartments  ||
+        to >= m_NumCompartments  ||  from == to  ||  !(rate >= 0)) {
+        throwError("invalid transfer of species " << species+1 << " from "
+                   "compartment " << from+1 << " to " << to+1 << " at rate "
+                   << rate);
+    }
+    STransfer t;
+    t.m_Species = species;
+    t.m_To = to;
+    t.m_Rate = rate;
+    m_Transfers[from].push_back(t);
+}
+
+void CCompartmentEqns::SetOutputTimes(const vector<double> &times) {
+    for (unsigned int p = 1;  p < times.size();  ++p) {
+        if (!(times[p] > times[p-1])) {
+            throwError("output times must be increasing");
+        }
+    }
+    m_OutputTimes = times;
+    m_Output.assign(times.size() * m_NumCompartments * m_NumStates,
+                    numeric_limits<double>::quiet_NaN());
+    m_NextOutput = 0;
+}
+
+double CCompartmentEqns::GetTotal(unsigned int i) const {
+    double res = 0;
+    for (unsigned int c = 0;  c < m_NumCompartments;  ++c) {
+        res += GetState(c, i);
+    }
+    return res;
+}
+
+SRunStatistics CCompartmentEqns::GetStatistics(void) const {
+    SRunStatistics res = m_Stats;
+    for (unsigned int c = 0;  c < m_Eqns.size();  ++c) {
+        const SRunStatistics &s = m_Eqns[c]->GetStatistics();
+        for (unsigned int k = 0;  k < 3;  ++k) {
+            res.m_Steps[k] += s.m_Steps[k];
+        }
+        res.m_Firings += s.m_Firings;
+        res.m_TauHalvings += s.m_TauHalvings;
+        res.m_RateEvaluations += s.m_RateEvaluations;
+        res.m_TauSum += s.m_TauSum;
+    }
+    return res;
+}
+
+/*---------------------------------------------------------------------------*/
+void CCompartmentEqns::x_CalcCompartment(unsigned int c) {
+    const double *x = &m_X[(size_t) c * m_NumStates];
+    double *rates = &m_Rates[(size_t) c * m_NumTrans];
+    m_Compiled->CalcRates(x, rates);
+    ++m_Stats.m_RateEvaluations;
+    double sum = 0;
+    for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+        sum += rates[j];
+    }
+    m_ReactionSum[c] = sum;
+    sum = 0;
+    for (unsigned int k = 0;  k < m_Transfers[c].size();  ++k) {
+        sum += m_Transfers[c][k].m_Rate * x[m_Transfers[c][k].m_Species];
+    }
+    m_TransferSum[c] = sum;
+}
+
+void CCompartmentEqns::x_Record(double t) {
+    while (m_NextOutput < m_OutputTimes.size()  &&
+           m_OutputTimes[m_NextOutput] < t) {
+        copy(m_X.begin(), m_X.end(), m_Output.begin() +
+             (size_t) m_NextOutput * m_X.size());
+        ++m_NextOutput;
+    }
+}
+
+void CCompartmentEqns::x_Finish(double tF) {
+    if (m_Halted < 0) {
+        m_T = tF;
+        while (m_NextOutput < m_OutputTimes.size()  &&
+               m_OutputTimes[m_NextOutput] <= tF) {
+            copy(m_X.begin(), m_X.end(), m_Output.begin() +
+                 (size_t) m_NextOutput * m_X.size());
+            ++m_NextOutput;
+        }
+    }
+}
+
+void CCompartmentEqns::x_CheckCancelled(void) const {
+    if (m_Control  &&  m_Control->IsCancelled()) {
+        throwEarlyExit("simulation cancelled at time " << m_T);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// Next Subvolume Method: the queue holds the time of the next event of
+// every compartment.
+void CCompartmentEqns::EvaluateExactUntil(double tF) {
+    const double inf = numeric_limits<double>::infinity();
+    const CRow<ETransCat> cats = m_Compiled->TransCats();
+    vector<double> times(m_NumCompartments);
+    for (unsigned int c = 0;  c < m_NumCompartments;  ++c) {
+        x_CalcCompartment(c);
+        const double total = m_ReactionSum[c] + m_TransferSum[c];
+        times[c] = total > 0 ? m_T + m_Random.Exp(1. / total) : inf;
+    }
+    m_Queue.Assign(times);
+
+    while (m_Halted < 0) {
+        const unsigned int c = m_Queue.Top();
+        const double t = m_Queue.TopKey();
+        if (t >= tF) {
+            break;
+        }
+        x_Record(t);
+        m_T = t;
+        double *x = &m_X[(size_t) c * m_NumStates];
+        const double *rates = &m_Rates[(size_t) c * m_NumTrans];
+        double u = m_Random.Unif() * (m_ReactionSum[c] + m_TransferSum[c]);
+        int changed = -1; //other compartment changed by a transfer
+        if (u < m_ReactionSum[c]  ||  m_TransferSum[c] <= 0) {
+            unsigned int fired = m_NumTrans;
+            for (unsigned int j = 0;  j < m_NumTrans;  ++j) {
+                if (rates[j] > 0) {
+                    fired = j; //in case rounding runs past the end
+                    u -= rates[j];
+                    if (u <= 0) {
+                        break;
+                    }
+                }
+            }
+            m_Compiled->ApplyTransition(fired, 1, x);
+            if (cats[fired] == eHalting) {
+                m_Halted = fired;
+                m_HaltedIn = c;
+            }
+        } else {
+            u -= m_ReactionSum[c];
+            const vector<STransfer> &out = m_Transfers[c];
+            unsigned int k = 0;
+            for (;  k + 1 < out.size();  ++k) {
+                u -= out[k].m_Rate * x[out[k].m_Species];
+                if (u <= 0  &&  x[out[k].m_Species] > 0) {
+                    break;
+                }
+            }
+            while (x[out[k].m_Species] <= 0  ||  out[k].m_Rate <= 0) {
+                --k; //rounding ran onto a transfer with rate 0
+            }
+            x[out[k].m_Species] -= 1;
+            m_X[(size_t) out[k].m_To * m_NumStates + out[k].m_Species] += 1;
+            changed = out[k].m_To;
+        }
+        ++m_Stats.m_Steps[eExact];
+        ++m_Stats.m_Firings;
+
+        x_CalcCompartment(c);
+        double total = m_ReactionSum[c] + m_TransferSum[c];
+        m_Queue.Update(c, total > 0 ? t + m_Random.Exp(1. / total) : inf);
+        if (changed >= 0) {
+            const double old = m_ReactionSum[changed] + m_TransferSum[changed];
+            const double next = m_Queue.Key(changed);
+            x_CalcCompartment(changed);
+            total = m_ReactionSum[changed] + m_TransferSum[changed];
+            m_Queue.Update(changed, total <= 0 ? inf :
+                           next < inf ? t + old / total * (next - t) :
+                           t + m_Random.Exp(1. / total));
+        }
+        x_CheckCancelled();
+    }
+    x_Finish(tF);
+}
+
+/*---------------------------------------------------------------------------*/
+void CCompartmentEqns::EvaluateSplitUntil(double tF, double dt) {
+    if (!(dt > 0)) {
+        throwError("split step must be positive");
+    }
+    if (m_Eqns.empty()) {
+        m_Eqns.resize(m_NumCompartments);
+        for (unsigned int c = 0;  c < m_NumCompartments;  ++c) {
+            m_Eqns[c].reset(new CStochasticEqns(m_Compiled,
+                                                &m_X[(size_t) c * m_NumStates]));
+            m_Eqns[c]->Seed(m_Seed + c);
+            if (m_Control) {
+                m_Eqns[c]->SetRunControl(m_Control);
+            }
+        }
+    }
+    m_Before.resize(m_X.size());
+    m_Left.resize(m_X.size());
+
+    while (m_T < tF  &&  m_Halted < 0) {
+        const double h = min(dt, tF - m_T);
+        x_Record(m_T + h);
+        //reactions
+        for (unsigned int c = 0;  c < m_NumCompartments  &&  m_Halted < 0;
+             ++c) {
+            double *x = &m_X[(size_t) c * m_NumStates];
+            CStochasticEqns &eqns = *m_Eqns[c];
+            eqns.SetEpsilon(m_Epsilon);
+            eqns.SetState(m_T, x);
+            eqns.EvaluateATLUntil(m_T + h);
+            copy(eqns.GetState(), eqns.GetState() + m_NumStates, x);
+            if (eqns.GetHaltingTransition() >= 0) {
+                m_Halted = eqns.GetHaltingTransition();
+                m_HaltedIn = c;
+                m_T = eqns.GetTime();
+            }
+        }
+        if (m_Halted >= 0) {
+            break;
+        }
+        //transfers, each capped at the molecules present before any left
+        copy(m_X.begin(), m_X.end(), m_Before.begin());
+        copy(m_X.begin(), m_X.end(), m_Left.begin());
+        for (unsigned int c = 0;  c < m_NumCompartments;  ++c) {
+            const vector<STransfer> &out = m_Transfers[c];
+            for (unsigned int k = 0;  k < out.size();  ++k) {
+                const size_t from = (size_t) c * m_NumStates + out[k].m_Species;
+                const double mu = out[k].m_Rate * m_Before[from] * h;
+                const double n = mu > 0 ?
+                    min(m_Random.Pois(mu), floor(m_Left[from])) : 0;
+                if (n > 0) {
+                    m_Left[from] -= n;
+                    m_X[from] -= n;
+                    m_X[(size_t) out[k].m_To * m_NumStates +
+                        out[k].m_Species] += n;
+                    m_Stats.m_Firings += (uint64_t) n;
+                }
+            }
+        }
+        ++m_Stats.m_Steps[eExplicit];
+        m_T += h;
+        x_CheckCancelled();
+    }
+    x_Finish(tF);
+}
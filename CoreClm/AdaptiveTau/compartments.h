@@ -0,0 +1,148 @@
+/*  compartments.h
+    --------------------------------------------------------------------------
+    Multi-compartment (reaction-transfer) simulation.
+
+    CCompartmentEqns runs one reaction network in several well-mixed
+    subvolumes ("compartments") joined by transfer transitions: species i
+    moves from compartment a to b at rate k * x_a[i].  Diffusion is a pair
+    of transfers; sedimentation, or any other one-way flux, is a single
+    one.  States are stored compartment by compartment (x[c*n + i]).
+
+    EvaluateExactUntil uses the Next Subvolume Method (Elf & Ehrenberg
+    2004): each compartment has one exponential clock for its total rate
+    (reactions + outgoing transfers), kept in an indexed priority queue,
+    so an event costs O(log compartments) for scheduling plus the
+    recalculation of the rates of the one or two compartments it changed.
+    The clocks of a compartment whose rate changed without firing are
+    rescaled rather than redrawn (Gibson & Bruck 2000).
+
+    EvaluateSplitUntil(tF, dt) keeps adaptive tau leaping available: each
+    step of length dt advances every compartment's reactions with the
+    usual ATL (a CStochasticEqns per compartment) and then the transfers
+    with one Poisson leap each, capped at the molecules present (Lie
+    splitting; first-order in dt).
+
+    Deterministic transitions are not supported.  A halting transition
+    ends the run in either mode.  States are sampled on a fixed output
+    grid (SetOutputTimes) rather than recorded at every event.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_COMPARTMENTS_H
+#define ADAPTIVETAU_COMPARTMENTS_H
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "compiledmodel.h"
+#include "indexedheap.h"
+#include "random.h"
+#include "stochasticeqns.h"
+
+class CCompartmentEqns {
+public:
+    // PRE : compiled binary model; number of compartments; initVal (per
+    // species, NULL == model's initial state) used for every compartment
+    CCompartmentEqns(const TCompiledModelPtr &compiled,
+                     unsigned int numCompartments,
+                     const double *initVal = NULL);
+
+    // POST: initial state of compartment c replaced
+    void SetInitialState(unsigned int c, const double *x);
+    // POST: species moves from compartment "from" to "to" at rate * x
+    void AddTransfer(unsigned int species, unsigned int from, unsigned int to,
+                     double rate);
+    // POST: transfers both ways between a & b at rate (per molecule)
+    void AddDiffusion(unsigned int species, unsigned int a, unsigned int b,
+                      double rate) {
+        AddTransfer(species, a, b, rate);
+        AddTransfer(species, b, a, rate);
+    }
+    // compartment c is seeded with seed + c (split mode); the NSM uses
+    // seed itself
+    void Seed(uint64_t seed) { m_Seed = seed;  m_Random.Seed(seed); }
+    // PRE : increasing simulated times
+    // POST: all compartments sampled at these times during the run
+    void SetOutputTimes(const std::vector<double> &times);
+    // cancellation only; NULL for none.  Must outlive the simulation.
+    void SetRunControl(CRunControl *control) { m_Control = control; }
+    // ATL parameter of the split mode (see CStochasticEqns)
+    void SetEpsilon(double epsilon) { m_Epsilon = epsilon; }
+
+    // POST: exact (NSM) simulation until tF or a halting transition
+    void EvaluateExactUntil(double tF);
+    // POST: reactions leaped per compartment & transfers leaped, in steps
+    // of dt, until tF or a halting transition
+    void EvaluateSplitUntil(double tF, double dt);
+
+    unsigned int GetNumCompartments(void) const { return m_NumCompartments; }
+    unsigned int GetNumStates(void) const { return m_NumStates; }
+    double GetTime(void) const { return m_T; }
+    double GetState(unsigned int c, unsigned int i) const {
+        return m_X[c * m_NumStates + i];
+    }
+    // total of species i over all compartments
+    double GetTotal(unsigned int i) const;
+    const std::vector<double>& GetOutputTimes(void) const { return m_OutputTimes; }
+    // state at output time p; NaN if the run ended before it
+    double GetOutput(unsigned int p, unsigned int c, unsigned int i) const {
+        return m_Output[((size_t) p * m_NumCompartments + c) * m_NumStates + i];
+    }
+    // 0-based id of the halting transition that ended the run (-1 if
+    // none) & its compartment
+    int GetHaltingTransition(void) const { return m_Halted; }
+    int GetHaltingCompartment(void) const { return m_HaltedIn; }
+    // events of both modes; transfers count as firings (& exact steps in
+    // the NSM)
+    SRunStatistics GetStatistics(void) const;
+
+private:
+    CCompartmentEqns(const CCompartmentEqns&);
+    CCompartmentEqns& operator=(const CCompartmentEqns&);
+
+    struct STransfer {
+        unsigned int m_Species;
+        unsigned int m_To;
+        double m_Rate;
+    };
+
+    // POST: rates & rate sums of compartment c from its state
+    void x_CalcCompartment(unsigned int c);
+    // POST: output points before t filled from the current state
+    void x_Record(double t);
+    // POST: remaining output points filled with NaN (halted) or the state
+    void x_Finish(double tF);
+    void x_CheckCancelled(void) const;
+
+    TCompiledModelPtr m_Compiled;
+    unsigned int m_NumStates;
+    unsigned int m_NumTrans;
+    unsigned int m_NumCompartments;
+    std::vector< std::vector<STransfer> > m_Transfers; // by source
+    uint64_t m_Seed;
+    CRandom m_Random;
+    double m_Epsilon;
+    CRunControl *m_Control;
+
+    double m_T;
+    std::vector<double> m_X;            // compartment by species
+    std::vector<double> m_Rates;        // compartment by transition
+    std::vector<double> m_ReactionSum;  // by compartment
+    std::vector<double> m_TransferSum;  // by compartment
+    CIndexedMinHeap m_Queue;            // next event time by compartment
+    int m_Halted;
+    int m_HaltedIn;
+    SRunStatistics m_Stats;
+
+    // split mode: one solver per compartment (created on first use)
+    std::vector< std::unique_ptr<CStochasticEqns> > m_Eqns;
+    std::vector<double> m_Before;       // state before a step's transfers
+    std::vector<double> m_Left;         // molecules not yet moved out
+
+    std::vector<double> m_OutputTimes;
+    std::vector<double> m_Output;       // point by compartment by species
+    unsigned int m_NextOutput;
+};
+
+#endif //ADAPTIVETAU_COMPARTMENTS_H
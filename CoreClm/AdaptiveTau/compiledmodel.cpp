@@ -0,0 +1,207 @@
+/*  compiledmodel.cpp
+    --------------------------------------------------------------------------
+    Immutable, shareable model structure (see compiledmodel.h).  The
+    structural analysis moved here from stochasticeqns.cpp.
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "compiledmodel.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+const bool debug = false;
+
+/*---------------------------------------------------------------------------*/
+CCompiledModel::CCompiledModel(const CModelFile &model,
+                               const CModelKernels *kernels)
+    : m_NumStates(model.NumSpecies()), m_Model(&model), m_Kernels(kernels) {
+    if (model.HasSpeciesNames()) {
+        m_VarNames.resize(m_NumStates);
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            m_VarNames[i] = model.SpeciesName(i);
+        }
+    }
+
+    m_Nu = model.Changes(); //view into mapping, nothing copied
+    m_TransCats.resize(m_Nu.size(), eNormal);
+    TTransList detTrans, haltTrans;
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        if (model.TransitionFlags(j) & eTransDeterministic) {
+            detTrans.push_back(j);
+        } else if (model.TransitionFlags(j) & eTransHalting) {
+            haltTrans.push_back(j);
+        }
+    }
+    x_SetCat(detTrans, eDeterministic);
+    x_SetCat(haltTrans, eHalting);
+    x_Compile();
+}
+
+CCompiledModel::CCompiledModel(unsigned int numStates,
+                               const vector< vector<SChange> > &nu,
+                               const TTransList &detTrans,
+                               const TTransList &haltTrans,
+                               const vector<string> &varNames)
+    : m_NumStates(numStates), m_VarNames(varNames), m_Model(NULL),
+      m_Kernels(NULL) {
+    m_Nu.Assign(nu);
+    m_TransCats.resize(m_Nu.size(), eNormal);
+    x_SetCat(detTrans, eDeterministic);
+    x_SetCat(haltTrans, eHalting);
+    x_Compile();
+}
+
+/*---------------------------------------------------------------------------*/
+void CCompiledModel::CalcRates(const double *x, double *rates) const {
+    if (m_Kernels) {
+        m_Kernels->CalcRates(x, rates);
+        return;
+    }
+    const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+    const double *rateConstants = m_Model->RateConstants();
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        double rate = rateConstants[j];
+        const CRow<SReactant> r = reactants[j];
+        for (unsigned int k = 0;  k < r.size()  &&  rate > 0;  ++k) {
+            const double v = x[r[k].m_State];
+            for (int n = 0;  n < r[k].m_Order;  ++n) {
+                rate *= max(v - n, 0.);
+            }
+        }
+        rates[j] = rate;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : list of (0-based) transitions to flag as category "cat"
+// POST: appropriate transCats set
+void CCompiledModel::x_SetCat(const TTransList &trans, ETransCat cat) {
+    for (TTransList::const_iterator j = trans.begin();  j != trans.end();  ++j) {
+        if (*j < 0  ||  *j >= (int) m_TransCats.size()) {
+            throwError("transition " << *j+1 << " does not exist (last "
+                       "transition is " << m_TransCats.size() << ")");
+        }
+        m_TransCats[*j] = cat;
+        m_TransByCat[cat].push_back(*j);
+    }
+}
+
+void CCompiledModel::x_Compile(void) {
+    if (m_TransByCat[eDeterministic].size() == m_TransCats.size()) {
+        throwError("At least one transition must be stochastic (all "
+                   "transitions are currently flagged as "
+                   "deterministic).");
+    }
+
+    // needed for ITL
+    x_IdentifyBalancedPairs();
+    x_IdentifyRealValuedVariables();
+
+    x_BuildNuBySpecies();
+    m_UnitChangeBound.assign(m_NumStates, 1);
+}
+
+/*---------------------------------------------------------------------------*/
+namespace {
+    // lexicographic order on rows of state changes (shorter rows first);
+    // b's magnitudes are negated if negateB
+    int CompareRows(const CRow<SChange> &a, const CRow<SChange> &b,
+                    bool negateB) {
+        if (a.size() != b.size()) {
+            return a.size() < b.size() ? -1 : 1;
+        }
+        for (unsigned int i = 0;  i < a.size();  ++i) {
+            const int magB = negateB ? -b[i].m_Mag : b[i].m_Mag;
+            if (a[i].m_State != b[i].m_State) {
+                return a[i].m_State < b[i].m_State ? -1 : 1;
+            }
+            if (a[i].m_Mag != magB) {
+                return a[i].m_Mag < magB ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+    struct SRowLess {
+        SRowLess(const CSparseRows<SChange> &nu) : m_Nu(nu) {}
+        bool operator()(unsigned int j1, unsigned int j2) const {
+            const int c = CompareRows(m_Nu[j1], m_Nu[j2], false);
+            return c < 0  ||  (c == 0  &&  j1 < j2);
+        }
+        const CSparseRows<SChange> &m_Nu;
+    };
+    // compares a row against the negation of another (the "key")
+    struct SNegatedRowLess {
+        SNegatedRowLess(const CSparseRows<SChange> &nu) : m_Nu(nu) {}
+        bool operator()(unsigned int j, unsigned int key) const {
+            return CompareRows(m_Nu[j], m_Nu[key], true) < 0;
+        }
+        const CSparseRows<SChange> &m_Nu;
+    };
+}
+
+// PRE : m_Nu initialized
+// POST: all balanced pairs of transitions identified & saved (in the order
+// of a pairwise scan, but found by sorting rather than comparing all pairs)
+void CCompiledModel::x_IdentifyBalancedPairs(void) {
+    vector<unsigned int> order(m_Nu.size());
+    for (unsigned int j = 0;  j < order.size();  ++j) {
+        order[j] = j;
+    }
+    sort(order.begin(), order.end(), SRowLess(m_Nu));
+
+    for (unsigned int j1 = 0;  j1 < m_Nu.size();  ++j1) {
+        //rows equal to -nu[j1] form one run of "order", sorted by index
+        vector<unsigned int>::const_iterator j2 =
+            lower_bound(order.begin(), order.end(), j1, SNegatedRowLess(m_Nu));
+        for (;  j2 != order.end()  &&
+                 CompareRows(m_Nu[*j2], m_Nu[j1], true) == 0;  ++j2) {
+            if (*j2 <= j1) {
+                continue;
+            }
+            m_BalancedPairs.push_back(TBalancedPair(j1, *j2));
+            if (debug) {
+                cerr << "balanced pair " << j1 << " and " << *j2 << endl;
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : m_Nu initialized, deterministic transition set (if any)
+// POST: all variables identified will take real values
+// (i.e. either non-integer nu or modified by a deterministic transition)
+void CCompiledModel::x_IdentifyRealValuedVariables(void) {
+    m_RealValuedVariables.assign(m_NumStates, 0);
+
+    for (TTransList::const_iterator j = m_TransByCat[eDeterministic].begin();
+         j != m_TransByCat[eDeterministic].end();  ++j) {
+        for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
+            m_RealValuedVariables[m_Nu[*j][i].m_State] = 1;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// POST: m_NuBySpecies = transpose of m_Nu (used by the parallel path)
+void CCompiledModel::x_BuildNuBySpecies(void) {
+    vector< vector<SChange> > bySpecies(m_NumStates);
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        for (unsigned int k = 0;  k < m_Nu[j].size();  ++k) {
+            SChange c;
+            c.m_State = j;
+            c.m_Mag = m_Nu[j][k].m_Mag;
+            bySpecies[m_Nu[j][k].m_State].push_back(c);
+        }
+    }
+    m_NuBySpecies.Assign(bySpecies);
+}
@@ -0,0 +1,135 @@
+/*  compiledmodel.h
+    --------------------------------------------------------------------------
+    Immutable structure of a reaction network, shared by many simulations.
+
+    A CCompiledModel holds everything about a model that does not change
+    during or between runs: the state changes (nu) & their transpose, the
+    transition categories, the balanced (reversible) pairs used by implicit
+    steps & the variables that take real values.  It is built once -- the
+    costly part is identifying balanced pairs -- and never modified after,
+    so one instance may be used by any number of CStochasticEqns at once,
+    on any threads.  Share it by TCompiledModelPtr; each simulation holds
+    a reference, so the model lives as long as its last user.  Per-run
+    state (current time, state & rates, time series, RNG, ...) stays in
+    CStochasticEqns, which attaches to the compiled structure by views
+    rather than copies.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_COMPILEDMODEL_H
+#define ADAPTIVETAU_COMPILEDMODEL_H
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "modelformat.h"
+#include "modelkernels.h"
+
+enum ETransCat {
+    eNormal = 0,
+    eCritical,
+    eDeterministic,
+    eHalting
+};
+
+class CCompiledModel {
+public:
+    typedef std::vector<int> TTransList;
+    typedef std::pair<unsigned int, unsigned int> TBalancedPair;
+
+    // Binary model (see modelformat.h): nu is used in place from the
+    // mapping.  kernels, if given, must have been compiled from the same
+    // model (see modelkernels.h).  model & kernels must outlive this
+    // object.
+    explicit CCompiledModel(const CModelFile &model,
+                            const CModelKernels *kernels = NULL);
+    // Model given by its structure (e.g. from R; rates are then evaluated
+    // by the host): nu by transition, 0-based lists of deterministic &
+    // halting transitions, variable names (may be empty).  A transition
+    // on both lists is halting.
+    CCompiledModel(unsigned int numStates,
+                   const std::vector< std::vector<SChange> > &nu,
+                   const TTransList &detTrans, const TTransList &haltTrans,
+                   const std::vector<std::string> &varNames);
+
+    unsigned int NumStates(void) const { return m_NumStates; }
+    unsigned int NumTransitions(void) const { return m_Nu.size(); }
+    const std::vector<std::string>& VarNames(void) const { return m_VarNames; }
+    // state changes by transition
+    const CSparseRows<SChange>& Nu(void) const { return m_Nu; }
+    // transpose of Nu (m_State is the transition)
+    const CSparseRows<SChange>& NuBySpecies(void) const {
+        return m_NuBySpecies;
+    }
+    // eNormal, eDeterministic or eHalting per transition
+    CRow<ETransCat> TransCats(void) const {
+        return CRow<ETransCat>(m_TransCats.empty() ? NULL : &m_TransCats[0],
+                               m_TransCats.size());
+    }
+    // transitions of category eDeterministic or eHalting
+    const TTransList& TransByCat(ETransCat cat) const {
+        return m_TransByCat[cat];
+    }
+    // pairs of transitions whose state changes cancel out (j1 < j2)
+    CRow<TBalancedPair> BalancedPairs(void) const {
+        return CRow<TBalancedPair>(m_BalancedPairs.empty() ? NULL :
+                                   &m_BalancedPairs[0], m_BalancedPairs.size());
+    }
+    // 1 per variable changed by a deterministic transition, else 0
+    CRow<unsigned char> RealValuedVariables(void) const {
+        return CRow<unsigned char>(m_RealValuedVariables.empty() ? NULL :
+                                   &m_RealValuedVariables[0],
+                                   m_RealValuedVariables.size());
+    }
+    // 1 for every variable (default relative rate change bound)
+    const double* UnitChangeBound(void) const {
+        return m_UnitChangeBound.empty() ? NULL : &m_UnitChangeBound[0];
+    }
+    // binary model & its kernels (NULL if none)
+    const CModelFile* Model(void) const { return m_Model; }
+    const CModelKernels* Kernels(void) const { return m_Kernels; }
+    // PRE : binary model (Model() != NULL); state x
+    // POST: rates by mass action (by the kernels, if any), for drivers
+    // that keep several states of one model (see mlmc.h)
+    void CalcRates(const double *x, double *rates) const;
+    // POST: x += times * nu[j]
+    void ApplyTransition(unsigned int j, double times, double *x) const {
+        if (m_Kernels) {
+            m_Kernels->ApplyTransition(j, times, x);
+        } else {
+            for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+                x[m_Nu[j][i].m_State] += times * m_Nu[j][i].m_Mag;
+            }
+        }
+    }
+
+private:
+    CCompiledModel(const CCompiledModel&);
+    CCompiledModel& operator=(const CCompiledModel&);
+
+    void x_SetCat(const TTransList &trans, ETransCat cat);
+    // POST: structure validated & derived data built from m_Nu & the
+    // categories
+    void x_Compile(void);
+    void x_IdentifyBalancedPairs(void);
+    void x_IdentifyRealValuedVariables(void);
+    void x_BuildNuBySpecies(void);
+
+    unsigned int m_NumStates;
+    std::vector<std::string> m_VarNames;
+    CSparseRows<SChange> m_Nu;
+    CSparseRows<SChange> m_NuBySpecies;
+    std::vector<ETransCat> m_TransCats;
+    TTransList m_TransByCat[4]; //only eDeterministic & eHalting used
+    std::vector<TBalancedPair> m_BalancedPairs;
+    std::vector<unsigned char> m_RealValuedVariables;
+    std::vector<double> m_UnitChangeBound;
+    const CModelFile *m_Model;
+    const CModelKernels *m_Kernels;
+};
+
+typedef std::shared_ptr<const CCompiledModel> TCompiledModelPtr;
+
+#endif //ADAPTIVETAU_COMPILEDMODEL_H
@@ -0,0 +1,86 @@
+/*  indexedheap.h
+    --------------------------------------------------------------------------
+    Binary min-heap over a fixed set of items 0..n-1 keyed by double, with
+    the position of every item tracked so that a key can be changed in
+    O(log n) (Gibson & Bruck 2000).  Used as the event queue of the Next
+    Subvolume Method (see compartments.h).
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_INDEXEDHEAP_H
+#define ADAPTIVETAU_INDEXEDHEAP_H
+
+#include <utility>
+#include <vector>
+
+class CIndexedMinHeap {
+public:
+    // POST: heap of keys.size() items, item i with key keys[i]; O(n)
+    void Assign(const std::vector<double> &keys) {
+        m_Keys = keys;
+        m_Heap.resize(keys.size());
+        m_Pos.resize(keys.size());
+        for (unsigned int i = 0;  i < keys.size();  ++i) {
+            m_Heap[i] = i;
+            m_Pos[i] = i;
+        }
+        for (unsigned int i = keys.size() / 2;  i-- > 0;  ) {
+            x_SiftDown(i);
+        }
+    }
+
+    unsigned int size(void) const { return m_Heap.size(); }
+    // item with the smallest key (PRE: not empty)
+    unsigned int Top(void) const { return m_Heap[0]; }
+    double TopKey(void) const { return m_Keys[m_Heap[0]]; }
+    double Key(unsigned int item) const { return m_Keys[item]; }
+
+    // POST: item's key changed & heap restored
+    void Update(unsigned int item, double key) {
+        const double old = m_Keys[item];
+        m_Keys[item] = key;
+        if (key < old) {
+            x_SiftUp(m_Pos[item]);
+        } else {
+            x_SiftDown(m_Pos[item]);
+        }
+    }
+
+private:
+    void x_Swap(unsigned int a, unsigned int b) {
+        std::swap(m_Heap[a], m_Heap[b]);
+        m_Pos[m_Heap[a]] = a;
+        m_Pos[m_Heap[b]] = b;
+    }
+    void x_SiftUp(unsigned int p) {
+        while (p > 0  &&  m_Keys[m_Heap[p]] < m_Keys[m_Heap[(p - 1) / 2]]) {
+            x_Swap(p, (p - 1) / 2);
+            p = (p - 1) / 2;
+        }
+    }
+    void x_SiftDown(unsigned int p) {
+        for (;;) {
+            unsigned int least = p;
+            const unsigned int l = 2 * p + 1, r = l + 1;
+            if (l < m_Heap.size()  &&
+                m_Keys[m_Heap[l]] < m_Keys[m_Heap[least]]) {
+                least = l;
+            }
+            if (r < m_Heap.size()  &&
+                m_Keys[m_Heap[r]] < m_Keys[m_Heap[least]]) {
+                least = r;
+            }
+            if (least == p) {
+                return;
+            }
+            x_Swap(p, least);
+            p = least;
+        }
+    }
+
+    std::vector<double> m_Keys;        // by item
+    std::vector<unsigned int> m_Heap;  // items in heap order
+    std::vector<unsigned int> m_Pos;   // position of each item in m_Heap
+};
+
+#endif //ADAPTIVETAU_INDEXEDHEAP_H
@@ -0,0 +1,330 @@
+/*  mlmc.cpp
+    --------------------------------------------------------------------------
+    Multilevel Monte Carlo with coupled tau-leaping paths (see mlmc.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "mlmc.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+/*---------------------------------------------------------------------------*/
+CMultilevelEstimator::CMultilevelEstimator(const TCompiledModelPtr &compiled,
+                                           const double *initVal)
+    : m_Compiled(compiled), m_Functional(NULL), m_FunctionalData(NULL),
+      m_Tau0(0), m_Refinement(4), m_NumRefinements(0), m_ExactTop(true),
+      m_PilotSamples(100), m_MaxSamples(10000000), m_Seed(1),
+      m_Control(NULL) {
+    if (!compiled->Model()) {
+        throwError("multilevel Monte Carlo needs a compiled binary model");
+    }
+    if (!compiled->TransByCat(eDeterministic).empty()  ||
+        !compiled->TransByCat(eHalting).empty()) {
+        throwError("multilevel Monte Carlo does not support deterministic "
+                   "or halting transitions");
+    }
+    const double *x0 = initVal ? initVal : compiled->Model()->InitialState();
+    m_InitVal.assign(x0, x0 + compiled->NumStates());
+}
+
+void CMultilevelEstimator::SetObservable(const CStopCriteria::TWeights &numerator,
+                                         const CStopCriteria::TWeights &denominator) {
+    CStopCriteria observable;
+    observable.AddThreshold("f", numerator, denominator, 0);
+    observable.Validate(m_Compiled->NumStates());
+    m_Observable = observable;
+    m_Functional = NULL;
+}
+
+void CMultilevelEstimator::SetLevels(double tau0, unsigned int refinement,
+                                     unsigned int numRefinements) {
+    if (!(tau0 > 0)  ||  refinement < 2) {
+        throwError("multilevel Monte Carlo needs tau0 > 0 and a refinement "
+                   "factor of at least 2");
+    }
+    m_Tau0 = tau0;
+    m_Refinement = refinement;
+    m_NumRefinements = numRefinements;
+}
+
+double CMultilevelEstimator::x_F(const double *x) const {
+    if (m_Functional) {
+        return m_Functional(x, m_FunctionalData);
+    }
+    const double f = m_Observable.Observable(0, x);
+    return std::isnan(f) ? 0 : f;
+}
+
+void CMultilevelEstimator::x_CheckCancelled(void) const {
+    if (m_Control  &&  m_Control->IsCancelled()) {
+        throwEarlyExit("multilevel Monte Carlo cancelled");
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+SMultilevelResult CMultilevelEstimator::Estimate(double tF,
+                                                 double targetVariance) {
+    if (!m_Functional  &&  m_Observable.empty()) {
+        throwError("multilevel Monte Carlo needs an observable or functional");
+    }
+    if (!(m_Tau0 > 0)) {
+        throwError("multilevel Monte Carlo needs levels (see SetLevels)");
+    }
+    if (!(targetVariance > 0)  ||  m_PilotSamples < 2) {
+        throwError("multilevel Monte Carlo needs a positive target variance "
+                   "and at least 2 pilot samples");
+    }
+    const unsigned int n = m_Compiled->NumStates();
+    const unsigned int m = m_Compiled->NumTransitions();
+    m_X1.resize(n);
+    m_X2.resize(n);
+    m_Rates1.resize(m);
+    m_Rates2.resize(m);
+
+    const unsigned int numLevels = 1 + m_NumRefinements + (m_ExactTop ? 1 : 0);
+    vector<SLevelSums> sums(numLevels);
+    vector<CRandom> rnd(numLevels);
+    vector<uint64_t> more(numLevels, m_PilotSamples);
+    for (unsigned int l = 0;  l < numLevels;  ++l) {
+        memset(&sums[l], 0, sizeof(sums[l]));
+        rnd[l].Seed(m_Seed + l);
+    }
+
+    vector<double> var(numLevels), cost(numLevels);
+    bool done = false;
+    while (!done) {
+        for (unsigned int l = 0;  l < numLevels;  ++l) {
+            if (more[l] > 0) {
+                x_Sample(l, more[l], tF, rnd[l], sums[l]);
+            }
+        }
+        double sumSqrtVC = 0;
+        for (unsigned int l = 0;  l < numLevels;  ++l) {
+            const double mean = sums[l].m_Sum / sums[l].m_N;
+            var[l] = max(0., (sums[l].m_SumSq - sums[l].m_N * mean * mean) /
+                         (sums[l].m_N - 1));
+            cost[l] = max(1., sums[l].m_Cost / sums[l].m_N);
+            sumSqrtVC += sqrt(var[l] * cost[l]);
+        }
+        done = true;
+        for (unsigned int l = 0;  l < numLevels;  ++l) {
+            const double opt = min((double) m_MaxSamples,
+                                   ceil(sqrt(var[l] / cost[l]) * sumSqrtVC /
+                                        targetVariance));
+            more[l] = opt > sums[l].m_N ? (uint64_t) opt - sums[l].m_N : 0;
+            done = done  &&  more[l] == 0;
+        }
+    }
+
+    SMultilevelResult res;
+    res.m_Mean = res.m_Variance = res.m_Cost = 0;
+    res.m_Levels.resize(numLevels);
+    for (unsigned int l = 0;  l < numLevels;  ++l) {
+        SMultilevelLevel &level = res.m_Levels[l];
+        level.m_Tau = l <= m_NumRefinements ?
+            m_Tau0 / pow((double) m_Refinement, (double) l) : 0;
+        level.m_Samples = sums[l].m_N;
+        level.m_Mean = sums[l].m_Sum / sums[l].m_N;
+        level.m_Variance = var[l];
+        level.m_Cost = sums[l].m_Cost / sums[l].m_N;
+        res.m_Mean += level.m_Mean;
+        res.m_Variance += var[l] / sums[l].m_N;
+        res.m_Cost += sums[l].m_Cost;
+    }
+    res.m_StdError = sqrt(res.m_Variance);
+    res.m_Lower = res.m_Mean - 1.96 * res.m_StdError;
+    res.m_Upper = res.m_Mean + 1.96 * res.m_StdError;
+    res.m_SingleLevelCost = numeric_limits<double>::quiet_NaN();
+    if (m_ExactTop  &&  res.m_Variance > 0) {
+        const SLevelSums &top = sums[numLevels - 1];
+        const double mean = top.m_ExactSum / top.m_N;
+        const double exactVar = (top.m_ExactSumSq - top.m_N * mean * mean) /
+            (top.m_N - 1);
+        res.m_SingleLevelCost = max(0., exactVar) / res.m_Variance *
+            top.m_ExactCost / top.m_N;
+    }
+    return res;
+}
+
+/*---------------------------------------------------------------------------*/
+void CMultilevelEstimator::x_Sample(unsigned int l, uint64_t n, double tF,
+                                    CRandom &rnd, SLevelSums &sums) {
+    const double tau = m_Tau0 / pow((double) m_Refinement,
+                                    (double) min(l, m_NumRefinements));
+    double *x1 = &m_X1[0], *x2 = &m_X2[0];
+    for (uint64_t k = 0;  k < n;  ++k) {
+        x_CheckCancelled();
+        copy(m_InitVal.begin(), m_InitVal.end(), x1);
+        copy(m_InitVal.begin(), m_InitVal.end(), x2);
+        double y, cost, exactCost = 0;
+        if (l == 0) {
+            cost = x_Leap(tau, tF, rnd, x1);
+            y = x_F(x1);
+        } else if (l <= m_NumRefinements) {
+            cost = x_CoupledLeap(tau, tF, rnd, x1, x2);
+            y = x_F(x1) - x_F(x2);
+        } else {
+            cost = x_CoupledExact(tau, tF, rnd, x1, x2, exactCost);
+            const double f = x_F(x1);
+            y = f - x_F(x2);
+            sums.m_ExactSum += f;
+            sums.m_ExactSumSq += f * f;
+            sums.m_ExactCost += exactCost;
+        }
+        ++sums.m_N;
+        sums.m_Sum += y;
+        sums.m_SumSq += y * y;
+        sums.m_Cost += cost;
+    }
+}
+
+void CMultilevelEstimator::x_EndLeap(double *x) const {
+    for (unsigned int i = 0;  i < m_Compiled->NumStates();  ++i) {
+        x[i] = max(x[i], 0.);
+    }
+}
+
+// step i covers [i tau, min((i+1) tau, tF)]
+double CMultilevelEstimator::x_Leap(double tau, double tF, CRandom &rnd,
+                                    double *x) {
+    const unsigned int m = m_Compiled->NumTransitions();
+    double *rates = &m_Rates1[0];
+    double cost = 0;
+    for (uint64_t i = 0;  i * tau < tF;  ++i) {
+        const double h = min((i + 1) * tau, tF) - i * tau;
+        m_Compiled->CalcRates(x, rates);
+        ++cost;
+        for (unsigned int j = 0;  j < m;  ++j) {
+            const double k = rates[j] > 0 ? rnd.Pois(rates[j] * h) : 0;
+            if (k > 0) {
+                m_Compiled->ApplyTransition(j, k, x);
+            }
+        }
+        x_EndLeap(x);
+    }
+    return cost;
+}
+
+// The coarse path's rates are refreshed every refinement fine steps &
+// its state clamped only then, so that it follows the same law as an
+// uncoupled path with step refinement * tau.
+double CMultilevelEstimator::x_CoupledLeap(double tau, double tF, CRandom &rnd,
+                                           double *xf, double *xc) {
+    const unsigned int m = m_Compiled->NumTransitions();
+    double *rf = &m_Rates1[0], *rc = &m_Rates2[0];
+    double cost = 0;
+    for (uint64_t i = 0;  i * tau < tF;  ++i) {
+        if (i % m_Refinement == 0) {
+            x_EndLeap(xc);
+            m_Compiled->CalcRates(xc, rc);
+            ++cost;
+        }
+        const double h = min((i + 1) * tau, tF) - i * tau;
+        m_Compiled->CalcRates(xf, rf);
+        ++cost;
+        for (unsigned int j = 0;  j < m;  ++j) {
+            const double shared = min(rf[j], rc[j]);
+            double k = shared > 0 ? rnd.Pois(shared * h) : 0;
+            if (k > 0) {
+                m_Compiled->ApplyTransition(j, k, xf);
+                m_Compiled->ApplyTransition(j, k, xc);
+            }
+            k = rf[j] > shared ? rnd.Pois((rf[j] - shared) * h) : 0;
+            if (k > 0) {
+                m_Compiled->ApplyTransition(j, k, xf);
+            }
+            k = rc[j] > shared ? rnd.Pois((rc[j] - shared) * h) : 0;
+            if (k > 0) {
+                m_Compiled->ApplyTransition(j, k, xc);
+            }
+        }
+        x_EndLeap(xf);
+    }
+    x_EndLeap(xc);
+    return cost;
+}
+
+// Direct method on 3 channels per transition: shared (min of the two
+// rates), exact only & leaping only.  The leaping path's rates stay
+// frozen until its next grid point, so its firings per step are Poisson
+// as in x_Leap.
+double CMultilevelEstimator::x_CoupledExact(double tau, double tF,
+                                            CRandom &rnd, double *x,
+                                            double *xl, double &exactCost) {
+    const unsigned int m = m_Compiled->NumTransitions();
+    double *r = &m_Rates1[0], *rl = &m_Rates2[0];
+    m_Compiled->CalcRates(x, r);
+    m_Compiled->CalcRates(xl, rl);
+    double cost = 2;
+    exactCost = 1;
+    double t = 0;
+    uint64_t i = 0;
+    double nextGrid = min(tau, tF);
+    for (;;) {
+        double total = 0;
+        for (unsigned int j = 0;  j < m;  ++j) {
+            total += max(r[j], rl[j]);
+        }
+        const double dt = total > 0 ? rnd.Exp(1. / total) :
+            numeric_limits<double>::infinity();
+        if (t + dt >= nextGrid) {
+            t = nextGrid;
+            x_EndLeap(xl);
+            if (t >= tF) {
+                break;
+            }
+            ++i;
+            nextGrid = min((i + 1) * tau, tF);
+            m_Compiled->CalcRates(xl, rl);
+            ++cost;
+            continue;
+        }
+        t += dt;
+
+        double u = rnd.Unif() * total;
+        int pick = -1, channel = 0;
+        for (unsigned int j = 0;  j < m  &&  pick < 0;  ++j) {
+            const double shared = min(r[j], rl[j]);
+            const double part[3] = {shared, r[j] - shared, rl[j] - shared};
+            for (int c = 0;  c < 3;  ++c) {
+                if (part[c] <= 0) {
+                    continue;
+                }
+                if (u < part[c]) {
+                    pick = j;
+                    channel = c;
+                    break;
+                }
+                u -= part[c];
+                pick = -2 - j; //last channel with a positive rate so far
+                channel = c;
+            }
+        }
+        if (pick < 0) { //round-off: u fell past the last channel
+            pick = -2 - pick;
+        }
+        if (channel != 2) {
+            m_Compiled->ApplyTransition(pick, 1, x);
+            m_Compiled->CalcRates(x, r);
+            ++cost;
+            ++exactCost;
+        }
+        if (channel != 1) {
+            m_Compiled->ApplyTransition(pick, 1, xl);
+        }
+        x_CheckCancelled();
+    }
+    return cost;
+}
@@ -0,0 +1,150 @@
+/*  mlmc.h
+    --------------------------------------------------------------------------
+    Multilevel Monte Carlo estimation of E[f(X(tF))] (Anderson & Higham,
+    Multiscale Model. Simul. 2012).
+
+    Level 0 is a tau-leaping path with step tau0; level l = 1..L couples a
+    path with step tau0 / M^l to one with step tau0 / M^(l-1) by splitting
+    each transition's Poisson process into a shared part (rate min(a_f,
+    a_c)) & one part for each path; the top level, if enabled, couples an
+    exact path to the finest leaping path the same way (the leaping
+    path's rates are frozen between its grid points, the exact path's
+    change with every event).  The estimator
+        E[f(Z_0)] + sum_l E[f(Z_l) - f(Z_{l-1})] + E[f(X) - f(Z_L)]
+    is then unbiased for the exact process, and the coupled differences
+    have small variance, so most samples are taken on the cheap coarse
+    levels.  The number of samples per level is chosen for a target
+    variance of the estimator (Giles 2008): after a pilot run, level l
+    takes N_l = sqrt(V_l / C_l) * sum_k sqrt(V_k C_k) / target, repeated
+    until no level needs more.  Cost is counted in rate evaluations, so
+    the sample counts do not depend on the machine.
+
+    Leaps use fixed steps without a critical-transition safeguard; a
+    variable that goes negative is set to 0 at the end of its path's step
+    (the same rule on every level, so the telescoping sum still holds).
+    Binary models with mass-action (or kernel) rates only; deterministic
+    & halting transitions are not supported.  Level l draws from its own
+    RNG stream (seed + l), so adding samples to one level does not
+    change the others.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_MLMC_H
+#define ADAPTIVETAU_MLMC_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "compiledmodel.h"
+#include "random.h"
+#include "stochasticeqns.h"
+#include "stopcriteria.h"
+
+// f(x) at tF; userData as given to SetFunctional
+typedef double (*TFunctional)(const double *x, void *userData);
+
+// one level of SMultilevelResult
+struct SMultilevelLevel {
+    double m_Tau;         // finer step of the level (0 == exact top level)
+    uint64_t m_Samples;
+    double m_Mean;        // of f (level 0) or of the coupled difference
+    double m_Variance;    // of one sample
+    double m_Cost;        // rate evaluations per sample
+};
+
+// result of CMultilevelEstimator::Estimate
+struct SMultilevelResult {
+    double m_Mean;
+    double m_Variance;    // of m_Mean
+    double m_StdError;
+    double m_Lower;       // 95% confidence interval (normal approx.)
+    double m_Upper;
+    std::vector<SMultilevelLevel> m_Levels;
+    double m_Cost;        // rate evaluations, all levels
+    // rate evaluations plain exact runs would need for the same variance
+    // (estimated from the exact paths of the top level; NaN without one)
+    double m_SingleLevelCost;
+};
+
+class CMultilevelEstimator {
+public:
+    // PRE : compiled binary model; initVal NULL == model's initial state
+    CMultilevelEstimator(const TCompiledModelPtr &compiled,
+                         const double *initVal = NULL);
+
+    // f = numerator / denominator of the state at tF (see CStopCriteria;
+    // 0 where the denominator is 0)
+    void SetObservable(const CStopCriteria::TWeights &numerator,
+                       const CStopCriteria::TWeights &denominator);
+    // f given by a function instead
+    void SetFunctional(TFunctional f, void *userData) {
+        m_Functional = f;
+        m_FunctionalData = userData;
+    }
+    // coarsest step, refinement factor M & number of leaping levels
+    // above the coarsest (L)
+    void SetLevels(double tau0, unsigned int refinement,
+                   unsigned int numRefinements);
+    // couple the finest leaping level to exact paths (default), making the
+    // estimate unbiased
+    void SetExactTopLevel(bool exact) { m_ExactTop = exact; }
+    // samples per level of the pilot run; cap on the samples of any level
+    void SetPilotSamples(unsigned int n) { m_PilotSamples = n; }
+    void SetMaxSamples(uint64_t n) { m_MaxSamples = n; }
+    void Seed(uint64_t seed) { m_Seed = seed; }
+    // cancellation only; NULL for none.  Must outlive Estimate.
+    void SetRunControl(CRunControl *control) { m_Control = control; }
+
+    // POST: E[f(X(tF))] estimated to variance targetVariance (unless a
+    // level reached SetMaxSamples); CEarlyExit if cancelled
+    SMultilevelResult Estimate(double tF, double targetVariance);
+
+private:
+    // running sums of one level
+    struct SLevelSums {
+        uint64_t m_N;
+        double m_Sum;
+        double m_SumSq;
+        double m_Cost;
+        double m_ExactSum;   // of f(X), top level only
+        double m_ExactSumSq;
+        double m_ExactCost;
+    };
+
+    double x_F(const double *x) const;
+    // POST: level l sampled n more times into sums
+    void x_Sample(unsigned int l, uint64_t n, double tF, CRandom &rnd,
+                  SLevelSums &sums);
+    // POST: fixed-step leaping path with step tau to tF; returns cost
+    double x_Leap(double tau, double tF, CRandom &rnd, double *x);
+    // POST: coupled paths with steps tau & refinement * tau to tF
+    double x_CoupledLeap(double tau, double tF, CRandom &rnd,
+                         double *xf, double *xc);
+    // POST: exact path x & leaping path with step tau coupled to tF;
+    // exactCost = rate evaluations of the exact path alone
+    double x_CoupledExact(double tau, double tF, CRandom &rnd,
+                          double *x, double *xl, double &exactCost);
+    // POST: leaping path's pending changes applied & clamped at 0
+    void x_EndLeap(double *x) const;
+    void x_CheckCancelled(void) const;
+
+    TCompiledModelPtr m_Compiled;
+    std::vector<double> m_InitVal;
+    CStopCriteria m_Observable;
+    TFunctional m_Functional;
+    void *m_FunctionalData;
+    double m_Tau0;
+    unsigned int m_Refinement;
+    unsigned int m_NumRefinements;
+    bool m_ExactTop;
+    unsigned int m_PilotSamples;
+    uint64_t m_MaxSamples;
+    uint64_t m_Seed;
+    CRunControl *m_Control;
+
+    // scratch, sized once per Estimate
+    std::vector<double> m_X1, m_X2;
+    std::vector<double> m_Rates1, m_Rates2;
+};
+
+#endif //ADAPTIVETAU_MLMC_H
@@ -0,0 +1,538 @@
+/*  modelformat.cpp
+    --------------------------------------------------------------------------
+    Reader (memory-mapped) and writer for the binary model format described
+    in modelformat.h.
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "modelformat.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+/*---------------------------------------------------------------------------*/
+CModelFile::CModelFile(const string &path)
+    : m_Path(path), m_Base(NULL), m_Size(0),
+#ifdef _WIN32
+      m_FileHandle(INVALID_HANDLE_VALUE), m_MappingHandle(NULL),
+#endif
+      m_Header(NULL), m_Sections(NULL),
+      m_SpeciesNameOffsets(NULL), m_SpeciesNameChars(NULL),
+      m_SpeciesCategories(NULL), m_InitialState(NULL),
+      m_RateConstants(NULL), m_TransitionCategories(NULL),
+      m_TransitionFlags(NULL),
+      m_CategoryNameOffsets(NULL), m_CategoryNameChars(NULL),
+      m_TauLeapingParams(NULL) {
+    x_Map();
+    try {
+        x_Validate();
+    } catch (...) {
+        x_Unmap();
+        throw;
+    }
+}
+
+CModelFile::~CModelFile(void) {
+    x_Unmap();
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : m_Path set
+// POST: whole file mapped read-only at m_Base
+void CModelFile::x_Map(void) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(m_Path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,
+                              NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throwError("unable to open model file '" << m_Path << "'");
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throwError("unable to determine size of model file '" << m_Path << "'");
+    }
+    m_Size = size.QuadPart;
+    if (m_Size < sizeof(SModelFileHeader)) {
+        CloseHandle(file);
+        throwError("model file '" << m_Path << "' is truncated");
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        throwError("unable to map model file '" << m_Path << "'");
+    }
+    void *base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (base == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throwError("unable to map model file '" << m_Path << "'");
+    }
+    m_FileHandle = file;
+    m_MappingHandle = mapping;
+    m_Base = static_cast<const unsigned char*>(base);
+#else
+    int fd = open(m_Path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throwError("unable to open model file '" << m_Path << "'");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throwError("unable to determine size of model file '" << m_Path << "'");
+    }
+    m_Size = st.st_size;
+    if (m_Size < sizeof(SModelFileHeader)) {
+        close(fd);
+        throwError("model file '" << m_Path << "' is truncated");
+    }
+    void *base = mmap(NULL, m_Size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); //mapping keeps its own reference to the file
+    if (base == MAP_FAILED) {
+        throwError("unable to map model file '" << m_Path << "'");
+    }
+    m_Base = static_cast<const unsigned char*>(base);
+#endif
+}
+
+void CModelFile::x_Unmap(void) {
+    if (m_Base == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(m_Base);
+    CloseHandle(m_MappingHandle);
+    CloseHandle(m_FileHandle);
+    m_MappingHandle = NULL;
+    m_FileHandle = INVALID_HANDLE_VALUE;
+#else
+    munmap(const_cast<unsigned char*>(m_Base), m_Size);
+#endif
+    m_Base = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : id, element size & expected number of elements of a section
+// POST: pointer to start of section (NULL if absent and not required)
+const void* CModelFile::x_Section(EModelSection id, uint32_t elemSize,
+                                  uint64_t count, bool required) const {
+    for (unsigned int s = 0;  s < m_Header->m_NumSections;  ++s) {
+        const SModelFileSection &sec = m_Sections[s];
+        if (sec.m_Id != (uint32_t) id) {
+            continue;
+        }
+        if (sec.m_ElemSize != elemSize  ||  sec.m_Count != count) {
+            throwError("model file '" << m_Path << "': section " << id <<
+                       " has " << sec.m_Count << " elements of size " <<
+                       sec.m_ElemSize << " (expected " << count <<
+                       " of size " << elemSize << ")");
+        }
+        if (sec.m_Offset % kModelFormatAlignment != 0  ||
+            sec.m_Offset > m_Size  ||
+            sec.m_Count > (m_Size - sec.m_Offset) / sec.m_ElemSize) {
+            throwError("model file '" << m_Path << "': section " << id <<
+                       " lies outside of the file or is misaligned");
+        }
+        return m_Base + sec.m_Offset;
+    }
+    if (required) {
+        throwError("model file '" << m_Path << "' is missing section " << id);
+    }
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : file mapped
+// POST: header & all known sections checked, accessors pointing into mapping
+void CModelFile::x_Validate(void) {
+    m_Header = reinterpret_cast<const SModelFileHeader*>(m_Base);
+    if (memcmp(m_Header->m_Magic, kModelFormatMagic,
+               sizeof(kModelFormatMagic)) != 0) {
+        throwError("'" << m_Path << "' is not a model file");
+    }
+    if (m_Header->m_EndianCheck != kModelFormatEndianCheck) {
+        throwError("model file '" << m_Path << "' was written with a "
+                   "different byte order");
+    }
+    if (m_Header->m_Version != kModelFormatVersion) {
+        throwError("model file '" << m_Path << "' has format version " <<
+                   m_Header->m_Version << " but this engine reads version " <<
+                   kModelFormatVersion);
+    }
+    if (m_Header->m_FileSize != m_Size) {
+        throwError("model file '" << m_Path << "' is truncated (expected " <<
+                   m_Header->m_FileSize << " bytes, found " << m_Size << ")");
+    }
+    if (sizeof(SModelFileHeader) +
+        (uint64_t) m_Header->m_NumSections * sizeof(SModelFileSection) > m_Size) {
+        throwError("model file '" << m_Path << "' has a corrupt section table");
+    }
+    m_Sections = reinterpret_cast<const SModelFileSection*>
+        (m_Base + sizeof(SModelFileHeader));
+    //every section, known or not, must lie within the file (sections this
+    //engine does not read are still copied by SaveTauLeapingParams)
+    for (unsigned int s = 0;  s < m_Header->m_NumSections;  ++s) {
+        const SModelFileSection &sec = m_Sections[s];
+        if (sec.m_Offset > m_Size  ||  (sec.m_ElemSize > 0  &&
+            sec.m_Count > (m_Size - sec.m_Offset) / sec.m_ElemSize)) {
+            throwError("model file '" << m_Path << "': section " <<
+                       sec.m_Id << " lies outside of the file");
+        }
+    }
+
+    const uint64_t nS = m_Header->m_NumSpecies;
+    const uint64_t nT = m_Header->m_NumTransitions;
+    const uint64_t nC = m_Header->m_NumCategories;
+    if (nS == 0  ||  nT == 0) {
+        throwError("model file '" << m_Path << "' contains no species or "
+                   "no transitions");
+    }
+
+    m_InitialState = static_cast<const double*>
+        (x_Section(eSecInitialState, sizeof(double), nS, true));
+    m_RateConstants = static_cast<const double*>
+        (x_Section(eSecRateConstants, sizeof(double), nT, true));
+    m_SpeciesCategories = static_cast<const uint32_t*>
+        (x_Section(eSecSpeciesCategories, sizeof(uint32_t), nS, false));
+    m_TransitionCategories = static_cast<const uint32_t*>
+        (x_Section(eSecTransitionCategories, sizeof(uint32_t), nT, false));
+    m_TransitionFlags = static_cast<const uint32_t*>
+        (x_Section(eSecTransitionFlags, sizeof(uint32_t), nT, false));
+
+    //sparse structures: offsets must be monotone and end at the entry count
+    const uint64_t *changeOffsets = static_cast<const uint64_t*>
+        (x_Section(eSecChangeOffsets, sizeof(uint64_t), nT+1, true));
+    const uint64_t *reactantOffsets = static_cast<const uint64_t*>
+        (x_Section(eSecReactantOffsets, sizeof(uint64_t), nT+1, true));
+    for (uint64_t j = 0;  j < nT;  ++j) {
+        if (changeOffsets[j+1] < changeOffsets[j]  ||
+            reactantOffsets[j+1] < reactantOffsets[j]) {
+            throwError("model file '" << m_Path << "' has corrupt offsets "
+                       "for transition " << j+1);
+        }
+    }
+    if (changeOffsets[0] != 0  ||  reactantOffsets[0] != 0) {
+        throwError("model file '" << m_Path << "' has corrupt offsets");
+    }
+    const SChange *changes = static_cast<const SChange*>
+        (x_Section(eSecChanges, sizeof(SChange), changeOffsets[nT], true));
+    const SReactant *reactants = static_cast<const SReactant*>
+        (x_Section(eSecReactants, sizeof(SReactant), reactantOffsets[nT],
+                   true));
+    for (uint64_t k = 0;  k < changeOffsets[nT];  ++k) {
+        if (changes[k].m_State < 0  ||  (uint64_t) changes[k].m_State >= nS) {
+            throwError("model file '" << m_Path << "': state change refers "
+                       "to non-existent species " << changes[k].m_State);
+        }
+    }
+    for (uint64_t k = 0;  k < reactantOffsets[nT];  ++k) {
+        if (reactants[k].m_State < 0  ||
+            (uint64_t) reactants[k].m_State >= nS  ||
+            reactants[k].m_Order <= 0) {
+            throwError("model file '" << m_Path << "': invalid reactant "
+                       "(species " << reactants[k].m_State << ", order " <<
+                       reactants[k].m_Order << ")");
+        }
+    }
+    m_Changes.Attach(changeOffsets, changes, nT);
+    m_Reactants.Attach(reactantOffsets, reactants, nT);
+
+    //names are optional, but if present they must be complete, with
+    //offsets as above (the last one is the char count by x_Section)
+    m_SpeciesNameOffsets = static_cast<const uint64_t*>
+        (x_Section(eSecSpeciesNameOffsets, sizeof(uint64_t), nS+1, false));
+    if (m_SpeciesNameOffsets) {
+        for (uint64_t i = 0;  i < nS;  ++i) {
+            if (m_SpeciesNameOffsets[i+1] < m_SpeciesNameOffsets[i]) {
+                throwError("model file '" << m_Path << "' has corrupt name "
+                           "offsets for species " << i+1);
+            }
+        }
+        if (m_SpeciesNameOffsets[0] != 0) {
+            throwError("model file '" << m_Path << "' has corrupt species "
+                       "name offsets");
+        }
+        m_SpeciesNameChars = static_cast<const char*>
+            (x_Section(eSecSpeciesNameChars, 1, m_SpeciesNameOffsets[nS],
+                       true));
+    }
+    if (nC > 0) {
+        m_CategoryNameOffsets = static_cast<const uint64_t*>
+            (x_Section(eSecCategoryNameOffsets, sizeof(uint64_t), nC+1, true));
+        for (uint64_t c = 0;  c < nC;  ++c) {
+            if (m_CategoryNameOffsets[c+1] < m_CategoryNameOffsets[c]) {
+                throwError("model file '" << m_Path << "' has corrupt name "
+                           "offsets for category " << c+1);
+            }
+        }
+        if (m_CategoryNameOffsets[0] != 0) {
+            throwError("model file '" << m_Path << "' has corrupt category "
+                       "name offsets");
+        }
+        m_CategoryNameChars = static_cast<const char*>
+            (x_Section(eSecCategoryNameChars, 1, m_CategoryNameOffsets[nC],
+                       true));
+    }
+    m_TauLeapingParams = static_cast<const STauLeapingParams*>
+        (x_Section(eSecTauLeapingParams, sizeof(STauLeapingParams), 1, false));
+    for (uint64_t i = 0;  i < nS  &&  m_SpeciesCategories;  ++i) {
+        if (m_SpeciesCategories[i] >= (nC > 0 ? nC : 1)) {
+            throwError("model file '" << m_Path << "': species " << i+1 <<
+                       " has an unknown category");
+        }
+    }
+    for (uint64_t j = 0;  j < nT  &&  m_TransitionCategories;  ++j) {
+        if (m_TransitionCategories[j] >= (nC > 0 ? nC : 1)) {
+            throwError("model file '" << m_Path << "': transition " << j+1 <<
+                       " has an unknown category");
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+unsigned int CModelFileWriter::AddCategory(const string &name) {
+    m_CategoryNames.push_back(name);
+    return m_CategoryNames.size() - 1;
+}
+
+unsigned int CModelFileWriter::AddSpecies(const string &name,
+                                          unsigned int category,
+                                          double initialCount) {
+    if (category >= max<size_t>(m_CategoryNames.size(), 1)) {
+        throwError("unknown category " << category << " for species '" <<
+                   name << "'");
+    }
+    if (initialCount < 0) {
+        throwError("initial count of species '" << name << "' must not be "
+                   "negative");
+    }
+    m_SpeciesNames.push_back(name);
+    m_SpeciesCategories.push_back(category);
+    m_InitialState.push_back(initialCount);
+    return m_SpeciesNames.size() - 1;
+}
+
+unsigned int CModelFileWriter::AddTransition(const vector<SReactant> &reactants,
+                                             const vector<SChange> &changes,
+                                             double rateConstant,
+                                             unsigned int category,
+                                             uint32_t flags) {
+    if (category >= max<size_t>(m_CategoryNames.size(), 1)) {
+        throwError("unknown category " << category << " for transition " <<
+                   m_RateConstants.size()+1);
+    }
+    for (unsigned int i = 0;  i < reactants.size();  ++i) {
+        if (reactants[i].m_State < 0  ||
+            (unsigned int) reactants[i].m_State >= m_SpeciesNames.size()  ||
+            reactants[i].m_Order <= 0) {
+            throwError("invalid reactant for transition " <<
+                       m_RateConstants.size()+1);
+        }
+    }
+    for (unsigned int i = 0;  i < changes.size();  ++i) {
+        if (changes[i].m_State < 0  ||
+            (unsigned int) changes[i].m_State >= m_SpeciesNames.size()) {
+            throwError("invalid state change for transition " <<
+                       m_RateConstants.size()+1);
+        }
+    }
+    if (!(rateConstant >= 0)) {
+        throwError("rate constant of transition " << m_RateConstants.size()+1
+                   << " must not be negative");
+    }
+    m_Reactants.push_back(reactants);
+    m_Changes.push_back(changes);
+    m_RateConstants.push_back(rateConstant);
+    m_TransitionCategories.push_back(category);
+    m_TransitionFlags.push_back(flags);
+    return m_RateConstants.size() - 1;
+}
+
+/*---------------------------------------------------------------------------*/
+namespace {
+    struct SPendingSection {
+        SModelFileSection m_Sec;
+        const void *m_Data;
+    };
+
+    template <class T>
+    void AddSection(vector<SPendingSection> &secs, EModelSection id,
+                    const vector<T> &data) {
+        SPendingSection p;
+        p.m_Sec.m_Id = id;
+        p.m_Sec.m_ElemSize = sizeof(T);
+        p.m_Sec.m_Offset = 0;
+        p.m_Sec.m_Count = data.size();
+        p.m_Data = data.empty() ? NULL : &data[0];
+        secs.push_back(p);
+    }
+
+    void FlattenStrings(const vector<string> &strs, vector<uint64_t> &offsets,
+                        vector<char> &chars) {
+        offsets.assign(1, 0);
+        for (unsigned int i = 0;  i < strs.size();  ++i) {
+            chars.insert(chars.end(), strs[i].begin(), strs[i].end());
+            offsets.push_back(chars.size());
+        }
+    }
+
+    template <class T>
+    void FlattenRows(const vector< vector<T> > &rows, vector<uint64_t> &offsets,
+                     vector<T> &entries) {
+        offsets.assign(1, 0);
+        for (unsigned int j = 0;  j < rows.size();  ++j) {
+            entries.insert(entries.end(), rows[j].begin(), rows[j].end());
+            offsets.push_back(entries.size());
+        }
+    }
+
+    uint64_t AlignUp(uint64_t x) {
+        return (x + kModelFormatAlignment - 1) /
+            kModelFormatAlignment * kModelFormatAlignment;
+    }
+
+    // PRE : header's species, transition & category counts set
+    // POST: sections laid out & written to path (overwriting any existing
+    // file), with the rest of the header filled in
+    void WriteSections(const string &path, SModelFileHeader header,
+                       vector<SPendingSection> &secs) {
+        uint64_t offset = AlignUp(sizeof(SModelFileHeader) +
+                                  secs.size() * sizeof(SModelFileSection));
+        for (unsigned int s = 0;  s < secs.size();  ++s) {
+            secs[s].m_Sec.m_Offset = offset;
+            offset = AlignUp(offset + secs[s].m_Sec.m_Count * secs[s].m_Sec.m_ElemSize);
+        }
+
+        memcpy(header.m_Magic, kModelFormatMagic, sizeof(kModelFormatMagic));
+        header.m_Version = kModelFormatVersion;
+        header.m_EndianCheck = kModelFormatEndianCheck;
+        header.m_NumSections = secs.size();
+        header.m_FileSize = offset;
+
+        ofstream out(path.c_str(), ios::binary | ios::trunc);
+        if (!out) {
+            throwError("unable to create model file '" << path << "'");
+        }
+        const char zeros[kModelFormatAlignment] = { 0 };
+        uint64_t pos = 0;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        pos += sizeof(header);
+        for (unsigned int s = 0;  s < secs.size();  ++s) {
+            out.write(reinterpret_cast<const char*>(&secs[s].m_Sec),
+                      sizeof(SModelFileSection));
+            pos += sizeof(SModelFileSection);
+        }
+        for (unsigned int s = 0;  s < secs.size();  ++s) {
+            out.write(zeros, secs[s].m_Sec.m_Offset - pos);
+            uint64_t bytes = secs[s].m_Sec.m_Count * secs[s].m_Sec.m_ElemSize;
+            if (bytes > 0) {
+                out.write(static_cast<const char*>(secs[s].m_Data), bytes);
+            }
+            pos = secs[s].m_Sec.m_Offset + bytes;
+        }
+        out.write(zeros, header.m_FileSize - pos);
+        if (!out) {
+            throwError("error while writing model file '" << path << "'");
+        }
+    }
+}
+
+// PRE : at least one species & transition added
+// POST: model written to path (overwriting any existing file)
+void CModelFileWriter::Write(const string &path) const {
+    if (m_SpeciesNames.empty()  ||  m_RateConstants.empty()) {
+        throwError("refusing to write model without species or transitions");
+    }
+
+    vector<uint64_t> speciesNameOffsets, categoryNameOffsets;
+    vector<char> speciesNameChars, categoryNameChars;
+    FlattenStrings(m_SpeciesNames, speciesNameOffsets, speciesNameChars);
+    FlattenStrings(m_CategoryNames, categoryNameOffsets, categoryNameChars);
+    vector<uint64_t> changeOffsets, reactantOffsets;
+    vector<SChange> changes;
+    vector<SReactant> reactants;
+    FlattenRows(m_Changes, changeOffsets, changes);
+    FlattenRows(m_Reactants, reactantOffsets, reactants);
+
+    vector<SPendingSection> secs;
+    AddSection(secs, eSecSpeciesNameOffsets, speciesNameOffsets);
+    AddSection(secs, eSecSpeciesNameChars, speciesNameChars);
+    AddSection(secs, eSecSpeciesCategories, m_SpeciesCategories);
+    AddSection(secs, eSecInitialState, m_InitialState);
+    AddSection(secs, eSecChangeOffsets, changeOffsets);
+    AddSection(secs, eSecChanges, changes);
+    AddSection(secs, eSecReactantOffsets, reactantOffsets);
+    AddSection(secs, eSecReactants, reactants);
+    AddSection(secs, eSecRateConstants, m_RateConstants);
+    AddSection(secs, eSecTransitionCategories, m_TransitionCategories);
+    AddSection(secs, eSecTransitionFlags, m_TransitionFlags);
+    if (!m_CategoryNames.empty()) {
+        AddSection(secs, eSecCategoryNameOffsets, categoryNameOffsets);
+        AddSection(secs, eSecCategoryNameChars, categoryNameChars);
+    }
+
+    if (!m_TauLeapingParams.empty()) {
+        AddSection(secs, eSecTauLeapingParams, m_TauLeapingParams);
+    }
+
+    SModelFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.m_NumSpecies = m_SpeciesNames.size();
+    header.m_NumTransitions = m_RateConstants.size();
+    header.m_NumCategories = m_CategoryNames.size();
+    WriteSections(path, header, secs);
+}
+
+/*---------------------------------------------------------------------------*/
+void SaveTauLeapingParams(const string &path, const STauLeapingParams &params) {
+    const string tmp = path + ".tmp";
+    {
+        CModelFile model(path);
+        vector<SPendingSection> secs;
+        for (unsigned int k = 0;  k < model.m_Header->m_NumSections;  ++k) {
+            if (model.m_Sections[k].m_Id != (uint32_t) eSecTauLeapingParams) {
+                SPendingSection p;
+                p.m_Sec = model.m_Sections[k];
+                p.m_Data = model.m_Base + p.m_Sec.m_Offset;
+                secs.push_back(p);
+            }
+        }
+        const vector<STauLeapingParams> stored(1, params);
+        AddSection(secs, eSecTauLeapingParams, stored);
+        WriteSections(tmp, *model.m_Header, secs);
+    }
+    //replace path atomically; on failure it stays as it was, next to tmp
+#ifdef _WIN32
+    const bool replaced = MoveFileExA(tmp.c_str(), path.c_str(),
+                                      MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    const bool replaced = rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+    if (!replaced) {
+        throwError("unable to replace model file '" << path << "'; the "
+                   "updated model is in '" << tmp << "'");
+    }
+}
@@ -0,0 +1,324 @@
+/*  modelformat.h
+    --------------------------------------------------------------------------
+    Versioned binary model format shared between ClmGenerator and the
+    stochastic solver core.
+
+    The file is a fixed header, followed by a table of sections, followed by
+    the section payloads.  Every payload starts on a 64-byte boundary and is a
+    plain array of little-endian PODs, so that a reader can mmap the file and
+    use the arrays in place (no parsing, no copying).  Sections with unknown
+    ids are skipped by the reader, which lets newer writers add optional data
+    without breaking older engines; incompatible layout changes must bump
+    kModelFormatVersion.
+
+    Propensities follow the mass-action convention
+        a_j(x) = c_j * prod_i x_i (x_i - 1) ... (x_i - n_ij + 1)
+    where c_j is the stochastic rate constant (in molecule-count units) and
+    n_ij the order of reactant i in transition j.  A deterministic rate
+    constant k for concentrations in a system of size V therefore converts as
+    c = k * V^(1 - sum_i n_ij).
+
+    The F# writer lives in ClmGenerator/BinaryModelWriter.fs and must be kept
+    in sync with the layout below.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_MODELFORMAT_H
+#define ADAPTIVETAU_MODELFORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+const char kModelFormatMagic[8] = { 'C', 'L', 'M', 'M', 'O', 'D', 'E', 'L' };
+const uint32_t kModelFormatVersion = 1;
+const uint32_t kModelFormatEndianCheck = 0x01020304;
+const uint32_t kModelFormatAlignment = 64;
+
+// one non-zero entry of the stoichiometry (state change) of a transition
+struct SChange {
+    int32_t m_State;
+    int32_t m_Mag;
+};
+
+// one reactant of a mass-action transition
+struct SReactant {
+    int32_t m_State;
+    int32_t m_Order;
+};
+
+// optional per-transition flags (same meaning as the deterministic /
+// halting arguments of simAdaptiveTau)
+enum ETransitionFlags {
+    eTransDeterministic = 1,
+    eTransHalting = 2
+};
+
+enum EModelSection {
+    eSecSpeciesNameOffsets = 1,  // uint64_t[numSpecies+1] into name chars
+    eSecSpeciesNameChars,        // char[], names are not NUL terminated
+    eSecSpeciesCategories,       // uint32_t[numSpecies], index of category name
+    eSecInitialState,            // double[numSpecies], molecule counts
+    eSecChangeOffsets,           // uint64_t[numTransitions+1] into changes
+    eSecChanges,                 // SChange[]
+    eSecReactantOffsets,         // uint64_t[numTransitions+1] into reactants
+    eSecReactants,               // SReactant[]
+    eSecRateConstants,           // double[numTransitions]
+    eSecTransitionCategories,    // uint32_t[numTransitions], index of category name
+    eSecTransitionFlags,         // uint32_t[numTransitions], ETransitionFlags
+    eSecCategoryNameOffsets,     // uint64_t[numCategories+1] into category chars
+    eSecCategoryNameChars,       // char[]
+    eSecTauLeapingParams         // STauLeapingParams[1], tuned (see autotune.h)
+};
+
+// tau leaping parameters stored with a model (see CStochasticEqns for
+// their meaning); all doubles, so the layout has no padding.  Written by
+// the C++ side only (ClmGenerator does not tune).
+struct STauLeapingParams {
+    double m_Epsilon;
+    double m_Delta;
+    double m_Ncritical;
+    double m_Nstiff;
+    double m_ExactThreshold;
+    double m_NumExactSteps[3];   // indexed by EStepType
+    double m_ITLConvergenceTol;
+    double m_MaxTau;             // infinity == unlimited
+};
+
+struct SModelFileHeader {
+    char m_Magic[8];
+    uint32_t m_Version;
+    uint32_t m_EndianCheck;
+    uint32_t m_NumSpecies;
+    uint32_t m_NumTransitions;
+    uint32_t m_NumCategories;
+    uint32_t m_NumSections;
+    uint64_t m_FileSize;
+};
+
+struct SModelFileSection {
+    uint32_t m_Id;
+    uint32_t m_ElemSize;
+    uint64_t m_Offset; // from start of file
+    uint64_t m_Count;  // number of elements
+};
+
+/*---------------------------------------------------------------------------*/
+// Read-only view of one row of a compressed sparse row structure.
+template <class T>
+class CRow {
+public:
+    CRow(void) : m_Begin(NULL), m_Size(0) {}
+    CRow(const T *begin, unsigned int size) : m_Begin(begin), m_Size(size) {}
+    unsigned int size(void) const { return m_Size; }
+    bool empty(void) const { return m_Size == 0; }
+    const T& operator[](unsigned int i) const { return m_Begin[i]; }
+    const T* begin(void) const { return m_Begin; }
+    const T* end(void) const { return m_Begin + m_Size; }
+private:
+    const T *m_Begin;
+    unsigned int m_Size;
+};
+
+/*---------------------------------------------------------------------------*/
+// Compressed sparse rows (offsets + entries).  Either owns its storage (built
+// from nested vectors) or is a view over memory owned by someone else, e.g. a
+// memory-mapped CModelFile, which must then outlive this object.
+template <class T>
+class CSparseRows {
+public:
+    CSparseRows(void) : m_Offsets(NULL), m_Entries(NULL), m_NumRows(0) {}
+    CSparseRows(const CSparseRows &o) { x_Copy(o); }
+    CSparseRows& operator=(const CSparseRows &o) {
+        if (this != &o) {
+            x_Copy(o);
+        }
+        return *this;
+    }
+
+    void Assign(const std::vector< std::vector<T> > &rows) {
+        m_OwnedOffsets.assign(1, 0);
+        m_OwnedEntries.clear();
+        for (unsigned int j = 0;  j < rows.size();  ++j) {
+            m_OwnedEntries.insert(m_OwnedEntries.end(),
+                                  rows[j].begin(), rows[j].end());
+            m_OwnedOffsets.push_back(m_OwnedEntries.size());
+        }
+        m_NumRows = rows.size();
+        x_PointAtOwned();
+    }
+    void Attach(const uint64_t *offsets, const T *entries,
+                unsigned int numRows) {
+        m_OwnedOffsets.clear();
+        m_OwnedEntries.clear();
+        m_Offsets = offsets;
+        m_Entries = entries;
+        m_NumRows = numRows;
+    }
+
+    unsigned int size(void) const { return m_NumRows; }
+    uint64_t NumEntries(void) const {
+        return m_NumRows == 0 ? 0 : m_Offsets[m_NumRows];
+    }
+    CRow<T> operator[](unsigned int j) const {
+        return CRow<T>(m_Entries + m_Offsets[j],
+                       (unsigned int) (m_Offsets[j+1] - m_Offsets[j]));
+    }
+    // POST: view over the same rows (nothing copied; this must outlive it)
+    CSparseRows View(void) const {
+        CSparseRows res;
+        res.Attach(m_Offsets, m_Entries, m_NumRows);
+        return res;
+    }
+
+private:
+    void x_PointAtOwned(void) {
+        m_Offsets = m_OwnedOffsets.empty() ? NULL : &m_OwnedOffsets[0];
+        m_Entries = m_OwnedEntries.empty() ? NULL : &m_OwnedEntries[0];
+    }
+    void x_Copy(const CSparseRows &o) {
+        m_OwnedOffsets = o.m_OwnedOffsets;
+        m_OwnedEntries = o.m_OwnedEntries;
+        m_NumRows = o.m_NumRows;
+        if (o.m_OwnedOffsets.empty()) {
+            m_Offsets = o.m_Offsets;
+            m_Entries = o.m_Entries;
+        } else {
+            x_PointAtOwned();
+        }
+    }
+
+    std::vector<uint64_t> m_OwnedOffsets;
+    std::vector<T> m_OwnedEntries;
+    const uint64_t *m_Offsets;
+    const T *m_Entries;
+    unsigned int m_NumRows;
+};
+
+/*---------------------------------------------------------------------------*/
+// Memory-mapped, read-only model file.  All accessors point straight into
+// the mapping; nothing is copied.  Throws runtime_error if the file cannot
+// be mapped or fails validation.
+class CModelFile {
+public:
+    explicit CModelFile(const std::string &path);
+    ~CModelFile(void);
+
+    const std::string& GetPath(void) const { return m_Path; }
+    unsigned int NumSpecies(void) const { return m_Header->m_NumSpecies; }
+    unsigned int NumTransitions(void) const { return m_Header->m_NumTransitions; }
+    unsigned int NumCategories(void) const { return m_Header->m_NumCategories; }
+
+    bool HasSpeciesNames(void) const { return m_SpeciesNameOffsets != NULL; }
+    std::string SpeciesName(unsigned int i) const {
+        return x_String(m_SpeciesNameOffsets, m_SpeciesNameChars, i);
+    }
+    unsigned int SpeciesCategory(unsigned int i) const {
+        return m_SpeciesCategories ? m_SpeciesCategories[i] : 0;
+    }
+    const double* InitialState(void) const { return m_InitialState; }
+    const CSparseRows<SChange>& Changes(void) const { return m_Changes; }
+    const CSparseRows<SReactant>& Reactants(void) const { return m_Reactants; }
+    const double* RateConstants(void) const { return m_RateConstants; }
+    unsigned int TransitionCategory(unsigned int j) const {
+        return m_TransitionCategories ? m_TransitionCategories[j] : 0;
+    }
+    uint32_t TransitionFlags(unsigned int j) const {
+        return m_TransitionFlags ? m_TransitionFlags[j] : 0;
+    }
+    std::string CategoryName(unsigned int k) const {
+        return x_String(m_CategoryNameOffsets, m_CategoryNameChars, k);
+    }
+    // tuned parameters stored with the model; NULL if none
+    const STauLeapingParams* TauLeapingParams(void) const {
+        return m_TauLeapingParams;
+    }
+
+private:
+    friend void SaveTauLeapingParams(const std::string &path,
+                                     const STauLeapingParams &params);
+    CModelFile(const CModelFile&);
+    CModelFile& operator=(const CModelFile&);
+
+    void x_Map(void);
+    void x_Unmap(void);
+    void x_Validate(void);
+    const void* x_Section(EModelSection id, uint32_t elemSize,
+                          uint64_t count, bool required) const;
+    static std::string x_String(const uint64_t *offsets, const char *chars,
+                                unsigned int i) {
+        return offsets ? std::string(chars + offsets[i],
+                                     offsets[i+1] - offsets[i])
+                       : std::string();
+    }
+
+    std::string m_Path;
+    const unsigned char *m_Base;
+    uint64_t m_Size;
+#ifdef _WIN32
+    void *m_FileHandle;
+    void *m_MappingHandle;
+#endif
+
+    const SModelFileHeader *m_Header;
+    const SModelFileSection *m_Sections;
+    const uint64_t *m_SpeciesNameOffsets;
+    const char *m_SpeciesNameChars;
+    const uint32_t *m_SpeciesCategories;
+    const double *m_InitialState;
+    CSparseRows<SChange> m_Changes;
+    CSparseRows<SReactant> m_Reactants;
+    const double *m_RateConstants;
+    const uint32_t *m_TransitionCategories;
+    const uint32_t *m_TransitionFlags;
+    const uint64_t *m_CategoryNameOffsets;
+    const char *m_CategoryNameChars;
+    const STauLeapingParams *m_TauLeapingParams;
+};
+
+// PRE : path of a model file that is not mapped by a CModelFile (Windows
+// cannot replace a mapped file)
+// POST: file rewritten with params stored (replacing any stored before);
+// all other sections, including unknown ones, are kept as they were
+void SaveTauLeapingParams(const std::string &path,
+                          const STauLeapingParams &params);
+
+/*---------------------------------------------------------------------------*/
+// Accumulates a model in memory and writes it in the layout read by
+// CModelFile.  Used by tools that build models on the C++ side; ClmGenerator
+// has its own writer (see top of file).
+class CModelFileWriter {
+public:
+    unsigned int AddCategory(const std::string &name);
+    unsigned int AddSpecies(const std::string &name, unsigned int category,
+                            double initialCount);
+    unsigned int AddTransition(const std::vector<SReactant> &reactants,
+                               const std::vector<SChange> &changes,
+                               double rateConstant, unsigned int category,
+                               uint32_t flags = 0);
+    unsigned int NumSpecies(void) const { return m_SpeciesNames.size(); }
+    unsigned int NumTransitions(void) const { return m_RateConstants.size(); }
+    void SetInitialCount(unsigned int i, double initialCount) {
+        m_InitialState.at(i) = initialCount;
+    }
+    void SetTauLeapingParams(const STauLeapingParams &params) {
+        m_TauLeapingParams.assign(1, params);
+    }
+
+    void Write(const std::string &path) const;
+
+private:
+    std::vector<std::string> m_CategoryNames;
+    std::vector<std::string> m_SpeciesNames;
+    std::vector<uint32_t> m_SpeciesCategories;
+    std::vector<double> m_InitialState;
+    std::vector< std::vector<SChange> > m_Changes;
+    std::vector< std::vector<SReactant> > m_Reactants;
+    std::vector<double> m_RateConstants;
+    std::vector<uint32_t> m_TransitionCategories;
+    std::vector<uint32_t> m_TransitionFlags;
+    std::vector<STauLeapingParams> m_TauLeapingParams; // 0 or 1
+};
+
+#endif //ADAPTIVETAU_MODELFORMAT_H
@@ -0,0 +1,276 @@
+/*  modelkernels.cpp
+    --------------------------------------------------------------------------
+    Generator & loader for model-specialized kernels (see modelkernels.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "modelkernels.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+// number of transitions (or species) handled by one generated function;
+// keeps individual functions small enough for the optimizer
+const unsigned int kKernelChunk = 1024;
+
+/*---------------------------------------------------------------------------*/
+namespace {
+    // FNV-1a
+    void HashBytes(uint64_t &h, const void *data, size_t n) {
+        const unsigned char *p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0;  i < n;  ++i) {
+            h ^= p[i];
+            h *= 1099511628211ULL;
+        }
+    }
+}
+
+uint64_t ModelChecksum(const CModelFile &model) {
+    uint64_t h = 14695981039346656037ULL;
+    const uint32_t nS = model.NumSpecies(), nT = model.NumTransitions();
+    HashBytes(h, &nS, sizeof(nS));
+    HashBytes(h, &nT, sizeof(nT));
+    HashBytes(h, model.RateConstants(), nT*sizeof(double));
+    for (unsigned int j = 0;  j < nT;  ++j) {
+        const CRow<SChange> nu = model.Changes()[j];
+        const CRow<SReactant> r = model.Reactants()[j];
+        const uint32_t sizes[2] = { nu.size(), r.size() };
+        HashBytes(h, sizes, sizeof(sizes));
+        HashBytes(h, nu.begin(), nu.size()*sizeof(SChange));
+        HashBytes(h, r.begin(), r.size()*sizeof(SReactant));
+    }
+    return h;
+}
+
+/*---------------------------------------------------------------------------*/
+namespace {
+    void WriteChunkedDispatch(ostream &out, const char *name,
+                              const char *params, const char *args,
+                              unsigned int numChunks) {
+        out << "extern \"C\" void " << name << "(" << params << ") {\n";
+        for (unsigned int c = 0;  c < numChunks;  ++c) {
+            out << "    " << name << "_" << c << "(" << args << ");\n";
+        }
+        out << "}\n\n";
+    }
+}
+
+// PRE : model; stream to receive C++ source
+// POST: source for model-specialized kernels written
+void WriteModelKernels(const CModelFile &model, ostream &out) {
+    const unsigned int nS = model.NumSpecies(), nT = model.NumTransitions();
+    const CSparseRows<SChange> &nu = model.Changes();
+    const CSparseRows<SReactant> &reactants = model.Reactants();
+    const double *c = model.RateConstants();
+
+    ostringstream checksum;
+    checksum << "0x" << hex << ModelChecksum(model) << "ULL";
+    out << setprecision(numeric_limits<double>::max_digits10);
+
+    out << "// Generated from model '" << model.GetPath() << "' -- do not edit.\n"
+        "// " << nS << " species, " << nT << " transitions.\n"
+        "#include <stdint.h>\n\n"
+        "#ifdef _WIN32\n"
+        "#define KERNELS_EXPORT __declspec(dllexport)\n"
+        "#else\n"
+        "#define KERNELS_EXPORT __attribute__((visibility(\"default\")))\n"
+        "#endif\n\n"
+        "extern \"C\" {\n"
+        "    struct SModelKernels {\n"
+        "        uint32_t m_AbiVersion;\n"
+        "        uint32_t m_NumSpecies;\n"
+        "        uint32_t m_NumTransitions;\n"
+        "        uint32_t m_Reserved;\n"
+        "        uint64_t m_ModelChecksum;\n"
+        "        void (*m_CalcRates)(const double *x, double *rates);\n"
+        "        void (*m_ApplyTransition)(unsigned int j, double times, double *x);\n"
+        "        void (*m_ApplyFirings)(const double *firings, double *x);\n"
+        "    };\n"
+        "}\n\n"
+        "namespace {\n"
+        "    // falling factorial x (x-1) ... (x-N+1), clamped at 0\n"
+        "    template <int N> inline double FF(double x) {\n"
+        "        const double y = x - (N-1);\n"
+        "        return FF<N-1>(x) * (y > 0 ? y : 0.);\n"
+        "    }\n"
+        "    template <> inline double FF<0>(double) { return 1; }\n"
+        "    template <> inline double FF<1>(double x) { return x; }\n"
+        "}\n\n";
+
+    //propensities: one statement per transition, constants folded in
+    const unsigned int rateChunks = (nT + kKernelChunk - 1) / kKernelChunk;
+    for (unsigned int chunk = 0;  chunk < rateChunks;  ++chunk) {
+        out << "static void CalcRates_" << chunk <<
+            "(const double *x, double *r) {\n";
+        for (unsigned int j = chunk*kKernelChunk;
+             j < nT  &&  j < (chunk+1)*kKernelChunk;  ++j) {
+            out << "    r[" << j << "] = ";
+            if (c[j] == 0) {
+                out << "0;\n";
+                continue;
+            }
+            out << c[j];
+            const CRow<SReactant> r = reactants[j];
+            for (unsigned int k = 0;  k < r.size();  ++k) {
+                out << " * FF<" << r[k].m_Order << ">(x[" << r[k].m_State << "])";
+            }
+            out << ";\n";
+        }
+        out << "}\n\n";
+    }
+    WriteChunkedDispatch(out, "CalcRates", "const double *x, double *r",
+                         "x, r", rateChunks);
+
+    //single transition: unrolled per transition, dispatched by table
+    for (unsigned int chunk = 0;  chunk < rateChunks;  ++chunk) {
+        out << "static void ApplyTransition_" << chunk <<
+            "(unsigned int j, double k, double *x) {\n"
+            "    switch (j) {\n";
+        for (unsigned int j = chunk*kKernelChunk;
+             j < nT  &&  j < (chunk+1)*kKernelChunk;  ++j) {
+            out << "    case " << j << ":";
+            const CRow<SChange> n = nu[j];
+            for (unsigned int i = 0;  i < n.size();  ++i) {
+                out << " x[" << n[i].m_State << "] " <<
+                    (n[i].m_Mag < 0 ? "-" : "+") << "= ";
+                if (abs(n[i].m_Mag) != 1) {
+                    out << abs(n[i].m_Mag) << "*";
+                }
+                out << "k;";
+            }
+            out << " return;\n";
+        }
+        out << "    }\n}\n\n";
+    }
+    out << "typedef void (*TApplyTransition)(unsigned int, double, double*);\n"
+        "static const TApplyTransition kApplyTransition[] = {\n";
+    for (unsigned int chunk = 0;  chunk < rateChunks;  ++chunk) {
+        out << "    ApplyTransition_" << chunk << ",\n";
+    }
+    out << "};\n\n"
+        "extern \"C\" void ApplyTransition(unsigned int j, double k, double *x) {\n"
+        "    kApplyTransition[j / " << kKernelChunk << "](j, k, x);\n"
+        "}\n\n";
+
+    //all firings: transposed to a gather per species, so that every
+    //species is written exactly once
+    vector< vector<pair<unsigned int, int> > > bySpecies(nS);
+    for (unsigned int j = 0;  j < nT;  ++j) {
+        const CRow<SChange> n = nu[j];
+        for (unsigned int i = 0;  i < n.size();  ++i) {
+            bySpecies[n[i].m_State].push_back(make_pair(j, n[i].m_Mag));
+        }
+    }
+    const unsigned int firingChunks = (nS + kKernelChunk - 1) / kKernelChunk;
+    for (unsigned int chunk = 0;  chunk < firingChunks;  ++chunk) {
+        out << "static void ApplyFirings_" << chunk <<
+            "(const double *f, double *x) {\n";
+        for (unsigned int i = chunk*kKernelChunk;
+             i < nS  &&  i < (chunk+1)*kKernelChunk;  ++i) {
+            if (bySpecies[i].empty()) {
+                continue;
+            }
+            out << "    x[" << i << "] +=";
+            for (unsigned int k = 0;  k < bySpecies[i].size();  ++k) {
+                const int mag = bySpecies[i][k].second;
+                out << (mag < 0 ? " - " : (k > 0 ? " + " : " "));
+                if (abs(mag) != 1) {
+                    out << abs(mag) << "*";
+                }
+                out << "f[" << bySpecies[i][k].first << "]";
+            }
+            out << ";\n";
+        }
+        out << "}\n\n";
+    }
+    WriteChunkedDispatch(out, "ApplyFirings", "const double *f, double *x",
+                         "f, x", firingChunks);
+
+    out << "static const SModelKernels kKernels = {\n"
+        "    " << kModelKernelsAbiVersion << ", " << nS << ", " << nT << ", 0,\n"
+        "    " << checksum.str() << ",\n"
+        "    CalcRates, ApplyTransition, ApplyFirings\n"
+        "};\n\n"
+        "extern \"C\" KERNELS_EXPORT const SModelKernels* "
+        ADAPTIVETAU_KERNELS_ENTRY "(void) {\n"
+        "    return &kKernels;\n"
+        "}\n";
+    if (!out) {
+        throwError("error while writing kernels for model '" <<
+                   model.GetPath() << "'");
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+CModelKernels::CModelKernels(const string &path, const CModelFile &model)
+    : m_Library(NULL), m_Kernels(NULL) {
+    TGetModelKernels getKernels;
+#ifdef _WIN32
+    HMODULE lib = LoadLibraryA(path.c_str());
+    if (lib == NULL) {
+        throwError("unable to load model kernels '" << path << "'");
+    }
+    m_Library = lib;
+    getKernels = reinterpret_cast<TGetModelKernels>
+        (GetProcAddress(lib, ADAPTIVETAU_KERNELS_ENTRY));
+#else
+    m_Library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (m_Library == NULL) {
+        throwError("unable to load model kernels '" << path << "': " <<
+                   dlerror());
+    }
+    getKernels = reinterpret_cast<TGetModelKernels>
+        (dlsym(m_Library, ADAPTIVETAU_KERNELS_ENTRY));
+#endif
+    try {
+        if (getKernels == NULL  ||  (m_Kernels = getKernels()) == NULL) {
+            throwError("'" << path << "' does not contain model kernels");
+        }
+        if (m_Kernels->m_AbiVersion != kModelKernelsAbiVersion) {
+            throwError("model kernels '" << path << "' were generated for "
+                       "ABI version " << m_Kernels->m_AbiVersion <<
+                       " but this engine uses version " <<
+                       kModelKernelsAbiVersion);
+        }
+        if (m_Kernels->m_NumSpecies != model.NumSpecies()  ||
+            m_Kernels->m_NumTransitions != model.NumTransitions()  ||
+            m_Kernels->m_ModelChecksum != ModelChecksum(model)) {
+            throwError("model kernels '" << path << "' were not generated "
+                       "from model '" << model.GetPath() << "'");
+        }
+    } catch (...) {
+#ifdef _WIN32
+        FreeLibrary(static_cast<HMODULE>(m_Library));
+#else
+        dlclose(m_Library);
+#endif
+        throw;
+    }
+}
+
+CModelKernels::~CModelKernels(void) {
+#ifdef _WIN32
+    FreeLibrary(static_cast<HMODULE>(m_Library));
+#else
+    dlclose(m_Library);
+#endif
+}
@@ -0,0 +1,82 @@
+/*  modelkernels.h
+    --------------------------------------------------------------------------
+    Model-specialized propensity & update kernels.
+
+    WriteModelKernels() turns a binary model (see modelformat.h) into a
+    self-contained C++ source in which stoichiometry and rate constants are
+    literals, propensities are built from per-order template kernels and
+    state updates are fully unrolled.  The source is compiled into a shared
+    object, e.g.
+        g++ -O3 -march=native -shared -fPIC kernels.cpp -o kernels.so
+    or (under R)
+        R CMD SHLIB kernels.cpp
+    and CModelKernels loads it back so that the engine can use it in place
+    of the generic loops over m_Nu.  The shared object is tied to the exact
+    model it was generated from by a checksum over the model structure.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_MODELKERNELS_H
+#define ADAPTIVETAU_MODELKERNELS_H
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+
+#include "modelformat.h"
+
+// bump whenever SModelKernels changes; generated sources carry a copy
+const uint32_t kModelKernelsAbiVersion = 1;
+#define ADAPTIVETAU_KERNELS_ENTRY "AdaptiveTauGetModelKernels"
+
+extern "C" {
+    struct SModelKernels {
+        uint32_t m_AbiVersion;
+        uint32_t m_NumSpecies;
+        uint32_t m_NumTransitions;
+        uint32_t m_Reserved;
+        uint64_t m_ModelChecksum;
+        // rates[j] = propensity of transition j at state x
+        void (*m_CalcRates)(const double *x, double *rates);
+        // x += times * nu[j]
+        void (*m_ApplyTransition)(unsigned int j, double times, double *x);
+        // x += nu . firings (firings has one entry per transition)
+        void (*m_ApplyFirings)(const double *firings, double *x);
+    };
+    typedef const SModelKernels* (*TGetModelKernels)(void);
+}
+
+// checksum over everything that the generated kernels hard-code
+uint64_t ModelChecksum(const CModelFile &model);
+
+// PRE : model; stream to receive C++ source
+// POST: source for model-specialized kernels written
+void WriteModelKernels(const CModelFile &model, std::ostream &out);
+
+/*---------------------------------------------------------------------------*/
+// Loads compiled kernels from a shared object & checks that they were
+// generated from the given model.  Throws runtime_error otherwise.
+class CModelKernels {
+public:
+    CModelKernels(const std::string &path, const CModelFile &model);
+    ~CModelKernels(void);
+
+    void CalcRates(const double *x, double *rates) const {
+        m_Kernels->m_CalcRates(x, rates);
+    }
+    void ApplyTransition(unsigned int j, double times, double *x) const {
+        m_Kernels->m_ApplyTransition(j, times, x);
+    }
+    void ApplyFirings(const double *firings, double *x) const {
+        m_Kernels->m_ApplyFirings(firings, x);
+    }
+
+private:
+    CModelKernels(const CModelKernels&);
+    CModelKernels& operator=(const CModelKernels&);
+
+    void *m_Library;
+    const SModelKernels *m_Kernels;
+};
+
+#endif //ADAPTIVETAU_MODELKERNELS_H
@@ -0,0 +1,345 @@
+/*  moments.cpp
+    --------------------------------------------------------------------------
+    Linear noise approximation & moment closure (see moments.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+#include "moments.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+namespace {
+    // Dormand & Prince (1980) 5(4), first same as last
+    const double kA21 = 1./5;
+    const double kA31 = 3./40,       kA32 = 9./40;
+    const double kA41 = 44./45,      kA42 = -56./15,      kA43 = 32./9;
+    const double kA51 = 19372./6561, kA52 = -25360./2187, kA53 = 64448./6561,
+                 kA54 = -212./729;
+    const double kA61 = 9017./3168,  kA62 = -355./33,     kA63 = 46732./5247,
+                 kA64 = 49./176,     kA65 = -5103./18656;
+    const double kB1 = 35./384,      kB3 = 500./1113,     kB4 = 125./192,
+                 kB5 = -2187./6784,  kB6 = 11./84;
+    // 5th minus 4th order weights
+    const double kE1 = 71./57600,    kE3 = -71./16695,    kE4 = 71./1920,
+                 kE5 = -17253./339200, kE6 = 22./525,     kE7 = -1./40;
+
+    // product of f[0..n) but f[skip1] & f[skip2]
+    inline double ProductExcept(const double *f, unsigned int n,
+                                unsigned int skip1, unsigned int skip2) {
+        double p = 1;
+        for (unsigned int k = 0;  k < n;  ++k) {
+            if (k != skip1  &&  k != skip2) {
+                p *= f[k];
+            }
+        }
+        return p;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+CMomentEquations::CMomentEquations(const TCompiledModelPtr &compiled,
+                                   const double *initVal)
+    : m_Compiled(compiled), m_NumStates(compiled->NumStates()),
+      m_Closure(eLinearNoise), m_RelTol(1e-6), m_AbsTol(1e-6), m_MaxSteps(0),
+      m_Control(NULL) {
+    if (!compiled->Model()) {
+        throwError("moment equations need a compiled binary model");
+    }
+    if (!compiled->TransByCat(eDeterministic).empty()  ||
+        !compiled->TransByCat(eHalting).empty()) {
+        throwError("moment equations do not support deterministic or "
+                   "halting transitions");
+    }
+    const double *x0 = initVal ? initVal : compiled->Model()->InitialState();
+    m_InitVal.assign(x0, x0 + m_NumStates);
+}
+
+void CMomentEquations::SetTimes(const vector<double> &times) {
+    for (unsigned int p = 0;  p < times.size();  ++p) {
+        if (!(times[p] >= 0)  ||  (p > 0  &&  !(times[p] > times[p-1]))) {
+            throwError("moment times must be increasing & not negative");
+        }
+    }
+    m_Times = times;
+}
+
+void CMomentEquations::AddObservable(const string &name,
+                                     const CStopCriteria::TWeights &weights) {
+    for (unsigned int k = 0;  k < weights.size();  ++k) {
+        if (weights[k].first >= m_NumStates) {
+            throwError("observable '" << name << "': species " <<
+                       weights[k].first+1 << " does not exist");
+        }
+    }
+    m_ObservableNames.push_back(name);
+    m_Observables.push_back(weights);
+}
+
+void CMomentEquations::SetTolerances(double relTol, double absTol) {
+    if (!(relTol > 0)  ||  !(absTol > 0)) {
+        throwError("moment equation tolerances must be positive");
+    }
+    m_RelTol = relTol;
+    m_AbsTol = absTol;
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : y = (m, C), C by rows
+// POST: dy = (nu E[a], J C + C J' + nu diag(E[a]) nu')
+void CMomentEquations::x_Derivatives(const double *y, double *dy) {
+    const unsigned int n = m_NumStates;
+    const double *mean = y;
+    const double *cov = y + n;
+    double *dMean = dy;
+    double *dCov = dy + n;
+    fill(dy, dy + n + (size_t) n * n, 0.);
+    fill(m_JC.begin(), m_JC.end(), 0.);
+
+    const CSparseRows<SReactant> &reactants = m_Compiled->Model()->Reactants();
+    const double *rateConstants = m_Compiled->Model()->RateConstants();
+    const CSparseRows<SChange> &nu = m_Compiled->Nu();
+    for (unsigned int j = 0;  j < nu.size();  ++j) {
+        const CRow<SReactant> r = reactants[j];
+        const CRow<SChange> change = nu[j];
+        const double c = rateConstants[j];
+        //falling factorial of each reactant & its derivatives, built up
+        //one factor (x - i) at a time
+        for (unsigned int k = 0;  k < r.size();  ++k) {
+            const double x = mean[r[k].m_State];
+            double f = 1, f1 = 0, f2 = 0;
+            for (int i = 0;  i < r[k].m_Order;  ++i) {
+                f2 = f2 * (x - i) + 2 * f1;
+                f1 = f1 * (x - i) + f;
+                f = f * (x - i);
+            }
+            m_F[k] = f;
+            m_F1[k] = f1;
+            m_F2[k] = f2;
+        }
+        const unsigned int none = r.size();
+        double expected = c * ProductExcept(&m_F[0], r.size(), none, none);
+        if (m_Closure == eNormalClosure) {
+            //E[a] = a(m) + sum_kl H_kl C_kl / 2 (C symmetric)
+            for (unsigned int k = 0;  k < r.size();  ++k) {
+                const size_t sk = r[k].m_State;
+                expected += 0.5 * c * m_F2[k] * cov[sk * n + sk] *
+                    ProductExcept(&m_F[0], r.size(), k, none);
+                for (unsigned int k2 = k + 1;  k2 < r.size();  ++k2) {
+                    expected += c * m_F1[k] * m_F1[k2] *
+                        cov[sk * n + r[k2].m_State] *
+                        ProductExcept(&m_F[0], r.size(), k, k2);
+                }
+            }
+        }
+        for (unsigned int i = 0;  i < change.size();  ++i) {
+            const size_t a = change[i].m_State;
+            dMean[a] += change[i].m_Mag * expected;
+            for (unsigned int i2 = 0;  i2 < change.size();  ++i2) {
+                dCov[a * n + change[i2].m_State] += change[i].m_Mag *
+                    change[i2].m_Mag * expected;
+            }
+        }
+        //J C: row a of J is sum_j nu_aj grad a_j, so each reactant of j
+        //adds its row of C, times its derivative, to the rows j changes
+        for (unsigned int k = 0;  k < r.size();  ++k) {
+            const double grad = c * m_F1[k] *
+                ProductExcept(&m_F[0], r.size(), k, none);
+            if (grad == 0) {
+                continue;
+            }
+            const double *row = cov + (size_t) r[k].m_State * n;
+            for (unsigned int i = 0;  i < change.size();  ++i) {
+                double *jc = &m_JC[(size_t) change[i].m_State * n];
+                const double g = change[i].m_Mag * grad;
+                for (unsigned int b = 0;  b < n;  ++b) {
+                    jc[b] += g * row[b];
+                }
+            }
+        }
+    }
+    for (size_t a = 0;  a < n;  ++a) {
+        for (size_t b = 0;  b < n;  ++b) {
+            dCov[a * n + b] += m_JC[a * n + b] + m_JC[b * n + a];
+        }
+    }
+}
+
+void CMomentEquations::x_Record(const double *y, unsigned int p,
+                                SMomentTrajectory &res) const {
+    const unsigned int n = m_NumStates;
+    const unsigned int k = m_Observables.size();
+    for (unsigned int a = 0;  a < k;  ++a) {
+        const CStopCriteria::TWeights &wa = m_Observables[a];
+        double mean = 0;
+        for (unsigned int i = 0;  i < wa.size();  ++i) {
+            mean += wa[i].second * y[wa[i].first];
+        }
+        res.m_Means[(size_t) p * k + a] = mean;
+        for (unsigned int b = 0;  b < k;  ++b) {
+            const CStopCriteria::TWeights &wb = m_Observables[b];
+            double cov = 0;
+            for (unsigned int i = 0;  i < wa.size();  ++i) {
+                for (unsigned int i2 = 0;  i2 < wb.size();  ++i2) {
+                    cov += wa[i].second * wb[i2].second *
+                        y[n + (size_t) wa[i].first * n + wb[i2].first];
+                }
+            }
+            res.m_Covariances[((size_t) p * k + a) * k + b] = cov;
+        }
+    }
+}
+
+double CMomentEquations::x_ErrorNorm(const double *e, const double *y,
+                                     const double *y1) const {
+    const size_t size = m_NumStates + (size_t) m_NumStates * m_NumStates;
+    double sum = 0;
+    for (size_t i = 0;  i < size;  ++i) {
+        const double scale = m_AbsTol + m_RelTol * max(fabs(y[i]), fabs(y1[i]));
+        sum += (e[i] / scale) * (e[i] / scale);
+    }
+    return sqrt(sum / size);
+}
+
+/*---------------------------------------------------------------------------*/
+SMomentTrajectory CMomentEquations::Integrate(void) {
+    if (m_Times.empty()) {
+        throwError("moment equations need output times (see SetTimes)");
+    }
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const unsigned int n = m_NumStates;
+    const size_t size = n + (size_t) n * n;
+    if (m_Observables.empty()) {
+        for (unsigned int i = 0;  i < n;  ++i) {
+            ostringstream name;
+            if (m_Compiled->Model()->HasSpeciesNames()) {
+                name << m_Compiled->Model()->SpeciesName(i);
+            } else {
+                name << "species " << i+1;
+            }
+            AddObservable(name.str(),
+                          CStopCriteria::TWeights(1, make_pair(i, 1.)));
+        }
+    }
+    unsigned int maxReactants = 0;
+    const CSparseRows<SReactant> &reactants = m_Compiled->Model()->Reactants();
+    for (unsigned int j = 0;  j < m_Compiled->NumTransitions();  ++j) {
+        maxReactants = max(maxReactants, (unsigned int) reactants[j].size());
+    }
+    m_F.resize(maxReactants + 1);
+    m_F1.resize(maxReactants + 1);
+    m_F2.resize(maxReactants + 1);
+    m_JC.assign((size_t) n * n, 0.);
+
+    SMomentTrajectory res;
+    res.m_Observables = m_ObservableNames;
+    res.m_Times = m_Times;
+    res.m_Means.resize(m_Times.size() * m_Observables.size());
+    res.m_Covariances.resize(m_Times.size() * m_Observables.size() *
+                             m_Observables.size());
+    res.m_Steps = 0;
+    res.m_RejectedSteps = 0;
+
+    vector<double> y(size, 0.), y1(size), tmp(size), err(size);
+    vector<double> k1(size), k2(size), k3(size), k4(size), k5(size),
+        k6(size), k7(size);
+    copy(m_InitVal.begin(), m_InitVal.end(), y.begin());
+    double t = 0;
+    unsigned int p = 0;
+    for (;  p < m_Times.size()  &&  m_Times[p] <= t;  ++p) {
+        x_Record(&y[0], p, res);
+    }
+
+    //first step from the scale of y & its derivative (Hairer et al.)
+    x_Derivatives(&y[0], &k1[0]);
+    double h;
+    {
+        const double d0 = x_ErrorNorm(&y[0], &y[0], &y[0]);
+        const double d1 = x_ErrorNorm(&k1[0], &y[0], &y[0]);
+        h = (d0 < 1e-5  ||  d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+    }
+    while (p < m_Times.size()) {
+        if (m_Control  &&  m_Control->IsCancelled()) {
+            throwEarlyExit("moment equations cancelled at time " << t);
+        }
+        if (m_MaxSteps > 0  &&  res.m_Steps >= m_MaxSteps) {
+            throwError("moment equations took more than " << m_MaxSteps <<
+                       " steps to reach time " << m_Times[p] <<
+                       " (stopped at " << t << ")");
+        }
+        const bool last = t + h >= m_Times[p];
+        const double step = last ? m_Times[p] - t : h;
+
+        for (size_t i = 0;  i < size;  ++i) {
+            tmp[i] = y[i] + step * kA21 * k1[i];
+        }
+        x_Derivatives(&tmp[0], &k2[0]);
+        for (size_t i = 0;  i < size;  ++i) {
+            tmp[i] = y[i] + step * (kA31 * k1[i] + kA32 * k2[i]);
+        }
+        x_Derivatives(&tmp[0], &k3[0]);
+        for (size_t i = 0;  i < size;  ++i) {
+            tmp[i] = y[i] + step * (kA41 * k1[i] + kA42 * k2[i] + kA43 * k3[i]);
+        }
+        x_Derivatives(&tmp[0], &k4[0]);
+        for (size_t i = 0;  i < size;  ++i) {
+            tmp[i] = y[i] + step * (kA51 * k1[i] + kA52 * k2[i] +
+                                    kA53 * k3[i] + kA54 * k4[i]);
+        }
+        x_Derivatives(&tmp[0], &k5[0]);
+        for (size_t i = 0;  i < size;  ++i) {
+            tmp[i] = y[i] + step * (kA61 * k1[i] + kA62 * k2[i] +
+                                    kA63 * k3[i] + kA64 * k4[i] +
+                                    kA65 * k5[i]);
+        }
+        x_Derivatives(&tmp[0], &k6[0]);
+        for (size_t i = 0;  i < size;  ++i) {
+            y1[i] = y[i] + step * (kB1 * k1[i] + kB3 * k3[i] + kB4 * k4[i] +
+                                   kB5 * k5[i] + kB6 * k6[i]);
+        }
+        x_Derivatives(&y1[0], &k7[0]);
+        for (size_t i = 0;  i < size;  ++i) {
+            err[i] = step * (kE1 * k1[i] + kE3 * k3[i] + kE4 * k4[i] +
+                             kE5 * k5[i] + kE6 * k6[i] + kE7 * k7[i]);
+        }
+        const double norm = x_ErrorNorm(&err[0], &y[0], &y1[0]);
+
+        double factor;
+        if (norm <= 1) {
+            t = last ? m_Times[p] : t + step;
+            y.swap(y1);
+            k1.swap(k7);
+            ++res.m_Steps;
+            for (;  p < m_Times.size()  &&  m_Times[p] <= t;  ++p) {
+                x_Record(&y[0], p, res);
+            }
+            factor = norm > 0 ? min(5., 0.9 * pow(norm, -0.2)) : 5.;
+        } else {
+            ++res.m_RejectedSteps;
+            factor = std::isfinite(norm) ? max(0.2, 0.9 * pow(norm, -0.2)) : 0.2;
+        }
+        if (norm <= 1  &&  last) {
+            //a step cut short to land on an output time says little about
+            //the next one
+            h = max(h, step * factor);
+        } else {
+            h = step * factor;
+        }
+        if (!(h > 1e-14 * max(1., t))) {
+            throwError("moment equations: step size underflow at time " << t);
+        }
+    }
+    res.m_Seconds =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return res;
+}
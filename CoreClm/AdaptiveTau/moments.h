@@ -0,0 +1,121 @@
+/*  moments.h
+    --------------------------------------------------------------------------
+    Means & covariances of a mass-action network by ordinary differential
+    equations instead of an ensemble of trajectories.
+
+    CMomentEquations integrates, for the mean m & the covariance C of the
+    species counts,
+        dm/dt = nu E[a(x)]
+        dC/dt = J C + C J' + nu diag(E[a(x)]) nu'
+    where J = nu da/dx at m, under one of two closures:
+        - eLinearNoise, the linear noise approximation (van Kampen): the
+          mean follows the rate equations, E[a(x)] = a(m), & C is the
+          covariance of the Gaussian fluctuations about them,
+        - eNormalClosure, second-order moment closure: third central
+          moments are taken as 0, so that E[a(x)] = a(m) + tr(H C) / 2
+          (H the Hessian of the rate at m).  This is exact for the
+          quadratic rates of at most bimolecular networks up to the
+          closure, and corrects the mean for the curvature of their
+          rates.
+    Rates are the propensities of the SSA (falling factorials, see
+    modelformat.h) as polynomials, so E[x (x-1)] = m^2 + C - m is the
+    exact second moment.  Both closures assume the distributions are
+    unimodal & not close to 0; near a symmetry-breaking transition, or
+    for species of a few copies, they can be far off & only the SSA
+    will do.
+
+    The system is assembled from the sparse reactants & nu of the model,
+    at a cost per evaluation of about (nonzeros of nu times reactants per
+    transition) * species, plus species^2 -- the covariance is dense, so
+    networks of more than a few thousand species are out of reach.  It is
+    integrated by the adaptive Dormand-Prince 5(4) pair to the requested
+    tolerances; an explicit method, so very stiff networks need many
+    steps (see SetMaxSteps).  Results are the mean & covariance of
+    selected linear observables (by default every species) at the
+    requested times.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_MOMENTS_H
+#define ADAPTIVETAU_MOMENTS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "compiledmodel.h"
+#include "stochasticeqns.h"
+#include "stopcriteria.h"
+
+enum EMomentClosure {
+    eLinearNoise = 0,
+    eNormalClosure
+};
+
+// result of CMomentEquations::Integrate
+struct SMomentTrajectory {
+    std::vector<std::string> m_Observables;
+    std::vector<double> m_Times;
+    // mean of observable a at m_Times[p] at [p * observables + a], and
+    // covariance of a & b at [(p * observables + a) * observables + b]
+    std::vector<double> m_Means;
+    std::vector<double> m_Covariances;
+    uint64_t m_Steps;         // accepted steps
+    uint64_t m_RejectedSteps;
+    double m_Seconds;
+};
+
+class CMomentEquations {
+public:
+    // PRE : compiled binary model without deterministic or halting
+    // transitions; initVal NULL == model's initial state (taken as exact,
+    // i.e. of covariance 0)
+    CMomentEquations(const TCompiledModelPtr &compiled,
+                     const double *initVal = NULL);
+
+    void SetClosure(EMomentClosure closure) { m_Closure = closure; }
+    // results at these times (increasing, >= 0; required)
+    void SetTimes(const std::vector<double> &times);
+    // observable reported (weights of species); none added == every
+    // species, by its name
+    void AddObservable(const std::string &name,
+                       const CStopCriteria::TWeights &weights);
+    // relative & absolute tolerance of each step (defaults 1e-6 & 1e-6)
+    void SetTolerances(double relTol, double absTol);
+    // accepted steps before giving up (0 == no limit, the default)
+    void SetMaxSteps(uint64_t maxSteps) { m_MaxSteps = maxSteps; }
+    // cancellation only; NULL for none.  Must outlive Integrate.
+    void SetRunControl(CRunControl *control) { m_Control = control; }
+
+    // POST: moments at every time; CEarlyExit if cancelled
+    SMomentTrajectory Integrate(void);
+
+private:
+    // POST: dy = time derivative of y = (m, C)
+    void x_Derivatives(const double *y, double *dy);
+    // POST: observables' moments from y at row p of res
+    void x_Record(const double *y, unsigned int p, SMomentTrajectory &res) const;
+    // POST: weighted RMS norm of e relative to y & y1
+    double x_ErrorNorm(const double *e, const double *y,
+                       const double *y1) const;
+
+    TCompiledModelPtr m_Compiled;
+    unsigned int m_NumStates;
+    std::vector<double> m_InitVal;
+    EMomentClosure m_Closure;
+    std::vector<double> m_Times;
+    std::vector<std::string> m_ObservableNames;
+    std::vector<CStopCriteria::TWeights> m_Observables;
+    double m_RelTol;
+    double m_AbsTol;
+    uint64_t m_MaxSteps;
+    CRunControl *m_Control;
+
+    // scratch, sized once per Integrate
+    std::vector<double> m_F;          // falling factorial of each reactant
+    std::vector<double> m_F1;         // of a transition at m, & its first
+    std::vector<double> m_F2;         // & second derivatives
+    std::vector<double> m_JC;         // J C
+};
+
+#endif //ADAPTIVETAU_MOMENTS_H
@@ -0,0 +1,231 @@
+/*  random.h
+    --------------------------------------------------------------------------
+    Self-contained random number generator for the stochastic solver core.
+
+    The core cannot use R's RNG (it must run without R), so every simulation
+    owns a CRandom.  The R glue seeds it from R's RNG, so set.seed() still
+    makes runs reproducible.  The generator is xoshiro256** (Blackman &
+    Vigna); seeds are expanded with splitmix64.  Poisson variates use
+    multiplication for small means and PTRS (Hormann 1993) otherwise,
+    binomial variates inversion for small means and BTRD (Hormann 1993)
+    otherwise, and gamma variates Marsaglia & Tsang (2000).
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_RANDOM_H
+#define ADAPTIVETAU_RANDOM_H
+
+#include <stdint.h>
+#include <cmath>
+
+class CRandom {
+public:
+    explicit CRandom(uint64_t seed = 0) { Seed(seed); }
+
+    void Seed(uint64_t seed) {
+        for (unsigned int i = 0;  i < 4;  ++i) {
+            seed += 0x9E3779B97F4A7C15ULL; //splitmix64
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            m_S[i] = z ^ (z >> 31);
+        }
+        m_SpareNorm = 0;
+        m_HaveSpareNorm = false;
+    }
+
+    uint64_t Next(void) {
+        const uint64_t result = x_Rotl(m_S[1] * 5, 7) * 9;
+        const uint64_t t = m_S[1] << 17;
+        m_S[2] ^= m_S[0];
+        m_S[3] ^= m_S[1];
+        m_S[1] ^= m_S[2];
+        m_S[0] ^= m_S[3];
+        m_S[2] ^= t;
+        m_S[3] = x_Rotl(m_S[3], 45);
+        return result;
+    }
+
+    // uniform on the open interval (0,1)
+    double Unif(void) {
+        return ((Next() >> 11) + 0.5) * (1. / 9007199254740992.);
+    }
+    double Unif(double a, double b) { return a + (b - a) * Unif(); }
+
+    // exponential with the given *scale* (i.e. mean), as R's rexp
+    double Exp(double scale) { return -std::log(Unif()) * scale; }
+
+    double Norm(double mean, double sd) {
+        if (m_HaveSpareNorm) {
+            m_HaveSpareNorm = false;
+            return mean + sd * m_SpareNorm;
+        }
+        double u, v, s;
+        do { //Marsaglia polar method
+            u = 2 * Unif() - 1;
+            v = 2 * Unif() - 1;
+            s = u*u + v*v;
+        } while (s >= 1);
+        const double f = std::sqrt(-2 * std::log(s) / s);
+        m_SpareNorm = v * f;
+        m_HaveSpareNorm = true;
+        return mean + sd * u * f;
+    }
+
+    double Pois(double mu) {
+        if (!(mu > 0)) {
+            return 0;
+        }
+        if (mu < 10) {
+            const double limit = std::exp(-mu);
+            double k = 0, p = Unif();
+            while (p > limit) {
+                p *= Unif();
+                ++k;
+            }
+            return k;
+        }
+        const double slam = std::sqrt(mu);
+        const double loglam = std::log(mu);
+        const double b = 0.931 + 2.53 * slam;
+        const double a = -0.059 + 0.02483 * b;
+        const double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+        const double vr = 0.9277 - 3.6224 / (b - 2);
+        for (;;) {
+            const double u = Unif() - 0.5;
+            const double v = Unif();
+            const double us = 0.5 - std::fabs(u);
+            const double k = std::floor((2 * a / us + b) * u + mu + 0.43);
+            if (us >= 0.07  &&  v <= vr) {
+                return k;
+            }
+            if (k < 0  ||  (us < 0.013  &&  v > us)) {
+                continue;
+            }
+            if (std::log(v) + std::log(invalpha) - std::log(a / (us*us) + b) <=
+                -mu + k * loglam - std::lgamma(k + 1)) {
+                return k;
+            }
+        }
+    }
+
+    // PRE : n >= 0 whole (a double, as counts may exceed 32 bits)
+    double Binom(double n, double p) {
+        if (!(n > 0)  ||  !(p > 0)) {
+            return 0;
+        }
+        if (p >= 1) {
+            return n;
+        }
+        if (p > 0.5) {
+            return n - Binom(n, 1 - p);
+        }
+        const double q = 1 - p;
+        if (n * p < 10) { //inversion, walking up from 0
+            const double ratio = p / q;
+            const double a = (n + 1) * ratio;
+            double f = std::exp(n * std::log(q));
+            double u = Unif();
+            double k = 0;
+            while (u > f  &&  k < n) {
+                u -= f;
+                ++k;
+                f *= a / k - ratio;
+            }
+            return k;
+        }
+        const double m = std::floor((n + 1) * p);
+        const double r = p / q;
+        const double nr = (n + 1) * r;
+        const double npq = n * p * q;
+        const double spq = std::sqrt(npq);
+        const double b = 1.15 + 2.53 * spq;
+        const double a = -0.0873 + 0.0248 * b + 0.01 * p;
+        const double c = n * p + 0.5;
+        const double alpha = (2.83 + 5.1 / b) * spq;
+        const double vr = 0.92 - 4.2 / b;
+        const double urvr = 0.86 * vr;
+        for (;;) {
+            double v = Unif();
+            double u;
+            if (v <= urvr) {
+                u = v / vr - 0.43;
+                return std::floor((2 * a / (0.5 - std::fabs(u)) + b) * u + c);
+            }
+            if (v >= vr) {
+                u = Unif() - 0.5;
+            } else {
+                u = v / vr - 0.93;
+                u = (u < 0 ? -0.5 : 0.5) - u;
+                v = Unif() * vr;
+            }
+            const double us = 0.5 - std::fabs(u);
+            const double k = std::floor((2 * a / us + b) * u + c);
+            if (k < 0  ||  k > n) {
+                continue;
+            }
+            v = v * alpha / (a / (us*us) + b);
+            const double km = std::fabs(k - m);
+            if (km <= 15) { //recursive evaluation of f(k) / f(m)
+                double f = 1;
+                if (m < k) {
+                    for (double i = m + 1;  i <= k;  ++i) {
+                        f *= nr / i - r;
+                    }
+                } else {
+                    for (double i = k + 1;  i <= m;  ++i) {
+                        v *= nr / i - r;
+                    }
+                }
+                if (v <= f) {
+                    return k;
+                }
+                continue;
+            }
+            v = std::log(v);
+            const double rho = (km / npq) *
+                (((km / 3 + 0.625) * km + 1. / 6) / npq + 0.5);
+            const double t = -km * km / (2 * npq);
+            if (v < t - rho) {
+                return k;
+            }
+            if (v > t + rho) {
+                continue;
+            }
+            if (v <= std::lgamma(m + 1) + std::lgamma(n - m + 1) -
+                std::lgamma(k + 1) - std::lgamma(n - k + 1) +
+                (k - m) * std::log(r)) {
+                return k;
+            }
+        }
+    }
+
+    // gamma with the given shape (>= 1) & scale
+    double Gamma(double shape, double scale) {
+        const double d = shape - 1. / 3;
+        const double c = 1 / std::sqrt(9 * d);
+        for (;;) {
+            double x, v;
+            do {
+                x = Norm(0, 1);
+                v = 1 + c * x;
+            } while (v <= 0);
+            v = v * v * v;
+            const double u = Unif();
+            if (std::log(u) < 0.5 * x * x + d - d * v + d * std::log(v)) {
+                return d * v * scale;
+            }
+        }
+    }
+
+private:
+    static uint64_t x_Rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t m_S[4];
+    double m_SpareNorm;
+    bool m_HaveSpareNorm;
+};
+
+#endif //ADAPTIVETAU_RANDOM_H
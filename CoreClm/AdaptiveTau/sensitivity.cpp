@@ -0,0 +1,280 @@
+/*  sensitivity.cpp
+    --------------------------------------------------------------------------
+    Finite-difference sensitivities from coupled runs (see sensitivity.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "sensitivity.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+namespace {
+    // splitmix64 finalizer
+    inline uint64_t Mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // running sums of one estimate
+    struct SSums {
+        SSums(void) : m_Sum(0), m_SumSq(0) {}
+        void Add(double v) {
+            m_Sum += v;
+            m_SumSq += v * v;
+        }
+        double Mean(uint64_t n) const { return m_Sum / n; }
+        double Variance(uint64_t n) const {
+            const double mean = m_Sum / n;
+            return max(0., (m_SumSq - n * mean * mean) / (n - 1));
+        }
+        double m_Sum;
+        double m_SumSq;
+    };
+}
+
+/*---------------------------------------------------------------------------*/
+CSensitivityEstimator::CSensitivityEstimator(const TCompiledModelPtr &compiled,
+                                             const double *initVal)
+    : m_Compiled(compiled), m_Functional(NULL), m_FunctionalData(NULL),
+      m_Method(eSensitivityExact), m_LeapStep(0), m_Runs(1000), m_Seed(1),
+      m_Control(NULL) {
+    if (!compiled->Model()) {
+        throwError("sensitivity analysis needs a compiled binary model");
+    }
+    if (!compiled->TransByCat(eDeterministic).empty()  ||
+        !compiled->TransByCat(eHalting).empty()) {
+        throwError("sensitivity analysis does not support deterministic "
+                   "or halting transitions");
+    }
+    const double *x0 = initVal ? initVal : compiled->Model()->InitialState();
+    m_InitVal.assign(x0, x0 + compiled->NumStates());
+}
+
+void CSensitivityEstimator::SetObservable(const CStopCriteria::TWeights &numerator,
+                                          const CStopCriteria::TWeights &denominator) {
+    CStopCriteria observable;
+    observable.AddThreshold("f", numerator, denominator, 0);
+    observable.Validate(m_Compiled->NumStates());
+    m_Observable = observable;
+    m_Functional = NULL;
+}
+
+void CSensitivityEstimator::AddParameter(const string &name,
+                                         const vector<unsigned int> &transitions,
+                                         double relStep) {
+    if (transitions.empty()  ||  !(relStep > -1)  ||  relStep == 0) {
+        throwError("parameter '" << name << "' needs transitions and a "
+                   "relative step > -1 other than 0");
+    }
+    for (unsigned int k = 0;  k < transitions.size();  ++k) {
+        if (transitions[k] >= m_Compiled->NumTransitions()) {
+            throwError("parameter '" << name << "': no transition " <<
+                       transitions[k] << " (0-based)");
+        }
+    }
+    SParameter p;
+    p.m_Name = name;
+    p.m_Transitions = transitions;
+    p.m_RelStep = relStep;
+    m_Parameters.push_back(p);
+}
+
+void CSensitivityEstimator::SetLeapStep(double tau) {
+    if (!(tau > 0)) {
+        throwError("sensitivity analysis needs a leap step > 0");
+    }
+    m_LeapStep = tau;
+}
+
+double CSensitivityEstimator::x_F(const double *x) const {
+    if (m_Functional) {
+        return m_Functional(x, m_FunctionalData);
+    }
+    const double f = m_Observable.Observable(0, x);
+    return std::isnan(f) ? 0 : f;
+}
+
+void CSensitivityEstimator::x_CalcRates(int p, const double *x,
+                                        double *rates) const {
+    m_Compiled->CalcRates(x, rates);
+    if (p >= 0) {
+        const SParameter &param = m_Parameters[p];
+        for (unsigned int k = 0;  k < param.m_Transitions.size();  ++k) {
+            rates[param.m_Transitions[k]] *= 1 + param.m_RelStep;
+        }
+    }
+}
+
+uint64_t CSensitivityEstimator::x_StreamSeed(uint64_t replicate,
+                                             unsigned int j,
+                                             uint64_t step) const {
+    return Mix(Mix(Mix(Mix(m_Seed) ^ replicate) ^ j) ^ step);
+}
+
+void CSensitivityEstimator::x_CheckCancelled(void) const {
+    if (m_Control  &&  m_Control->IsCancelled()) {
+        throwEarlyExit("sensitivity analysis cancelled");
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+SSensitivityResult CSensitivityEstimator::Estimate(double tF) {
+    if (!m_Functional  &&  m_Observable.empty()) {
+        throwError("sensitivity analysis needs an observable or functional");
+    }
+    if (m_Parameters.empty()) {
+        throwError("sensitivity analysis needs a parameter (see AddParameter)");
+    }
+    if (m_Runs < 2) {
+        throwError("sensitivity analysis needs at least 2 runs");
+    }
+    if (m_Method == eSensitivityLeap  &&  !(m_LeapStep > 0)) {
+        throwError("sensitivity analysis by leaping needs a leap step "
+                   "(see SetLeapStep)");
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const unsigned int m = m_Compiled->NumTransitions();
+    m_X.resize(m_Compiled->NumStates());
+    m_Rates.resize(m);
+    m_Streams.resize(m);
+    m_Internal.resize(m);
+    m_NextJump.resize(m);
+
+    const unsigned int numParams = m_Parameters.size();
+    SSums nominal;
+    vector<SSums> perturbed(numParams), diff(numParams);
+    double cost = 0;
+    for (uint64_t r = 0;  r < m_Runs;  ++r) {
+        x_CheckCancelled();
+        cost += m_Method == eSensitivityExact ?
+            x_ExactPath(-1, r, tF, &m_X[0]) : x_LeapPath(-1, r, tF, &m_X[0]);
+        const double f = x_F(&m_X[0]);
+        nominal.Add(f);
+        for (unsigned int p = 0;  p < numParams;  ++p) {
+            cost += m_Method == eSensitivityExact ?
+                x_ExactPath(p, r, tF, &m_X[0]) : x_LeapPath(p, r, tF, &m_X[0]);
+            const double fp = x_F(&m_X[0]);
+            perturbed[p].Add(fp);
+            diff[p].Add(fp - f);
+        }
+    }
+
+    SSensitivityResult res;
+    res.m_Runs = m_Runs;
+    res.m_Nominal = nominal.Mean(m_Runs);
+    res.m_NominalVariance = nominal.Variance(m_Runs);
+    res.m_Estimates.resize(numParams);
+    for (unsigned int p = 0;  p < numParams;  ++p) {
+        SSensitivityEstimate &est = res.m_Estimates[p];
+        const double logStep = log1p(m_Parameters[p].m_RelStep);
+        est.m_Parameter = m_Parameters[p].m_Name;
+        est.m_RelStep = m_Parameters[p].m_RelStep;
+        est.m_Perturbed = perturbed[p].Mean(m_Runs);
+        est.m_Difference = diff[p].Mean(m_Runs);
+        est.m_Variance = diff[p].Variance(m_Runs);
+        est.m_StdError = sqrt(est.m_Variance / m_Runs);
+        est.m_Derivative = est.m_Difference / logStep;
+        est.m_DerivativeStdError = est.m_StdError / fabs(logStep);
+        est.m_IndependentVariance = res.m_NominalVariance +
+            perturbed[p].Variance(m_Runs);
+        est.m_VarianceReduction = est.m_Variance > 0 ?
+            est.m_IndependentVariance / est.m_Variance :
+            numeric_limits<double>::infinity();
+    }
+    res.m_Cost = cost;
+    res.m_Seconds = chrono::duration<double>
+        (chrono::steady_clock::now() - start).count();
+    return res;
+}
+
+/*---------------------------------------------------------------------------*/
+// Modified next reaction method: transition j has fired Y_j(T_j) times,
+// T_j its integrated rate, & next fires when T_j reaches P_j, the next
+// jump of Y_j.  The jumps come from stream j alone, so paths with other
+// rates see the same Y_j.
+double CSensitivityEstimator::x_ExactPath(int p, uint64_t replicate,
+                                          double tF, double *x) {
+    const unsigned int m = m_Compiled->NumTransitions();
+    copy(m_InitVal.begin(), m_InitVal.end(), x);
+    for (unsigned int j = 0;  j < m;  ++j) {
+        m_Streams[j].Seed(x_StreamSeed(replicate, j, 0));
+        m_Internal[j] = 0;
+        m_NextJump[j] = m_Streams[j].Exp(1);
+    }
+    double *rates = &m_Rates[0];
+    x_CalcRates(p, x, rates);
+    double cost = 1;
+    double t = 0;
+    for (;;) {
+        int next = -1;
+        double dt = numeric_limits<double>::infinity();
+        for (unsigned int j = 0;  j < m;  ++j) {
+            if (rates[j] > 0) {
+                const double d = (m_NextJump[j] - m_Internal[j]) / rates[j];
+                if (d < dt) {
+                    dt = d;
+                    next = j;
+                }
+            }
+        }
+        if (next < 0  ||  t + dt >= tF) {
+            break;
+        }
+        t += dt;
+        for (unsigned int j = 0;  j < m;  ++j) {
+            m_Internal[j] += rates[j] * dt;
+        }
+        m_Internal[next] = m_NextJump[next]; //exactly, despite round-off
+        m_NextJump[next] += m_Streams[next].Exp(1);
+        m_Compiled->ApplyTransition(next, 1, x);
+        x_CalcRates(p, x, rates);
+        ++cost;
+        x_CheckCancelled();
+    }
+    return cost;
+}
+
+// step i covers [i tau, min((i+1) tau, tF)]; transition j draws its
+// firings in step i from a stream seeded for (replicate, j, i)
+double CSensitivityEstimator::x_LeapPath(int p, uint64_t replicate,
+                                         double tF, double *x) {
+    const unsigned int m = m_Compiled->NumTransitions();
+    const unsigned int n = m_Compiled->NumStates();
+    const double tau = m_LeapStep;
+    copy(m_InitVal.begin(), m_InitVal.end(), x);
+    double *rates = &m_Rates[0];
+    double cost = 0;
+    CRandom rnd;
+    for (uint64_t i = 0;  i * tau < tF;  ++i) {
+        const double h = min((i + 1) * tau, tF) - i * tau;
+        x_CalcRates(p, x, rates);
+        ++cost;
+        for (unsigned int j = 0;  j < m;  ++j) {
+            if (!(rates[j] > 0)) {
+                continue;
+            }
+            rnd.Seed(x_StreamSeed(replicate, j, i + 1));
+            const double firings = rnd.Pois(rates[j] * h);
+            if (firings > 0) {
+                m_Compiled->ApplyTransition(j, firings, x);
+            }
+        }
+        for (unsigned int k = 0;  k < n;  ++k) {
+            x[k] = max(x[k], 0.);
+        }
+    }
+    return cost;
+}
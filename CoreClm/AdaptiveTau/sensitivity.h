@@ -0,0 +1,149 @@
+/*  sensitivity.h
+    --------------------------------------------------------------------------
+    Parameter sensitivities of E[f(X(tF))] by finite differences between
+    coupled runs (common random numbers).
+
+    The finite difference of independent nominal & perturbed runs has the
+    variance of both runs, which swamps a small change in the mean.
+    CSensitivityEstimator instead runs, per replicate, the nominal model &
+    one perturbed model per parameter on the same random numbers, so the
+    paired differences f(perturbed) - f(nominal) only vary by as much as
+    the perturbation moves the paths apart.  Randomness is drawn from an
+    independent stream per transition (the random time change
+    representation, X(t) = X(0) + sum_j nu_j Y_j(int_0^t a_j(X(s)) ds),
+    with Y_j unit Poisson processes):
+        - eSensitivityExact: the modified next reaction method (Anderson,
+          J Chem Phys 2007) on each path, with Y_j drawn from stream j, so
+          every path of a replicate shares the same Y_j -- the common
+          reaction path coupling of Rathinam, Sheppard & Khammash (J Chem
+          Phys 2010);
+        - eSensitivityLeap: fixed-step tau leaping on a common grid, with
+          the Poisson firings of transition j in step i drawn from a
+          stream of its own, so that the paths stay in step even where
+          one draw takes more uniforms than another.  Variables that go
+          negative are set to 0 at the end of the step (as mlmc.h).
+    A parameter scales the rates of its transitions by 1 + relative step,
+    i.e. it is a rate constant (or any factor of the rate) shared by those
+    transitions.  Results are the mean paired difference & its variance,
+    the derivative of E[f] with respect to the log of the parameter, and
+    the variance independent runs would have had (from the variances of
+    the nominal & perturbed values), so the saving shows directly.
+    Binary models only; deterministic & halting transitions are not
+    supported.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_SENSITIVITY_H
+#define ADAPTIVETAU_SENSITIVITY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "compiledmodel.h"
+#include "mlmc.h"
+#include "random.h"
+#include "stochasticeqns.h"
+#include "stopcriteria.h"
+
+enum ESensitivityMethod {
+    eSensitivityExact = 0,
+    eSensitivityLeap
+};
+
+// one parameter of SSensitivityResult
+struct SSensitivityEstimate {
+    std::string m_Parameter;
+    double m_RelStep;
+    double m_Perturbed;    // mean of f over the perturbed runs
+    double m_Difference;   // mean paired difference f(perturbed) - f(nominal)
+    double m_Variance;     // of one paired difference
+    double m_StdError;     // of m_Difference
+    double m_Derivative;   // d E[f] / d log(parameter), forward difference
+    double m_DerivativeStdError;
+    // variance of one difference of independent runs, & its ratio to
+    // m_Variance (the factor fewer runs the coupling needs)
+    double m_IndependentVariance;
+    double m_VarianceReduction;
+};
+
+// result of CSensitivityEstimator::Estimate
+struct SSensitivityResult {
+    uint64_t m_Runs;        // replicates (each one path per model)
+    double m_Nominal;       // mean of f over the nominal runs
+    double m_NominalVariance;
+    std::vector<SSensitivityEstimate> m_Estimates; // in order of AddParameter
+    double m_Cost;          // rate evaluations, all paths
+    double m_Seconds;
+};
+
+class CSensitivityEstimator {
+public:
+    // PRE : compiled binary model; initVal NULL == model's initial state
+    CSensitivityEstimator(const TCompiledModelPtr &compiled,
+                          const double *initVal = NULL);
+
+    // f = numerator / denominator of the state at tF (see CStopCriteria;
+    // 0 where the denominator is 0)
+    void SetObservable(const CStopCriteria::TWeights &numerator,
+                       const CStopCriteria::TWeights &denominator);
+    // f given by a function instead
+    void SetFunctional(TFunctional f, void *userData) {
+        m_Functional = f;
+        m_FunctionalData = userData;
+    }
+    // parameter scaling the rates of transitions (0-based) by 1 + relStep
+    void AddParameter(const std::string &name,
+                      const std::vector<unsigned int> &transitions,
+                      double relStep);
+    void SetMethod(ESensitivityMethod method) { m_Method = method; }
+    // step of eSensitivityLeap (required for it)
+    void SetLeapStep(double tau);
+    void SetRuns(uint64_t runs) { m_Runs = runs; }
+    void Seed(uint64_t seed) { m_Seed = seed; }
+    // cancellation only; NULL for none.  Must outlive Estimate.
+    void SetRunControl(CRunControl *control) { m_Control = control; }
+
+    // POST: sensitivities of E[f(X(tF))] to every parameter from
+    // SetRuns replicates; CEarlyExit if cancelled
+    SSensitivityResult Estimate(double tF);
+
+private:
+    struct SParameter {
+        std::string m_Name;
+        std::vector<unsigned int> m_Transitions;
+        double m_RelStep;
+    };
+
+    double x_F(const double *x) const;
+    // POST: rates at x, those of parameter p (-1 == nominal) scaled
+    void x_CalcRates(int p, const double *x, double *rates) const;
+    // POST: x at tF on replicate's streams; returns cost
+    double x_ExactPath(int p, uint64_t replicate, double tF, double *x);
+    double x_LeapPath(int p, uint64_t replicate, double tF, double *x);
+    // seed of transition j's stream in step (0 for exact paths)
+    uint64_t x_StreamSeed(uint64_t replicate, unsigned int j,
+                          uint64_t step) const;
+    void x_CheckCancelled(void) const;
+
+    TCompiledModelPtr m_Compiled;
+    std::vector<double> m_InitVal;
+    CStopCriteria m_Observable;
+    TFunctional m_Functional;
+    void *m_FunctionalData;
+    std::vector<SParameter> m_Parameters;
+    ESensitivityMethod m_Method;
+    double m_LeapStep;
+    uint64_t m_Runs;
+    uint64_t m_Seed;
+    CRunControl *m_Control;
+
+    // scratch, sized once per Estimate
+    std::vector<double> m_X;
+    std::vector<double> m_Rates;
+    std::vector<CRandom> m_Streams;   // per transition (exact paths)
+    std::vector<double> m_Internal;   // integrated rate, per transition
+    std::vector<double> m_NextJump;   // of Y_j, per transition
+};
+
+#endif //ADAPTIVETAU_SENSITIVITY_H
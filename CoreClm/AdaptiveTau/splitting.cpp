@@ -0,0 +1,225 @@
+/*  splitting.cpp
+    --------------------------------------------------------------------------
+    Rare-event estimation by multilevel splitting (see splitting.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "splitting.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+/*---------------------------------------------------------------------------*/
+CSplittingEstimator::CSplittingEstimator(const TCompiledModelPtr &compiled,
+                                         const double *initVal)
+    : m_Compiled(compiled), m_PerLevel(1000), m_NumReplicates(10),
+      m_UseATL(false), m_Seed(1), m_Pool(NULL), m_Control(NULL) {
+    if (!compiled->Model()) {
+        throwError("splitting needs a compiled binary model");
+    }
+    const double *x0 = initVal ? initVal : compiled->Model()->InitialState();
+    m_InitVal.assign(x0, x0 + compiled->NumStates());
+}
+
+void CSplittingEstimator::SetCoordinate(const CStopCriteria::TWeights &numerator,
+                                        const CStopCriteria::TWeights &denominator) {
+    CStopCriteria coordinate;
+    coordinate.AddThreshold("coordinate", numerator, denominator, 0);
+    coordinate.Validate(m_Compiled->NumStates());
+    m_Coordinate = coordinate;
+    m_Numerator = numerator;
+    m_Denominator = denominator;
+}
+
+void CSplittingEstimator::SetLevels(const vector<double> &levels) {
+    if (levels.empty()) {
+        throwError("splitting needs at least one level");
+    }
+    for (unsigned int k = 1;  k < levels.size();  ++k) {
+        if (!(levels[k] > levels[k-1])) {
+            throwError("splitting levels must be increasing (level " << k+1 <<
+                       " is " << levels[k] << " after " << levels[k-1] << ")");
+        }
+    }
+    m_Levels = levels;
+}
+
+void CSplittingEstimator::SetEvenLevels(double target, unsigned int numLevels) {
+    double start = Coordinate(&m_InitVal[0]);
+    if (std::isnan(start)) {
+        start = 0;
+    }
+    if (numLevels == 0  ||  !(target > start)) {
+        throwError("splitting target " << target << " must lie above the "
+                   "coordinate at the initial state (" << start << ")");
+    }
+    vector<double> levels(numLevels);
+    for (unsigned int k = 0;  k < numLevels;  ++k) {
+        levels[k] = start + (target - start) * (k + 1) / numLevels;
+    }
+    SetLevels(levels);
+}
+
+double CSplittingEstimator::Coordinate(const double *x) const {
+    if (m_Coordinate.empty()) {
+        throwError("no splitting coordinate set (see SetCoordinate)");
+    }
+    return fabs(m_Coordinate.Observable(0, x));
+}
+
+/*---------------------------------------------------------------------------*/
+SSplittingResult CSplittingEstimator::Estimate(double tF) {
+    if (m_Coordinate.empty()  ||  m_Levels.empty()) {
+        throwError("splitting needs a coordinate & levels");
+    }
+    if (m_PerLevel == 0  ||  m_NumReplicates == 0) {
+        throwError("splitting needs at least one trajectory per level & one "
+                   "replicate");
+    }
+    m_Stages.assign(m_Levels.size(), CStopCriteria());
+    for (unsigned int k = 0;  k < m_Levels.size();  ++k) {
+        ostringstream name;
+        name << "level " << k+1;
+        m_Stages[k].AddThreshold(name.str(), m_Numerator, m_Denominator,
+                                 m_Levels[k]);
+    }
+
+    vector<SReplicate> reps(m_NumReplicates);
+    CReplicateTask task(*this, tF, reps);
+    if (m_Pool) {
+        m_Pool->Run(task, m_NumReplicates);
+    } else {
+        for (unsigned int r = 0;  r < m_NumReplicates;  ++r) {
+            task.Run(r);
+        }
+    }
+
+    SSplittingResult res;
+    const unsigned int numReps = reps.size(), numLevels = m_Levels.size();
+    res.m_Trajectories = res.m_Firings = 0;
+    res.m_Replicates.resize(numReps);
+    vector<uint64_t> successes(numLevels, 0), trials(numLevels, 0);
+    uint64_t failedFirings = 0;
+    double failedTime = 0, sum = 0;
+    for (unsigned int r = 0;  r < numReps;  ++r) {
+        const SReplicate &rep = reps[r];
+        res.m_Replicates[r] = rep.m_Estimate;
+        sum += rep.m_Estimate;
+        res.m_Trajectories += rep.m_Trajectories;
+        res.m_Firings += rep.m_Firings;
+        failedTime += rep.m_FailedTime;
+        failedFirings += rep.m_FailedFirings;
+        //a replicate stops at the first stage nobody passes
+        for (unsigned int k = 0;  k < numLevels;  ++k) {
+            trials[k] += k == 0  ||  rep.m_Successes[k-1] > 0 ? m_PerLevel : 0;
+            successes[k] += rep.m_Successes[k];
+        }
+    }
+    res.m_Probability = sum / numReps;
+    res.m_LevelProbabilities.resize(numLevels);
+    for (unsigned int k = 0;  k < numLevels;  ++k) {
+        res.m_LevelProbabilities[k] = trials[k] == 0 ?
+            numeric_limits<double>::quiet_NaN() :
+            double(successes[k]) / trials[k];
+    }
+
+    if (numReps >= 2) {
+        double ss = 0;
+        for (unsigned int r = 0;  r < numReps;  ++r) {
+            ss += (reps[r].m_Estimate - res.m_Probability) *
+                (reps[r].m_Estimate - res.m_Probability);
+        }
+        res.m_StdError = sqrt(ss / (numReps - 1) / numReps);
+    } else {
+        //relative variance of a product of independent binomial fractions
+        double relVar = 0;
+        for (unsigned int k = 0;  k < numLevels;  ++k) {
+            const double p = res.m_LevelProbabilities[k];
+            relVar += p > 0 ? (1 - p) / (m_PerLevel * p) : 0;
+        }
+        res.m_StdError = res.m_Probability * sqrt(relVar);
+    }
+    res.m_Lower = max(0., res.m_Probability - 1.96 * res.m_StdError);
+    res.m_Upper = min(1., res.m_Probability + 1.96 * res.m_StdError);
+
+    res.m_FiringsPerTrajectory = failedTime > 0 ?
+        failedFirings / failedTime * tF : numeric_limits<double>::quiet_NaN();
+    //plain replicates: var = p (1 - p) / n
+    res.m_EquivalentFirings = res.m_Probability > 0  &&  res.m_StdError > 0 ?
+        res.m_Probability * (1 - res.m_Probability) /
+        (res.m_StdError * res.m_StdError) * res.m_FiringsPerTrajectory :
+        numeric_limits<double>::quiet_NaN();
+    return res;
+}
+
+/*---------------------------------------------------------------------------*/
+// Entrance states are stored as rows of (t, x); stage k picks its starts
+// round-robin from those of stage k-1, so every entrance state is used
+// floor(N / entrances) or one more times.
+void CSplittingEstimator::x_RunReplicate(unsigned int r, double tF,
+                                         SReplicate &res) const {
+    const unsigned int numStates = m_Compiled->NumStates();
+    const unsigned int row = numStates + 1;
+    CStochasticEqns eqns(m_Compiled, &m_InitVal[0]);
+    eqns.Seed(m_Seed + r);
+    if (m_Control) {
+        eqns.SetRunControl(m_Control);
+    }
+
+    vector<double> entrances(row), next;
+    entrances[0] = 0;
+    copy(m_InitVal.begin(), m_InitVal.end(), entrances.begin() + 1);
+    next.reserve((size_t) m_PerLevel * row);
+    res.m_Estimate = 1;
+    res.m_Successes.assign(m_Levels.size(), 0);
+    res.m_Trajectories = res.m_Firings = 0;
+    res.m_FailedTime = 0;
+    res.m_FailedFirings = 0;
+
+    for (unsigned int k = 0;  k < m_Levels.size();  ++k) {
+        eqns.SetStopCriteria(m_Stages[k]);
+        next.clear();
+        const unsigned int numEntrances = entrances.size() / row;
+        for (unsigned int n = 0;  n < m_PerLevel;  ++n) {
+            const double *start = &entrances[(size_t) (n % numEntrances) * row];
+            if (Coordinate(start + 1) >= m_Levels[k]) {
+                //already there (an earlier leap overshot this level)
+                next.insert(next.end(), start, start + row);
+                continue;
+            }
+            const uint64_t firings = eqns.GetStatistics().m_Firings;
+            eqns.SetState(start[0], start + 1);
+            if (m_UseATL) {
+                eqns.EvaluateATLUntil(tF);
+            } else {
+                eqns.EvaluateExactUntil(tF);
+            }
+            ++res.m_Trajectories;
+            if (eqns.GetStopReason() == eStopCriterion) {
+                next.push_back(eqns.GetTime());
+                next.insert(next.end(), eqns.GetState(),
+                            eqns.GetState() + numStates);
+            } else if (eqns.GetStopReason() == eStopFinalTime) {
+                res.m_FailedTime += tF - start[0];
+                res.m_FailedFirings += eqns.GetStatistics().m_Firings - firings;
+            }
+        }
+        res.m_Successes[k] = next.size() / row;
+        res.m_Estimate *= double(res.m_Successes[k]) / m_PerLevel;
+        if (res.m_Successes[k] == 0) {
+            break;
+        }
+        entrances.swap(next);
+    }
+    res.m_Firings = eqns.GetStatistics().m_Firings;
+}
@@ -0,0 +1,136 @@
+/*  splitting.h
+    --------------------------------------------------------------------------
+    Rare-event estimation by multilevel splitting.
+
+    Estimates the probability that a reaction coordinate -- the absolute
+    value of a CStopCriteria observable, e.g. |ee| = |L - D| / (L + D) --
+    reaches a target level before tF, for outcomes too rare to count
+    among plain replicates.  Fixed-effort splitting (Garvels 2000): levels
+    l_1 < ... < l_K = target are set between the start & the target.
+    Stage k runs N trajectories (exact SSA by default) from the states in
+    which stage k-1 first reached l_{k-1}, each until it reaches l_k or
+    tF.  The fraction p_k that made it is an estimate of the conditional
+    probability of reaching l_k; the estimate is the product of the p_k.
+    Each stage costs N short trajectories, so the events needed for a
+    given relative error grow with log(1/p) rather than with 1/p.
+
+    Independent replicates of the whole procedure give the confidence
+    interval (the trajectories of one replicate share ancestors, so their
+    spread understates the error); with a single replicate, the usual
+    estimate that treats the stages as independent binomials is used.
+    Replicate r is seeded with seed + r, so the result does not depend on
+    the thread pool (if any).
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_SPLITTING_H
+#define ADAPTIVETAU_SPLITTING_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "compiledmodel.h"
+#include "stochasticeqns.h"
+#include "stopcriteria.h"
+#include "threadpool.h"
+
+// result of CSplittingEstimator::Estimate
+struct SSplittingResult {
+    double m_Probability;   // mean over replicates
+    double m_StdError;      // of m_Probability
+    double m_Lower;         // 95% confidence interval (normal approx.)
+    double m_Upper;
+    // conditional probability of reaching each level from the previous
+    // one, pooled over replicates
+    std::vector<double> m_LevelProbabilities;
+    std::vector<double> m_Replicates; // estimate of every replicate
+    uint64_t m_Trajectories;  // simulated, over all stages & replicates
+    uint64_t m_Firings;       // total simulated events
+    // events of one plain replicate from 0 to tF, estimated from the
+    // event rate of the trajectories that reached tF without reaching
+    // their level (NaN if none did)
+    double m_FiringsPerTrajectory;
+    // events plain replicates would need for the same standard error
+    // (NaN if the estimate is 0 or has no error estimate)
+    double m_EquivalentFirings;
+};
+
+class CSplittingEstimator {
+public:
+    // PRE : compiled binary model; initVal NULL == model's initial state
+    CSplittingEstimator(const TCompiledModelPtr &compiled,
+                        const double *initVal = NULL);
+
+    // reaction coordinate: |numerator / denominator| (see CStopCriteria)
+    void SetCoordinate(const CStopCriteria::TWeights &numerator,
+                       const CStopCriteria::TWeights &denominator);
+    // PRE : increasing levels of the coordinate; the last is the target
+    void SetLevels(const std::vector<double> &levels);
+    // POST: numLevels levels evenly spaced from (excluding) the
+    // coordinate at the initial state to (including) target
+    void SetEvenLevels(double target, unsigned int numLevels);
+    // trajectories per stage (N) & independent replicates
+    void SetTrajectoriesPerLevel(unsigned int n) { m_PerLevel = n; }
+    void SetReplicates(unsigned int replicates) { m_NumReplicates = replicates; }
+    // adaptive tau leaping instead of exact steps; a level may then be
+    // overshot by a leap, which restarts the next stage beyond it
+    void SetUseATL(bool useATL) { m_UseATL = useATL; }
+    void Seed(uint64_t seed) { m_Seed = seed; }
+    // run replicates in parallel on pool (must outlive Estimate); NULL
+    // for serial
+    void SetThreadPool(CThreadPool *pool) { m_Pool = pool; }
+    // shared by every trajectory (e.g. to cancel the estimate); NULL for
+    // none.  Must outlive Estimate.
+    void SetRunControl(CRunControl *control) { m_Control = control; }
+
+    const std::vector<double>& GetLevels(void) const { return m_Levels; }
+    // coordinate in state x
+    double Coordinate(const double *x) const;
+
+    // POST: probability of reaching the target level before tF
+    // estimated; CEarlyExit if cancelled
+    SSplittingResult Estimate(double tF);
+
+private:
+    // counts of one replicate
+    struct SReplicate {
+        double m_Estimate;
+        std::vector<uint64_t> m_Successes; // by level
+        uint64_t m_Trajectories;
+        uint64_t m_Firings;
+        double m_FailedTime;     // simulated by trajectories that reached tF
+        uint64_t m_FailedFirings;
+    };
+    class CReplicateTask : public CParallelTask {
+    public:
+        CReplicateTask(CSplittingEstimator &est, double tF,
+                       std::vector<SReplicate> &res)
+            : m_Est(est), m_TF(tF), m_Res(res) {}
+        void Run(unsigned int block) {
+            m_Est.x_RunReplicate(block, m_TF, m_Res[block]);
+        }
+    private:
+        CSplittingEstimator &m_Est;
+        double m_TF;
+        std::vector<SReplicate> &m_Res;
+    };
+
+    // POST: replicate r run to the target (or the first empty stage)
+    void x_RunReplicate(unsigned int r, double tF, SReplicate &res) const;
+
+    TCompiledModelPtr m_Compiled;
+    std::vector<double> m_InitVal;
+    CStopCriteria m_Coordinate; // single criterion; its observable only
+    std::vector<CStopCriteria> m_Stages; // threshold at each level
+    CStopCriteria::TWeights m_Numerator;
+    CStopCriteria::TWeights m_Denominator;
+    std::vector<double> m_Levels;
+    unsigned int m_PerLevel;
+    unsigned int m_NumReplicates;
+    bool m_UseATL;
+    uint64_t m_Seed;
+    CThreadPool *m_Pool;
+    CRunControl *m_Control;
+};
+
+#endif //ADAPTIVETAU_SPLITTING_H
@@ -0,0 +1,2324 @@
+/*  stochasticeqns.cpp
+    --------------------------------------------------------------------------
+    R-independent core of the adaptive tau-leaping algorithm (see
+    stochasticeqns.h).  Moved out of adaptivetau.cpp.
+
+    Author: Philip Johnson <plfjohnson@emory.edu>
+    Copyright (C) 2010 Philip Johnson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+#include "stochasticeqns.h"
+
+using namespace std;
+
+// LAPACK (as provided by R, or linked directly when built without R)
+extern "C" void dgesv_(const int *n, const int *nrhs, double *a,
+                       const int *lda, int *ipiv, double *b, const int *ldb,
+                       int *info);
+
+const bool debug = false;
+
+const double CStochasticEqns::kDefaultRSSAFluctuation = 0.1;
+
+namespace {
+    // rate of a mass-action transition at state x
+    inline double MassActionRate(const CRow<SReactant> &r, double rate,
+                                 const double *x) {
+        for (unsigned int k = 0;  k < r.size()  &&  rate > 0;  ++k) {
+            for (int n = 0;  n < r[k].m_Order;  ++n) {
+                rate *= max(x[r[k].m_State] - n, 0.);
+            }
+        }
+        return rate;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+CStochasticEqns::CStochasticEqns(void) {
+    m_T = NULL;
+    m_X = NULL;
+    m_Rates = NULL;
+    m_NumStates = 0;
+    m_RateChangeBound = NULL;
+    m_Model = NULL;
+    m_Kernels = NULL;
+    m_UseJacobian = false;
+    m_FDJacobian = false;
+    m_Profiling = false;
+    m_Trace = NULL;
+    m_Control = &m_OwnControl;
+    m_Pool = NULL;
+    m_StopReason = eStopNone;
+    m_NativeT = 0;
+    x_InitDefaultParams(NULL);
+}
+
+CStochasticEqns::CStochasticEqns(const CModelFile &model,
+                                 const double *initVal,
+                                 const double *changeBound,
+                                 const CModelKernels *kernels)
+    : CStochasticEqns(make_shared<const CCompiledModel>(model, kernels),
+                      initVal, changeBound) {
+}
+
+CStochasticEqns::CStochasticEqns(const TCompiledModelPtr &compiled,
+                                 const double *initVal,
+                                 const double *changeBound) {
+    if (!compiled->Model()) {
+        throwError("the compiled model has no binary model to evaluate "
+                   "rates from");
+    }
+    m_UseJacobian = false;
+    m_FDJacobian = false;
+    m_Profiling = false;
+    m_Trace = NULL;
+    m_Control = &m_OwnControl;
+    m_Pool = NULL;
+    m_StopReason = eStopNone;
+    x_AttachModel(compiled);
+
+    const double *x0 = initVal ? initVal : m_Model->InitialState();
+    m_NativeX.assign(x0, x0 + m_NumStates);
+    m_X = m_NativeX.empty() ? NULL : &m_NativeX[0];
+    m_NativeT = 0;
+    m_T = &m_NativeT;
+    m_NativeRates.resize(m_Nu.size(), 0);
+    m_Rates = &m_NativeRates[0];
+    if (m_Kernels) {
+        m_Firings.resize(m_Nu.size(), 0);
+    }
+
+    x_InitDefaultParams(changeBound ? changeBound :
+                        compiled->UnitChangeBound());
+    if (m_Model->TauLeapingParams()) {
+        SetTauLeapingParams(*m_Model->TauLeapingParams());
+    }
+
+    x_CheckInitialValues();
+    *m_T = 0;
+    m_LastTransition = -1;
+    m_PrevStepType = eExact;
+    x_ReserveWorkspace();
+}
+
+/*---------------------------------------------------------------------------*/
+// POST: structure viewed from compiled; nothing is copied except the
+// (short) lists of deterministic & halting transitions
+void CStochasticEqns::x_AttachModel(const TCompiledModelPtr &compiled) {
+    m_Compiled = compiled;
+    m_NumStates = compiled->NumStates();
+    m_Nu = compiled->Nu().View();
+    m_NuBySpecies = compiled->NuBySpecies().View();
+    m_TransCats = compiled->TransCats();
+    m_BalancedPairs = compiled->BalancedPairs();
+    m_RealValuedVariables = compiled->RealValuedVariables();
+    m_Model = compiled->Model();
+    m_Kernels = compiled->Kernels();
+
+    m_TransByCat[eNormal].clear();
+    m_TransByCat[eDeterministic] = compiled->TransByCat(eDeterministic);
+    m_TransByCat[eHalting] = compiled->TransByCat(eHalting);
+    m_TransByCat[eCritical] = m_TransByCat[eHalting];
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::SetUseJacobian(bool useJacobian) {
+    if (useJacobian  &&  !m_Model) {
+        throwError("the mass-action Jacobian is only available for binary "
+                   "models");
+    }
+    m_UseJacobian = useJacobian;
+    m_NativeJacobian.assign(m_UseJacobian  ||  m_FDJacobian ?
+                            m_NumStates * m_Nu.size() : 0, 0);
+    x_ReserveWorkspace();
+}
+
+void CStochasticEqns::SetExactMethod(EExactMethod method) {
+    if (method != eExactDirect) {
+        const char *name = method == eExactRejection ?
+            "the rejection-based SSA" : "the partial-propensity SSA";
+        if (!m_Model) {
+            throwError(name << " needs a binary (mass-action) model");
+        }
+        if (!m_TransByCat[eDeterministic].empty()) {
+            throwError(name << " does not support deterministic transitions");
+        }
+        if (m_ReactantOf.size() != m_NumStates) {
+            const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+            vector< vector<unsigned int> > reactantOf(m_NumStates);
+            for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+                const CRow<SReactant> r = reactants[j];
+                for (unsigned int k = 0;  k < r.size();  ++k) {
+                    reactantOf[r[k].m_State].push_back(j);
+                }
+            }
+            m_ReactantOf.Assign(reactantOf);
+        }
+    }
+    if (method == eExactRejection) {
+        m_RSSALow.resize(m_NumStates);
+        m_RSSAHigh.resize(m_NumStates);
+        m_RSSARateLow.resize(m_Nu.size());
+        m_RSSARateHigh.Resize(m_Nu.size());
+    } else if (method == eExactPartialPropensity  &&
+               m_PDMGroupOf.size() != m_Nu.size()) {
+        //group of a transition: its reactant that is a reactant of the
+        //most transitions (source transitions form group m_NumStates)
+        const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+        vector< vector<unsigned int> > groupTrans(m_NumStates + 1);
+        vector< vector<unsigned int> > dependents(m_NumStates);
+        m_PDMGroupOf.resize(m_Nu.size());
+        m_PDMPos.resize(m_Nu.size());
+        for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+            const CRow<SReactant> r = reactants[j];
+            unsigned int g = m_NumStates;
+            for (unsigned int k = 0;  k < r.size();  ++k) {
+                if (g == m_NumStates  ||
+                    m_ReactantOf[r[k].m_State].size() > m_ReactantOf[g].size()) {
+                    g = r[k].m_State;
+                }
+            }
+            m_PDMGroupOf[j] = g;
+            m_PDMPos[j] = groupTrans[g].size();
+            groupTrans[g].push_back(j);
+            //a single molecule of the group species is factored out
+            for (unsigned int k = 0;  k < r.size();  ++k) {
+                if ((unsigned int) r[k].m_State != g  ||  r[k].m_Order > 1) {
+                    dependents[r[k].m_State].push_back(j);
+                }
+            }
+        }
+        m_PDMGroupTrans.Assign(groupTrans);
+        m_PDMDependents.Assign(dependents);
+        m_PDMPartial.resize(m_NumStates + 1);
+        for (unsigned int g = 0;  g <= m_NumStates;  ++g) {
+            m_PDMPartial[g].Resize(groupTrans[g].size());
+        }
+        m_PDMGroups.Resize(m_NumStates + 1);
+    }
+    m_ExactMethod = method;
+    m_ExactStateValid = false;
+}
+
+void CStochasticEqns::SetRSSAFluctuation(double fluctuation) {
+    if (!(fluctuation > 0  &&  fluctuation < 1)) {
+        throwError("invalid RSSA fluctuation " << fluctuation <<
+                   " (must be between 0 and 1)");
+    }
+    m_RSSAFluctuation = fluctuation;
+    m_ExactStateValid = false;
+}
+
+void CStochasticEqns::SetLangevinThreshold(double threshold) {
+    if (!(threshold >= 0)) {
+        throwError("invalid Langevin threshold " << threshold <<
+                   " (must not be negative)");
+    }
+    m_LangevinThreshold = threshold;
+    x_ReserveWorkspace();
+}
+
+void CStochasticEqns::SetStopCriteria(const CStopCriteria &criteria) {
+    criteria.Validate(m_NumStates);
+    m_StopCriteria = criteria;
+    m_StopCriteria.Reset();
+}
+
+void CStochasticEqns::SetState(double t, const double *x) {
+    copy(x, x + m_NumStates, m_X);
+    *m_T = t;
+    x_CheckInitialValues();
+    m_LastTransition = -1;
+    m_PrevStepType = eExact;
+    m_StopReason = eStopNone;
+    m_ExactStateValid = false;
+    m_StopCriteria.Reset();
+    m_TimeSeries.Clear();
+}
+
+STauLeapingParams CStochasticEqns::GetTauLeapingParams(void) const {
+    STauLeapingParams res;
+    res.m_Epsilon = m_Epsilon;
+    res.m_Delta = m_Delta;
+    res.m_Ncritical = m_Ncritical;
+    res.m_Nstiff = m_Nstiff;
+    res.m_ExactThreshold = m_ExactThreshold;
+    for (unsigned int k = 0;  k < 3;  ++k) {
+        res.m_NumExactSteps[k] = m_NumExactSteps[k];
+    }
+    res.m_ITLConvergenceTol = m_ITLConvergenceTol;
+    res.m_MaxTau = m_MaxTau;
+    return res;
+}
+
+void CStochasticEqns::SetTauLeapingParams(const STauLeapingParams &params) {
+    if (!(params.m_Epsilon > 0)  ||  !(params.m_Delta > 0)  ||
+        !(params.m_Ncritical >= 0)  ||  !(params.m_Nstiff > 0)  ||
+        !(params.m_ExactThreshold >= 0)  ||
+        !(params.m_ITLConvergenceTol > 0)  ||  !(params.m_MaxTau > 0)) {
+        throwError("invalid tau leaping parameters");
+    }
+    m_Epsilon = params.m_Epsilon;
+    m_Delta = params.m_Delta;
+    m_Ncritical = (unsigned int) params.m_Ncritical;
+    m_Nstiff = params.m_Nstiff;
+    m_ExactThreshold = params.m_ExactThreshold;
+    for (unsigned int k = 0;  k < 3;  ++k) {
+        m_NumExactSteps[k] = (unsigned int) max(1., params.m_NumExactSteps[k]);
+    }
+    m_ITLConvergenceTol = params.m_ITLConvergenceTol;
+    m_MaxTau = params.m_MaxTau;
+}
+
+void CStochasticEqns::SetProfiling(bool profiling) {
+    m_Profiling = profiling;
+    const unsigned int n = profiling ? m_Nu.size() : 0;
+    m_Profile.m_Firings.assign(n, 0);
+    m_Profile.m_Critical.assign(n, 0);
+    m_Profile.m_Propensity.assign(n, 0);
+    if (profiling) {
+        m_Firings.resize(m_Nu.size(), 0);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::x_InitDefaultParams(const double* changeBound) {
+    //default parameters to adaptive tau leaping algorithm
+    m_Epsilon = 0.05;
+    m_Ncritical = 10;
+    m_Nstiff = 100;
+    m_ExactThreshold = 10;
+    m_Delta = 0.05;
+    m_NumExactSteps[eExact] = 100;
+    m_NumExactSteps[eExplicit] = 100;
+    m_NumExactSteps[eImplicit] = 10;
+    m_ITLConvergenceTol = 0.01;
+    m_MaxTau = numeric_limits<double>::infinity();
+    m_MaxSteps = 0; // special case 0 == no limit
+
+    //useful additional parameters
+    m_ExtraChecks = true;
+    m_RecordTimeSeries = true;
+    m_ExactMethod = eExactDirect;
+    m_ExactStateValid = false;
+    m_LangevinThreshold = 0;
+    m_LeapMethod = eLeapTau;
+    m_RSSAFluctuation = kDefaultRSSAFluctuation;
+    m_VerboseTracing = 0;
+    m_RateChangeBound = changeBound;
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::x_CheckInitialValues(void) const {
+    //check initial conditions to make sure legit
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        if (m_X[i] < 0) {
+            throwError("initial value for variable " << i+1 <<
+                       " must be positive (currently " << m_X[i] << ")");
+        }
+        if (!m_RealValuedVariables[i]  &&
+            (m_X[i] - trunc(m_X[i]) > 1e-5)) {
+            if (!GetVarNames().empty()) {
+                throwError("initial value for variable " << i+1 <<
+                           " ('" << GetVarNames()[i] << "') " <<
+                           "must be an integer (currently " << m_X[i] << ")");
+            } else {
+                throwError("initial value for variable " << i+1 <<
+                           " must be an integer (currently " << m_X[i] << ")");
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::EvaluateATLUntil(double tF) {
+    CPhaseTimer timer(m_Stats.m_Seconds[ePhaseTotal]);
+    unsigned int c = 0;
+    x_BeginRun(tF);
+    //add initial conditions to time series
+    if (m_RecordTimeSeries) {
+        m_TimeSeries.Append(*m_T, m_X, m_NumStates);
+    }
+    //main loop
+    while (x_Continue(tF, c)) {
+        if (m_Trace) {
+            m_Trace->BeginStep(*m_T);
+        }
+        {
+            CTraceScope trace(m_Trace, eTraceStep, *m_T);
+            x_UpdateRates();
+            if (m_LeapMethod == eLeapR) {
+                x_SingleStepRL(tF);
+            } else {
+                x_SingleStepATL(tF);
+            }
+        }
+        x_CheckStop();
+        x_CheckRunControl(++c);
+    }
+    x_EndRun(tF, c);
+}
+
+void CStochasticEqns::EvaluateExactUntil(double tF) {
+    CPhaseTimer timer(m_Stats.m_Seconds[ePhaseTotal]);
+    unsigned int c = 0;
+    x_BeginRun(tF);
+    //add initial conditions to time series
+    if (m_RecordTimeSeries) {
+        m_TimeSeries.Append(*m_T, m_X, m_NumStates);
+    }
+    m_LastTransition = -1;
+    //main loop
+    while (x_Continue(tF, c)) {
+        if (m_Trace) {
+            m_Trace->BeginStep(*m_T);
+        }
+        {
+            CTraceScope trace(m_Trace, eTraceStep, *m_T);
+            x_StepExact(tF, false);
+        }
+        x_CheckStop();
+        x_CheckRunControl(++c);
+    }
+    x_EndRun(tF, c);
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::x_BeginRun(double tF) {
+    x_ReserveWorkspace(); //derived classes may have enabled a Jacobian
+    m_StopReason = eStopEarlyExit; //unless the main loop ends normally
+    m_RunStart = TClock::now();
+    m_RunFinalTime = tF;
+    m_ClockCountdown = CRunControl::kClockCheckSteps;
+    m_NextProgressSim = (m_Control->m_Progress  &&
+                         m_Control->m_ProgressSimInterval > 0) ?
+        *m_T + m_Control->m_ProgressSimInterval :
+        numeric_limits<double>::infinity();
+    m_NextProgressWall = m_Control->m_ProgressWallInterval > 0 ?
+        m_Control->m_ProgressWallInterval : numeric_limits<double>::infinity();
+    m_NextInterruptCheck = m_Control->m_InterruptInterval > 0 ?
+        m_Control->m_InterruptInterval : numeric_limits<double>::infinity();
+}
+
+void CStochasticEqns::x_EndRun(double tF, uint64_t steps) {
+    if (m_StopCriteria.GetMet() >= 0) {
+        m_StopReason = eStopCriterion;
+    } else if (m_LastTransition >= 0  &&
+               m_TransCats[m_LastTransition] == eHalting) {
+        m_StopReason = eStopHalting;
+    } else if (*m_T >= tF) {
+        m_StopReason = eStopFinalTime;
+    } else {
+        m_StopReason = eStopMaxSteps;
+    }
+    x_ReportProgress(steps, chrono::duration<double>(TClock::now() -
+                                                     m_RunStart).count(), true);
+}
+
+void CStochasticEqns::x_CheckRunClock(uint64_t steps) {
+    m_ClockCountdown = CRunControl::kClockCheckSteps;
+    const double wall = chrono::duration<double>(TClock::now() -
+                                                 m_RunStart).count();
+    const CRunControl &ctl = *m_Control;
+    if (ctl.m_WallClockBudget > 0  &&  wall > ctl.m_WallClockBudget) {
+        throwEarlyExit("wall-clock budget of " << ctl.m_WallClockBudget <<
+                       "s used up at time " << *m_T << " after " << steps <<
+                       " time steps");
+    }
+    if (wall >= m_NextInterruptCheck) {
+        m_NextInterruptCheck = wall + ctl.m_InterruptInterval;
+        if (AdaptiveTauCheckUserInterrupt()) {
+            throwEarlyExit("simulation interrupted by user at time " << *m_T
+                           << " after " << steps << " time steps.");
+        }
+    }
+    if (*m_T >= m_NextProgressSim  ||  wall >= m_NextProgressWall) {
+        while (m_NextProgressSim <= *m_T) {
+            m_NextProgressSim += ctl.m_ProgressSimInterval;
+        }
+        if (wall >= m_NextProgressWall) {
+            m_NextProgressWall = wall + ctl.m_ProgressWallInterval;
+        }
+        x_ReportProgress(steps, wall, false);
+    }
+}
+
+void CStochasticEqns::x_ReportProgress(uint64_t steps, double wallSeconds,
+                                       bool finished) {
+    CRunControl &ctl = *m_Control;
+    if (!ctl.m_Progress) {
+        return;
+    }
+    SProgress p;
+    p.m_Time = *m_T;
+    p.m_FinalTime = m_RunFinalTime;
+    p.m_WallSeconds = wallSeconds;
+    p.m_Steps = steps;
+    p.m_Finished = finished;
+    p.m_Stats = &m_Stats;
+    if (!ctl.m_Progress(p, ctl.m_ProgressData)  &&  !finished) {
+        //this run only: ctl may be shared with other simulations
+        throwEarlyExit("simulation cancelled by progress callback at time " <<
+                       *m_T << " after " << steps << " time steps");
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : m_X current
+// POST: m_Rates current (& checked if m_ExtraChecks)
+void CStochasticEqns::x_UpdateRates(void) {
+    if (m_ExtraChecks) {
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            if (m_X[i] < 0) {
+                throwError("negative variable: " << i+1 << " is " <<
+                           m_X[i] << " (check rate function "
+                           "and/or transition matrix)");
+            } else if (std::isnan(m_X[i])) {
+                throwError("NaN variable: " << i+1 << " is " <<
+                           m_X[i] << " (check rate function "
+                           "and/or transition matrix)");
+            }
+        }
+    }
+
+    {
+        CPhaseTimer timer(m_Stats.m_Seconds[ePhaseRates]);
+        CTraceScope trace(m_Trace, eTraceRates, *m_T);
+        x_CalcRates();
+    }
+    ++m_Stats.m_RateEvaluations;
+
+    if (m_ExtraChecks) {
+        for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+            if (std::isnan(m_Rates[j])) {
+                throwError("invalid rate function -- rate for transition "
+                           << j+1 << " is not a number (NA/NaN)! (check "
+                           "for divison by zero or similar)");
+            }
+            if (m_Rates[j] < 0) {
+                throwError("invalid rate function -- rate for transition "
+                           << j+1 << " is negative!");
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::x_CalcRates(void) {
+    if (m_Kernels) {
+        m_Kernels->CalcRates(m_X, m_Rates);
+    } else if (m_Model) {
+        x_CalcMassActionRates();
+    } else {
+        throwError("logic error at line " << __LINE__);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : m_Model set & Jacobian enabled, m_X current
+// POST: d rate_j / d x_i at [j*m_NumStates + i] (same layout as R)
+double* CStochasticEqns::x_CalcJacobian(void) {
+    if (m_FDJacobian) {
+        return x_CalcFiniteDifferenceJacobian();
+    }
+    if (!m_UseJacobian) { throwError("logic error at line " << __LINE__) }
+    const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+    const double *rateConstants = m_Model->RateConstants();
+    fill(m_NativeJacobian.begin(), m_NativeJacobian.end(), 0.);
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        const CRow<SReactant> r = reactants[j];
+        for (unsigned int k = 0;  k < r.size();  ++k) {
+            //product rule: derivative of reactant k's falling factorial
+            //times the other reactants' falling factorials
+            double others = rateConstants[j];
+            for (unsigned int k2 = 0;  k2 < r.size();  ++k2) {
+                if (k2 != k) {
+                    for (int n = 0;  n < r[k2].m_Order;  ++n) {
+                        others *= max(m_X[r[k2].m_State] - n, 0.);
+                    }
+                }
+            }
+            const double x = m_X[r[k].m_State];
+            double deriv = 0;
+            for (int m = 0;  m < r[k].m_Order;  ++m) {
+                double term = 1;
+                for (int n = 0;  n < r[k].m_Order;  ++n) {
+                    if (n != m) {
+                        term *= max(x - n, 0.);
+                    }
+                }
+                deriv += term;
+            }
+            m_NativeJacobian[j*m_NumStates + r[k].m_State] += others * deriv;
+        }
+    }
+    return &m_NativeJacobian[0];
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::SetFiniteDifferenceJacobian(bool fdJacobian) {
+    m_FDJacobian = fdJacobian;
+    if (fdJacobian) {
+        x_InitFiniteDifferenceJacobian();
+    }
+    m_NativeJacobian.assign(m_UseJacobian  ||  m_FDJacobian ?
+                            m_NumStates * m_Nu.size() : 0, 0);
+    x_ReserveWorkspace();
+}
+
+void CStochasticEqns::SetRateDependencies(const vector< vector<unsigned int> >
+                                          &deps) {
+    if (deps.size() != m_Nu.size()) {
+        throwError("rate dependencies given for " << deps.size() <<
+                   " transitions but there are " << m_Nu.size());
+    }
+    for (unsigned int j = 0;  j < deps.size();  ++j) {
+        for (unsigned int k = 0;  k < deps[j].size();  ++k) {
+            if (deps[j][k] >= m_NumStates) {
+                throwError("rate of transition " << j+1 << " depends on "
+                           "variable " << deps[j][k]+1 << " but there are "
+                           "only " << m_NumStates);
+            }
+        }
+    }
+    m_RateDeps.Assign(deps);
+    if (m_FDJacobian) {
+        x_InitFiniteDifferenceJacobian();
+    }
+}
+
+void CStochasticEqns::x_InitFiniteDifferenceJacobian(void) {
+    if (m_RateDeps.size() != m_Nu.size()) {
+        vector< vector<unsigned int> > deps(m_Nu.size());
+        for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+            if (m_Model) {
+                const CRow<SReactant> r = m_Model->Reactants()[j];
+                for (unsigned int k = 0;  k < r.size();  ++k) {
+                    deps[j].push_back(r[k].m_State);
+                }
+            } else {
+                for (unsigned int k = 0;  k < m_Nu[j].size();  ++k) {
+                    if (m_Nu[j][k].m_Mag < 0) {
+                        deps[j].push_back(m_Nu[j][k].m_State);
+                    }
+                }
+            }
+        }
+        m_RateDeps.Assign(deps);
+    }
+    vector< vector<unsigned int> > bySpecies(m_NumStates);
+    for (unsigned int j = 0;  j < m_RateDeps.size();  ++j) {
+        for (unsigned int k = 0;  k < m_RateDeps[j].size();  ++k) {
+            bySpecies[m_RateDeps[j][k]].push_back(j);
+        }
+    }
+    m_RateDepsBySpecies.Assign(bySpecies);
+
+    //greedy colouring: variables on which one rate depends get distinct
+    //colours.  Variables no rate depends on are never perturbed.
+    const unsigned int kUncoloured = numeric_limits<unsigned int>::max();
+    vector<unsigned int> colour(m_NumStates, kUncoloured);
+    vector<unsigned int> forbiddenFor; //per colour: last variable it clashed with
+    vector< vector<unsigned int> > groups;
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        const CRow<unsigned int> trans = m_RateDepsBySpecies[i];
+        if (trans.empty()) {
+            continue;
+        }
+        for (unsigned int k = 0;  k < trans.size();  ++k) {
+            const CRow<unsigned int> deps = m_RateDeps[trans[k]];
+            for (unsigned int k2 = 0;  k2 < deps.size();  ++k2) {
+                if (colour[deps[k2]] != kUncoloured) {
+                    forbiddenFor[colour[deps[k2]]] = i;
+                }
+            }
+        }
+        unsigned int c = 0;
+        while (c < groups.size()  &&  forbiddenFor[c] == i) {
+            ++c;
+        }
+        if (c == groups.size()) {
+            groups.push_back(vector<unsigned int>());
+            forbiddenFor.push_back(kUncoloured);
+        }
+        colour[i] = c;
+        groups[c].push_back(i);
+    }
+    m_ColourGroups.Assign(groups);
+}
+
+// PRE : m_X current (m_Rates need not be)
+// POST: d rate_j / d x_i at [j*m_NumStates + i] for the entries in the
+// sparsity pattern (others 0); m_Rates current
+double* CStochasticEqns::x_CalcFiniteDifferenceJacobian(void) {
+    const unsigned int m = m_Nu.size();
+    CWorkspace::CScope scope(m_Workspace);
+    double *origX = m_Workspace.Alloc<double>(m_NumStates);
+    double *step = m_Workspace.Alloc<double>(m_NumStates);
+    double *baseRates = m_Workspace.Alloc<double>(m);
+    memcpy(origX, m_X, sizeof(double)*m_NumStates);
+    x_CalcRates();
+    ++m_Stats.m_RateEvaluations;
+    memcpy(baseRates, m_Rates, sizeof(double)*m);
+
+    //relative step ~ sqrt(machine epsilon), the usual choice for forward
+    //differences; at least that for variables near 0
+    const double relStep = sqrt(numeric_limits<double>::epsilon());
+    fill(m_NativeJacobian.begin(), m_NativeJacobian.end(), 0.);
+    for (unsigned int c = 0;  c < m_ColourGroups.size();  ++c) {
+        const CRow<unsigned int> group = m_ColourGroups[c];
+        for (unsigned int k = 0;  k < group.size();  ++k) {
+            const unsigned int i = group[k];
+            m_X[i] = origX[i] + relStep * max(fabs(origX[i]), 1.);
+            step[i] = m_X[i] - origX[i]; //exactly representable
+        }
+        x_CalcRates();
+        ++m_Stats.m_RateEvaluations;
+        for (unsigned int k = 0;  k < group.size();  ++k) {
+            const unsigned int i = group[k];
+            m_X[i] = origX[i];
+            const CRow<unsigned int> trans = m_RateDepsBySpecies[i];
+            for (unsigned int k2 = 0;  k2 < trans.size();  ++k2) {
+                const unsigned int j = trans[k2];
+                m_NativeJacobian[j*m_NumStates + i] =
+                    (m_Rates[j] - baseRates[j]) / step[i];
+            }
+        }
+    }
+    memcpy(m_Rates, baseRates, sizeof(double)*m);
+    return &m_NativeJacobian[0];
+}
+
+/*---------------------------------------------------------------------------*/
+double CStochasticEqns::x_TauEx(void) const {
+    double tau = numeric_limits<double>::infinity();
+    CWorkspace::CScope scope(m_Workspace);
+    double *mu = m_Workspace.Alloc<double>(m_NumStates);
+    double *sigma = m_Workspace.Alloc<double>(m_NumStates);
+    fill(mu, mu + m_NumStates, 0.);
+    fill(sigma, sigma + m_NumStates, 0.);
+
+    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+         j != m_TransByCat[eNormal].end();  ++j) {
+        for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
+            const SChange &c = m_Nu[*j][i];
+            mu[c.m_State] += c.m_Mag * m_Rates[*j];
+            sigma[c.m_State] += c.m_Mag * c.m_Mag * m_Rates[*j];
+        }
+    }
+    //cerr << "-=| mu:";
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        //cerr << "\t" << mu[i];
+        double val = max(m_Epsilon * m_X[i] / m_RateChangeBound[i],
+                         1.)/fabs(mu[i]);
+        //cerr << "/" << val;
+        if (val < tau) {
+            tau = val;
+            if (tau < 0) {
+                throwError("tried to select tau < 0; most likely means "
+                           "your rate function generated a negative rate");
+            }
+        }
+        val = pow(max(m_Epsilon * m_X[i] / m_RateChangeBound[i],
+                      1.),2) / sigma[i];
+        if (val < tau) {
+            tau = val;
+            if (tau < 0) {
+                throwError("tried to select tau < 0; most likely means "
+                           "your rate function generated a negative rate");
+            }
+        }
+    }
+    //cerr << endl;
+
+    return tau;
+}
+
+/*---------------------------------------------------------------------------*/
+double CStochasticEqns::x_TauIm(void) const {
+    if (!x_HasJacobian()) {
+        return 0;
+    }
+    CWorkspace::CScope scope(m_Workspace);
+    bool *equil = m_Workspace.Alloc<bool>(m_TransCats.size());
+    fill(equil, equil + m_TransCats.size(), false);
+    for (const CCompiledModel::TBalancedPair *i = m_BalancedPairs.begin();
+         i != m_BalancedPairs.end();  ++i) {
+        if (fabs(m_Rates[i->first] - m_Rates[i->second]) <=
+            m_Delta * min(m_Rates[i->first], m_Rates[i->second])) {
+            equil[i->first] = true;
+            equil[i->second] = true;
+        }
+    }
+
+    double *mu = m_Workspace.Alloc<double>(m_NumStates);
+    double *sigma = m_Workspace.Alloc<double>(m_NumStates);
+    fill(mu, mu + m_NumStates, 0.);
+    fill(sigma, sigma + m_NumStates, 0.);
+    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+         j != m_TransByCat[eNormal].end();  ++j) {
+        if (!equil[*j]) {
+            for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
+                const SChange &c = m_Nu[*j][i];
+                mu[c.m_State] += c.m_Mag * m_Rates[*j];
+                sigma[c.m_State] += c.m_Mag * c.m_Mag * m_Rates[*j];
+            }
+        }
+    }
+
+    double tau = numeric_limits<double>::infinity();
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        double val = max(m_Epsilon * m_X[i] / m_RateChangeBound[i],
+                         1.)/fabs(mu[i]);
+        if (val < tau) {
+            tau = val;
+        }
+        val = pow(max(m_Epsilon * m_X[i] / m_RateChangeBound[i],
+                      1.),2) / sigma[i];
+        if (val < tau) {
+            tau = val;
+        }
+    }
+    
+    return tau;
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : m_Model set, m_X current
+// POST: m_Rates set by mass action (see modelformat.h for the convention)
+void CStochasticEqns::x_CalcMassActionRates(void) {
+    if (x_UseParallel()) {
+        x_RunBlocks(&CStochasticEqns::x_MassActionRatesBlock, m_Nu.size());
+    } else {
+        x_CalcMassActionRates(0, m_Nu.size());
+    }
+}
+
+void CStochasticEqns::x_CalcMassActionRates(unsigned int from,
+                                            unsigned int to) {
+    const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+    const double *rateConstants = m_Model->RateConstants();
+    for (unsigned int j = from;  j < to;  ++j) {
+        double rate = rateConstants[j];
+        const CRow<SReactant> r = reactants[j];
+        for (unsigned int k = 0;  k < r.size()  &&  rate > 0;  ++k) {
+            const double x = m_X[r[k].m_State];
+            for (int n = 0;  n < r[k].m_Order;  ++n) {
+                rate *= max(x - n, 0.);
+            }
+        }
+        m_Rates[j] = rate;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : normal transition j
+// POST: whether j could exhaust one of its reactants within m_Ncritical
+// firings (see Cao et al. 2006)
+inline bool CStochasticEqns::x_IsCritical(unsigned int j) const {
+    unsigned int minTimes = numeric_limits<unsigned int>::max();
+    for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+        if (m_Nu[j][i].m_Mag < 0  &&
+            m_X[m_Nu[j][i].m_State]/abs(m_Nu[j][i].m_Mag) < minTimes) {
+            minTimes = m_X[m_Nu[j][i].m_State]/abs(m_Nu[j][i].m_Mag);
+        }
+    }
+    return minTimes < m_Ncritical;
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::SetThreadPool(CThreadPool *pool,
+                                    unsigned int parallelThreshold) {
+    m_Pool = (pool  &&  m_Nu.size() >= parallelThreshold) ? pool : NULL;
+    if (!m_Pool) {
+        return;
+    }
+    m_Firings.resize(m_Nu.size(), 0);
+    m_CriticalFlags.resize(m_Nu.size(), 0);
+}
+
+void CStochasticEqns::x_RunBlocks(TBlockFn fn, unsigned int numItems) {
+    CBlockTask task(this, fn);
+    m_Pool->Run(task, (numItems + kParallelBlock - 1) / kParallelBlock);
+}
+
+void CStochasticEqns::x_MassActionRatesBlock(unsigned int block) {
+    x_CalcMassActionRates(block * kParallelBlock,
+                          min<unsigned int>((block+1) * kParallelBlock,
+                                            m_Nu.size()));
+}
+
+// POST: m_CriticalFlags set for the normal transitions of the block;
+// m_BlockSums[2*block] / [2*block+1] = critical / non-critical rate
+void CStochasticEqns::x_ClassifyBlock(unsigned int block) {
+    const unsigned int to = min<unsigned int>((block+1) * kParallelBlock,
+                                              m_Nu.size());
+    double critical = 0, noncrit = 0;
+    for (unsigned int j = block * kParallelBlock;  j < to;  ++j) {
+        if (m_TransCats[j] != eNormal) {
+            continue;
+        }
+        m_CriticalFlags[j] = x_IsCritical(j);
+        if (m_CriticalFlags[j]) {
+            critical += m_Rates[j];
+        } else {
+            noncrit += m_Rates[j];
+        }
+    }
+    m_BlockSums[2*block] = critical;
+    m_BlockSums[2*block + 1] = noncrit;
+}
+
+// PRE : m_TransByCat[eCritical] holds only the halting transitions,
+// m_TransByCat[eNormal] empty
+// POST: as the serial loop in x_SingleStepATL; partial sums are reduced in
+// block order so the result does not depend on the number of threads
+void CStochasticEqns::x_ClassifyParallel(double &criticalRate,
+                                         double &noncritRate) {
+    const unsigned int numBlocks =
+        (m_Nu.size() + kParallelBlock - 1) / kParallelBlock;
+    m_BlockSums.assign(2 * numBlocks, 0);
+    x_RunBlocks(&CStochasticEqns::x_ClassifyBlock, m_Nu.size());
+    for (unsigned int b = 0;  b < numBlocks;  ++b) {
+        criticalRate += m_BlockSums[2*b];
+        noncritRate += m_BlockSums[2*b + 1];
+    }
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        if (m_TransCats[j] != eNormal) {
+            continue;
+        }
+        if (m_CriticalFlags[j]) {
+            m_TransByCat[eCritical].push_back(j);
+            if (m_Profiling) {
+                ++m_Profile.m_Critical[j];
+            }
+        } else {
+            m_TransByCat[eNormal].push_back(j);
+        }
+    }
+}
+
+// POST: m_Firings set for the block's share of m_TransByCat[eNormal] from
+// the block's own RNG substream; m_BlockSums[block] = total firings
+void CStochasticEqns::x_SampleBlock(unsigned int block) {
+    CRandom rng(m_ParSeed + block);
+    const TTransList &normal = m_TransByCat[eNormal];
+    const unsigned int to = min<unsigned int>((block+1) * kParallelBlock,
+                                              normal.size());
+    double firings = 0;
+    for (unsigned int n = block * kParallelBlock;  n < to;  ++n) {
+        const unsigned int j = normal[n];
+        const double mean = m_Rates[j] * m_ParTau;
+        const double k = mean > 1e8 ?
+            max(0., floor(rng.Norm(mean, sqrt(mean)))) : rng.Pois(mean);
+        m_Firings[j] = k;
+        firings += k;
+    }
+    m_BlockSums[block] = firings;
+}
+
+// POST: m_X += nu . m_Firings for the block's species (each species is
+// written by one block only)
+void CStochasticEqns::x_ScatterBlock(unsigned int block) {
+    const unsigned int to = min<unsigned int>((block+1) * kParallelBlock,
+                                              m_NumStates);
+    for (unsigned int i = block * kParallelBlock;  i < to;  ++i) {
+        const CRow<SChange> row = m_NuBySpecies[i];
+        double delta = 0;
+        for (unsigned int k = 0;  k < row.size();  ++k) {
+            delta += m_Firings[row[k].m_State] * row[k].m_Mag;
+        }
+        m_X[i] += delta;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : list of critical transitions & their total rate
+// POST: one picked according to probability
+unsigned int CStochasticEqns::x_PickCritical(double critRate) {
+    double r = m_Random.Unif();
+    double d = 0;
+    TTransList::const_iterator j = m_TransByCat[eCritical].begin();
+    while (j != m_TransByCat[eCritical].end()) {
+        d += m_Rates[*j]/critRate;
+        if (d > r) {
+            break;
+        }
+        ++j;
+    }
+    if (!(d >= r)) { throwError("logic error at line " << __LINE__) }
+    return *j;
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::x_ProfileStep(double deltaT) {
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        m_Profile.m_Propensity[j] += m_Rates[j] * deltaT;
+    }
+    for (TTransList::const_iterator j = m_TransByCat[eDeterministic].begin();
+         j != m_TransByCat[eDeterministic].end();  ++j) {
+        m_Profile.m_Firings[*j] += m_Rates[*j] * deltaT;
+    }
+}
+
+// POST: m_Firings zero for all normal transitions (if used at all)
+void CStochasticEqns::x_ResetFirings(void) {
+    if (m_Firings.empty()) {
+        return;
+    }
+    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+         j != m_TransByCat[eNormal].end();  ++j) {
+        m_Firings[*j] = 0;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// orders transitions by decreasing integrated propensity, then firings
+struct SProfileMore {
+    SProfileMore(const STransitionProfile &p) : m_P(p) {}
+    bool operator()(unsigned int a, unsigned int b) const {
+        if (m_P.m_Propensity[a] != m_P.m_Propensity[b]) {
+            return m_P.m_Propensity[a] > m_P.m_Propensity[b];
+        }
+        if (m_P.m_Firings[a] != m_P.m_Firings[b]) {
+            return m_P.m_Firings[a] > m_P.m_Firings[b];
+        }
+        return a < b;
+    }
+    const STransitionProfile &m_P;
+};
+
+vector<unsigned int>
+CStochasticEqns::GetProfileRanking(unsigned int maxRows) const {
+    vector<unsigned int> order;
+    if (!m_Profiling) {
+        return order;
+    }
+    order.resize(m_Nu.size());
+    for (unsigned int j = 0;  j < order.size();  ++j) {
+        order[j] = j;
+    }
+    if (maxRows > 0  &&  maxRows < order.size()) {
+        partial_sort(order.begin(), order.begin() + maxRows, order.end(),
+                     SProfileMore(m_Profile));
+        order.resize(maxRows);
+    } else {
+        sort(order.begin(), order.end(), SProfileMore(m_Profile));
+    }
+    return order;
+}
+
+// PRE : j < number of transitions
+// POST: reactants -> products; reactants are taken from the model if there
+// is one (so catalysts appear on both sides), otherwise from the negative
+// entries of the state change
+string CStochasticEqns::DescribeTransition(unsigned int j) const {
+    vector<pair<int, int> > lhs, rhs; //(species, count)
+    if (m_Model) {
+        const CRow<SReactant> r = m_Model->Reactants()[j];
+        for (unsigned int k = 0;  k < r.size();  ++k) {
+            lhs.push_back(make_pair(r[k].m_State, r[k].m_Order));
+        }
+        rhs = lhs;
+        for (unsigned int k = 0;  k < m_Nu[j].size();  ++k) {
+            unsigned int i = 0;
+            while (i < rhs.size()  &&  rhs[i].first != m_Nu[j][k].m_State) {
+                ++i;
+            }
+            if (i == rhs.size()) {
+                rhs.push_back(make_pair(m_Nu[j][k].m_State, 0));
+            }
+            rhs[i].second += m_Nu[j][k].m_Mag;
+        }
+    } else {
+        for (unsigned int k = 0;  k < m_Nu[j].size();  ++k) {
+            if (m_Nu[j][k].m_Mag < 0) {
+                lhs.push_back(make_pair(m_Nu[j][k].m_State,
+                                        -m_Nu[j][k].m_Mag));
+            } else {
+                rhs.push_back(make_pair(m_Nu[j][k].m_State, m_Nu[j][k].m_Mag));
+            }
+        }
+    }
+
+    ostringstream oss;
+    for (unsigned int side = 0;  side < 2;  ++side) {
+        const vector<pair<int, int> > &terms = side == 0 ? lhs : rhs;
+        bool first = true;
+        for (unsigned int k = 0;  k < terms.size();  ++k) {
+            if (terms[k].second <= 0) {
+                continue;
+            }
+            oss << (first ? "" : " + ");
+            if (terms[k].second > 1) {
+                oss << terms[k].second << " ";
+            }
+            if ((unsigned int)terms[k].first < GetVarNames().size()) {
+                oss << GetVarNames()[terms[k].first];
+            } else {
+                oss << "x" << terms[k].first+1;
+            }
+            first = false;
+        }
+        if (first) {
+            oss << "0";
+        }
+        if (side == 0) {
+            oss << " -> ";
+        }
+    }
+    return oss.str();
+}
+
+void CStochasticEqns::WriteProfileReport(ostream &out,
+                                         unsigned int maxRows) const {
+    if (!m_Profiling) {
+        out << "profiling was not enabled" << endl;
+        return;
+    }
+    double totalFirings = 0, totalPropensity = 0;
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        totalFirings += m_Profile.m_Firings[j];
+        totalPropensity += m_Profile.m_Propensity[j];
+    }
+    const uint64_t atlSteps = m_Stats.m_Steps[eExplicit] +
+        m_Stats.m_Steps[eImplicit];
+
+    out << setw(6) << "rank" << setw(10) << "trans" << setw(14) << "firings"
+        << setw(9) << "fire%" << setw(11) << "critical" << setw(14)
+        << "propensity" << setw(9) << "prop%" << "  reaction" << endl;
+    const vector<unsigned int> order = GetProfileRanking(maxRows);
+    for (unsigned int r = 0;  r < order.size();  ++r) {
+        const unsigned int j = order[r];
+        out << setw(6) << r+1 << setw(10) << j+1 << setw(14)
+            << setprecision(6) << m_Profile.m_Firings[j] << setw(9)
+            << fixed << setprecision(2)
+            << (totalFirings > 0 ?
+                100 * m_Profile.m_Firings[j] / totalFirings : 0)
+            << defaultfloat << setw(11) << m_Profile.m_Critical[j] << setw(14)
+            << setprecision(6) << m_Profile.m_Propensity[j] << setw(9)
+            << fixed << setprecision(2)
+            << (totalPropensity > 0 ?
+                100 * m_Profile.m_Propensity[j] / totalPropensity : 0)
+            << defaultfloat << "  " << DescribeTransition(j)
+            << (m_TransCats[j] == eDeterministic ? " [deterministic]" :
+                m_TransCats[j] == eHalting ? " [halting]" : "") << endl;
+    }
+    out << setprecision(6) << "total firings " << totalFirings << ", integrated propensity "
+        << totalPropensity << ", leap steps " << atlSteps << endl;
+}
+
+/*---------------------------------------------------------------------------*/
+void CStochasticEqns::x_RecordTimePoint(void) {
+    if (!m_RecordTimeSeries) {
+        return;
+    }
+    CTraceScope trace(m_Trace, eTraceRecord, *m_T);
+    m_TimeSeries.Append(*m_T, m_X, m_NumStates);
+}
+
+// Tau selection (x_TauEx, x_TauIm) and the leaps (x_SingleStepETL,
+// x_SingleStepITL) each release their scratch before the next one runs,
+// so the workspace needs the largest of them, not their sum.
+size_t CStochasticEqns::x_WorkspaceBytes(void) const {
+    const size_t n = m_NumStates, m = m_Nu.size();
+    const size_t tauSelection = CWorkspace::Footprint<bool>(m) +
+        2 * CWorkspace::Footprint<double>(n);
+    size_t leap = CWorkspace::Footprint<double>(n); //origX, or R-leap reserve
+    if (m_FDJacobian) {
+        leap += 2 * CWorkspace::Footprint<double>(n) + //origX, step
+            CWorkspace::Footprint<double>(m);          //baseRates
+    }
+    if (m_LangevinThreshold > 0) {
+        leap += CWorkspace::Footprint<double>(m);  //noise
+    }
+    if (x_HasJacobian()) {
+        leap += CWorkspace::Footprint<double>(m) + //origRates
+            CWorkspace::Footprint<int>(m) +        //numTransitions
+            2 * CWorkspace::Footprint<double>(n) + //alpha, matrixB
+            CWorkspace::Footprint<int>(n) +        //ipiv
+            CWorkspace::Footprint<double>(n * n);  //matrixA
+    }
+    return max(tauSelection, leap);
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : time period to step; whether to clamp variables at 0
+// POST: all determinisitic transitions updated by the expected amount
+// (i.e. Euler method); if clamping, then negative variables set to 0.
+void CStochasticEqns::x_AdvanceDeterministic(double deltaT, bool clamp) {
+    for (TTransList::const_iterator j = m_TransByCat[eDeterministic].begin();
+         j != m_TransByCat[eDeterministic].end();  ++j) {
+        for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
+            m_X[m_Nu[*j][i].m_State] += m_Nu[*j][i].m_Mag * m_Rates[*j] *
+                deltaT;
+            //clamp at zero if specified
+            if (clamp  &&  m_X[m_Nu[*j][i].m_State] < 0) {
+                m_X[m_Nu[*j][i].m_State] = 0;
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : simulation end time; **transition rates already updated**
+// POST: id of transition taken (if none, then -1) & time series updated.
+void CStochasticEqns::x_SingleStepExact(double tf) {
+    CTraceScope trace(m_Trace, eTraceExact, *m_T);
+    m_LastTransition = -1;
+    double stochRate = 0;
+    double detRate = 0;
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        if (m_TransCats[j] != eDeterministic) {
+            stochRate += m_Rates[j];
+        } else {
+            detRate += m_Rates[j];
+        }
+    }
+
+    double tau = stochRate > 0 ? m_Random.Exp(1./stochRate) :
+        detRate > 0 ? 1./detRate : tf - *m_T;
+    if (stochRate == 0  ||  tau > tf - *m_T) {
+        tau = tf - *m_T; // step is off end so just advance time
+    } else {
+        double r = m_Random.Unif();
+        double d = 0;
+        unsigned int j = 0;
+        for (;  j < m_Nu.size()  &&  d < r;  ++j) {
+            if (m_TransCats[j] != eDeterministic) {
+                d += m_Rates[j]/stochRate;
+            }
+        }
+        if (!(d >= r)) { throwError("logic error at line " << __LINE__) }
+        --j;
+
+        //take transition "j"
+        if (m_VerboseTracing >= 1) {
+            AdaptiveTauTrace("%f: taking transition #%i\n", *m_T, j+1);
+        }
+        if (m_Kernels) {
+            m_Kernels->ApplyTransition(j, 1, m_X);
+        } else {
+            for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+                m_X[m_Nu[j][i].m_State] += m_Nu[j][i].m_Mag;
+            }
+        }
+        m_LastTransition = j;
+        ++m_Stats.m_Firings;
+        if (m_Profiling) {
+            ++m_Profile.m_Firings[j];
+        }
+    }
+    ++m_Stats.m_Steps[eExact];
+    if (m_Profiling) {
+        x_ProfileStep(tau);
+    }
+
+    //clamp deterministic at 0, assuming that it is unreasonable to
+    //take a smaller step then exact.
+    x_AdvanceDeterministic(tau, true);
+    *m_T += tau;
+    x_RecordTimePoint();
+}
+
+/*---------------------------------------------------------------------------*/
+inline void CStochasticEqns::x_StepExact(double tf, bool ratesCurrent) {
+    if (m_ExactMethod == eExactRejection) {
+        x_SingleStepRSSA(tf);
+    } else if (m_ExactMethod == eExactPartialPropensity) {
+        x_SingleStepPDM(tf);
+    } else {
+        if (!ratesCurrent) {
+            x_UpdateRates();
+        }
+        x_SingleStepExact(tf);
+    }
+}
+
+// PRE : simulation end time
+// POST: id of transition taken (if none, then -1) & time series updated.
+// Candidates arrive at the total of the upper bounds & are thinned to the
+// true rates (Thanh et al. 2014), so the first accepted one is distributed
+// as a direct-method step.
+void CStochasticEqns::x_SingleStepRSSA(double tf) {
+    CTraceScope trace(m_Trace, eTraceExact, *m_T);
+    if (!m_ExactStateValid) {
+        x_InitRSSABounds();
+    }
+    if (m_Profiling) {
+        x_UpdateRates(); //the profile integrates the rates of the step
+    }
+    m_LastTransition = -1;
+    const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+    const double *rateConstants = m_Model->RateConstants();
+    double tau = 0;
+    for (;;) {
+        const double upper = m_RSSARateHigh.Total();
+        if (!(upper > 0)) {
+            tau = tf - *m_T;
+            break;
+        }
+        if (!std::isfinite(upper)) {
+            throwEarlyExit("Infinite transition rate at time " << *m_T);
+        }
+        tau += m_Random.Exp(1./upper);
+        if (tau > tf - *m_T) {
+            tau = tf - *m_T; // step is off end so just advance time
+            break;
+        }
+        const unsigned int j = m_RSSARateHigh.Find(m_Random.Unif() * upper);
+        const double r = m_Random.Unif() * m_RSSARateHigh.Get(j);
+        if (!(r < m_RSSARateLow[j])  &&
+            !(r < MassActionRate(reactants[j], rateConstants[j], m_X))) {
+            ++m_Stats.m_Rejections;
+            continue;
+        }
+
+        //take transition "j"
+        if (m_VerboseTracing >= 1) {
+            AdaptiveTauTrace("%f: taking transition #%i\n", *m_T, j+1);
+        }
+        if (m_Kernels) {
+            m_Kernels->ApplyTransition(j, 1, m_X);
+        } else {
+            for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+                m_X[m_Nu[j][i].m_State] += m_Nu[j][i].m_Mag;
+            }
+        }
+        //only species that left their interval move any bounds
+        for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+            const unsigned int state = m_Nu[j][i].m_State;
+            if (m_X[state] < m_RSSALow[state]  ||
+                m_X[state] > m_RSSAHigh[state]) {
+                x_SetRSSAInterval(state);
+                const CRow<unsigned int> trans = m_ReactantOf[state];
+                for (unsigned int k = 0;  k < trans.size();  ++k) {
+                    x_SetRSSABounds(trans[k]);
+                }
+            }
+        }
+        m_LastTransition = j;
+        ++m_Stats.m_Firings;
+        if (m_Profiling) {
+            ++m_Profile.m_Firings[j];
+        }
+        break;
+    }
+    ++m_Stats.m_Steps[eExact];
+    if (m_Profiling) {
+        x_ProfileStep(tau);
+    }
+    *m_T += tau;
+    x_RecordTimePoint();
+}
+
+void CStochasticEqns::x_InitRSSABounds(void) {
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        x_SetRSSAInterval(i);
+    }
+    const CSparseRows<SReactant> &reactants = m_Model->Reactants();
+    const double *rateConstants = m_Model->RateConstants();
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        m_RSSARateLow[j] = MassActionRate(reactants[j], rateConstants[j],
+                                          &m_RSSALow[0]);
+        m_RSSARateHigh.SetDeferred(j, MassActionRate(reactants[j],
+                                                     rateConstants[j],
+                                                     &m_RSSAHigh[0]));
+    }
+    m_RSSARateHigh.Resum();
+    m_ExactStateValid = true;
+}
+
+inline void CStochasticEqns::x_SetRSSAInterval(unsigned int i) {
+    m_RSSALow[i] = max(0., floor(m_X[i] * (1 - m_RSSAFluctuation)));
+    m_RSSAHigh[i] = ceil(m_X[i] * (1 + m_RSSAFluctuation));
+}
+
+inline void CStochasticEqns::x_SetRSSABounds(unsigned int j) {
+    const CRow<SReactant> r = m_Model->Reactants()[j];
+    const double k = m_Model->RateConstants()[j];
+    m_RSSARateLow[j] = MassActionRate(r, k, &m_RSSALow[0]);
+    m_RSSARateHigh.Set(j, MassActionRate(r, k, &m_RSSAHigh[0]));
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : simulation end time
+// POST: id of transition taken (if none, then -1) & time series updated.
+// A group is drawn by its share count * (sum of partial propensities),
+// then a transition of the group by its partial propensity (Ramaswamy et
+// al. 2009), which is a direct-method step.
+void CStochasticEqns::x_SingleStepPDM(double tf) {
+    CTraceScope trace(m_Trace, eTraceExact, *m_T);
+    if (!m_ExactStateValid) {
+        x_InitPDM();
+    }
+    if (m_Profiling) {
+        x_UpdateRates(); //the profile integrates the rates of the step
+    }
+    m_LastTransition = -1;
+    const double total = m_PDMGroups.Total();
+    double tau;
+    if (!(total > 0)) {
+        tau = tf - *m_T;
+    } else {
+        if (!std::isfinite(total)) {
+            throwEarlyExit("Infinite transition rate at time " << *m_T);
+        }
+        tau = m_Random.Exp(1./total);
+    }
+    if (!(total > 0)  ||  tau > tf - *m_T) {
+        tau = tf - *m_T; // step is off end so just advance time
+    } else {
+        //rounding in the sums may land on an empty group or transition;
+        //drawing again keeps the choice proportional to the rest
+        unsigned int g, pos;
+        do {
+            g = m_PDMGroups.Find(m_Random.Unif() * total);
+        } while (!(m_PDMGroups.Get(g) > 0));
+        const CSumTree &partial = m_PDMPartial[g];
+        do {
+            pos = partial.Find(m_Random.Unif() * partial.Total());
+        } while (!(partial.Get(pos) > 0));
+        const unsigned int j = m_PDMGroupTrans[g][pos];
+
+        //take transition "j"
+        if (m_VerboseTracing >= 1) {
+            AdaptiveTauTrace("%f: taking transition #%i\n", *m_T, j+1);
+        }
+        if (m_Kernels) {
+            m_Kernels->ApplyTransition(j, 1, m_X);
+        } else {
+            for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+                m_X[m_Nu[j][i].m_State] += m_Nu[j][i].m_Mag;
+            }
+        }
+        //only the partial propensities & groups of changed species move
+        for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+            const unsigned int state = m_Nu[j][i].m_State;
+            const CRow<unsigned int> trans = m_PDMDependents[state];
+            for (unsigned int k = 0;  k < trans.size();  ++k) {
+                const unsigned int group = m_PDMGroupOf[trans[k]];
+                m_PDMPartial[group].Set(m_PDMPos[trans[k]],
+                                        x_PartialPropensity(trans[k]));
+                x_SetPDMGroup(group);
+            }
+            x_SetPDMGroup(state);
+        }
+        m_LastTransition = j;
+        ++m_Stats.m_Firings;
+        if (m_Profiling) {
+            ++m_Profile.m_Firings[j];
+        }
+    }
+    ++m_Stats.m_Steps[eExact];
+    if (m_Profiling) {
+        x_ProfileStep(tau);
+    }
+    *m_T += tau;
+    x_RecordTimePoint();
+}
+
+void CStochasticEqns::x_InitPDM(void) {
+    for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+        m_PDMPartial[m_PDMGroupOf[j]].SetDeferred(m_PDMPos[j],
+                                                  x_PartialPropensity(j));
+    }
+    for (unsigned int g = 0;  g <= m_NumStates;  ++g) {
+        m_PDMPartial[g].Resum();
+        m_PDMGroups.SetDeferred(g, (g < m_NumStates ? m_X[g] : 1) *
+                                m_PDMPartial[g].Total());
+    }
+    m_PDMGroups.Resum();
+    m_ExactStateValid = true;
+}
+
+inline double CStochasticEqns::x_PartialPropensity(unsigned int j) const {
+    const CRow<SReactant> r = m_Model->Reactants()[j];
+    double rate = m_Model->RateConstants()[j];
+    for (unsigned int k = 0;  k < r.size()  &&  rate > 0;  ++k) {
+        //x (x-1) ... of the group species, less its first factor
+        const int first =
+            (unsigned int) r[k].m_State == m_PDMGroupOf[j] ? 1 : 0;
+        for (int n = first;  n < r[k].m_Order;  ++n) {
+            rate *= max(m_X[r[k].m_State] - n, 0.);
+        }
+    }
+    return rate;
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : tau value to use for step, list of "critical" transitions
+// POST: IMPLICIT tau step taken (m_X updated if so) (or overflow
+// error thrown if tau was too big)
+// NOTE: See equation (7) in Cao et al. (2007)
+void CStochasticEqns::x_SingleStepITL(double tau) {
+    CTraceScope trace(m_Trace, eTraceITL, *m_T, tau);
+    if (m_VerboseTracing >= 1) {
+        AdaptiveTauTrace("%f: taking implicit step of tau = %f\n", *m_T, tau);
+    }
+    if (!x_HasJacobian()) { throwError("logic error at line " << __LINE__) }
+    CWorkspace::CScope scope(m_Workspace);
+    double *origX = m_Workspace.Alloc<double>(m_NumStates);
+    double *origRates = m_Workspace.Alloc<double>(m_Nu.size());
+    memcpy(origX, m_X, sizeof(double)*m_NumStates);
+    memcpy(origRates, m_Rates, sizeof(double)*m_Nu.size());
+
+    if (debug) {
+        cerr << " origX: ";
+        for (unsigned int i =0; i < m_NumStates;  ++i) {
+            cerr << origX[i] << "\t";
+        }
+        cerr << endl;
+    }
+
+    // draw (stochastic) number of times each transition will occur
+    int *numTransitions = m_Workspace.Alloc<int>(m_Nu.size());
+    fill(numTransitions, numTransitions + m_Nu.size(), 0);
+    
+    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+         j != m_TransByCat[eNormal].end();  ++j) {
+        if (m_Rates[*j]*tau > 1e8) {
+            //for high rate, use normal to approx poisson.
+            //should basically never yield negative, but just to
+            //be sure, cap at 0
+            numTransitions[*j] = max(0.,floor(m_Random.Norm(m_Rates[*j]*tau,
+                                                    sqrt(m_Rates[*j]*tau))));
+        } else {
+            numTransitions[*j] = m_Random.Pois(m_Rates[*j]*tau);
+            //cerr << "nt[" << *j << "] " << numTransitions[*j] << endl;
+        }
+    }
+
+    // Calculate equation (7) terms not involving x[t+tau] and call this alpha:
+    //   alpha = x + nu.(P - tau/2 R(x))
+    // Also initialize iterative search for x[t+tau] at expectation (reset m_X)
+    double* alpha = m_Workspace.Alloc<double>(m_NumStates);
+    memcpy(alpha, m_X, sizeof(double)*m_NumStates);
+    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+         j != m_TransByCat[eNormal].end();  ++j) {
+        for (unsigned int k = 0;  k < m_Nu[*j].size();  ++k) {
+            alpha[m_Nu[*j][k].m_State] += m_Nu[*j][k].m_Mag * 
+                (numTransitions[*j] - (tau/2)*m_Rates[*j]);
+            //reset m_X to expectation as our initial guess
+            m_X[m_Nu[*j][k].m_State] += m_Nu[*j][k].m_Mag *
+                (tau/2)*m_Rates[*j];
+        }
+    }
+    //expectations may send states negative; clamp!
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        if (m_X[i] < 0) {
+            m_X[i] = 0;
+        }
+    }
+
+    if (debug) {
+        cerr << " alpha:";
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            cerr << " " << alpha[i];
+        }
+        cerr << endl;
+        cerr << "it " << 0 << " newX: ";
+        for (unsigned int i =0; i < m_NumStates;  ++i) {
+            cerr << m_X[i] << "\t";
+        }
+        cerr << endl;
+    }
+
+    x_SolveImplicit(origX, alpha, tau);
+
+    //restore original rates to execute deterministic transitions
+    memcpy(m_Rates, origRates, sizeof(double)*m_Nu.size());
+    x_AdvanceDeterministic(tau);
+
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        if (m_X[i] < 0) {
+            memcpy(m_X, origX, sizeof(double)*m_NumStates);
+            throw overflow_error("tau too big");
+        }
+        if (!m_RealValuedVariables[i]) {
+            m_X[i] = floor(m_X[i] + 0.5); //i.e., round
+        }
+    }
+    *m_T += tau;
+    ++m_Stats.m_Steps[eImplicit];
+    m_Stats.m_TauSum += tau;
+    for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+         j != m_TransByCat[eNormal].end();  ++j) {
+        m_Stats.m_Firings += numTransitions[*j];
+        if (m_Profiling) {
+            m_Profile.m_Firings[*j] += numTransitions[*j];
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : m_X initial guess, origX state at the start of the step, alpha
+// POST: m_X solves Y = alpha + nu.((tau/2)*R(Y)) over the non-critical
+// transitions (see x_SingleStepITL) & m_Rates are those of the last
+// iterate (or overflow error thrown, m_X restored, if a state went
+// negative)
+void CStochasticEqns::x_SolveImplicit(const double *origX, const double *alpha,
+                                      double tau) {
+    CWorkspace::CScope scope(m_Workspace);
+    //a few variables needed by LAPACK
+    int N = m_NumStates;
+    int nrhs = 1;
+    int *ipiv = m_Workspace.Alloc<int>(m_NumStates);
+    int info;
+    double *matrixA = m_Workspace.Alloc<double>(m_NumStates*m_NumStates);
+    double *matrixB = m_Workspace.Alloc<double>(m_NumStates);
+
+    
+    //Use Newton's method to solve implicit equation:
+    //  Let Y = x[t+tau]
+    //  F(Y) = Y - alpha - nu.((tau/2)*R(Y))
+    //Solve Jacobian(F(Y0)) Y1 = -F(Y0) for Y1 to iteratively approach solution
+    //This eqn expands to (I - nu.((tau/2)Jacobian(R(Y0)))) Y1 = -F(Y0) where
+    //the Jacobian of rates is supplied by the user.  The term to the
+    //left of Y1 is called matrix A by LAPACK and the term on right is
+    //matrix B.
+    //
+    //Perhaps should adjust max # of iterations..
+    bool converged = false;
+    unsigned int c = 0;
+    while (++c <= 20  &&  !converged) {
+        CTraceScope newtonTrace(m_Trace, eTraceNewton, *m_T, c);
+        ++m_Stats.m_NewtonIterations;
+        // Check to make sure we haven't taken too big a step --
+        // i.e. no state variables should go negative
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            if (m_X[i] < 0) {
+                memcpy(m_X, origX, sizeof(double)*m_NumStates);
+                throw overflow_error("tau too big");
+            }
+        }
+
+        // define matrix A
+        double* rateJacobian;
+        {
+            CPhaseTimer timer(m_Stats.m_Seconds[ePhaseJacobian]);
+            rateJacobian = x_CalcJacobian();
+        }
+        ++m_Stats.m_JacobianEvaluations;
+        CPhaseTimer solveTimer(m_Stats.m_Seconds[ePhaseLinearSolve]);
+        memset(matrixA, 0, m_NumStates*m_NumStates*sizeof(double));
+        for (TTransList::const_iterator j =
+                 m_TransByCat[eNormal].begin();
+             j != m_TransByCat[eNormal].end();  ++j) {
+            for (unsigned int k = 0;  k < m_Nu[*j].size();  ++k) {
+                for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+                    //R stores matrices column-wise
+                    //LAPACK stores matrices row-wise
+                    matrixA[i*m_NumStates + m_Nu[*j][k].m_State] +=
+                        m_Nu[*j][k].m_Mag * rateJacobian[(*j)*m_NumStates + i];
+                }
+            }
+        }
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            for (unsigned int i2 = 0;  i2 < m_NumStates;  ++i2) {
+                matrixA[i*m_NumStates + i2] *= -tau/2;
+            }
+            matrixA[i*m_NumStates + i] += 1;
+        }
+        solveTimer.Stop();
+
+        // define matrix B
+        // m_X is now our proposed x[t+tau].  Note that m_X has changed
+        // even in our first iteration (initialized to expected value).
+        x_UpdateRates();
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            matrixB[i] = alpha[i] - m_X[i];
+        }
+        for (TTransList::const_iterator j =
+                 m_TransByCat[eNormal].begin();
+             j != m_TransByCat[eNormal].end();  ++j) {
+            for (unsigned int k = 0;  k < m_Nu[*j].size();  ++k) {
+                matrixB[m_Nu[*j][k].m_State] += 
+                    m_Nu[*j][k].m_Mag * (tau/2) * m_Rates[*j];
+            }
+        }
+
+
+    if (debug) {
+        cerr << "A:" << endl;
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            for (unsigned int i2 = 0;  i2 < m_NumStates;  ++i2) {
+                cerr << matrixA[i2*m_NumStates + i] << "\t";
+            }
+            cerr << endl;
+        }
+
+        cerr << "B:" << endl;
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            cerr << matrixB[i] << "\t";
+        }
+        cerr << endl;
+
+        cerr << "a:" << endl;
+        for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+            cerr << m_Rates[j] << "\t";
+        }
+        cerr << endl;
+    }
+
+        //solve linear eqn
+        {
+            CPhaseTimer timer(m_Stats.m_Seconds[ePhaseLinearSolve]);
+            dgesv_(&N, &nrhs, matrixA, &N, ipiv, matrixB, &N, &info);
+        }
+        if (info != 0) {
+            ++m_Stats.m_LapackFailures;
+            AdaptiveTauWarning("warning: lapack ran into trouble solving "
+                               "implicit equation");
+            break;
+        }
+        //matrixB now contains solution (change in X)
+        double normDelta = 0, normX = 0;
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            m_X[i] += matrixB[i];
+            normDelta += matrixB[i]*matrixB[i];
+            normX += m_X[i] * m_X[i];
+        }
+        //cerr << "\tNorms: " << normDelta << "\t" << normX << endl;
+        converged = (normDelta < normX * m_ITLConvergenceTol);
+        if (debug) {
+            /*
+            cerr << "Delta: ";
+            for (unsigned int i =0; i < m_NumStates;  ++i) {
+                cerr << matrixB[i] << "\t";
+            }
+            cerr << endl;
+            */
+            cerr << "it " << c << " newX: ";
+            for (unsigned int i =0; i < m_NumStates;  ++i) {
+                cerr << m_X[i] << "\t";
+            }
+            cerr << endl;
+            /*
+            x_UpdateRates();
+            double t[m_NumStates];
+            memcpy(t, alpha, sizeof(double)*m_NumStates);
+            for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+                if (m_TransCats[j] == eNoncritical) {
+                    for (unsigned int k = 0;  k < m_Nu[j].size();  ++k) {
+                        t[m_Nu[j][k].m_State] +=
+                            m_Nu[j][k].m_Mag * (tau/2) * m_Rates[j];
+                    }
+                }
+            }
+            cerr << "     newX: ";
+            for (unsigned int i =0; i < m_NumStates;  ++i) {
+                cerr << t[i] << "\t";
+            }
+            cerr << endl;
+            */
+        }
+
+    } // end of iterating for Newton's method
+    if (!converged) {
+        ++m_Stats.m_ITLNotConverged;
+        if (m_Trace) {
+            m_Trace->AddInstant(eTraceNotConverged, *m_T, tau);
+        }
+        AdaptiveTauWarning("ITL solution did not converge!");
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : tau value to use for step, list of "critical" transitions
+// POST: EXPLICIT tau step taken (m_X updated if so) (or overflow
+// error thrown if tau was too big)
+void CStochasticEqns::x_SingleStepETL(double tau) {
+    CTraceScope trace(m_Trace, eTraceETL, *m_T, tau);
+    if (m_VerboseTracing >= 1) {
+        AdaptiveTauTrace("%f: taking explicit step of tau = %f\n", *m_T, tau);
+    }
+    if (m_VerboseTracing >= 2) {
+        AdaptiveTauTrace("%f:    ", *m_T);
+    }
+    CWorkspace::CScope scope(m_Workspace);
+    double *origX = m_Workspace.Alloc<double>(m_NumStates);
+    memcpy(origX, m_X, sizeof(double)*m_NumStates);
+    double firings = 0;
+    if (x_UseParallel()) {
+        m_ParTau = tau;
+        m_ParSeed = m_Random.Next();
+        const unsigned int numBlocks =
+            (m_TransByCat[eNormal].size() + kParallelBlock - 1) / kParallelBlock;
+        m_BlockSums.assign(numBlocks, 0);
+        x_RunBlocks(&CStochasticEqns::x_SampleBlock,
+                    m_TransByCat[eNormal].size());
+        for (unsigned int b = 0;  b < numBlocks;  ++b) {
+            firings += m_BlockSums[b];
+        }
+        if (m_Kernels) {
+            m_Kernels->ApplyFirings(&m_Firings[0], m_X);
+        } else {
+            x_RunBlocks(&CStochasticEqns::x_ScatterBlock, m_NumStates);
+        }
+    } else {
+        for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+             j != m_TransByCat[eNormal].end();  ++j) {
+            double k;
+            if (m_Rates[*j]*tau > 1e8) {
+                //for high rate, use normal to approx poisson.
+                //should basically never yield negative, but just to
+                //be sure, bound at 0
+                k = max(0.,floor(m_Random.Norm(m_Rates[*j]*tau, sqrt(m_Rates[*j]*tau))));
+            } else {
+                k = m_Random.Pois(m_Rates[*j]*tau);
+            }
+            if (k > 0) {
+                firings += k;
+                if (m_VerboseTracing >= 2) {
+                    AdaptiveTauTrace("%fx#%i ", k, *j);
+                }
+                if (m_Kernels  ||  m_Profiling) {
+                    m_Firings[*j] = k; //kernels: applied all at once below
+                }
+                if (!m_Kernels) {
+                    for (unsigned int i = 0;  i < m_Nu[*j].size();  ++i) {
+                        m_X[m_Nu[*j][i].m_State] +=  k * m_Nu[*j][i].m_Mag;
+                    }
+                }
+            }
+        }
+        if (m_Kernels) {
+            m_Kernels->ApplyFirings(&m_Firings[0], m_X);
+        }
+    }
+    if (m_VerboseTracing >= 2) {
+        AdaptiveTauTrace("\n");
+    }
+    x_AdvanceDeterministic(tau);
+
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        if (m_X[i] < 0) {
+            memcpy(m_X, origX, sizeof(double)*m_NumStates);
+            x_ResetFirings();
+            throw overflow_error("tau too big");
+        }
+    }
+    if (m_Profiling) {
+        for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+             j != m_TransByCat[eNormal].end();  ++j) {
+            m_Profile.m_Firings[*j] += m_Firings[*j];
+        }
+    }
+    x_ResetFirings();
+
+    *m_T += tau;
+    ++m_Stats.m_Steps[eExplicit];
+    m_Stats.m_TauSum += tau;
+    m_Stats.m_Firings += firings;
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : tau value to use for step, list of "critical" transitions; whether
+// the drift is implicit (Jacobian enabled)
+// POST: CHEMICAL LANGEVIN step taken (m_X updated if so) (or overflow
+// error thrown if tau was too big).  The non-critical transitions fire
+// a_j tau + sqrt(a_j tau) N(0,1) times (Euler-Maruyama), or, implicitly,
+// with the drift split between the start & end of the step as in
+// x_SingleStepITL.
+void CStochasticEqns::x_SingleStepCLE(double tau, bool implicit) {
+    CTraceScope trace(m_Trace, eTraceCLE, *m_T, tau);
+    if (m_VerboseTracing >= 1) {
+        AdaptiveTauTrace("%f: taking %s Langevin step of tau = %f\n", *m_T,
+                         implicit ? "implicit" : "explicit", tau);
+    }
+    const TTransList &normal = m_TransByCat[eNormal];
+    CWorkspace::CScope scope(m_Workspace);
+    double *origX = m_Workspace.Alloc<double>(m_NumStates);
+    memcpy(origX, m_X, sizeof(double)*m_NumStates);
+    //Gaussian part of each transition's firings
+    double *noise = m_Workspace.Alloc<double>(normal.size());
+    for (unsigned int k = 0;  k < normal.size();  ++k) {
+        noise[k] = m_Random.Norm(0, sqrt(m_Rates[normal[k]]*tau));
+    }
+
+    if (!implicit) {
+        for (unsigned int k = 0;  k < normal.size();  ++k) {
+            const unsigned int j = normal[k];
+            const double firings = m_Rates[j]*tau + noise[k];
+            for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+                m_X[m_Nu[j][i].m_State] += firings * m_Nu[j][i].m_Mag;
+            }
+        }
+        x_AdvanceDeterministic(tau);
+    } else {
+        //as x_SingleStepITL, with the noise in place of the Poisson
+        //deviations: alpha = x + nu.(tau/2 R(x) + noise)
+        double *origRates = m_Workspace.Alloc<double>(m_Nu.size());
+        memcpy(origRates, m_Rates, sizeof(double)*m_Nu.size());
+        double *alpha = m_Workspace.Alloc<double>(m_NumStates);
+        memcpy(alpha, m_X, sizeof(double)*m_NumStates);
+        for (unsigned int k = 0;  k < normal.size();  ++k) {
+            const unsigned int j = normal[k];
+            for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+                alpha[m_Nu[j][i].m_State] += m_Nu[j][i].m_Mag *
+                    ((tau/2)*m_Rates[j] + noise[k]);
+                m_X[m_Nu[j][i].m_State] += m_Nu[j][i].m_Mag *
+                    (tau/2)*m_Rates[j];
+            }
+        }
+        for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+            if (m_X[i] < 0) {
+                m_X[i] = 0;
+            }
+        }
+        x_SolveImplicit(origX, alpha, tau);
+        memcpy(m_Rates, origRates, sizeof(double)*m_Nu.size());
+        x_AdvanceDeterministic(tau);
+    }
+
+    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+        if (m_X[i] < 0) {
+            memcpy(m_X, origX, sizeof(double)*m_NumStates);
+            throw overflow_error("tau too big");
+        }
+        if (!m_RealValuedVariables[i]) {
+            m_X[i] = floor(m_X[i] + 0.5); //i.e., round
+        }
+    }
+    double firings = 0;
+    for (unsigned int k = 0;  k < normal.size();  ++k) {
+        const double f = max(0., m_Rates[normal[k]]*tau + noise[k]);
+        firings += f;
+        if (m_Profiling) {
+            m_Profile.m_Firings[normal[k]] += f;
+        }
+    }
+    *m_T += tau;
+    ++m_Stats.m_Steps[implicit ? eImplicit : eExplicit];
+    ++m_Stats.m_LangevinSteps;
+    m_Stats.m_TauSum += tau;
+    m_Stats.m_Firings += floor(firings + 0.5);
+}
+
+/*---------------------------------------------------------------------------*/
+// Implemented from Auger A, Chatelain P, Koumoutsakos P. The Journal of
+// Chemical Physics (2006).  Rates are frozen over the leap, as in tau
+// leaping: the L firings are then L independent draws from the
+// transitions by rate, & their time the L-th event of a Poisson process
+// of the total rate.  Critical & halting transitions (as in ATL) are
+// left out of the cascade: the first draw of one ends the leap, so each
+// fires at most once per leap.  Where even one firing could empty a
+// species (counting what that critical firing takes) the step is exact.
+void CStochasticEqns::x_SingleStepRL(double tf) {
+    CTraceScope trace(m_Trace, eTraceRLeap, *m_T);
+    m_LastTransition = -1;
+    CPhaseTimer tauTimer(m_Stats.m_Seconds[ePhaseTauSelection]);
+
+    //identify "critical" transitions, as x_SingleStepATL
+    double normalRate = 0;
+    double criticalRate = 0;
+    {
+        CTraceScope trace(m_Trace, eTraceClassify, *m_T);
+        for (TTransList::const_iterator j =
+                 m_TransByCat[eHalting].begin();
+             j != m_TransByCat[eHalting].end();  ++j) {
+            criticalRate += m_Rates[*j];
+        }
+        m_TransByCat[eCritical].resize(m_TransByCat[eHalting].size());
+        m_TransByCat[eNormal].clear();
+        for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+            if (m_TransCats[j] != eNormal  ||  !(m_Rates[j] > 0)) {
+                continue;
+            }
+            if (x_IsCritical(j)) {
+                criticalRate += m_Rates[j];
+                m_TransByCat[eCritical].push_back(j);
+                if (m_Profiling) {
+                    ++m_Profile.m_Critical[j];
+                }
+            } else {
+                normalRate += m_Rates[j];
+                m_TransByCat[eNormal].push_back(j);
+            }
+        }
+    }
+    const double totalRate = normalRate + criticalRate;
+    if (totalRate == 0) {
+        //nothing to leap; the exact step still advances the deterministic
+        //transitions to tf
+        tauTimer.Stop();
+        x_StepExact(tf, true);
+        m_PrevStepType = eExact;
+        return;
+    }
+    if (!std::isfinite(totalRate)) {
+        throwEarlyExit("Infinite transition rate at time " << *m_T);
+    }
+
+    //L: expected firings in the tau of the epsilon bound ...
+    double tau;
+    {
+        CTraceScope trace(m_Trace, eTraceTauSelection, *m_T);
+        tau = x_TauEx();
+    }
+    if (tau > tf - *m_T) {
+        tau = tf - *m_T;
+    }
+    if (tau > m_MaxTau) {
+        tau = x_HasUserMaxTau() ? min(tau, x_CalcUserMaxTau()) : m_MaxTau;
+    }
+    double numFirings = floor(totalRate * tau);
+    //... but no more than the fewest firings of non-critical transitions
+    //that could empty a species, less what the critical firing that may
+    //end the leap takes of it
+    {
+        CWorkspace::CScope scope(m_Workspace);
+        double *reserve = m_Workspace.Alloc<double>(m_NumStates);
+        const TTransList &normal = m_TransByCat[eNormal];
+        const TTransList &crit = m_TransByCat[eCritical];
+        for (unsigned int k = 0;  k < normal.size();  ++k) {
+            for (unsigned int i = 0;  i < m_Nu[normal[k]].size();  ++i) {
+                reserve[m_Nu[normal[k]][i].m_State] = 0;
+            }
+        }
+        for (unsigned int k = 0;  k < crit.size();  ++k) {
+            for (unsigned int i = 0;  i < m_Nu[crit[k]].size();  ++i) {
+                reserve[m_Nu[crit[k]][i].m_State] = 0;
+            }
+        }
+        for (unsigned int k = 0;  k < crit.size();  ++k) {
+            for (unsigned int i = 0;  i < m_Nu[crit[k]].size();  ++i) {
+                double &r = reserve[m_Nu[crit[k]][i].m_State];
+                r = max(r, (double) -m_Nu[crit[k]][i].m_Mag);
+            }
+        }
+        for (unsigned int k = 0;  k < normal.size();  ++k) {
+            for (unsigned int i = 0;  i < m_Nu[normal[k]].size();  ++i) {
+                const SChange &c = m_Nu[normal[k]][i];
+                if (c.m_Mag < 0) {
+                    numFirings = min(numFirings, floor((m_X[c.m_State] -
+                                                        reserve[c.m_State]) /
+                                                       -c.m_Mag));
+                }
+            }
+        }
+    }
+    if (numFirings < 1) {
+        //no firing can be leapt safely: an exact step instead
+        tauTimer.Stop();
+        x_StepExact(tf, true);
+        m_PrevStepType = eExact;
+        return;
+    }
+    //the first critical firing, if any, ends the leap
+    bool critical = false;
+    if (criticalRate > 0) {
+        const double p = criticalRate / totalRate;
+        const double first = p >= 1 ? 1 :
+            1 + floor(log(m_Random.Unif()) / log1p(-p));
+        if (first <= numFirings) {
+            numFirings = first;
+            critical = true;
+        }
+    }
+    tauTimer.Stop();
+
+    tau = m_Random.Gamma(numFirings, 1. / totalRate);
+    double normalFirings = critical ? numFirings - 1 : numFirings;
+    if (tau > tf - *m_T) {
+        //the last firing is past tf; the others are uniform over tau
+        normalFirings = m_Random.Binom(numFirings - 1, (tf - *m_T) / tau);
+        critical = false;
+        tau = tf - *m_T;
+    }
+    if (m_VerboseTracing >= 1) {
+        AdaptiveTauTrace("%f: taking R-leap of %.0f firings, tau = %f\n",
+                         *m_T, normalFirings + critical, tau);
+    }
+
+    //binomial cascade: transition k takes its share of the firings left
+    //by its rate over the rates left
+    double left = normalFirings;
+    double rateLeft = normalRate;
+    const TTransList &normal = m_TransByCat[eNormal];
+    for (unsigned int k = 0;  k < normal.size()  &&  left > 0;  ++k) {
+        const unsigned int j = normal[k];
+        const double n = k + 1 == normal.size() ? left :
+            m_Random.Binom(left, m_Rates[j] / rateLeft);
+        rateLeft -= m_Rates[j];
+        if (n == 0) {
+            continue;
+        }
+        left -= n;
+        if (m_Kernels) {
+            m_Kernels->ApplyTransition(j, n, m_X);
+        } else {
+            for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+                m_X[m_Nu[j][i].m_State] += n * m_Nu[j][i].m_Mag;
+            }
+        }
+        if (m_Profiling) {
+            m_Profile.m_Firings[j] += n;
+        }
+    }
+    if (critical) {
+        const unsigned int j = x_PickCritical(criticalRate);
+        for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+            m_X[m_Nu[j][i].m_State] += m_Nu[j][i].m_Mag;
+        }
+        m_LastTransition = j;
+        if (m_Profiling) {
+            ++m_Profile.m_Firings[j];
+        }
+    }
+    if (m_Profiling) {
+        x_ProfileStep(tau);
+    }
+    //as exact steps, there is no smaller step to fall back on
+    x_AdvanceDeterministic(tau, true);
+
+    *m_T += tau;
+    ++m_Stats.m_Steps[eExplicit];
+    m_Stats.m_TauSum += tau;
+    m_Stats.m_Firings += normalFirings + critical;
+    m_PrevStepType = eExplicit;
+    m_ExactStateValid = false;
+    x_RecordTimePoint();
+}
+
+/*---------------------------------------------------------------------------*/
+// PRE : time at which to end simulation; **transition rates already updated**
+// POST: single adaptive tau leaping step taken & time series updated.
+// Implemented from Cao Y, Gillespie DT, Petzold LR. The Journal of Chemical
+// Physics (2007).
+void CStochasticEqns::x_SingleStepATL(double tf) {
+    m_LastTransition = -1;
+    EStepType stepType;
+    CPhaseTimer tauTimer(m_Stats.m_Seconds[ePhaseTauSelection]);
+
+    //identify "critical" transitions
+    double criticalRate = 0;
+    double noncritRate = 0;
+    {
+        CTraceScope trace(m_Trace, eTraceClassify, *m_T);
+        for (TTransList::const_iterator j =
+                 m_TransByCat[eDeterministic].begin();
+             j != m_TransByCat[eDeterministic].end();  ++j) {
+            noncritRate += m_Rates[*j];
+        }
+        for (TTransList::const_iterator j =
+                 m_TransByCat[eHalting].begin();
+             j != m_TransByCat[eHalting].end();  ++j) {
+            criticalRate += m_Rates[*j];
+        }
+
+        //reset (lop off) all non-halting criticals
+        m_TransByCat[eCritical].resize(m_TransByCat[eHalting].size());
+        m_TransByCat[eNormal].clear();
+        if (x_UseParallel()) {
+            x_ClassifyParallel(criticalRate, noncritRate);
+        } else {
+            for (unsigned int j = 0;  j < m_Nu.size();  ++j) {
+                if (m_TransCats[j] != eNormal) {
+                    continue;
+                }
+                if (x_IsCritical(j)) {
+                    criticalRate += m_Rates[j];
+                    m_TransByCat[eCritical].push_back(j);
+                    if (m_Profiling) {
+                        ++m_Profile.m_Critical[j];
+                    }
+                } else {
+                    noncritRate += m_Rates[j];
+                    m_TransByCat[eNormal].push_back(j);
+                }
+            }
+        }
+    }
+
+    if (debug) {
+        cerr << "critical rate: " << criticalRate << "\t" << "noncrit rate: " << noncritRate << endl;
+    }
+    if (criticalRate + noncritRate == 0) {
+        *m_T = tf;//numeric_limits<double>::infinity();
+        x_RecordTimePoint();
+        return;
+    }
+    if (!std::isfinite(criticalRate + noncritRate)) {
+        throwEarlyExit("Infinite transition rate at time " << *m_T);
+    }
+
+    // calc explicit & implicit taus
+    double tau1, tau2;
+    double tauEx, tauIm;
+    {
+        CTraceScope trace(m_Trace, eTraceTauSelection, *m_T);
+        tauEx = x_TauEx();
+        tauIm = x_TauIm();
+    }
+    if (debug) {
+        cerr << "tauEx: " << tauEx << "  tauIm:" << tauIm << endl;
+    }
+    if (tauEx*m_Nstiff < tauIm) {
+        stepType = eImplicit;
+        tau1 = tauIm;
+    } else {
+        stepType = eExplicit;
+        tau1 = tauEx;
+    }
+    if (tau1 > tf - *m_T) { //cap at the final simulation time
+        tau1 = tf - *m_T;
+    }
+    if (tau1 > m_MaxTau) {
+        tau1 = x_HasUserMaxTau() ? min(tau1, x_CalcUserMaxTau()) : m_MaxTau;
+        if (debug) {
+            cerr << "maxtau: " << tau1 << " (" <<
+                (x_HasUserMaxTau() ? x_CalcUserMaxTau() : m_MaxTau) << ")" << endl;
+        }
+    }
+
+    //the leap is a Langevin step if even the slowest non-critical
+    //transition that fires at all would fire often enough
+    double minNormalRate = 0;
+    if (m_LangevinThreshold > 0) {
+        minNormalRate = numeric_limits<double>::infinity();
+        for (TTransList::const_iterator j = m_TransByCat[eNormal].begin();
+             j != m_TransByCat[eNormal].end();  ++j) {
+            if (m_Rates[*j] > 0) {
+                minNormalRate = min(minNormalRate, m_Rates[*j]);
+            }
+        }
+        if (!(noncritRate > 0)) {
+            minNormalRate = 0;
+        }
+    }
+
+    tauTimer.Stop();
+
+    bool tauTooBig;
+    do {
+        tauTooBig = false;
+        if (!(tau1 > 0)) { throwError("logic error at line " << __LINE__) }
+        if (tau1 < m_ExactThreshold / (criticalRate + noncritRate)) {
+            if (debug) {
+                cerr << "Taking exact steps.. (tau1 = " << tau1 << ")" << endl;
+            }
+            stepType = eExact;
+            for (unsigned int i = 0;
+                 i < m_NumExactSteps[m_PrevStepType]  &&  *m_T < tf;  ++i) {
+                x_StepExact(tf, i == 0);
+                if (m_VerboseTracing >= 2) {
+                    AdaptiveTauTrace("%f -- ", *m_T);
+                    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+                        AdaptiveTauTrace("%f ", m_X[i]);
+                    }
+                    AdaptiveTauTrace("\n");
+                }
+                if (m_LastTransition >= 0  &&
+                    m_TransCats[m_LastTransition] == eHalting) {
+                    return;
+                }
+            }
+        } else {
+            m_ExactStateValid = false; //a leap moves many species at once
+            try { //catch exception if tauTooBig
+                tau2 = (criticalRate == 0) ? numeric_limits<double>::infinity():
+                    m_Random.Exp(1./criticalRate);
+                if (stepType == eExplicit  ||
+                    (tau1 > tau2  &&  stepType == eImplicit && tau2 <= tauEx)) {
+                    if (debug) {
+                        cerr << "going explicit w/ tau = " << min(tau1, tau2)
+                             << endl;
+                    }
+                    const double tau = min(tau1, tau2);
+                    if (m_LangevinThreshold > 0  &&
+                        minNormalRate * tau >= m_LangevinThreshold) {
+                        x_SingleStepCLE(tau, false);
+                    } else {
+                        x_SingleStepETL(tau);
+                    }
+                    if (m_Profiling) {
+                        x_ProfileStep(min(tau1, tau2));
+                    }
+                } else {
+                    if (debug) {
+                        cerr << "going implicit w/ tau = " << tau1 << endl;
+                    }
+                    if (m_LangevinThreshold > 0  &&
+                        minNormalRate * tau1 >= m_LangevinThreshold) {
+                        x_SingleStepCLE(tau1, true);
+                    } else {
+                        x_SingleStepITL(tau1);
+                    }
+                    if (m_Profiling) {
+                        x_ProfileStep(tau1);
+                    }
+                }
+                if (tau1 > tau2) { //pick one critical transition
+                    unsigned int j = x_PickCritical(criticalRate);
+                    m_LastTransition = j;
+                    ++m_Stats.m_Firings;
+                    if (m_Profiling) {
+                        ++m_Profile.m_Firings[j];
+                    }
+                    if (debug) {
+                        cerr << "hittin' the critical (" << j << ")" << endl;
+                    }
+                    if (m_VerboseTracing >= 1) {
+                        AdaptiveTauTrace("%f:    executing critical transition #%i\n",
+                                 *m_T, j+1);
+                    }
+                    for (unsigned int i = 0;  i < m_Nu[j].size();  ++i) {
+                        m_X[m_Nu[j][i].m_State] +=  m_Nu[j][i].m_Mag;
+                        if (m_X[m_Nu[j][i].m_State] < 0) {
+                            throwError("variable " << m_Nu[j][i].m_State+1 <<
+                                       " went negative after executing "
+                                       "transition " << j+1 << ".  Most likely "
+                                       "either your rate calculation or "
+                                       "transition matrix is flawed.");
+                        }
+                    }
+                }
+
+                x_RecordTimePoint();
+                if (m_VerboseTracing >= 2) {
+                    AdaptiveTauTrace("%f -- ", *m_T);
+                    for (unsigned int i = 0;  i < m_NumStates;  ++i) {
+                        AdaptiveTauTrace("%f ", m_X[i]);
+                    }
+                    AdaptiveTauTrace("\n");
+                }
+            } catch (overflow_error&) { //i.e. tauTooBig exception
+                tauTooBig = true;
+                ++m_Stats.m_TauHalvings;
+                if (m_Trace) {
+                    m_Trace->AddInstant(eTraceTauTooBig, *m_T, tau1);
+                }
+                if (m_VerboseTracing >= 1) {
+                    AdaptiveTauTrace("%f:    tau too big; cutting in half\n", *m_T);
+                }
+                tau1 /= 2;
+            }
+        }
+    } while (tauTooBig);
+
+    m_PrevStepType = stepType;
+}
@@ -0,0 +1,707 @@
+/*  stochasticeqns.h
+    --------------------------------------------------------------------------
+    R-independent core of the adaptive tau-leaping algorithm described by
+    Cao Y, Gillespie DT, Petzold LR. The Journal of Chemical Physics (2007).
+
+    CStochasticEqns simulates a binary model (see modelformat.h) on its own;
+    adaptivetau.cpp derives the R flavour from it (rates, Jacobian & maxTau
+    from R functions).  Anything the core needs from its host -- interrupt
+    checks, warnings & trace output -- goes through the AdaptiveTau* hooks
+    below, which each host (the R package, AdaptiveTauBench, ...) defines.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_STOCHASTICEQNS_H
+#define ADAPTIVETAU_STOCHASTICEQNS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "compiledmodel.h"
+#include "modelformat.h"
+#include "modelkernels.h"
+#include "random.h"
+#include "stopcriteria.h"
+#include "sumtree.h"
+#include "threadpool.h"
+#include "tracing.h"
+#include "workspace.h"
+
+//use below rather than R's "error" directly (which will not free memory, etc.)
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { std::ostringstream s; s << e; throw std::runtime_error(s.str()); }
+#ifdef throwEarlyExit
+#undef throwEarlyExit
+#endif
+#define throwEarlyExit(e) { std::ostringstream s; s << e << "; results returned only up until this point"; throw CEarlyExit(s.str());}
+
+class CEarlyExit : public std::runtime_error {
+public:
+    CEarlyExit(const std::string &w) : std::runtime_error(w) {}
+};
+
+// host hooks -- defined once per executable / shared library
+bool AdaptiveTauCheckUserInterrupt(void);
+void AdaptiveTauWarning(const char *msg);
+void AdaptiveTauTrace(const char *format, ...);
+
+enum EStepType {
+    eExact = 0,
+    eExplicit,
+    eImplicit
+};
+
+// how exact steps are taken (see CStochasticEqns::SetExactMethod)
+enum EExactMethod {
+    eExactDirect = 0,         // direct method, all rates every step
+    eExactRejection,          // rejection-based SSA
+    eExactPartialPropensity   // partial-propensity direct method
+};
+
+// how EvaluateATLUntil leaps (see CStochasticEqns::SetLeapMethod)
+enum ELeapMethod {
+    eLeapTau = 0,             // adaptive tau leaping (Cao et al.)
+    eLeapR                    // R-leaping, a fixed number of firings
+};
+
+// phases of a run that are timed separately (see SRunStatistics)
+enum EPhase {
+    ePhaseRates = 0,   // rate evaluation
+    ePhaseJacobian,    // Jacobian evaluation
+    ePhaseLinearSolve, // assembling & solving the implicit (ITL) system
+    ePhaseTauSelection,// classifying transitions & choosing tau
+    ePhaseTotal,       // whole run
+    eNumPhases
+};
+
+// counters accumulated over one simulation
+struct SRunStatistics {
+    SRunStatistics(void) { memset(this, 0, sizeof(*this)); }
+    static const char* PhaseName(EPhase phase) {
+        static const char* names[eNumPhases] =
+            {"rates", "jacobian", "linearSolve", "tauSelection", "total"};
+        return names[phase];
+    }
+    // mean tau of the accepted explicit & implicit leaps (0 if none)
+    double AverageTau(void) const {
+        uint64_t leaps = m_Steps[eExplicit] + m_Steps[eImplicit];
+        return leaps == 0 ? 0 : m_TauSum / leaps;
+    }
+
+    uint64_t m_Steps[3];   // indexed by EStepType
+    uint64_t m_Firings;    // transitions executed (leaps count every firing)
+    uint64_t m_TauHalvings;      // leaps rejected as "tau too big" & retried
+    uint64_t m_NewtonIterations; // over all implicit steps
+    uint64_t m_ITLNotConverged;  // implicit steps whose Newton solve failed to converge
+    uint64_t m_LapackFailures;   // dgesv_ returned an error
+    uint64_t m_RateEvaluations;
+    uint64_t m_JacobianEvaluations;
+    uint64_t m_Rejections;       // candidates rejected by the rejection-based SSA
+    uint64_t m_LangevinSteps;    // leaps taken as Langevin steps (also in m_Steps)
+    double m_TauSum;             // sum of accepted leap sizes
+    double m_Seconds[eNumPhases];// wall time, indexed by EPhase
+};
+
+// Adds the wall time between construction and Stop() (or destruction) to
+// one of the SRunStatistics phase timers.
+class CPhaseTimer {
+public:
+    typedef std::chrono::steady_clock TClock;
+    CPhaseTimer(double &seconds) : m_Seconds(seconds), m_Start(TClock::now()),
+                                   m_Running(true) {}
+    ~CPhaseTimer(void) { Stop(); }
+    void Stop(void) {
+        if (m_Running) {
+            m_Seconds += std::chrono::duration<double>(TClock::now() -
+                                                       m_Start).count();
+            m_Running = false;
+        }
+    }
+private:
+    double &m_Seconds;
+    TClock::time_point m_Start;
+    bool m_Running;
+};
+
+// why the last run ended
+enum EStopReason {
+    eStopNone = 0,      // no run yet
+    eStopFinalTime,     // reached tF
+    eStopMaxSteps,      // used up SetMaxSteps
+    eStopHalting,       // a halting transition fired
+    eStopCriterion,     // a stop criterion was met (see SetStopCriteria)
+    eStopEarlyExit      // CEarlyExit: cancelled, out of budget, interrupted
+};
+
+// snapshot handed to progress callbacks
+struct SProgress {
+    double m_Time;          // simulated time reached
+    double m_FinalTime;     // tF of the run
+    double m_WallSeconds;   // since the run started
+    uint64_t m_Steps;       // main loop iterations so far
+    bool m_Finished;        // last call for this run
+    const SRunStatistics *m_Stats;
+};
+// return false to end this run with CEarlyExit; other simulations sharing
+// the CRunControl go on (call its Cancel() to end them too).  Called on
+// the simulating thread.
+typedef bool (*TProgressCallback)(const SProgress &progress, void *userData);
+
+/*---------------------------------------------------------------------------*/
+// Run control: cancellation, wall-clock budget & progress reporting.  The
+// main loop only tests an atomic flag & a simulated time every step; the
+// clock is read every kClockCheckSteps steps.  Cancel() may be called from
+// any thread; one CRunControl may be shared by several simulations (e.g.
+// to cancel all runs of a batch at once).  A run that is cancelled or runs
+// out of budget ends with CEarlyExit, keeping the results so far.
+class CRunControl {
+public:
+    CRunControl(void) : m_Cancelled(false), m_WallClockBudget(0),
+                        m_Progress(NULL), m_ProgressData(NULL),
+                        m_ProgressSimInterval(0), m_ProgressWallInterval(0),
+                        m_InterruptInterval(0.1) {}
+
+    static const unsigned int kClockCheckSteps = 16;
+
+    void Cancel(void) { m_Cancelled.store(true, std::memory_order_relaxed); }
+    void ResetCancel(void) { m_Cancelled.store(false, std::memory_order_relaxed); }
+    bool IsCancelled(void) const {
+        return m_Cancelled.load(std::memory_order_relaxed);
+    }
+    // end the run after this many seconds of wall time (0 == unlimited)
+    void SetWallClockBudget(double seconds) { m_WallClockBudget = seconds; }
+    double GetWallClockBudget(void) const { return m_WallClockBudget; }
+    // call progress every simInterval of simulated time and/or every
+    // wallInterval seconds (0 == not on this cadence), and once more when
+    // a run completes.  Wall cadence has a granularity of kClockCheckSteps.
+    void SetProgressCallback(TProgressCallback progress, void *userData,
+                             double simInterval, double wallInterval) {
+        m_Progress = progress;
+        m_ProgressData = userData;
+        m_ProgressSimInterval = simInterval;
+        m_ProgressWallInterval = wallInterval;
+    }
+    // how often (seconds) the host's AdaptiveTauCheckUserInterrupt is
+    // polled (0 == never)
+    void SetInterruptInterval(double seconds) { m_InterruptInterval = seconds; }
+
+private:
+    friend class CStochasticEqns;
+    std::atomic<bool> m_Cancelled;
+    double m_WallClockBudget;
+    TProgressCallback m_Progress;
+    void *m_ProgressData;
+    double m_ProgressSimInterval;
+    double m_ProgressWallInterval;
+    double m_InterruptInterval;
+};
+
+// per-transition counters, accumulated only if profiling is enabled
+// (see CStochasticEqns::SetProfiling)
+struct STransitionProfile {
+    std::vector<double> m_Firings;     // times fired (real-valued for
+                                       // deterministic transitions)
+    std::vector<uint64_t> m_Critical;  // ATL steps in which classified critical
+    std::vector<double> m_Propensity;  // time-integrated rate
+};
+
+/*---------------------------------------------------------------------------*/
+class CStochasticEqns {
+public:
+    // Model read from a binary model file (see modelformat.h): structure
+    // is used in place from the mapping & rates are evaluated natively by
+    // mass action.  initVal may be NULL (use initial state stored in model)
+    // and changeBound may be NULL (use 1 for all variables).  kernels, if
+    // given, must have been compiled from the same model (see
+    // modelkernels.h) and replace the generic rate & update loops.  model &
+    // kernels must outlive this object.  Compiles the model for this
+    // object alone; to run a model many times, compile it once and use
+    // the constructor below.
+    CStochasticEqns(const CModelFile &model, const double *initVal = NULL,
+                    const double *changeBound = NULL,
+                    const CModelKernels *kernels = NULL);
+    // As above, for a compiled binary model (see compiledmodel.h), which
+    // may be shared with other simulations, including ones running on
+    // other threads.  Only the per-run state is allocated here (O(states
+    // + transitions), no structural analysis).  changeBound, if given,
+    // must outlive this object.
+    CStochasticEqns(const TCompiledModelPtr &compiled,
+                    const double *initVal = NULL,
+                    const double *changeBound = NULL);
+    virtual ~CStochasticEqns(void) {}
+
+    // one recorded point; m_X points into the time series & is valid
+    // until the next point is appended
+    struct STimePoint {
+        double m_T;
+        const double *m_X;
+    };
+    // points stored back to back (one row of states each), so appending a
+    // point is a copy into storage that grows geometrically rather than an
+    // allocation per step
+    class CTimeSeries {
+    public:
+        CTimeSeries(void) : m_NumStates(0) {}
+        void Reserve(unsigned int points, unsigned int numStates) {
+            m_Times.reserve(points);
+            m_States.reserve((size_t) points * numStates);
+        }
+        void Append(double t, const double *x, unsigned int numStates) {
+            m_NumStates = numStates;
+            m_Times.push_back(t);
+            m_States.insert(m_States.end(), x, x + numStates);
+        }
+        unsigned int size(void) const { return m_Times.size(); }
+        bool empty(void) const { return m_Times.empty(); }
+        // POST: no points (storage kept for the next run)
+        void Clear(void) {
+            m_Times.clear();
+            m_States.clear();
+        }
+        STimePoint operator[](unsigned int p) const {
+            STimePoint res;
+            res.m_T = m_Times[p];
+            res.m_X = m_NumStates == 0 ? NULL : &m_States[(size_t) p * m_NumStates];
+            return res;
+        }
+    private:
+        std::vector<double> m_Times;
+        std::vector<double> m_States;
+        unsigned int m_NumStates;
+    };
+
+    // parameters to the tau leaping algorithm (see SetTLParams in R)
+    void SetEpsilon(double epsilon) { m_Epsilon = epsilon; }
+    void SetDelta(double delta) { m_Delta = delta; }
+    void SetMaxTau(double maxTau) { m_MaxTau = maxTau; }
+    void SetMaxSteps(unsigned int maxSteps) { m_MaxSteps = maxSteps; }
+    void SetExtraChecks(bool extraChecks) { m_ExtraChecks = extraChecks; }
+    void SetVerboseTracing(int verbose) { m_VerboseTracing = verbose; }
+    // the above & the thresholds that have no setter of their own (critical
+    // & stiffness thresholds, exact steps after a rejected leap, ITL
+    // tolerance).  Parameters stored with a binary model (see autotune.h)
+    // are applied on construction.
+    STauLeapingParams GetTauLeapingParams(void) const;
+    void SetTauLeapingParams(const STauLeapingParams &params);
+    // enable implicit steps for a binary model by way of the analytic
+    // mass-action Jacobian.  The implicit step is dense (O(n^3) in the
+    // number of variables), so this is only worthwhile for small models.
+    void SetUseJacobian(bool useJacobian);
+    // enable implicit steps for any rate function (R, kernels or mass
+    // action) by estimating the Jacobian of the rates with forward
+    // differences.  Only the entries in the sparsity pattern (see
+    // SetRateDependencies) are estimated, and variables that share no
+    // transition are perturbed together (greedy column colouring), so a
+    // Jacobian costs one rate evaluation per colour, plus one, rather than
+    // one per variable.  Takes precedence over SetUseJacobian.
+    void SetFiniteDifferenceJacobian(bool fdJacobian);
+    // how exact steps (EvaluateExactUntil & the exact steps of ATL) are
+    // taken.  Besides the direct method (the default), which evaluates
+    // every rate every step, two methods keep per-step work independent
+    // of the number of transitions; their trajectories have the same
+    // distribution as the direct method's (but differ by seed).  Both
+    // are for binary models without deterministic transitions only, and
+    // do not keep m_Rates current.
+    //   eExactRejection  the rejection-based SSA of Thanh, Priami &
+    //     Zunino (J Chem Phys 2014).  Each species is given an interval
+    //     of +-fluctuation (SetRSSAFluctuation) of its population, and
+    //     each transition the lower & upper bounds of its propensity over
+    //     those intervals; a candidate is drawn from the upper bounds (in
+    //     O(log transitions)) and accepted with probability rate / upper
+    //     bound, where the exact rate is only computed if the lower bound
+    //     does not already decide.  Bounds are recomputed only for the
+    //     transitions of a species that leaves its interval.
+    //   eExactPartialPropensity  the partial-propensity direct method of
+    //     Ramaswamy, Gonzalez-Segredo & Sbalzarini (J Chem Phys 2009).
+    //     Each transition is filed under one of its reactants (the one
+    //     that is a reactant of the most transitions, e.g. the food of
+    //     catalytic synthesis) and keeps its propensity divided by that
+    //     reactant's count; a species' group total times its count is
+    //     its share of the total rate.  A firing updates only the groups
+    //     of the species it changes & the partial propensities that
+    //     depend on them, so for elementary (at most bimolecular)
+    //     networks an event costs O(coupled species * log), whatever the
+    //     number of transitions.
+    void SetExactMethod(EExactMethod method);
+    EExactMethod GetExactMethod(void) const { return m_ExactMethod; }
+    void SetRSSAFluctuation(double fluctuation);
+    static const double kDefaultRSSAFluctuation; // 0.1
+    // leaps in which every non-critical transition that can fire is
+    // expected to fire at least threshold times are taken as steps of the
+    // chemical Langevin equation: each transition fires a tau +
+    // sqrt(a tau) N(0,1) times, real-valued, instead of a Poisson number
+    // (Gillespie, J Chem Phys 2000).  Where ATL chose an implicit leap the
+    // drift is implicit (trapezoidal, as the implicit leap) & only the
+    // noise explicit.  Integer-valued variables are rounded after the
+    // step.  0 (the default) == never.  The Gaussian approximation is
+    // good to about 1/sqrt(threshold); values of 100 or more keep
+    // ensemble statistics within sampling error of the leap.
+    void SetLangevinThreshold(double threshold);
+    // how EvaluateATLUntil leaps.  eLeapR is R-leaping (Auger, Chatelain
+    // & Koumoutsakos, J Chem Phys 2006): each leap fires a fixed number
+    // L of transitions, split among them by a binomial cascade on their
+    // rates, and takes the gamma-distributed time of L firings.  L is
+    // the expected firings in the tau of the usual epsilon bound, capped
+    // so that no species can go negative even if every firing fell on the
+    // transition that consumes it fastest -- so there are no rejected
+    // leaps (tau halvings) and no separate exact steps: a leap of one
+    // firing is an exact step, and a species of few copies keeps L small
+    // as a critical transition keeps tau small.  Leaps are explicit &
+    // serial (the Jacobian, Langevin threshold & thread pool are not
+    // used), and count as explicit steps.
+    void SetLeapMethod(ELeapMethod method) { m_LeapMethod = method; }
+    ELeapMethod GetLeapMethod(void) const { return m_LeapMethod; }
+    // PRE : per transition, the (0-based) variables its rate depends on
+    // POST: sparsity pattern of the finite-difference Jacobian.  The
+    // default is the reactants of a binary model, or otherwise the
+    // variables a transition consumes -- catalysts & inhibitors of rates
+    // given by R functions must be listed here.
+    void SetRateDependencies(const std::vector< std::vector<unsigned int> > &deps);
+    // colours of the finite-difference Jacobian (0 if not enabled)
+    unsigned int GetNumJacobianColours(void) const {
+        return m_FDJacobian ? m_ColourGroups.size() : 0;
+    }
+    void Seed(uint64_t seed) { m_Random.Seed(seed); }
+    // collect per-transition firings, critical classifications &
+    // integrated propensities (STransitionProfile).  Costs one pass over
+    // the rates per step.  Must be called before the simulation starts.
+    void SetProfiling(bool profiling);
+    // record phase-level events into trace (see tracing.h); NULL to stop.
+    // trace must outlive the simulation & is not shared between threads.
+    void SetTraceBuffer(CTraceBuffer *trace) { m_Trace = trace; }
+    // run control in effect (by default, one owned by this object); a
+    // shared control must outlive the simulation
+    CRunControl& GetRunControl(void) { return *m_Control; }
+    // split the per-step work of this trajectory (mass-action rates,
+    // critical classification, Poisson sampling & the scatter of firings
+    // into the state) across pool, for models with at least
+    // parallelThreshold transitions; smaller models stay serial.  The
+    // parallel path draws from per-block RNG substreams, so its results
+    // differ from the serial path but do not depend on the number of
+    // threads.  pool must outlive the simulation; NULL to go serial.
+    void SetThreadPool(CThreadPool *pool,
+                       unsigned int parallelThreshold = kDefaultParallelThreshold);
+    static const unsigned int kDefaultParallelThreshold = 20000;
+    static const unsigned int kParallelBlock = 2048; //items per block
+    void SetRunControl(CRunControl *control) {
+        m_Control = control ? control : &m_OwnControl;
+    }
+    // end runs early once one of criteria is met (see stopcriteria.h);
+    // criteria are copied & their history cleared.  Empty for none.
+    void SetStopCriteria(const CStopCriteria &criteria);
+    // room for this many recorded points (each step records one), so that
+    // a run of known length does not reallocate the time series
+    void ReserveTimeSeries(unsigned int points) {
+        m_TimeSeries.Reserve(points, m_NumStates);
+    }
+    // record a point every step (default); off, runs keep only the
+    // current state, e.g. when only the state at tF is wanted
+    void SetRecordTimeSeries(bool record) { m_RecordTimeSeries = record; }
+    // PRE : time & state (GetNumStates() values) to continue from
+    // POST: the next run starts from there, e.g. to restart trajectories
+    // from states saved earlier (see splitting.h): time series cleared
+    // (storage kept), stop criteria history & stop reason reset.
+    // Statistics keep accumulating.
+    void SetState(double t, const double *x);
+
+    void EvaluateATLUntil(double tF);
+    void EvaluateExactUntil(double tF);
+
+    unsigned int GetNumStates(void) const { return m_NumStates; }
+    unsigned int GetNumTransitions(void) const { return m_Nu.size(); }
+    const std::vector<std::string>& GetVarNames(void) const {
+        return m_Compiled->VarNames();
+    }
+    const TCompiledModelPtr& GetCompiledModel(void) const { return m_Compiled; }
+    double GetTime(void) const { return *m_T; }
+    const double* GetState(void) const { return m_X; }
+    const CTimeSeries& GetTimeSeries(void) const { return m_TimeSeries; }
+    const SRunStatistics& GetStatistics(void) const { return m_Stats; }
+    bool IsProfiling(void) const { return m_Profiling; }
+    const STransitionProfile& GetProfile(void) const { return m_Profile; }
+    // transitions ordered by decreasing integrated propensity (ties by
+    // firings); at most maxRows (0 == all)
+    std::vector<unsigned int> GetProfileRanking(unsigned int maxRows = 0) const;
+    // human readable form of transition j, e.g. "A + 2 B -> C"
+    std::string DescribeTransition(unsigned int j) const;
+    // ranked table of the profile, one transition per line
+    void WriteProfileReport(std::ostream &out, unsigned int maxRows = 0) const;
+    bool HasHaltingTransitions(void) const {
+        return !m_TransByCat[eHalting].empty();
+    }
+    EStopReason GetStopReason(void) const { return m_StopReason; }
+    static const char* StopReasonName(EStopReason reason) {
+        static const char* names[] = {"none", "finalTime", "maxSteps",
+                                      "halting", "criterion", "earlyExit"};
+        return names[reason];
+    }
+    // index (in SetStopCriteria) of the criterion that ended the run; -1
+    // if none
+    int GetStopCriterion(void) const { return m_StopCriteria.GetMet(); }
+    const CStopCriteria& GetStopCriteria(void) const { return m_StopCriteria; }
+    // 0-based id of the halting transition that ended the run; -1 if none
+    int GetHaltingTransition(void) const {
+        return (m_LastTransition < 0  ||
+                m_TransCats[m_LastTransition] != eHalting) ?
+            -1 : m_LastTransition;
+    }
+
+protected:
+    typedef CRow<ETransCat> TTransCats;
+    typedef CCompiledModel::TTransList TTransList;
+    typedef CRow<CCompiledModel::TBalancedPair> TBalancedPairs;
+    typedef CRow<unsigned char> TBools;
+    typedef double* TStates;
+    typedef double* TRates;
+    typedef CSparseRows<SChange> TTransitions;
+
+protected:
+    // for derived classes, which must set up m_X & m_T themselves and
+    // attach a compiled model (see R constructor)
+    CStochasticEqns(void);
+
+    void x_InitDefaultParams(const double* changeBound);
+
+    typedef std::chrono::steady_clock TClock;
+    // POST: run clock & progress cadence reset for a run until tF
+    void x_BeginRun(double tF);
+    // PRE : main loop iterations so far
+    // POST: CEarlyExit thrown if cancelled, out of budget or interrupted;
+    // progress reported when due
+    void x_CheckRunControl(uint64_t steps) {
+        if (m_Control->IsCancelled()) {
+            throwEarlyExit("simulation cancelled at time " << *m_T <<
+                           " after " << steps << " time steps");
+        }
+        if (--m_ClockCountdown == 0  ||  *m_T >= m_NextProgressSim) {
+            x_CheckRunClock(steps);
+        }
+    }
+    void x_CheckRunClock(uint64_t steps);
+    // POST: progress callback (if any) called; CEarlyExit thrown if it
+    // says so
+    void x_ReportProgress(uint64_t steps, double wallSeconds, bool finished);
+    // POST: stop criteria sampled if due (ending the run once one is met)
+    void x_CheckStop(void) {
+        if (!m_StopCriteria.empty()  &&  *m_T >= m_StopCriteria.NextSample()) {
+            m_StopCriteria.Sample(*m_T, m_X);
+        }
+    }
+    // whether the main loop of a run until tF should continue
+    bool x_Continue(double tF, uint64_t steps) const {
+        return *m_T < tF  &&  (m_MaxSteps == 0 || steps < m_MaxSteps)  &&
+            (m_LastTransition < 0  ||
+             m_TransCats[m_LastTransition] != eHalting)  &&
+            m_StopCriteria.GetMet() < 0;
+    }
+    // PRE : main loop of a run until tF ended normally after steps
+    // POST: m_StopReason set; final progress reported
+    void x_EndRun(double tF, uint64_t steps);
+    void x_CheckInitialValues(void) const;
+    // POST: structure viewed from compiled (held until destruction);
+    // transition lists of the run initialized
+    void x_AttachModel(const TCompiledModelPtr &compiled);
+
+    void x_CalcMassActionRates(void);
+    void x_CalcMassActionRates(unsigned int from, unsigned int to);
+
+    void x_AdvanceDeterministic(double deltaT, bool clamp = false);
+    void x_SingleStepExact(double tf);
+    // PRE : ratesCurrent if m_Rates already hold for m_X
+    // POST: one exact step by m_ExactMethod
+    void x_StepExact(double tf, bool ratesCurrent);
+    // as x_SingleStepExact, by rejection (rates need not be current)
+    void x_SingleStepRSSA(double tf);
+    // as x_SingleStepExact, by partial propensities (rates need not be
+    // current)
+    void x_SingleStepPDM(double tf);
+    // POST: every partial propensity & group total from m_X
+    void x_InitPDM(void);
+    // POST: partial propensity of transition j (in its group) from m_X
+    double x_PartialPropensity(unsigned int j) const;
+    // POST: share of group g in the total rate from m_X
+    void x_SetPDMGroup(unsigned int g) {
+        m_PDMGroups.Set(g, (g < m_NumStates ? m_X[g] : 1) *
+                        m_PDMPartial[g].Total());
+    }
+    // POST: intervals of all species & bounds of all transitions from m_X
+    void x_InitRSSABounds(void);
+    // POST: interval of species i centred on m_X[i]
+    void x_SetRSSAInterval(unsigned int i);
+    // POST: propensity bounds of transition j from the species intervals
+    void x_SetRSSABounds(unsigned int j);
+    void x_SingleStepETL(double tau);
+    void x_SingleStepITL(double tau);
+    void x_SingleStepCLE(double tau, bool implicit);
+    // PRE : m_X initial guess, alpha the explicit part of the step
+    // POST: m_X solves the implicit leap equation (see x_SingleStepITL)
+    void x_SolveImplicit(const double *origX, const double *alpha, double tau);
+    void x_SingleStepATL(double tf);
+    // PRE : simulation end time; **transition rates already updated**
+    // POST: single R-leap taken & time series updated
+    void x_SingleStepRL(double tf);
+
+    void x_UpdateRates(void);
+    // PRE : m_X current
+    // POST: m_Rates points to the current rates
+    virtual void x_CalcRates(void);
+    virtual bool x_HasJacobian(void) const {
+        return m_UseJacobian  ||  m_FDJacobian;
+    }
+    // PRE : m_X current
+    // POST: Jacobian of rates (variables by transitions, column-major)
+    virtual double* x_CalcJacobian(void);
+    // as x_CalcJacobian, by forward differences; m_Rates current on return
+    double* x_CalcFiniteDifferenceJacobian(void);
+    // POST: default rate dependencies (if none set) & column colouring
+    // of the finite-difference Jacobian
+    void x_InitFiniteDifferenceJacobian(void);
+    virtual bool x_HasUserMaxTau(void) const { return false; }
+    virtual double x_CalcUserMaxTau(void) {
+        throwError("logic error at line " << __LINE__);
+    }
+
+    unsigned int x_PickCritical(double prCrit);
+
+    // parallel path (see SetThreadPool)
+    typedef void (CStochasticEqns::*TBlockFn)(unsigned int block);
+    class CBlockTask : public CParallelTask {
+    public:
+        CBlockTask(CStochasticEqns *eqns, TBlockFn fn) : m_Eqns(eqns), m_Fn(fn) {}
+        void Run(unsigned int block) { (m_Eqns->*m_Fn)(block); }
+    private:
+        CStochasticEqns *m_Eqns;
+        TBlockFn m_Fn;
+    };
+    bool x_UseParallel(void) const { return m_Pool != NULL; }
+    bool x_IsCritical(unsigned int j) const;
+    // POST: fn run for every kParallelBlock-sized block of numItems items
+    void x_RunBlocks(TBlockFn fn, unsigned int numItems);
+    void x_MassActionRatesBlock(unsigned int block);
+    void x_ClassifyBlock(unsigned int block);
+    void x_SampleBlock(unsigned int block);
+    void x_ScatterBlock(unsigned int block);
+    void x_ClassifyParallel(double &criticalRate, double &noncritRate);
+
+    // PRE : m_Rates as at the start of a step of length deltaT
+    // POST: profile propensities (& deterministic firings) accumulated
+    void x_ProfileStep(double deltaT);
+    // POST: current time & state appended to m_TimeSeries
+    void x_RecordTimePoint(void);
+    // largest amount of scratch memory any single step takes from
+    // m_Workspace (depends on x_HasJacobian)
+    size_t x_WorkspaceBytes(void) const;
+    // POST: m_Workspace large enough for every step; only allocates if it
+    // has grown (e.g. the Jacobian was enabled)
+    void x_ReserveWorkspace(void) { m_Workspace.Reserve(x_WorkspaceBytes()); }
+    void x_ResetFirings(void);
+
+    double x_TauEx(void) const;
+    double x_TauIm(void) const;
+
+protected:
+    bool m_ExtraChecks; //turns on extra checks on rates returned by
+                        //user-supplied rate function. Slower, but if
+                        //the rate function does have a bug, this will
+                        //give a more meaningful error message.
+    int m_VerboseTracing; //trace algorithm verbosely
+
+    // parameters to tau leaping algorithm
+    unsigned int m_Ncritical;
+    double m_Nstiff;
+    double m_Epsilon;
+    double m_ExactThreshold;
+    double m_Delta;
+    unsigned int m_NumExactSteps[3];
+    double m_ITLConvergenceTol;
+    double m_MaxTau;
+    unsigned int m_MaxSteps;
+
+    // time-dependent variables
+    double *m_T;    // *current* time
+    TStates m_X;    // *current* state variables
+    TRates m_Rates; // *current* rates (must be updated if m_X changes!)
+    EStepType m_PrevStepType; // type of last step
+    int m_LastTransition; // id of transition taken if critical/exact; -1 o.w.
+    CRandom m_Random;
+    SRunStatistics m_Stats;
+
+    // constant variables (views into m_Compiled, except m_TransByCat,
+    // whose critical & normal lists change every step)
+    TCompiledModelPtr m_Compiled; //shared model structure
+    unsigned int m_NumStates; //total number of states
+    TTransitions m_Nu;        //state changes caused by transitions
+    TTransCats  m_TransCats;  //i.e. normal, deterministic, halting
+    TTransList  m_TransByCat[4];//i.e. critical, normal, deterministic, halting
+    TBalancedPairs m_BalancedPairs;
+    TBools m_RealValuedVariables;
+    const double *m_RateChangeBound; //see Cao (2006) for details
+    const CModelFile *m_Model; //binary model (if any) -- rates by mass action
+    const CModelKernels *m_Kernels; //compiled kernels for m_Model (if any)
+    bool m_UseJacobian; //mass-action Jacobian enabled for m_Model
+    bool m_FDJacobian;  //finite-difference Jacobian enabled
+    CSparseRows<unsigned int> m_RateDeps; //variables each rate depends on
+    CSparseRows<unsigned int> m_RateDepsBySpecies; //transpose of m_RateDeps
+    CSparseRows<unsigned int> m_ColourGroups; //variables perturbed together
+    std::vector<double> m_NativeX; //storage for m_X if not from R
+    double m_NativeT;              //storage for m_T if not from R
+    std::vector<double> m_NativeRates; //storage for m_Rates if not from R
+    std::vector<double> m_NativeJacobian; //storage for mass-action Jacobian
+    std::vector<double> m_Firings; //per-transition firings of an ETL step (kernels or profiling only)
+    bool m_Profiling;
+    STransitionProfile m_Profile;
+    CTraceBuffer *m_Trace; //phase-level tracing (if any); not owned
+    CRunControl m_OwnControl;
+    CRunControl *m_Control;  //m_OwnControl unless shared
+    TClock::time_point m_RunStart;
+    double m_RunFinalTime;
+    unsigned int m_ClockCountdown;  //steps until clock is read again
+    double m_NextProgressSim;       //simulated time of next progress report
+    double m_NextProgressWall;      //wall seconds of next progress report
+    double m_NextInterruptCheck;    //wall seconds of next interrupt poll
+    CStopCriteria m_StopCriteria;
+    EStopReason m_StopReason;
+
+    CThreadPool *m_Pool;     //parallel path in use if set; not owned
+    TTransitions m_NuBySpecies; //transpose of m_Nu (m_State is transition)
+    std::vector<unsigned char> m_CriticalFlags; //per transition, this step
+    std::vector<double> m_BlockSums; //per-block partial sums (2 per block)
+    double m_ParTau;         //tau of the ETL step being sampled
+    uint64_t m_ParSeed;      //base of the per-block RNG substreams
+
+    EExactMethod m_ExactMethod;
+    bool m_ExactStateValid;     //RSSA / PDM state below holds for m_X
+    double m_RSSAFluctuation;   //relative half-width of species intervals
+    double m_LangevinThreshold; //expected firings for a CLE step (0 == off)
+    ELeapMethod m_LeapMethod;
+    std::vector<double> m_RSSALow;  //species intervals
+    std::vector<double> m_RSSAHigh;
+    std::vector<double> m_RSSARateLow; //propensity lower bounds
+    CSumTree m_RSSARateHigh;           //propensity upper bounds
+    CSparseRows<unsigned int> m_ReactantOf; //transitions by reactant species
+    std::vector<unsigned int> m_PDMGroupOf; //group by transition (species;
+                                            //m_NumStates for no reactant)
+    std::vector<unsigned int> m_PDMPos;     //index of transition in its group
+    CSparseRows<unsigned int> m_PDMGroupTrans; //transitions by group
+    CSparseRows<unsigned int> m_PDMDependents; //transitions whose partial
+                                               //propensity a species changes
+    std::vector<CSumTree> m_PDMPartial;     //partial propensities by group
+    CSumTree m_PDMGroups;                   //count * group total by group
+
+    mutable CWorkspace m_Workspace; //per-step scratch (see x_WorkspaceBytes)
+
+    CTimeSeries m_TimeSeries;
+    bool m_RecordTimeSeries;
+};
+
+#endif //ADAPTIVETAU_STOCHASTICEQNS_H
@@ -0,0 +1,181 @@
+/*  stopcriteria.cpp
+    --------------------------------------------------------------------------
+    Online stopping criteria (see stopcriteria.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "stopcriteria.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+/*---------------------------------------------------------------------------*/
+unsigned int CStopCriteria::AddSteadyState(const string &name,
+                                           const TWeights &numerator,
+                                           const TWeights &denominator,
+                                           double window, double tolerance,
+                                           double absTolerance) {
+    if (!(window > 0)  ||  tolerance < 0  ||  absTolerance < 0) {
+        throwError("invalid steady state criterion '" << name << "' (window "
+                   "must be positive, tolerances non-negative)");
+    }
+    SCriterion c;
+    c.m_Name = name;
+    c.m_Kind = eSteadyState;
+    c.m_Numerator = numerator;
+    c.m_Denominator = denominator;
+    c.m_Window = window;
+    c.m_Tolerance = tolerance;
+    c.m_AbsTolerance = absTolerance;
+    m_Criteria.push_back(c);
+    Reset();
+    return m_Criteria.size() - 1;
+}
+
+unsigned int CStopCriteria::AddThreshold(const string &name,
+                                         const TWeights &numerator,
+                                         const TWeights &denominator,
+                                         double level, double holdTime) {
+    if (holdTime < 0) {
+        throwError("invalid threshold criterion '" << name << "' (hold "
+                   "time must be non-negative)");
+    }
+    SCriterion c;
+    c.m_Name = name;
+    c.m_Kind = eThreshold;
+    c.m_Numerator = numerator;
+    c.m_Denominator = denominator;
+    c.m_Window = holdTime;
+    c.m_Tolerance = level;
+    c.m_AbsTolerance = 0;
+    m_Criteria.push_back(c);
+    Reset();
+    return m_Criteria.size() - 1;
+}
+
+/*---------------------------------------------------------------------------*/
+void CStopCriteria::Validate(unsigned int numStates) const {
+    for (unsigned int c = 0;  c < m_Criteria.size();  ++c) {
+        const TWeights *sums[] = {&m_Criteria[c].m_Numerator,
+                                  &m_Criteria[c].m_Denominator};
+        for (unsigned int n = 0;  n < 2;  ++n) {
+            const TWeights &w = *sums[n];
+            for (unsigned int k = 0;  k < w.size();  ++k) {
+                if (w[k].first >= numStates) {
+                    throwError("stop criterion '" << m_Criteria[c].m_Name <<
+                               "' refers to variable " << w[k].first+1 <<
+                               " but there are only " << numStates);
+                }
+            }
+        }
+    }
+}
+
+double CStopCriteria::x_SampleInterval(void) const {
+    if (m_SampleInterval > 0) {
+        return m_SampleInterval;
+    }
+    double res = numeric_limits<double>::infinity();
+    for (unsigned int c = 0;  c < m_Criteria.size();  ++c) {
+        if (m_Criteria[c].m_Window > 0) {
+            res = min(res, m_Criteria[c].m_Window / kSamplesPerWindow);
+        }
+    }
+    return res == numeric_limits<double>::infinity() ? 0 : res;
+}
+
+void CStopCriteria::Reset(void) {
+    const double interval = x_SampleInterval();
+    for (unsigned int c = 0;  c < m_Criteria.size();  ++c) {
+        SCriterion &crit = m_Criteria[c];
+        // samples are at least interval apart & only one older than the
+        // window is kept
+        const unsigned int capacity = crit.m_Kind == eSteadyState ?
+            (unsigned int) ceil(crit.m_Window / interval) + 2 : 0;
+        crit.m_Samples.assign(capacity, make_pair(0., 0.));
+        crit.m_First = 0;
+        crit.m_Count = 0;
+        crit.m_Since = numeric_limits<double>::quiet_NaN();
+    }
+    m_NextSample = 0;
+    m_Met = -1;
+}
+
+/*---------------------------------------------------------------------------*/
+double CStopCriteria::Observable(unsigned int c, const double *x) const {
+    const SCriterion &crit = m_Criteria[c];
+    double num = 0, den = crit.m_Denominator.empty() ? 1 : 0;
+    for (unsigned int k = 0;  k < crit.m_Numerator.size();  ++k) {
+        num += crit.m_Numerator[k].second * x[crit.m_Numerator[k].first];
+    }
+    for (unsigned int k = 0;  k < crit.m_Denominator.size();  ++k) {
+        den += crit.m_Denominator[k].second * x[crit.m_Denominator[k].first];
+    }
+    return den == 0 ? numeric_limits<double>::quiet_NaN() : num / den;
+}
+
+int CStopCriteria::Sample(double t, const double *x) {
+    for (unsigned int c = 0;  c < m_Criteria.size()  &&  m_Met < 0;  ++c) {
+        const double value = Observable(c, x);
+        if (x_Update(m_Criteria[c], t, std::isnan(value) ? 0 : value,
+                     !std::isnan(value))) {
+            m_Met = c;
+        }
+    }
+    m_NextSample = t + x_SampleInterval();
+    return m_Met;
+}
+
+// PRE : sample (t, value) of c's observable; !defined if its denominator
+// was 0
+bool CStopCriteria::x_Update(SCriterion &c, double t, double value,
+                             bool defined) {
+    if (c.m_Kind == eThreshold) {
+        if (!defined  ||  fabs(value) < c.m_Tolerance) {
+            c.m_Since = numeric_limits<double>::quiet_NaN();
+            return false;
+        }
+        if (std::isnan(c.m_Since)) {
+            c.m_Since = t;
+        }
+        return t - c.m_Since >= c.m_Window;
+    }
+
+    if (!defined) {
+        c.m_Count = 0; //no steady value to speak of
+        return false;
+    }
+    const unsigned int capacity = c.m_Samples.size();
+    //drop samples older than needed: keep one at or before t - window
+    while (c.m_Count >= 2  &&
+           c.m_Samples[(c.m_First + 1) % capacity].first <= t - c.m_Window) {
+        c.m_First = (c.m_First + 1) % capacity;
+        --c.m_Count;
+    }
+    if (c.m_Count == capacity) { //guard; Reset sizes the ring to avoid this
+        c.m_First = (c.m_First + 1) % capacity;
+        --c.m_Count;
+    }
+    c.m_Samples[(c.m_First + c.m_Count) % capacity] = make_pair(t, value);
+    ++c.m_Count;
+    if (c.m_Samples[c.m_First].first > t - c.m_Window) {
+        return false; //window not yet covered
+    }
+    double lo = value, hi = value;
+    for (unsigned int k = 0;  k < c.m_Count;  ++k) {
+        const double v = c.m_Samples[(c.m_First + k) % capacity].second;
+        lo = min(lo, v);
+        hi = max(hi, v);
+    }
+    return hi - lo <= c.m_Tolerance * fabs(value) + c.m_AbsTolerance;
+}
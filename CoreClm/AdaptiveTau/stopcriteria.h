@@ -0,0 +1,113 @@
+/*  stopcriteria.h
+    --------------------------------------------------------------------------
+    Online stopping criteria: end a run before tF once the observables of
+    interest have settled or been decided.
+
+    Each criterion watches one observable, the ratio of two weighted sums
+    of variables (numerator / denominator; an empty denominator is 1), e.g.
+    total substance (numerator only) or enantiomeric excess
+    ee = (L - D) / (L + D).  The observables are sampled at most every
+    SetSampleInterval of simulated time, so the cost per step is a time
+    comparison; a run stops at the first sample at which any criterion is
+    met:
+        steady state  over the last window of simulated time, the
+                      observable stayed within tolerance * |current value|
+                      (+ absTolerance) of itself
+        threshold     |observable| >= level at every sample for holdTime
+                      (0 == as soon as it crosses)
+    All memory is taken when the criteria are set (Reset), not while the
+    run is sampled.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_STOPCRITERIA_H
+#define ADAPTIVETAU_STOPCRITERIA_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class CStopCriteria {
+public:
+    // linear combination of variables: (0-based variable, weight)
+    typedef std::vector< std::pair<unsigned int, double> > TWeights;
+
+    enum EKind {
+        eSteadyState = 0,
+        eThreshold
+    };
+
+    // default sample interval is the shortest window (or hold time) over
+    // this many
+    static const unsigned int kSamplesPerWindow = 16;
+
+    CStopCriteria(void) : m_SampleInterval(0), m_NextSample(0), m_Met(-1) {}
+
+    // POST: criterion added; returns its index.  window > 0.
+    unsigned int AddSteadyState(const std::string &name,
+                                const TWeights &numerator,
+                                const TWeights &denominator,
+                                double window, double tolerance,
+                                double absTolerance = 0);
+    // POST: criterion added; returns its index
+    unsigned int AddThreshold(const std::string &name,
+                              const TWeights &numerator,
+                              const TWeights &denominator,
+                              double level, double holdTime = 0);
+    // simulated time between samples (0 == default, see kSamplesPerWindow;
+    // every step if there are only thresholds without hold time)
+    void SetSampleInterval(double interval) {
+        m_SampleInterval = interval;
+        Reset();
+    }
+
+    bool empty(void) const { return m_Criteria.empty(); }
+    unsigned int size(void) const { return m_Criteria.size(); }
+    EKind GetKind(unsigned int c) const { return m_Criteria[c].m_Kind; }
+    const std::string& GetName(unsigned int c) const {
+        return m_Criteria[c].m_Name;
+    }
+
+    // observable of criterion c in state x (NaN if its denominator is 0)
+    double Observable(unsigned int c, const double *x) const;
+
+    // POST: runtime_error if a criterion refers to a variable >= numStates
+    void Validate(unsigned int numStates) const;
+    // POST: history cleared & sample buffers sized (start of a run)
+    void Reset(void);
+    // simulated time from which the next sample is due
+    double NextSample(void) const { return m_NextSample; }
+    // PRE : state x at time t >= NextSample()
+    // POST: sampled; returns index of the first criterion met, or -1
+    int Sample(double t, const double *x);
+    // index of the criterion that was met (-1 if none yet)
+    int GetMet(void) const { return m_Met; }
+
+private:
+    struct SCriterion {
+        std::string m_Name;
+        EKind m_Kind;
+        TWeights m_Numerator;
+        TWeights m_Denominator;
+        double m_Window;       // steady-state window, or hold time
+        double m_Tolerance;    // relative tolerance, or level
+        double m_AbsTolerance;
+        // history: ring of (time, value) samples (steady state), or time
+        // the observable last crossed the level (threshold; NaN if below)
+        std::vector< std::pair<double, double> > m_Samples;
+        unsigned int m_First;
+        unsigned int m_Count;
+        double m_Since;
+    };
+
+    double x_SampleInterval(void) const;
+    // POST: whether criterion c is met after adding the sample (t, value)
+    bool x_Update(SCriterion &c, double t, double value, bool defined);
+
+    std::vector<SCriterion> m_Criteria;
+    double m_SampleInterval;
+    double m_NextSample;
+    int m_Met;
+};
+
+#endif //ADAPTIVETAU_STOPCRITERIA_H
@@ -0,0 +1,78 @@
+/*  sumtree.h
+    --------------------------------------------------------------------------
+    Complete binary tree of partial sums over a fixed set of non-negative
+    weights 0..n-1: a weight is changed, and an item drawn with
+    probability proportional to its weight, in O(log n).  Every inner node
+    is recomputed from its children on update, so rounding errors do not
+    accumulate.  Used for the propensity upper bounds of the rejection-
+    based SSA and the partial propensities of the partial-propensity
+    direct method (see CStochasticEqns::SetExactMethod).
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_SUMTREE_H
+#define ADAPTIVETAU_SUMTREE_H
+
+#include <algorithm>
+#include <vector>
+
+class CSumTree {
+public:
+    CSumTree(void) : m_Size(0), m_NumItems(0) {}
+
+    // POST: tree of n items, all of weight 0
+    void Resize(unsigned int n) {
+        m_NumItems = n;
+        m_Size = 1;
+        while (m_Size < n) {
+            m_Size *= 2;
+        }
+        m_Tree.assign(2 * m_Size, 0.);
+    }
+    // POST: item's weight changed, but not the sums (see Resum)
+    void SetDeferred(unsigned int item, double weight) {
+        m_Tree[m_Size + item] = weight;
+    }
+    // POST: all sums recomputed, e.g. after SetDeferred on every item; O(n)
+    void Resum(void) {
+        for (unsigned int node = m_Size;  node-- > 1;  ) {
+            m_Tree[node] = m_Tree[2 * node] + m_Tree[2 * node + 1];
+        }
+    }
+
+    unsigned int size(void) const { return m_NumItems; }
+    double Total(void) const { return m_Size == 0 ? 0 : m_Tree[1]; }
+    double Get(unsigned int item) const { return m_Tree[m_Size + item]; }
+
+    // POST: item's weight changed & its ancestors' sums restored
+    void Set(unsigned int item, double weight) {
+        unsigned int node = m_Size + item;
+        m_Tree[node] = weight;
+        for (node /= 2;  node >= 1;  node /= 2) {
+            m_Tree[node] = m_Tree[2 * node] + m_Tree[2 * node + 1];
+        }
+    }
+
+    // PRE : 0 <= u < Total()
+    // POST: item whose slice of [0, Total()) holds u.  Rounding may yield
+    // an item of weight 0, which callers must treat as no item.
+    unsigned int Find(double u) const {
+        unsigned int node = 1;
+        while (node < m_Size) {
+            if (u < m_Tree[2 * node]) {
+                node = 2 * node;
+            } else {
+                u -= m_Tree[2 * node];
+                node = 2 * node + 1;
+            }
+        }
+        return std::min(node - m_Size, m_NumItems - 1);
+    }
+
+private:
+    unsigned int m_Size;        // leaves (a power of 2)
+    unsigned int m_NumItems;
+    std::vector<double> m_Tree; // node k has children 2k & 2k + 1; 1 is the root
+};
+
+#endif //ADAPTIVETAU_SUMTREE_H
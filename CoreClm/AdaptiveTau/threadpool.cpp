@@ -0,0 +1,109 @@
+/*  threadpool.cpp
+    --------------------------------------------------------------------------
+    Persistent thread pool (see threadpool.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+
+#include "threadpool.h"
+
+using namespace std;
+
+/*---------------------------------------------------------------------------*/
+CThreadPool::CThreadPool(unsigned int numThreads)
+    : m_Generation(0), m_Busy(0), m_Stop(false), m_Task(NULL),
+      m_NumBlocks(0), m_NextBlock(0) {
+    if (numThreads == 0) {
+        numThreads = max(1u, thread::hardware_concurrency());
+    }
+    for (unsigned int i = 1;  i < numThreads;  ++i) {
+        m_Workers.push_back(thread(&CThreadPool::x_WorkerLoop, this));
+    }
+}
+
+CThreadPool::~CThreadPool(void) {
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_WorkReady.notify_all();
+    for (unsigned int i = 0;  i < m_Workers.size();  ++i) {
+        m_Workers[i].join();
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+void CThreadPool::Run(CParallelTask &task, unsigned int numBlocks) {
+    if (numBlocks == 0) {
+        return;
+    }
+    if (m_Workers.empty()  ||  numBlocks == 1) {
+        for (unsigned int b = 0;  b < numBlocks;  ++b) {
+            task.Run(b);
+        }
+        return;
+    }
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_Task = &task;
+        m_NumBlocks = numBlocks;
+        m_NextBlock.store(0);
+        m_Error = exception_ptr();
+        m_Busy = m_Workers.size();
+        ++m_Generation;
+    }
+    m_WorkReady.notify_all();
+    x_RunBlocks();
+    {
+        unique_lock<mutex> lock(m_Mutex);
+        while (m_Busy > 0) {
+            m_WorkDone.wait(lock);
+        }
+        m_Task = NULL;
+    }
+    if (m_Error) {
+        rethrow_exception(m_Error);
+    }
+}
+
+// POST: blocks claimed & run until none are left
+void CThreadPool::x_RunBlocks(void) {
+    for (;;) {
+        const unsigned int b = m_NextBlock.fetch_add(1);
+        if (b >= m_NumBlocks) {
+            return;
+        }
+        try {
+            m_Task->Run(b);
+        } catch (...) {
+            lock_guard<mutex> lock(m_Mutex);
+            if (!m_Error) {
+                m_Error = current_exception();
+            }
+            m_NextBlock.store(m_NumBlocks); //skip the remaining blocks
+        }
+    }
+}
+
+void CThreadPool::x_WorkerLoop(void) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(m_Mutex);
+            while (!m_Stop  &&  m_Generation == seen) {
+                m_WorkReady.wait(lock);
+            }
+            if (m_Stop) {
+                return;
+            }
+            seen = m_Generation;
+        }
+        x_RunBlocks();
+        {
+            lock_guard<mutex> lock(m_Mutex);
+            --m_Busy;
+        }
+        m_WorkDone.notify_one();
+    }
+}
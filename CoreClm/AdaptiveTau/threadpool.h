@@ -0,0 +1,67 @@
+/*  threadpool.h
+    --------------------------------------------------------------------------
+    Persistent thread pool for splitting the per-step work of a single
+    trajectory (see CStochasticEqns::SetThreadPool).
+
+    Work is expressed as a CParallelTask over a number of blocks; Run()
+    hands the blocks out to the workers & the calling thread and returns
+    once all are done.  Which thread runs which block is not fixed, so tasks
+    must make each block's result independent of that (e.g. a RNG
+    substream per block, disjoint outputs per block).
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_THREADPOOL_H
+#define ADAPTIVETAU_THREADPOOL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CParallelTask {
+public:
+    virtual ~CParallelTask(void) {}
+    // PRE : block index in [0, numBlocks)
+    virtual void Run(unsigned int block) = 0;
+};
+
+/*---------------------------------------------------------------------------*/
+class CThreadPool {
+public:
+    // numThreads: total threads taking part, including the caller of Run()
+    // (0 == number of hardware threads)
+    explicit CThreadPool(unsigned int numThreads = 0);
+    ~CThreadPool(void);
+
+    unsigned int NumThreads(void) const { return m_Workers.size() + 1; }
+
+    // POST: task.Run(b) called exactly once for each b < numBlocks; the
+    // first exception thrown by any block is rethrown here.  Not reentrant.
+    void Run(CParallelTask &task, unsigned int numBlocks);
+
+private:
+    CThreadPool(const CThreadPool&);
+    CThreadPool& operator=(const CThreadPool&);
+
+    void x_WorkerLoop(void);
+    void x_RunBlocks(void);
+
+    std::vector<std::thread> m_Workers;
+    std::mutex m_Mutex;
+    std::condition_variable m_WorkReady;
+    std::condition_variable m_WorkDone;
+    uint64_t m_Generation;      // bumped for every Run()
+    unsigned int m_Busy;        // workers still inside the current Run()
+    bool m_Stop;
+
+    CParallelTask *m_Task;
+    unsigned int m_NumBlocks;
+    std::atomic<unsigned int> m_NextBlock;
+    std::exception_ptr m_Error;
+};
+
+#endif //ADAPTIVETAU_THREADPOOL_H
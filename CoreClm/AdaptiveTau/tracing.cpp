@@ -0,0 +1,145 @@
+/*  tracing.cpp
+    --------------------------------------------------------------------------
+    Trace ring buffer & Chrome trace-event writer (see tracing.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "tracing.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+/*---------------------------------------------------------------------------*/
+// small sequential id per thread (Chrome's viewer wants small tids)
+static uint64_t x_CurrentThreadId(void) {
+    static atomic<uint64_t> nextId(0);
+    thread_local uint64_t id = ++nextId;
+    return id;
+}
+
+/*---------------------------------------------------------------------------*/
+CTraceBuffer::CTraceBuffer(unsigned int capacity, const string &name)
+    : m_Events(capacity == 0 ? 1 : capacity), m_Next(0), m_Wrapped(false),
+      m_Total(0), m_StepCount(0), m_SampleEvery(1),
+      m_WindowFrom(-numeric_limits<double>::infinity()),
+      m_WindowTo(numeric_limits<double>::infinity()), m_Active(false),
+      m_Name(name), m_ThreadId(x_CurrentThreadId()) {
+}
+
+uint64_t CTraceBuffer::NowNs(void) {
+    static const chrono::steady_clock::time_point epoch =
+        chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::nanoseconds>
+        (chrono::steady_clock::now() - epoch).count();
+}
+
+vector<STraceEvent> CTraceBuffer::GetEvents(void) const {
+    vector<STraceEvent> res;
+    if (m_Wrapped) {
+        res.assign(m_Events.begin() + m_Next, m_Events.end());
+    }
+    res.insert(res.end(), m_Events.begin(), m_Events.begin() + m_Next);
+    return res;
+}
+
+/*---------------------------------------------------------------------------*/
+const char* TraceEventName(ETraceEvent event) {
+    static const char* names[eNumTraceEvents] = {
+        "step", "rates", "classify", "tauSelection", "exact", "ETL", "ITL",
+        "CLE", "RL", "newton", "record", "tauTooBig", "notConverged"
+    };
+    return event < eNumTraceEvents ? names[event] : "?";
+}
+
+static void x_WriteJsonString(ostream &out, const string &s) {
+    out << '"';
+    for (string::const_iterator c = s.begin();  c != s.end();  ++c) {
+        if (*c == '"'  ||  *c == '\\') {
+            out << '\\' << *c;
+        } else if ((unsigned char)*c < 0x20) {
+            out << ' ';
+        } else {
+            out << *c;
+        }
+    }
+    out << '"';
+}
+
+void WriteChromeTrace(ostream &out,
+                      const vector<const CTraceBuffer*> &buffers) {
+    out.precision(17);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (unsigned int b = 0;  b < buffers.size();  ++b) {
+        const CTraceBuffer &buf = *buffers[b];
+        // one track per buffer: pid 1, tid unique per buffer
+        const uint64_t tid = b + 1;
+        ostringstream trackName;
+        trackName << (buf.GetName().empty() ? "simulation" : buf.GetName())
+                  << " (thread " << buf.GetThreadId() << ")";
+        out << (first ? "" : ",\n") <<
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" <<
+            tid << ",\"args\":{\"name\":";
+        x_WriteJsonString(out, trackName.str());
+        out << "}}";
+        first = false;
+
+        const vector<STraceEvent> events = buf.GetEvents();
+        for (unsigned int i = 0;  i < events.size();  ++i) {
+            const STraceEvent &e = events[i];
+            const bool instant = e.m_Event == eTraceTauTooBig  ||
+                e.m_Event == eTraceNotConverged;
+            out << ",\n{\"name\":\"" <<
+                TraceEventName(ETraceEvent(e.m_Event)) <<
+                "\",\"cat\":\"adaptivetau\",\"ph\":\"" <<
+                (instant ? "i" : "X") << "\",\"pid\":1,\"tid\":" << tid <<
+                ",\"ts\":" << e.m_WallStartNs / 1000.;
+            if (instant) {
+                out << ",\"s\":\"t\"";
+            } else {
+                out << ",\"dur\":" << e.m_WallDurNs / 1000.;
+            }
+            out << ",\"args\":{\"simTime\":" << e.m_SimTime;
+            if (!std::isnan(e.m_Arg)) {
+                out << ",\"arg\":" << e.m_Arg;
+            }
+            out << "}}";
+            // simulated time as a counter track, once per step
+            if (e.m_Event == eTraceStep) {
+                out << ",\n{\"name\":\"simTime\",\"ph\":\"C\",\"pid\":1,"
+                    "\"tid\":" << tid << ",\"ts\":" << e.m_WallStartNs / 1000.
+                    << ",\"args\":{\"t\":" << e.m_SimTime << "}}";
+            }
+        }
+        if (buf.GetNumDropped() > 0) {
+            out << ",\n{\"name\":\"ring buffer full; " <<
+                buf.GetNumDropped() << " older events dropped\",\"ph\":\"i\","
+                "\"s\":\"t\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" <<
+                (events.empty() ? 0 : events[0].m_WallStartNs / 1000.) << "}";
+        }
+    }
+    out << "\n]}\n";
+}
+
+void WriteChromeTrace(const string &path,
+                      const vector<const CTraceBuffer*> &buffers) {
+    ofstream out(path.c_str());
+    if (!out) {
+        throwError("unable to create trace file '" << path << "'");
+    }
+    WriteChromeTrace(out, buffers);
+    if (!out) {
+        throwError("error writing trace file '" << path << "'");
+    }
+}
@@ -0,0 +1,159 @@
+/*  tracing.h
+    --------------------------------------------------------------------------
+    Phase-level timeline tracing of the stochastic solver core.
+
+    A CTraceBuffer is a fixed-size ring of events (rate update,
+    classification, tau selection, ETL/ITL, Newton iterations, recording,
+    ...) that one simulation writes into from the thread it runs on; once
+    full, the oldest events are overwritten.  Each event carries wall time
+    and the simulated time at which it started.  WriteChromeTrace() dumps one
+    or more buffers as Chrome trace-event JSON, which chrome://tracing and
+    https://ui.perfetto.dev load directly.
+
+    To keep multi-day runs small, only every n-th step is traced (SetSampling)
+    and/or only steps within a window of simulated time (SetSimTimeWindow).
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_TRACING_H
+#define ADAPTIVETAU_TRACING_H
+
+#include <stdint.h>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum ETraceEvent {
+    eTraceStep = 0,     // one iteration of the main loop
+    eTraceRates,        // rate update
+    eTraceClassify,     // critical / non-critical classification
+    eTraceTauSelection, // explicit & implicit tau
+    eTraceExact,        // exact (SSA) step
+    eTraceETL,          // explicit tau leap
+    eTraceITL,          // implicit tau leap
+    eTraceCLE,          // chemical Langevin step
+    eTraceRLeap,        // R-leap
+    eTraceNewton,       // one Newton iteration of an implicit leap
+    eTraceRecord,       // time series point recorded
+    eTraceTauTooBig,    // instant: leap rejected, tau halved
+    eTraceNotConverged, // instant: implicit leap did not converge
+    eNumTraceEvents
+};
+
+struct STraceEvent {
+    uint64_t m_WallStartNs; // since process-wide trace epoch
+    uint64_t m_WallDurNs;   // 0 for instant events
+    double m_SimTime;       // simulated time at start
+    double m_Arg;           // event specific (tau, iteration, ...); NaN if none
+    uint32_t m_Event;       // ETraceEvent
+};
+
+/*---------------------------------------------------------------------------*/
+class CTraceBuffer {
+public:
+    // capacity: maximum number of events retained
+    explicit CTraceBuffer(unsigned int capacity = 1 << 20,
+                          const std::string &name = std::string());
+
+    // trace only every n-th step (1 == all)
+    void SetSampling(unsigned int everyNthStep) {
+        m_SampleEvery = everyNthStep == 0 ? 1 : everyNthStep;
+    }
+    // trace only steps starting within [from, to] in simulated time
+    void SetSimTimeWindow(double from, double to) {
+        m_WindowFrom = from;
+        m_WindowTo = to;
+    }
+
+    // PRE : simulated time at the start of the next step
+    // POST: returns whether events of this step are recorded
+    bool BeginStep(double simTime) {
+        m_Active = (m_StepCount++ % m_SampleEvery) == 0  &&
+            simTime >= m_WindowFrom  &&  simTime <= m_WindowTo;
+        return m_Active;
+    }
+    bool IsActive(void) const { return m_Active; }
+
+    static uint64_t NowNs(void);
+    void Add(ETraceEvent event, uint64_t startNs, uint64_t durNs,
+             double simTime, double arg) {
+        STraceEvent &e = m_Events[m_Next];
+        e.m_WallStartNs = startNs;
+        e.m_WallDurNs = durNs;
+        e.m_SimTime = simTime;
+        e.m_Arg = arg;
+        e.m_Event = event;
+        ++m_Total;
+        if (++m_Next == m_Events.size()) {
+            m_Next = 0;
+            m_Wrapped = true;
+        }
+    }
+    void AddInstant(ETraceEvent event, double simTime,
+                    double arg = std::numeric_limits<double>::quiet_NaN()) {
+        if (m_Active) {
+            Add(event, NowNs(), 0, simTime, arg);
+        }
+    }
+
+    // events in the order they completed (duration events are added when
+    // they end, so nested events precede their parents), oldest first
+    std::vector<STraceEvent> GetEvents(void) const;
+    // events overwritten because the ring was full
+    uint64_t GetNumDropped(void) const {
+        return m_Total > m_Events.size() ? m_Total - m_Events.size() : 0;
+    }
+    const std::string& GetName(void) const { return m_Name; }
+    uint64_t GetThreadId(void) const { return m_ThreadId; }
+
+private:
+    std::vector<STraceEvent> m_Events;
+    unsigned int m_Next;
+    bool m_Wrapped;
+    uint64_t m_Total;
+    uint64_t m_StepCount;
+    unsigned int m_SampleEvery;
+    double m_WindowFrom;
+    double m_WindowTo;
+    bool m_Active;
+    std::string m_Name;
+    uint64_t m_ThreadId; // thread that created the buffer
+};
+
+/*---------------------------------------------------------------------------*/
+// Records one duration event over its lifetime, if buffer is non-NULL and
+// the current step is being traced.
+class CTraceScope {
+public:
+    CTraceScope(CTraceBuffer *buffer, ETraceEvent event, double simTime,
+                double arg = std::numeric_limits<double>::quiet_NaN()) :
+        m_Buffer(buffer  &&  buffer->IsActive() ? buffer : NULL),
+        m_Event(event), m_SimTime(simTime), m_Arg(arg),
+        m_StartNs(m_Buffer ? CTraceBuffer::NowNs() : 0) {}
+    ~CTraceScope(void) {
+        if (m_Buffer) {
+            m_Buffer->Add(m_Event, m_StartNs, CTraceBuffer::NowNs() - m_StartNs,
+                          m_SimTime, m_Arg);
+        }
+    }
+private:
+    CTraceBuffer *m_Buffer;
+    ETraceEvent m_Event;
+    double m_SimTime;
+    double m_Arg;
+    uint64_t m_StartNs;
+};
+
+const char* TraceEventName(ETraceEvent event);
+
+// PRE : buffers to dump (one track each)
+// POST: Chrome trace-event JSON written to out
+void WriteChromeTrace(std::ostream &out,
+                      const std::vector<const CTraceBuffer*> &buffers);
+// PRE : output file name
+// POST: as above; throws runtime_error if the file cannot be written
+void WriteChromeTrace(const std::string &path,
+                      const std::vector<const CTraceBuffer*> &buffers);
+
+#endif //ADAPTIVETAU_TRACING_H
@@ -0,0 +1,347 @@
+/*  validation.cpp
+    --------------------------------------------------------------------------
+    Accuracy validation of fast modes against the exact SSA (see
+    validation.h).
+    --------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "validation.h"
+
+using namespace std;
+
+#ifdef throwError
+#undef throwError
+#endif
+#define throwError(e) { ostringstream s; s << e; throw runtime_error(s.str()); }
+
+namespace {
+    // POST: eqns run from x0 through times, its state at each copied to
+    // states (one row per time); a halted run keeps its final state
+    void SampleRun(CStochasticEqns &eqns, bool exact, const double *x0,
+                   const vector<double> &times, uint64_t seed,
+                   double *states) {
+        const unsigned int n = eqns.GetNumStates();
+        eqns.SetState(0, x0);
+        eqns.Seed(seed);
+        for (unsigned int p = 0;  p < times.size();  ++p) {
+            if (eqns.GetStopReason() != eStopHalting) {
+                if (exact) {
+                    eqns.EvaluateExactUntil(times[p]);
+                } else {
+                    eqns.EvaluateATLUntil(times[p]);
+                }
+                if (eqns.GetStopReason() != eStopFinalTime  &&
+                    eqns.GetStopReason() != eStopHalting) {
+                    throwError("validation run ended at time " <<
+                               eqns.GetTime() << " before " << times[p] <<
+                               " (step limit or stop criterion)");
+                }
+            }
+            copy(eqns.GetState(), eqns.GetState() + n, states + (size_t) p * n);
+        }
+    }
+
+    void Sample(const double *x0, const vector<double> &times,
+                unsigned int runs, uint64_t seed, double *states,
+                void *userData, bool exact) {
+        CStochasticEqns &eqns = *static_cast<CStochasticEqns*>(userData);
+        eqns.SetRecordTimeSeries(false);
+        const size_t stride = times.size() * eqns.GetNumStates();
+        for (unsigned int r = 0;  r < runs;  ++r) {
+            SampleRun(eqns, exact, x0, times, seed + r, states + r * stride);
+        }
+    }
+
+    void MeanSd(const vector<double> &x, double &mean, double &sd) {
+        double sum = 0;
+        for (unsigned int k = 0;  k < x.size();  ++k) {
+            sum += x[k];
+        }
+        mean = sum / x.size();
+        double ss = 0;
+        for (unsigned int k = 0;  k < x.size();  ++k) {
+            ss += (x[k] - mean) * (x[k] - mean);
+        }
+        sd = x.size() > 1 ? sqrt(ss / (x.size() - 1)) : 0;
+    }
+
+    // Kolmogorov distribution: P(sqrt(n) D > lambda) (Numerical Recipes)
+    double KolmogorovQ(double lambda) {
+        const double a2 = -2 * lambda * lambda;
+        double sum = 0, sign = 2, prev = 0;
+        for (unsigned int j = 1;  j <= 100;  ++j) {
+            const double term = sign * exp(a2 * j * j);
+            sum += term;
+            if (fabs(term) <= 0.001 * prev  ||  fabs(term) <= 1e-8 * sum) {
+                return min(1., max(0., sum));
+            }
+            sign = -sign;
+            prev = fabs(term);
+        }
+        return 1; //no convergence: lambda is tiny
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+CAccuracyValidator::CAccuracyValidator(const TCompiledModelPtr &compiled,
+                                       const double *initVal)
+    : m_Compiled(compiled), m_Runs(1000), m_Alpha(0.01), m_Seed(1),
+      m_Control(NULL), m_ReferenceSeconds(0) {
+    if (!compiled->Model()) {
+        throwError("validation needs a compiled binary model");
+    }
+    const double *x0 = initVal ? initVal : compiled->Model()->InitialState();
+    m_InitVal.assign(x0, x0 + compiled->NumStates());
+}
+
+void CAccuracyValidator::SetTimes(const vector<double> &times) {
+    for (unsigned int p = 0;  p < times.size();  ++p) {
+        if (!(times[p] >= 0)  ||  (p > 0  &&  !(times[p] > times[p-1]))) {
+            throwError("validation times must be increasing & not negative");
+        }
+    }
+    m_Times = times;
+    m_Reference.clear();
+}
+
+void CAccuracyValidator::SetSpecies(const vector<unsigned int> &species) {
+    for (unsigned int k = 0;  k < species.size();  ++k) {
+        if (species[k] >= m_Compiled->NumStates()) {
+            throwError("species " << species[k]+1 << " does not exist");
+        }
+    }
+    m_Species = species;
+}
+
+void CAccuracyValidator::SetRuns(unsigned int runs) {
+    if (runs < 4) {
+        throwError("validation needs at least 4 runs per ensemble");
+    }
+    m_Runs = runs;
+    m_Reference.clear();
+}
+
+void CAccuracyValidator::Seed(uint64_t seed) {
+    m_Seed = seed;
+    m_Reference.clear();
+}
+
+/*---------------------------------------------------------------------------*/
+void CAccuracyValidator::SampleExact(const double *x0, const vector<double> &times,
+                                     unsigned int runs, uint64_t seed,
+                                     double *states, void *userData) {
+    Sample(x0, times, runs, seed, states, userData, true);
+}
+
+void CAccuracyValidator::SampleATL(const double *x0, const vector<double> &times,
+                                   unsigned int runs, uint64_t seed,
+                                   double *states, void *userData) {
+    Sample(x0, times, runs, seed, states, userData, false);
+}
+
+/*---------------------------------------------------------------------------*/
+double CAccuracyValidator::KolmogorovSmirnov(const vector<double> &a,
+                                             const vector<double> &b,
+                                             double &pValue) {
+    //largest gap between the empirical CDFs, taken after all copies of a
+    //value, so that ties do not open spurious gaps
+    const double na = a.size(), nb = b.size();
+    unsigned int i = 0, j = 0;
+    double d = 0;
+    while (i < a.size()  &&  j < b.size()) {
+        const double v = min(a[i], b[j]);
+        while (i < a.size()  &&  a[i] == v) {
+            ++i;
+        }
+        while (j < b.size()  &&  b[j] == v) {
+            ++j;
+        }
+        d = max(d, fabs(i / na - j / nb));
+    }
+    const double en = sqrt(na * nb / (na + nb));
+    pValue = KolmogorovQ((en + 0.12 + 0.11 / en) * d);
+    return d;
+}
+
+double CAccuracyValidator::AndersonDarling(const vector<double> &a,
+                                           const vector<double> &b,
+                                           double &pValue, int &bound) {
+    //A2akN of Scholz & Stephens for k = 2 samples, with mid-ranks for ties
+    const double n[2] = { (double) a.size(), (double) b.size() };
+    const double bigN = n[0] + n[1];
+    const vector<double> *samples[2] = { &a, &b };
+    vector<double> z(a);
+    z.insert(z.end(), b.begin(), b.end());
+    sort(z.begin(), z.end());
+    if (z.front() == z.back()) {
+        pValue = 1;
+        return -numeric_limits<double>::infinity();
+    }
+
+    double a2 = 0;
+    unsigned int pos[2] = { 0, 0 };
+    unsigned int below = 0; //values of z less than the current one
+    while (below < z.size()) {
+        const double v = z[below];
+        unsigned int l = 0;
+        while (below + l < z.size()  &&  z[below + l] == v) {
+            ++l;
+        }
+        const double bj = below + l / 2.;
+        const double denom = bj * (bigN - bj) - bigN * l / 4.;
+        for (unsigned int k = 0;  k < 2;  ++k) {
+            const vector<double> &x = *samples[k];
+            unsigned int f = 0;
+            while (pos[k] < x.size()  &&  x[pos[k]] == v) {
+                ++pos[k];
+                ++f;
+            }
+            const double mij = pos[k] - f / 2.;
+            const double diff = bigN * mij - bj * n[k];
+            if (denom > 0) {
+                a2 += l / bigN * diff * diff / denom / n[k];
+            }
+        }
+        below += l;
+    }
+    a2 *= (bigN - 1) / bigN;
+
+    //variance of A2akN under the null hypothesis
+    const double k = 2;
+    const double bigH = 1 / n[0] + 1 / n[1];
+    double h = 0, g = 0;
+    vector<double> harmonic((size_t) bigN, 0);  //harmonic[i] = sum 1/j, j <= i
+    for (unsigned int i = 1;  i < harmonic.size();  ++i) {
+        harmonic[i] = harmonic[i-1] + 1. / i;
+    }
+    h = harmonic[(size_t) bigN - 1];
+    for (unsigned int i = 1;  i + 2 <= bigN;  ++i) {
+        g += (h - harmonic[i]) / (bigN - i);
+    }
+    const double ca = (4*g - 6) * (k - 1) + (10 - 6*g) * bigH;
+    const double cb = (2*g - 4) * k*k + 8*h*k + (2*g - 14*h - 4) * bigH -
+        8*h + 4*g - 6;
+    const double cc = (6*h + 2*g - 2) * k*k + (4*h - 4*g + 6) * k +
+        (2*h - 6) * bigH + 4*h;
+    const double cd = (2*h + 6) * k*k - 4*h*k;
+    const double var = (((ca * bigN + cb) * bigN + cc) * bigN + cd) /
+        ((bigN - 1) * (bigN - 2) * (bigN - 3));
+    const double t = (a2 - (k - 1)) / sqrt(var);
+
+    //critical values for k - 1 = 1 (b0 + b1 + b2 of Scholz & Stephens,
+    //table 2); log significance is piecewise linear in between, and
+    //unknown beyond the table
+    static const double crit[] = { 0.325, 1.226, 1.961, 2.718, 3.752, 4.592,
+                                   6.546 };
+    static const double sig[] = { 0.25, 0.1, 0.05, 0.025, 0.01, 0.005,
+                                  0.001 };
+    const unsigned int last = sizeof(crit)/sizeof(crit[0]) - 1;
+    if (t < crit[0]) {
+        pValue = sig[0];
+        bound = 1;
+        return t;
+    }
+    if (t > crit[last]) {
+        pValue = sig[last];
+        bound = -1;
+        return t;
+    }
+    bound = 0;
+    unsigned int seg = 0;
+    while (seg + 1 < last  &&  t > crit[seg+1]) {
+        ++seg;
+    }
+    const double slope = (log(sig[seg+1]) - log(sig[seg])) /
+        (crit[seg+1] - crit[seg]);
+    pValue = exp(log(sig[seg]) + slope * (t - crit[seg]));
+    return t;
+}
+
+/*---------------------------------------------------------------------------*/
+void CAccuracyValidator::x_RunReference(void) {
+    CStochasticEqns eqns(m_Compiled, &m_InitVal[0]);
+    if (m_Control) {
+        eqns.SetRunControl(m_Control);
+    }
+    m_Reference.resize((size_t) m_Runs * m_Times.size() *
+                       m_Compiled->NumStates());
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    SampleExact(&m_InitVal[0], m_Times, m_Runs, m_Seed, &m_Reference[0],
+                &eqns);
+    m_ReferenceSeconds = chrono::duration<double>
+        (chrono::steady_clock::now() - start).count();
+}
+
+SValidationReport CAccuracyValidator::Validate(TEnsembleSampler sampler,
+                                               void *userData) {
+    if (m_Times.empty()) {
+        throwError("no validation times set (see SetTimes)");
+    }
+    if (m_Reference.empty()) {
+        x_RunReference();
+    }
+    const unsigned int n = m_Compiled->NumStates();
+    const unsigned int numTimes = m_Times.size();
+    vector<double> fast(m_Reference.size());
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    //seeds after the reference's, so that the ensembles are independent
+    sampler(&m_InitVal[0], m_Times, m_Runs, m_Seed + m_Runs, &fast[0],
+            userData);
+
+    SValidationReport res;
+    res.m_FastSeconds = chrono::duration<double>
+        (chrono::steady_clock::now() - start).count();
+    res.m_ExactSeconds = m_ReferenceSeconds;
+    res.m_Speedup = res.m_ExactSeconds / max(res.m_FastSeconds, 1e-9);
+
+    vector<unsigned int> species = m_Species;
+    if (species.empty()) {
+        for (unsigned int i = 0;  i < n;  ++i) {
+            species.push_back(i);
+        }
+    }
+    const double comparisons = (double) species.size() * numTimes;
+    res.m_Threshold = m_Alpha / (3 * comparisons);
+    res.m_MinPValue = 1;
+    res.m_Failures = 0;
+    vector<double> a(m_Runs), b(m_Runs);
+    for (unsigned int p = 0;  p < numTimes;  ++p) {
+        for (unsigned int k = 0;  k < species.size();  ++k) {
+            for (unsigned int r = 0;  r < m_Runs;  ++r) {
+                const size_t at = ((size_t) r * numTimes + p) * n + species[k];
+                a[r] = m_Reference[at];
+                b[r] = fast[at];
+            }
+            sort(a.begin(), a.end());
+            sort(b.begin(), b.end());
+
+            SMarginalTest t;
+            t.m_Species = species[k];
+            t.m_Time = m_Times[p];
+            MeanSd(a, t.m_MeanExact, t.m_SdExact);
+            MeanSd(b, t.m_MeanFast, t.m_SdFast);
+            t.m_KS = KolmogorovSmirnov(a, b, t.m_KSPValue);
+            t.m_AD = AndersonDarling(a, b, t.m_ADPValue, t.m_ADBound);
+            const double se = sqrt((t.m_SdExact * t.m_SdExact +
+                                    t.m_SdFast * t.m_SdFast) / m_Runs);
+            t.m_MeanPValue = se > 0 ?
+                erfc(fabs(t.m_MeanFast - t.m_MeanExact) / se / sqrt(2.)) :
+                (t.m_MeanFast == t.m_MeanExact ? 1 : 0);
+            const double minP = min(t.m_KSPValue,
+                                    min(t.m_ADPValue, t.m_MeanPValue));
+            t.m_Passed = minP >= res.m_Threshold  &&  t.m_ADBound >= 0;
+            res.m_MinPValue = min(res.m_MinPValue, minP);
+            res.m_Failures += !t.m_Passed;
+            res.m_Tests.push_back(t);
+        }
+    }
+    res.m_Passed = res.m_Failures == 0;
+    return res;
+}
@@ -0,0 +1,141 @@
+/*  validation.h
+    --------------------------------------------------------------------------
+    Statistical accuracy validation of the fast simulation modes against
+    the exact SSA.
+
+    CAccuracyValidator runs an ensemble of exact trajectories of a binary
+    model (the reference, run once & kept) and an ensemble of the mode
+    under test, and compares the marginal distribution of every chosen
+    species at every chosen time with
+        - the two-sample Kolmogorov-Smirnov test (asymptotic p-value,
+          Stephens' small-sample correction; conservative for the ties
+          of integer counts),
+        - the k-sample Anderson-Darling test for discrete data, version
+          A2akN of Scholz & Stephens (JASA 1987), p-value interpolated
+          in log scale from their table of critical values; beyond the
+          table it is only known to be < 0.001 or > 0.25, is clamped
+          there & flagged (m_ADBound),
+        - a z-test of the means (Welch), plus the standard deviations for
+          the report.
+    A comparison fails if any of its p-values falls below
+    significance / (3 * comparisons) -- Bonferroni over all tests, so
+    that significance is the family-wise rate of false alarms of a
+    faithful mode -- or if its Anderson-Darling statistic lies beyond the
+    table's smallest significance.  The verdict is a pass if no comparison fails.  Wall
+    time of both ensembles gives the speedup.
+
+    The mode under test is any TEnsembleSampler, so that every
+    performance feature (epsilon, implicit leaps, lockstep batches,
+    threads, ...) is checked the same way.  SampleExact & SampleATL
+    sample with a CStochasticEqns configured by the caller.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_VALIDATION_H
+#define ADAPTIVETAU_VALIDATION_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "compiledmodel.h"
+#include "stochasticeqns.h"
+
+// PRE : initial state x0, increasing times, number of runs & base seed
+// POST: states[(run * times.size() + p) * numStates + i] = species i of
+// run at times[p]; a run that halted keeps its final state.  Run r
+// should draw from seed + r.  userData as given to Validate.
+typedef void (*TEnsembleSampler)(const double *x0,
+                                 const std::vector<double> &times,
+                                 unsigned int runs, uint64_t seed,
+                                 double *states, void *userData);
+
+// comparison of one species at one time
+struct SMarginalTest {
+    unsigned int m_Species;
+    double m_Time;
+    double m_MeanExact;
+    double m_MeanFast;
+    double m_SdExact;
+    double m_SdFast;
+    double m_KS;           // statistic D
+    double m_KSPValue;
+    double m_AD;           // standardized statistic T
+    double m_ADPValue;     // clamped to the table, see m_ADBound
+    int m_ADBound;         // -1: p < m_ADPValue, 1: p > m_ADPValue, 0: as is
+    double m_MeanPValue;
+    bool m_Passed;
+};
+
+// result of CAccuracyValidator::Validate
+struct SValidationReport {
+    std::vector<SMarginalTest> m_Tests;
+    unsigned int m_Failures;
+    double m_Threshold;      // p-value below which a test fails
+    double m_MinPValue;      // over all tests
+    double m_ExactSeconds;   // wall time of the reference ensemble
+    double m_FastSeconds;
+    double m_Speedup;
+    bool m_Passed;
+};
+
+class CAccuracyValidator {
+public:
+    // PRE : compiled binary model; initVal NULL == model's initial state
+    CAccuracyValidator(const TCompiledModelPtr &compiled,
+                       const double *initVal = NULL);
+
+    // marginals compared at these times (increasing; required)
+    void SetTimes(const std::vector<double> &times);
+    // species compared (0-based; empty == all)
+    void SetSpecies(const std::vector<unsigned int> &species);
+    // trajectories per ensemble (default 1000)
+    void SetRuns(unsigned int runs);
+    // family-wise false-alarm rate (default 0.01)
+    void SetSignificance(double alpha) { m_Alpha = alpha; }
+    void Seed(uint64_t seed);
+    // cancellation only; NULL for none.  Must outlive Validate.
+    void SetRunControl(CRunControl *control) { m_Control = control; }
+
+    // POST: mode under test sampled & compared with the exact reference
+    // (which is run on the first call); CEarlyExit if cancelled
+    SValidationReport Validate(TEnsembleSampler sampler, void *userData);
+
+    // samplers for a CStochasticEqns (userData) set up by the caller,
+    // e.g. with SetEpsilon or SetUseJacobian
+    static void SampleExact(const double *x0, const std::vector<double> &times,
+                            unsigned int runs, uint64_t seed, double *states,
+                            void *userData);
+    static void SampleATL(const double *x0, const std::vector<double> &times,
+                          unsigned int runs, uint64_t seed, double *states,
+                          void *userData);
+
+    // two-sample tests on sorted samples a & b (exposed for reuse)
+    // POST: Kolmogorov-Smirnov statistic; p-value into pValue
+    static double KolmogorovSmirnov(const std::vector<double> &a,
+                                    const std::vector<double> &b,
+                                    double &pValue);
+    // POST: standardized Anderson-Darling statistic; p-value into pValue,
+    // clamped to the table's range, with bound -1 / 1 if the true value
+    // is below / above it & 0 otherwise
+    static double AndersonDarling(const std::vector<double> &a,
+                                  const std::vector<double> &b,
+                                  double &pValue, int &bound);
+
+private:
+    // POST: the exact reference ensemble in m_Reference
+    void x_RunReference(void);
+
+    TCompiledModelPtr m_Compiled;
+    std::vector<double> m_InitVal;
+    std::vector<double> m_Times;
+    std::vector<unsigned int> m_Species;
+    unsigned int m_Runs;
+    double m_Alpha;
+    uint64_t m_Seed;
+    CRunControl *m_Control;
+
+    std::vector<double> m_Reference;  // as TEnsembleSampler's states
+    double m_ReferenceSeconds;
+};
+
+#endif //ADAPTIVETAU_VALIDATION_H
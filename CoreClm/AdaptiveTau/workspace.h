@@ -0,0 +1,86 @@
+/*  workspace.h
+    --------------------------------------------------------------------------
+    Per-simulation scratch arena for the step loop.
+
+    A CWorkspace is one block of memory, sized before the simulation starts
+    (Reserve), from which the steps take their temporaries (Alloc) instead
+    of the heap.  Allocation is a pointer bump; a CWorkspace::CScope hands
+    everything allocated during its lifetime back when it goes out of
+    scope, including when a step exits by exception (e.g. "tau too big").
+    Running out of space is a logic error: the owner must reserve for the
+    largest step it takes.
+    --------------------------------------------------------------------------
+*/
+
+#ifndef ADAPTIVETAU_WORKSPACE_H
+#define ADAPTIVETAU_WORKSPACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <stdexcept>
+
+class CWorkspace {
+public:
+    static const size_t kAlignment = 64; //cache line; every Alloc starts on one
+
+    CWorkspace(void) : m_Base(NULL), m_Capacity(0), m_Top(0) {}
+
+    // bytes taken by Alloc<T>(n), including alignment
+    template <class T>
+    static size_t Footprint(size_t n) {
+        return (n * sizeof(T) + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    // PRE : nothing allocated (no CScope open)
+    // POST: capacity >= bytes (contents are not preserved)
+    void Reserve(size_t bytes) {
+        if (bytes <= m_Capacity) {
+            return;
+        }
+        if (m_Top != 0) {
+            throw std::logic_error("workspace resized while in use");
+        }
+        m_Block.reset(new unsigned char[bytes + kAlignment]);
+        const uintptr_t p = reinterpret_cast<uintptr_t>(m_Block.get());
+        m_Base = m_Block.get() + (kAlignment - p % kAlignment) % kAlignment;
+        m_Capacity = bytes;
+    }
+    size_t Capacity(void) const { return m_Capacity; }
+    size_t InUse(void) const { return m_Top; }
+
+    // POST: uninitialized room for n T's, valid until the enclosing CScope
+    // ends
+    template <class T>
+    T* Alloc(size_t n) {
+        const size_t bytes = Footprint<T>(n);
+        if (bytes > m_Capacity - m_Top) {
+            throw std::logic_error("workspace too small for this step");
+        }
+        T *res = reinterpret_cast<T*>(m_Base + m_Top);
+        m_Top += bytes;
+        return res;
+    }
+
+    class CScope {
+    public:
+        explicit CScope(CWorkspace &ws) : m_Ws(ws), m_Mark(ws.m_Top) {}
+        ~CScope(void) { m_Ws.m_Top = m_Mark; }
+    private:
+        CScope(const CScope&);
+        CScope& operator=(const CScope&);
+        CWorkspace &m_Ws;
+        size_t m_Mark;
+    };
+
+private:
+    CWorkspace(const CWorkspace&);
+    CWorkspace& operator=(const CWorkspace&);
+
+    std::unique_ptr<unsigned char[]> m_Block;
+    unsigned char *m_Base;
+    size_t m_Capacity;
+    size_t m_Top;
+};
+
+#endif //ADAPTIVETAU_WORKSPACE_H
@@ -0,0 +1,245 @@
+﻿namespace Clm.Generator
+
+open System
+open System.IO
+open System.Text
+open FSharp.Collections
+
+open Clm.Substances
+open Clm.Distributions
+open Clm.ReactionTypes
+open Clm.Reactions
+open Clm.CalculationData
+
+/// Writes a generated model in the binary format, which the C++ stochastic solver core maps into memory
+/// and uses in place. AdaptiveTau\modelformat.h is the reference for the layout and both must be kept in sync.
+module BinaryModelWriter =
+
+    let modelFormatMagic = "CLMMODEL"B
+    let modelFormatVersion = 1u
+    let modelFormatEndianCheck = 0x01020304u
+    let modelFormatAlignment = 64L
+    let headerSize = 40L
+    let sectionEntrySize = 24L
+
+
+    type ModelSection =
+        | SpeciesNameOffsets = 1u
+        | SpeciesNameChars = 2u
+        | SpeciesCategories = 3u
+        | InitialState = 4u
+        | ChangeOffsets = 5u
+        | Changes = 6u
+        | ReactantOffsets = 7u
+        | Reactants = 8u
+        | RateConstants = 9u
+        | TransitionCategories = 10u
+        | TransitionFlags = 11u
+        | CategoryNameOffsets = 12u
+        | CategoryNameChars = 13u
+
+
+    /// A single (one directional) transition with mass-action kinetics in molecule-count units.
+    type BinaryTransition =
+        {
+            reactants : list<int * int> // species index, order
+            changes : list<int * int> // species index, net change
+            rateConstant : double
+            category : int
+        }
+
+
+    type SectionData =
+        {
+            sectionId : ModelSection
+            elemSize : int
+            count : int64
+            data : byte[]
+        }
+
+
+    let substanceCategoryName (s : Substance) =
+        match s with
+        | Simple _ -> "simple"
+        | Chiral _ -> "chiral amino acid"
+        | PeptideChain _ -> "peptide"
+        | ActivatedPeptideChain _ -> "activated peptide"
+        | ChiralSug _ -> "chiral sugar"
+        | Sum _ -> "sum"
+
+
+    let allSubstanceCategoryNames =
+        [ "simple"; "chiral amino acid"; "peptide"; "activated peptide"; "chiral sugar"; "sum" ]
+
+
+    /// Category names stored in the file: substance categories first, then reaction names.
+    let allCategoryNames = allSubstanceCategoryNames @ (ReactionName.all |> List.map (fun n -> n.name))
+
+
+    let categoryIndex name =
+        match allCategoryNames |> List.tryFindIndex (fun e -> e = name) with
+        | Some i -> i
+        | None -> failwith $"BinaryModelWriter: unknown category: %A{name}"
+
+
+    /// Converts a deterministic rate constant k for concentrations into the stochastic
+    /// rate constant c = k * V^(1 - order) for molecule counts in a system of size V.
+    let toStochasticRate (systemSize : double) order k = k * Math.Pow(systemSize, 1.0 - double order)
+
+
+    /// Sedimentation all (no input and no output) is not a mass-action transition: its kW term acts on all
+    /// substances at once in the ODE model only, so it has no transition in the binary model.
+    let isTransition (r : AnyReaction) = r.name <> SedimentationAllName
+
+
+    /// Converts reactions into transitions. Zero-order entries (e.g. the Abundant input of food creation) and zero
+    /// net changes carry no information and are dropped, as the C++ side rejects reactants of order 0.
+    let toTransitions (si : SubstInfo) (systemSize : double) (allReac : list<AnyReaction>) =
+        let group (l : list<Substance * int>) =
+            l
+            |> List.groupBy fst
+            |> List.map (fun (s, e) -> si.allInd.[s], e |> List.sumBy snd)
+            |> List.filter (fun (_, n) -> n <> 0)
+            |> List.sortBy fst
+
+        let create c (i : list<Substance * int>) (o : list<Substance * int>) (ReactionRate k) =
+            {
+                reactants = group i
+                changes = o @ (i |> List.map (fun (s, n) -> s, -n)) |> group
+                rateConstant = toStochasticRate systemSize (i |> List.sumBy snd) k
+                category = c
+            }
+
+        allReac
+        |> List.filter isTransition
+        |> List.map (fun r ->
+            let c = categoryIndex r.name.name
+            let info = r.reaction.info
+            (r.forwardRate |> Option.map (create c info.input info.output) |> Option.toList)
+            @
+            (r.backwardRate |> Option.map (create c info.output info.input) |> Option.toList))
+        |> List.concat
+
+
+    let toBytes (f : BinaryWriter -> unit) =
+        use ms = new MemoryStream()
+        use w = new BinaryWriter(ms)
+        f w
+        w.Flush()
+        ms.ToArray()
+
+
+    let offsetsSection sectionId (lengths : list<int>) =
+        let offsets = lengths |> List.scan (fun acc n -> acc + uint64 n) 0UL
+
+        {
+            sectionId = sectionId
+            elemSize = 8
+            count = int64 offsets.Length
+            data = toBytes (fun w -> offsets |> List.iter w.Write)
+        }
+
+
+    let stringSections offsetsId charsId (names : list<string>) =
+        let bytes = names |> List.map Encoding.UTF8.GetBytes
+        let chars = bytes |> Array.concat
+
+        [
+            offsetsSection offsetsId (bytes |> List.map Array.length)
+            { sectionId = charsId; elemSize = 1; count = int64 chars.Length; data = chars }
+        ]
+
+
+    let pairSections offsetsId entriesId (rows : list<list<int * int>>) =
+        let entries = rows |> List.concat
+
+        [
+            offsetsSection offsetsId (rows |> List.map List.length)
+            {
+                sectionId = entriesId
+                elemSize = 8
+                count = int64 entries.Length
+                data = toBytes (fun w -> entries |> List.iter (fun (a, b) -> w.Write(int32 a); w.Write(int32 b)))
+            }
+        ]
+
+
+    let uint32Section sectionId (values : list<int>) =
+        {
+            sectionId = sectionId
+            elemSize = 4
+            count = int64 values.Length
+            data = toBytes (fun w -> values |> List.iter (fun v -> w.Write(uint32 v)))
+        }
+
+
+    let doubleSection sectionId (values : list<double>) =
+        {
+            sectionId = sectionId
+            elemSize = 8
+            count = int64 values.Length
+            data = toBytes (fun w -> values |> List.iter w.Write)
+        }
+
+
+    let alignUp (x : int64) = (x + modelFormatAlignment - 1L) / modelFormatAlignment * modelFormatAlignment
+
+
+    let writeSections (fileName : string) numSpecies numTransitions (sections : list<SectionData>) =
+        let start = alignUp (headerSize + sectionEntrySize * int64 sections.Length)
+        let offsets = sections |> List.scan (fun acc s -> alignUp (acc + int64 s.data.Length)) start
+        let fileSize = offsets |> List.last
+
+        use fs = new FileStream(fileName, FileMode.Create, FileAccess.Write)
+        use w = new BinaryWriter(fs)
+        let pad (o : int64) = w.Write(Array.zeroCreate<byte> (int (o - fs.Position)))
+
+        w.Write(modelFormatMagic)
+        w.Write(modelFormatVersion)
+        w.Write(modelFormatEndianCheck)
+        w.Write(uint32 numSpecies)
+        w.Write(uint32 numTransitions)
+        w.Write(uint32 allCategoryNames.Length)
+        w.Write(uint32 sections.Length)
+        w.Write(uint64 fileSize)
+
+        List.zip sections (offsets |> List.take sections.Length)
+        |> List.iter (fun (s, o) ->
+            w.Write(uint32 s.sectionId)
+            w.Write(uint32 s.elemSize)
+            w.Write(uint64 o)
+            w.Write(uint64 s.count))
+
+        List.zip sections (offsets |> List.take sections.Length)
+        |> List.iter (fun (s, o) ->
+            pad o
+            w.Write(s.data))
+
+        pad fileSize
+
+
+    /// Writes the model into fileName. y0 contains initial concentrations (e.g. from ModelInit.defaultInit),
+    /// which are converted into molecule counts using systemSize together with all rate constants.
+    let writeModel (fileName : string) (si : SubstInfo) (allReac : list<AnyReaction>) (systemSize : double) (y0 : array<double>) =
+        if y0.Length <> si.allSubst.Length
+        then failwith $"BinaryModelWriter: expected %A{si.allSubst.Length} initial values but got %A{y0.Length}."
+
+        let transitions = toTransitions si systemSize allReac
+
+        let sections =
+            (si.allSubst |> List.map (fun s -> si.allNamesMap.[s]) |> stringSections ModelSection.SpeciesNameOffsets ModelSection.SpeciesNameChars)
+            @
+            [
+                si.allSubst |> List.map (fun s -> substanceCategoryName s |> categoryIndex) |> uint32Section ModelSection.SpeciesCategories
+                y0 |> List.ofArray |> List.map (fun v -> Math.Round(max v 0.0 * systemSize)) |> doubleSection ModelSection.InitialState
+            ]
+            @ (transitions |> List.map (fun t -> t.changes) |> pairSections ModelSection.ChangeOffsets ModelSection.Changes)
+            @ (transitions |> List.map (fun t -> t.reactants) |> pairSections ModelSection.ReactantOffsets ModelSection.Reactants)
+            @
+            [
+                transitions |> List.map (fun t -> t.rateConstant) |> doubleSection ModelSection.RateConstants
+                transitions |> List.map (fun t -> t.category) |> uint32Section ModelSection.TransitionCategories
+            ]
+            @ (allCategoryNames |> stringSections ModelSection.CategoryNameOffsets ModelSection.CategoryNameChars)
+
+        writeSections fileName si.allSubst.Length transitions.Length sections
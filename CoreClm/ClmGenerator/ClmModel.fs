@@ -426,6 +426,16 @@ module ClmModel =
                 e |> WriteFileExn |> FileErr |> Error
 
 
+        let saveBinaryModel fileName systemSize y0 =
+            try
+                BinaryModelWriter.writeModel fileName si allReac systemSize y0
+                Ok ()
+            with
+            | e ->
+                printfn $"saveBinaryModel: Exception occurred: %A{e}"
+                e |> WriteFileExn |> FileErr |> Error
+
+
         let getModelDataImpl clmTaskId =
             {
                 modelDataId = modelDataId
@@ -469,4 +479,5 @@ module ClmModel =
         member model.allSubstances = si.allSubst
         member model.allReactions = allReac
         member model.generateCode fno = generateAndSave fno
+        member model.saveBinaryModel fileName systemSize y0 = saveBinaryModel fileName systemSize y0
         member model.getModelData() = getModelDataImpl clmTaskId
@@ -0,0 +1,85 @@
+﻿namespace ClmTests
+
+open System
+open System.Diagnostics
+open System.IO
+open Xunit
+open Xunit.Abstractions
+open FluentAssertions
+open Clm.Substances
+open Clm.Distributions
+open Clm.ReactionTypes
+open Clm.Reactions
+open Clm.CalculationData
+open Clm.Generator.BinaryModelWriter
+
+/// Checks that generated models written by BinaryModelWriter load in the C++ solver core (CModelFile).
+/// The round trip runs the native runner (AdaptiveTau\AdaptiveTauRunner.cpp), taken from the environment
+/// variable ADAPTIVETAU_RUN or else from the PATH.
+type BinaryModelWriterTests(output : ITestOutputHelper) =
+
+    let writeLine s = output.WriteLine s
+
+    let si =
+        {
+            maxPeptideLength = TwoMax
+            numberOfAminoAcids = OneAminoAcid
+            sedDirInfo = SedDirInfo.defaultValue
+        }
+        |> SubstInfo.create
+
+    let forward r k = ({ reaction = r; forwardRate = ReactionRate k } : ForwardReaction) |> Forward
+
+    let allReac =
+        [
+            forward (FoodCreation FoodCreationReaction) 0.01
+            forward (WasteRemoval WasteRemovalReaction) 0.1
+            forward (SedimentationAll SedimentationAllReaction) 0.1
+        ]
+        @ (si.synthesisReactions |> List.map (fun r -> forward (Synthesis r) 0.001))
+
+    let runnerPath () =
+        match Environment.GetEnvironmentVariable "ADAPTIVETAU_RUN" with
+        | null | "" -> "adaptivetau-run"
+        | p -> p
+
+
+    [<Fact>]
+    member _.ZeroOrderEntriesAndSedimentationAllAreDropped() : unit =
+        let transitions = toTransitions si 1000.0 allReac
+        transitions.Length.Should().Be(2 + si.synthesisReactions.Length, "sedimentation all has no transition") |> ignore
+
+        transitions
+        |> List.iter (fun t ->
+            (t.reactants |> List.forall (fun (_, n) -> n > 0)).Should().BeTrue("reactant orders must be positive") |> ignore
+            (t.changes |> List.forall (fun (_, n) -> n <> 0)).Should().BeTrue("net changes must not be 0") |> ignore)
+
+        let food = transitions.Head
+        food.reactants.Should().BeEmpty("food creation is of order 0") |> ignore
+        food.changes.Should().Equal([ (si.allInd.[Simple Food], 1) ]) |> ignore
+        food.rateConstant.Should().BeApproximately(0.01 * 1000.0, 1.0e-9, "zeroth-order rates scale with V") |> ignore
+
+
+    [<Fact>]
+    member _.GeneratedModelLoadsInSolverCore() : unit =
+        let dir = Path.Combine(Path.GetTempPath(), Guid.NewGuid().ToString("N"))
+        Directory.CreateDirectory dir |> ignore
+
+        try
+            let modelFile = Path.Combine(dir, "model.clmmodel")
+            let outFile = Path.Combine(dir, "result.bin")
+            let y0 = Array.create si.allSubst.Length 1.0
+            writeModel modelFile si allReac 1000.0 y0
+
+            let info = ProcessStartInfo(runnerPath (), $"--model \"{modelFile}\" --out \"{outFile}\" --tend 1 --output final")
+            info.UseShellExecute <- false
+            info.RedirectStandardError <- true
+            use p = Process.Start info
+            let err = p.StandardError.ReadToEnd()
+            p.WaitForExit()
+            writeLine $"%s{info.FileName} exited with %i{p.ExitCode}: %s{err}"
+
+            p.ExitCode.Should().Be(0, "the runner must load the model") |> ignore
+            File.Exists(outFile).Should().BeTrue() |> ignore
+        finally
+            Directory.Delete(dir, true)